@@ -1,34 +1,101 @@
 local builtin_shared = ...
 
+local raw_next, raw_pairs = next, pairs
+
+-- Item definitions that are not unpacked yet, mapped to their unpack function
+local lazy_definitions = setmetatable({}, {__mode = "k"})
+
+-- Metatable for item definitions whose contents are only unpacked once
+-- they are indexed or iterated (see mapgen_env_lazy_definitions)
+local function make_lazy_metatable(name, defaults, get_transferred_item)
+	local mt = {__newindex = {}}
+	local function unpack(def)
+		lazy_definitions[def] = nil
+		for k, v in raw_pairs(assert(get_transferred_item(name))) do
+			rawset(def, k, v)
+		end
+		mt.__index = defaults
+	end
+	mt.__index = function(def, key)
+		unpack(def)
+		return def[key]
+	end
+	-- Only honored by Lua 5.2 and later, see the pairs and next below
+	mt.__pairs = function(def)
+		if lazy_definitions[def] then
+			unpack(def)
+		end
+		return raw_next, def, nil
+	end
+	return mt, unpack
+end
+
 -- Copy all the registration tables over
 do
 	local all = assert(core.transferred_globals)
 	core.transferred_globals = nil
+	-- Only set if mapgen_env_lazy_definitions is enabled.
+	-- registered_items then maps item names to their types.
+	local get_transferred_item = core.get_transferred_item
+	core.get_transferred_item = nil
 
 	all.registered_nodes = {}
 	all.registered_craftitems = {}
 	all.registered_tools = {}
 	for k, v in pairs(all.registered_items) do
-		-- Disable further modification
-		setmetatable(v, {__newindex = {}})
+		local item_type
+		if get_transferred_item then
+			item_type = v
+			v = {}
+			all.registered_items[k] = v
+		else
+			item_type = v.type
+		end
 		-- Reassemble the other tables
-		if v.type == "node" then
-			getmetatable(v).__index = all.nodedef_default
+		local defaults
+		if item_type == "node" then
+			defaults = all.nodedef_default
 			all.registered_nodes[k] = v
-		elseif v.type == "craft" then
-			getmetatable(v).__index = all.craftitemdef_default
+		elseif item_type == "craft" then
+			defaults = all.craftitemdef_default
 			all.registered_craftitems[k] = v
-		elseif v.type == "tool" then
-			getmetatable(v).__index = all.tooldef_default
+		elseif item_type == "tool" then
+			defaults = all.tooldef_default
 			all.registered_tools[k] = v
 		else
-			getmetatable(v).__index = all.noneitemdef_default
+			defaults = all.noneitemdef_default
+		end
+		if get_transferred_item then
+			local mt, unpack = make_lazy_metatable(k, defaults, get_transferred_item)
+			setmetatable(v, mt)
+			lazy_definitions[v] = unpack
+		else
+			-- Disable further modification
+			setmetatable(v, {__newindex = {}, __index = defaults})
 		end
 	end
 
 	for k, v in pairs(all) do
 		core[k] = v
 	end
+
+	if get_transferred_item then
+		-- Iterating does not go through __index, so unpack the definition first
+		local function unpack_lazy(t)
+			local unpack = lazy_definitions[t]
+			if unpack then
+				unpack(t)
+			end
+		end
+		function next(t, k)
+			unpack_lazy(t)
+			return raw_next(t, k)
+		end
+		function pairs(t)
+			unpack_lazy(t)
+			return raw_pairs(t)
+		end
+	end
 end
 
 -- For tables that are indexed by item name:
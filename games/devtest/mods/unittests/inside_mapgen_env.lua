@@ -15,6 +15,13 @@ local function do_tests()
 	assert(type(meta.set_tool_capabilities) == "function")
 	assert(core.registered_items[""])
 	assert(core.save_gen_notify)
+	-- definitions can be iterated before any field is accessed
+	local fields = {}
+	for k in pairs(core.registered_items["unittests:iron_lump"]) do
+		fields[k] = true
+	end
+	assert(fields.name and fields.description)
+	assert(next(core.registered_craftitems["unittests:steel_ingot"]) ~= nil)
 	-- alias handling
 	assert(core.registered_items["unittests:steel_ingot_alias"].name ==
 		"unittests:steel_ingot")
@@ -147,6 +147,21 @@ local function test_compress()
 end
 unittests.register("test_compress", test_compress)
 
+local function test_serialize_binary()
+	local t = {1, 2.5, "foo\000bar", pos = vector.new(1, -2, 3.5), [true] = {}}
+	t.self = t
+	local u = core.deserialize_binary(core.serialize_binary(t))
+	assert(u[1] == 1 and u[2] == 2.5 and u[3] == "foo\000bar")
+	assert(vector.check(u.pos) and u.pos == vector.new(1, -2, 3.5))
+	assert(type(u[true]) == "table" and u.self == u)
+
+	assert(core.deserialize_binary(core.serialize_binary(nil)) == nil)
+	assert(not pcall(core.serialize_binary, {f = print}))
+	local value, err = core.deserialize_binary("return {}")
+	assert(value == nil and type(err) == "string")
+end
+unittests.register("test_serialize_binary", test_serialize_binary)
+
 local function test_urlencode()
 	-- checks that API code handles null bytes
 	assert(core.urlencode("foo\000bar!") == "foo%00bar%21")
@@ -330,3 +345,24 @@ local function test_ipc_poll(cb)
 	print("delta: " .. (core.get_us_time() - t0) .. "us")
 end
 unittests.register("test_ipc_poll", test_ipc_poll)
+
+local function test_vmanip_buffer(_, pos)
+	local vm = core.get_voxel_manip(pos, pos)
+	local data = vm:get_data()
+	local buf = vm:get_data_buffer()
+	assert(#buf == #data)
+	for i = 1, #data do
+		assert(buf[i] == data[i])
+	end
+	assert(buf[0] == nil and buf[#buf + 1] == nil and buf[1.5] == nil)
+	assert(not pcall(function() buf[0] = 1 end))
+
+	-- writes go to the VoxelManip
+	local vi = VoxelArea(vm:get_emerged_area()):indexp(pos)
+	buf[vi] = core.get_content_id("basenodes:stone")
+	vm:get_param2_data_buffer()[vi] = 3
+	local node = vm:get_node_at(pos)
+	assert(node.name == "basenodes:stone" and node.param2 == 3)
+	assert(vm:get_light_data_buffer()[vi] == node.param1)
+end
+unittests.register("test_vmanip_buffer", test_vmanip_buffer, {map=true})
@@ -0,0 +1,126 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "noise.h"
+#include "server/abmscanner.h"
+#include "threading/workerpool.h"
+
+namespace {
+
+struct ScanJob {
+	MapBlock *neighbors[27];
+};
+
+}
+
+static std::vector<ScanJob> collect_jobs(Map &map, v3s16 bpmin, v3s16 bpmax)
+{
+	std::vector<ScanJob> jobs;
+	v3s16 bp;
+	for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+	for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+	for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++) {
+		ScanJob &job = jobs.emplace_back();
+		v3s16 d;
+		int k = 0;
+		for (d.Z = -1; d.Z <= 1; d.Z++)
+		for (d.Y = -1; d.Y <= 1; d.Y++)
+		for (d.X = -1; d.X <= 1; d.X++)
+			job.neighbors[k++] = map.getBlockNoCreateNoEx(bp + d);
+	}
+	return jobs;
+}
+
+static size_t scan_all(const ABMScanner &scanner, std::vector<ScanJob> &jobs,
+		WorkerPool *pool)
+{
+	std::vector<std::vector<ABMTrigger>> triggers(jobs.size());
+	auto scan = [&] (size_t i) {
+		PcgRandom rand(i);
+		scanner.scan(jobs[i].neighbors, rand, triggers[i]);
+	};
+	if (pool) {
+		pool->run(jobs.size(), scan);
+	} else {
+		for (size_t i = 0; i < jobs.size(); i++)
+			scan(i);
+	}
+
+	size_t count = 0;
+	for (auto &it : triggers)
+		count += it.size();
+	return count;
+}
+
+TEST_CASE("benchmark_abm")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t ids[3];
+	const char *names[3] = {"stone", "dirt", "water"};
+	for (int i = 0; i < 3; i++) {
+		ContentFeatures f;
+		f.name = names[i];
+		ids[i] = ndef->set(f.name, f);
+	}
+	const content_t c_stone = ids[0], c_dirt = ids[1], c_water = ids[2];
+
+	// 8x4x8 blocks of hilly terrain with some water
+	const v3s16 bpmin(-4, -2, -4), bpmax(3, 1, 3);
+	DummyMap map(&gamedef, bpmin - v3s16(1, 1, 1), bpmax + v3s16(1, 1, 1));
+	map.fill(bpmin - v3s16(1, 1, 1), bpmax + v3s16(1, 1, 1), MapNode(CONTENT_AIR));
+	for (s16 z = bpmin.Z * MAP_BLOCKSIZE; z < (bpmax.Z + 1) * MAP_BLOCKSIZE; z++)
+	for (s16 x = bpmin.X * MAP_BLOCKSIZE; x < (bpmax.X + 1) * MAP_BLOCKSIZE; x++) {
+		s16 height = (x * 7 + z * 13) % 40 - 20;
+		for (s16 y = bpmin.Y * MAP_BLOCKSIZE; y < (bpmax.Y + 1) * MAP_BLOCKSIZE; y++) {
+			content_t c = CONTENT_AIR;
+			if (y < height - 3)
+				c = c_stone;
+			else if (y < height)
+				c = c_dirt;
+			else if (y < -10)
+				c = c_water;
+			if (c != CONTENT_AIR)
+				map.setNode(v3s16(x, y, z), MapNode(c));
+		}
+	}
+
+	// Grass spreading, flowing and a frequent one without neighbors
+	std::vector<ActiveABM> spread(1), flow(1), frequent(1);
+	spread[0].abm = nullptr;
+	spread[0].required_neighbors = {CONTENT_AIR};
+	spread[0].without_neighbors = {c_water};
+	spread[0].chance = 50;
+	spread[0].min_y = -32768;
+	spread[0].max_y = 32767;
+	flow[0] = spread[0];
+	flow[0].required_neighbors = {CONTENT_AIR};
+	flow[0].without_neighbors.clear();
+	flow[0].chance = 1;
+	frequent[0] = flow[0];
+	frequent[0].required_neighbors.clear();
+	frequent[0].chance = 5;
+
+	ABMScanner::ABMTable table(std::max({c_stone, c_dirt, c_water}) + 1, nullptr);
+	table[c_dirt] = &spread;
+	table[c_water] = &flow;
+	table[c_stone] = &frequent;
+	ABMScanner scanner(table);
+
+	std::vector<ScanJob> jobs = collect_jobs(map, bpmin, bpmax);
+
+	BENCHMARK("scan_sequential", i) {
+		return scan_all(scanner, jobs, nullptr) + i;
+	};
+
+	for (unsigned int threads : {2, 4}) {
+		WorkerPool pool("BenchWorker", threads - 1);
+		BENCHMARK("scan_parallel_" + std::to_string(threads), i) {
+			return scan_all(scanner, jobs, &pool) + i;
+		};
+	}
+}
@@ -0,0 +1,68 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "serverenvironment.h"
+#include "util/numeric.h"
+
+// matching the defaults of active_block_range and active_object_send_range_blocks
+constexpr s16 BLOCK_RANGE = 4;
+constexpr s16 OBJECT_RANGE = 8;
+
+static v3s16 randblockpos()
+{
+	// players tend to be close together on a server
+	return v3s16(myrand_range(-20, 20), myrand_range(-2, 2), myrand_range(-20, 20));
+}
+
+static void look(ActiveBlockList::PlayerView &view)
+{
+	view.camera_dir = v3f(0, 0, 1);
+	view.camera_dir.rotateXZBy(myrand_range(0, 359));
+	view.camera_pos = intToFloat(view.blockpos * MAP_BLOCKSIZE, BS);
+}
+
+template <size_t N, size_t MOVING_PERCENT>
+void benchUpdate(Catch::Benchmark::Chronometer &meter)
+{
+	ActiveBlockList list;
+	std::vector<ActiveBlockList::PlayerView> players(N);
+	for (size_t i = 0; i < N; i++) {
+		auto &view = players[i];
+		view.id = i + 1;
+		view.blockpos = randblockpos();
+		view.camera_fov = 72.0f * core::DEGTORAD;
+		view.wanted_range = OBJECT_RANGE;
+		look(view);
+	}
+
+	std::set<v3s16> removed, added, extra_added;
+	list.update(players, BLOCK_RANGE, OBJECT_RANGE, removed, added, extra_added);
+	REQUIRE(!list.m_list.empty());
+
+	meter.measure([&] {
+		for (size_t i = 0; i < N * MOVING_PERCENT / 100; i++) {
+			auto &view = players[myrand_range(0, N - 1)];
+			view.blockpos.X += myrand_range(-1, 1);
+			view.blockpos.Z += myrand_range(-1, 1);
+			look(view);
+		}
+		removed.clear();
+		added.clear();
+		extra_added.clear();
+		list.update(players, BLOCK_RANGE, OBJECT_RANGE, removed, added, extra_added);
+		return list.size();
+	});
+}
+
+#define BENCH_UPDATE(_count, _moving) \
+	BENCHMARK_ADVANCED("update_" #_count "_players_" #_moving "pct_moving")(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdate<_count, _moving>(meter); };
+
+TEST_CASE("benchmark_activeblocklist")
+{
+	BENCH_UPDATE(10, 10)
+	BENCH_UPDATE(100, 0)
+	BENCH_UPDATE(100, 10)
+	BENCH_UPDATE(100, 100)
+}
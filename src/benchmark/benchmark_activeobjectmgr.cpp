@@ -4,6 +4,7 @@
 #include "catch.h"
 #include "server/activeobjectmgr.h"
 #include "util/numeric.h"
+#include "constants.h"
 
 namespace {
 
@@ -94,6 +95,45 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	mgr.clear(); // implementation expects this
 }
 
+template <size_t N>
+void benchGetAddedActiveObjectsAroundPos(Catch::Benchmark::Chronometer &meter)
+{
+	server::ActiveObjectMgr mgr;
+	std::set<u16> current_objects;
+	std::vector<u16> result;
+
+	fill(mgr, N);
+	meter.measure([&] {
+		result.clear();
+		// matches the default active_object_send_range_blocks
+		mgr.getAddedActiveObjectsAroundPos(randpos(), "player",
+			8 * MAP_BLOCKSIZE * BS, 0, current_objects, result);
+		return result.size();
+	});
+
+	mgr.clear(); // implementation expects this
+}
+
+template <size_t N>
+void benchUpdateObjectPos(Catch::Benchmark::Chronometer &meter)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<u16> ids;
+
+	fill(mgr, N);
+	for (u16 id = 1; ids.size() < N; id++) {
+		if (mgr.getActiveObject(id))
+			ids.push_back(id);
+	}
+	meter.measure([&] {
+		// every object moves to a random position, mostly changing cell
+		for (u16 id : ids)
+			mgr.updateObjectPos(id, randpos());
+	});
+
+	mgr.clear(); // implementation expects this
+}
+
 #define BENCH_INSIDE_RADIUS(_count) \
 	BENCHMARK_ADVANCED("inside_radius_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInsideRadius<_count>(meter); };
@@ -102,10 +142,27 @@ void benchGetObjectsInArea(Catch::Benchmark::Chronometer &meter)
 	BENCHMARK_ADVANCED("in_area_" #_count)(Catch::Benchmark::Chronometer meter) \
 	{ benchGetObjectsInArea<_count>(meter); };
 
+#define BENCH_ADDED_AROUND_POS(_count) \
+	BENCHMARK_ADVANCED("added_around_pos_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchGetAddedActiveObjectsAroundPos<_count>(meter); };
+
+#define BENCH_UPDATE_POS(_count) \
+	BENCHMARK_ADVANCED("update_pos_" #_count)(Catch::Benchmark::Chronometer meter) \
+	{ benchUpdateObjectPos<_count>(meter); };
+
 TEST_CASE("ActiveObjectMgr") {
 	BENCH_INSIDE_RADIUS(200)
 	BENCH_INSIDE_RADIUS(1450)
+	BENCH_INSIDE_RADIUS(10000)
 
 	BENCH_IN_AREA(200)
 	BENCH_IN_AREA(1450)
+	BENCH_IN_AREA(10000)
+
+	BENCH_ADDED_AROUND_POS(200)
+	BENCH_ADDED_AROUND_POS(1450)
+	BENCH_ADDED_AROUND_POS(10000)
+
+	BENCH_UPDATE_POS(1450)
+	BENCH_UPDATE_POS(10000)
 }
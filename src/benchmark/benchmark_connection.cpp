@@ -0,0 +1,205 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include <queue>
+#include <random>
+#include <string>
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+#include "network/peerhandler.h"
+#include "network/socket.h"
+#include "porting.h"
+#include "settings.h"
+#include "threading/thread.h"
+
+namespace {
+
+struct LinkParams {
+	const char *name;
+	float latency; // one way, in seconds
+	float loss; // probability of losing a datagram
+	u32 bandwidth; // bytes per second
+	float max_queue_delay; // datagrams that would wait longer are dropped
+};
+
+/*
+	Relays datagrams between a client and a server over loopback, behaving
+	like a network link with the given latency, random loss and bandwidth.
+	The bandwidth is enforced by a drop-tail queue in each direction.
+*/
+class LinkSimulator : public Thread
+{
+public:
+	LinkSimulator(const Address &bind_addr, const Address &server,
+			const LinkParams &params) :
+		Thread("LinkSimulator"),
+		m_socket(false),
+		m_server(server),
+		m_params(params)
+	{
+		m_socket.Bind(bind_addr);
+		m_socket.setTimeoutMs(1);
+	}
+
+	void *run() override
+	{
+		char buf[1500];
+		while (!stopRequested()) {
+			Address sender;
+			int size;
+			while ((size = m_socket.Receive(sender, buf, sizeof(buf))) >= 0)
+				enqueue(sender, buf, size);
+
+			const u64 now = porting::getTimeUs();
+			while (!m_queue.empty() && m_queue.top().release_time <= now) {
+				const Datagram &d = m_queue.top();
+				try {
+					m_socket.Send(d.destination, d.data.data(), d.data.size());
+				} catch (SendFailedException &e) {
+				}
+				m_queue.pop();
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	struct Datagram {
+		u64 release_time;
+		Address destination;
+		std::string data;
+
+		bool operator>(const Datagram &other) const
+		{
+			return release_time > other.release_time;
+		}
+	};
+
+	void enqueue(const Address &sender, const char *data, int size)
+	{
+		Datagram d;
+		u64 *link_free;
+		if (sender == m_server) {
+			if (m_client.getPort() == 0)
+				return;
+			d.destination = m_client;
+			link_free = &m_down_free;
+		} else {
+			m_client = sender;
+			d.destination = m_server;
+			link_free = &m_up_free;
+		}
+
+		if (std::uniform_real_distribution<float>()(m_rng) < m_params.loss)
+			return;
+
+		const u64 now = porting::getTimeUs();
+		const u64 start = std::max(now, *link_free);
+		if (start - now > m_params.max_queue_delay * 1000000)
+			return;
+		*link_free = start + (u64)size * 1000000 / m_params.bandwidth;
+
+		d.release_time = *link_free + (u64)(m_params.latency * 1000000);
+		d.data.assign(data, size);
+		m_queue.push(std::move(d));
+	}
+
+	UDPSocket m_socket;
+	const Address m_server;
+	Address m_client;
+	const LinkParams m_params;
+	std::mt19937 m_rng{1234};
+	u64 m_up_free = 0;
+	u64 m_down_free = 0;
+	std::priority_queue<Datagram, std::vector<Datagram>,
+		std::greater<Datagram>> m_queue;
+};
+
+struct Handler : public con::PeerHandler
+{
+	void peerAdded(con::IPeer *peer) override { last_id = peer->id; }
+	void deletingPeer(con::IPeer *peer, bool timeout) override {}
+
+	session_t last_id = 0;
+};
+
+// Returns the goodput in KiB/s, or 0 if the transfer did not finish
+float transfer(const LinkParams &link, const std::string &congestion_control)
+{
+	constexpr u16 server_port = 30020;
+	constexpr u16 link_port = 30021;
+	constexpr int num_packets = 32;
+	constexpr int packet_size = 64 * 1024;
+
+	const std::string old_setting = g_settings->get("network_congestion_control");
+	g_settings->set("network_congestion_control", congestion_control);
+
+	Handler server_handler, client_handler;
+	con::Connection server(512, 30.0f, false, &server_handler);
+	server.Serve(Address(127, 0, 0, 1, server_port));
+	LinkSimulator simulator(Address(127, 0, 0, 1, link_port),
+		Address(127, 0, 0, 1, server_port), link);
+	simulator.start();
+	con::Connection client(512, 30.0f, false, &client_handler);
+	client.Connect(Address(127, 0, 0, 1, link_port));
+
+	g_settings->set("network_congestion_control", old_setting);
+
+	const u64 deadline = porting::getTimeMs() + 30000;
+	while (!client.Connected() || server_handler.last_id == 0) {
+		if (porting::getTimeMs() > deadline)
+			break;
+		NetworkPacket pkt;
+		client.ReceiveTimeoutMs(&pkt, 1);
+		server.ReceiveTimeoutMs(&pkt, 1);
+	}
+
+	const u64 start = porting::getTimeUs();
+	for (int i = 0; i < num_packets; i++) {
+		NetworkPacket pkt(0xff, packet_size);
+		for (int j = 0; j < packet_size; j++)
+			pkt << (u8)j;
+		server.Send(server_handler.last_id, 0, &pkt, true);
+	}
+
+	int received = 0;
+	while (received < num_packets && porting::getTimeMs() < deadline) {
+		NetworkPacket pkt;
+		if (client.ReceiveTimeoutMs(&pkt, 10) && pkt.getSize() == packet_size)
+			received++;
+	}
+	const u64 end = porting::getTimeUs();
+
+	simulator.stop();
+	simulator.wait();
+
+	if (received < num_packets)
+		return 0;
+	return (float)num_packets * packet_size / 1024 / ((end - start) / 1e6f);
+}
+
+}
+
+TEST_CASE("benchmark_connection")
+{
+	// The transfers take real time and ports, so unit test runs skip them
+	if (Catch::getCurrentContext().getConfig()->skipBenchmarks())
+		SKIP("only run with --run-benchmarks");
+
+	const LinkParams links[] = {
+		{"lan", 0.001f, 0.0f, 10 * 1024 * 1024, 0.05f},
+		{"dsl", 0.025f, 0.0f, 2 * 1024 * 1024, 0.1f},
+		{"lossy", 0.05f, 0.01f, 1024 * 1024, 0.2f},
+	};
+
+	for (const LinkParams &link : links) {
+		for (const char *cc : {"loss", "rtt"}) {
+			float goodput = transfer(link, cc);
+			WARN("goodput_" << link.name << "_" << cc << ": "
+				<< goodput << " KiB/s (link: " << link.bandwidth / 1024
+				<< " KiB/s)");
+			CHECK(goodput > 0);
+		}
+	}
+}
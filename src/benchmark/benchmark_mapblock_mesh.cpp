@@ -0,0 +1,365 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include <cmath>
+#include <functional>
+#include "dummygamedef.h"
+#include "filesys.h"
+#include "light.h"
+#include "nodedef.h"
+#include "settings.h"
+#include "client/content_mapblock.h"
+#include "client/mapblock_mesh.h"
+#include "client/mesh.h"
+#include "client/meshgen/collector.h"
+#include "client/meshgen/diskcache.h"
+#include "client/shader.h"
+#include "client/texturesource.h"
+
+/*
+	Generates meshes for synthetic blocks, the way MeshUpdateWorkerThread does.
+	Textures and shaders are not loaded, so no video driver is needed.
+*/
+
+namespace {
+
+class DummyTextureSource : public ITextureSource
+{
+public:
+	u32 getTextureId(const std::string &name) override { return 0; }
+	std::string getTextureName(u32 id) override
+	{
+		return "bench_" + std::to_string(id) + ".png";
+	}
+	video::ITexture *getTexture(u32 id) override { return nullptr; }
+	video::ITexture *getTexture(const std::string &name, u32 *id) override
+	{
+		return nullptr;
+	}
+	video::ITexture *getTextureForMesh(const std::string &name, u32 *id) override
+	{
+		return nullptr;
+	}
+	Palette *getPalette(const std::string &name) override { return nullptr; }
+	bool isKnownSourceImage(const std::string &name) override { return false; }
+	video::SColor getTextureAverageColor(const std::string &name) override
+	{
+		return video::SColor(0);
+	}
+};
+
+class DummyShaderSource : public IShaderSource
+{
+public:
+	ShaderInfo getShaderInfo(u32 id) override { return ShaderInfo(); }
+	u32 getShader(const std::string &name, MaterialType material_type,
+		NodeDrawType drawtype) override { return 0; }
+	u32 getShaderRaw(const std::string &name, bool blendAlpha) override { return 0; }
+};
+
+struct Nodes {
+	content_t stone, dirt, grass, tree, leaves, plant, water, water_flowing,
+		stair, post;
+};
+
+// Roughly what ContentFeatures::updateTextures() would set up
+content_t add_node(NodeDefManager *ndef, ContentFeatures f, u32 texture,
+	MaterialType material_type = TILE_MATERIAL_OPAQUE)
+{
+	f.name = "bench:" + f.name;
+	for (TileSpec &tile : f.tiles) {
+		tile.layers[0].texture_id = texture;
+		tile.layers[0].material_type = material_type;
+	}
+	for (TileSpec &tile : f.special_tiles) {
+		tile.layers[0].texture_id = texture;
+		tile.layers[0].material_type = material_type;
+	}
+	return ndef->set(f.name, f);
+}
+
+Nodes register_nodes(NodeDefManager *ndef)
+{
+	Nodes n;
+	ContentFeatures f;
+
+	f.name = "stone";
+	n.stone = add_node(ndef, f, 1);
+	f.name = "dirt";
+	n.dirt = add_node(ndef, f, 2);
+	f.name = "grass";
+	n.grass = add_node(ndef, f, 3);
+	f.name = "tree";
+	n.tree = add_node(ndef, f, 4);
+
+	f = ContentFeatures();
+	f.name = "leaves";
+	f.drawtype = NDT_ALLFACES;
+	f.solidness = 0;
+	f.visual_solidness = 1;
+	f.param_type = CPT_LIGHT;
+	f.light_propagates = true;
+	n.leaves = add_node(ndef, f, 5, TILE_MATERIAL_BASIC);
+
+	f = ContentFeatures();
+	f.name = "plant";
+	f.drawtype = NDT_PLANTLIKE;
+	f.solidness = 0;
+	f.walkable = false;
+	f.param_type = CPT_LIGHT;
+	f.light_propagates = true;
+	f.sunlight_propagates = true;
+	n.plant = add_node(ndef, f, 6, TILE_MATERIAL_BASIC);
+
+	f = ContentFeatures();
+	f.name = "water_source";
+	f.drawtype = NDT_LIQUID;
+	f.solidness = 1;
+	f.alpha = ALPHAMODE_BLEND;
+	f.param_type = CPT_LIGHT;
+	f.light_propagates = true;
+	f.walkable = false;
+	f.liquid_type = LIQUID_SOURCE;
+	f.liquid_alternative_source = "bench:water_source";
+	f.liquid_alternative_flowing = "bench:water_flowing";
+	n.water = add_node(ndef, f, 7, TILE_MATERIAL_LIQUID_TRANSPARENT);
+	f.name = "water_flowing";
+	f.drawtype = NDT_FLOWINGLIQUID;
+	f.solidness = 0;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.liquid_type = LIQUID_FLOWING;
+	n.water_flowing = add_node(ndef, f, 8, TILE_MATERIAL_LIQUID_TRANSPARENT);
+
+	const float h = BS / 2;
+	const std::vector<aabb3f> stair_boxes = {
+		aabb3f(-h, -h, -h, h, 0, h),
+		aabb3f(-h, 0, 0, h, h, h),
+	};
+	f = ContentFeatures();
+	f.name = "stair";
+	f.drawtype = NDT_NODEBOX;
+	f.solidness = 0;
+	f.param_type = CPT_LIGHT;
+	f.param_type_2 = CPT2_FACEDIR;
+	f.light_propagates = true;
+	f.node_box.type = NODEBOX_FIXED;
+	f.node_box.fixed = stair_boxes;
+	n.stair = add_node(ndef, f, 9);
+
+	// the node definition manager takes ownership of the mesh
+	f = ContentFeatures();
+	f.name = "post";
+	f.drawtype = NDT_MESH;
+	f.solidness = 0;
+	f.param_type = CPT_LIGHT;
+	f.param_type_2 = CPT2_FACEDIR;
+	f.light_propagates = true;
+	f.mesh_ptr = convertNodeboxesToMesh({
+		aabb3f(-h / 4, -h, -h / 4, h / 4, h, h / 4),
+		aabb3f(-h, h / 2, -h / 8, h, h * 3 / 4, h / 8),
+	});
+	n.post = add_node(ndef, f, 10);
+
+	ndef->resolveCrossrefs();
+	return n;
+}
+
+using Scene = std::function<MapNode(v3s16 p)>;
+
+s16 terrain_height(v3s16 p)
+{
+	return 8 + std::round(3 * std::sin(p.X * 0.4f) * std::cos(p.Z * 0.3f));
+}
+
+MapNode air()
+{
+	// full sunlight
+	return MapNode(CONTENT_AIR, LIGHT_SUN);
+}
+
+MapNode terrain(const Nodes &n, v3s16 p)
+{
+	s16 h = terrain_height(p);
+	if (p.Y < h - 3)
+		return MapNode(n.stone);
+	if (p.Y < h)
+		return MapNode(n.dirt);
+	if (p.Y == h)
+		return MapNode(n.grass);
+	return air();
+}
+
+MapNode foliage(const Nodes &n, v3s16 p)
+{
+	s16 h = terrain_height(p);
+	if (p.Y <= h)
+		return terrain(n, p);
+
+	// a tree every 8 nodes, and grass in between
+	v3s16 t((p.X + 32) / 8 * 8 - 28, 0, (p.Z + 32) / 8 * 8 - 28);
+	t.Y = terrain_height(t);
+	v3s16 d = p - t;
+	if (d.X == 0 && d.Z == 0 && d.Y <= 4)
+		return MapNode(n.tree);
+	if (d.Y >= 3 && d.Y <= 6 && std::abs(d.X) <= 2 && std::abs(d.Z) <= 2)
+		return MapNode(n.leaves, LIGHT_SUN);
+	if (p.Y == h + 1 && (p.X * 7 + p.Z * 3) % 3 == 0)
+		return MapNode(n.plant, LIGHT_SUN);
+	return air();
+}
+
+MapNode liquids(const Nodes &n, v3s16 p)
+{
+	s16 h = terrain_height(p) - 2;
+	if (p.Y <= h)
+		return MapNode(n.stone);
+	if (p.Y <= 7)
+		return MapNode(n.water, LIGHT_SUN);
+	// a waterfall flowing down from above
+	if (p.X == 4 && p.Y < 14)
+		return MapNode(n.water_flowing, LIGHT_SUN, LIQUID_FLOW_DOWN_MASK | 7);
+	if (p.Y == 8 && p.X > 4 && p.X < 10)
+		return MapNode(n.water_flowing, LIGHT_SUN, 10 - p.X);
+	return air();
+}
+
+MapNode nodeboxes(const Nodes &n, v3s16 p)
+{
+	if (p.Y < 4)
+		return MapNode(n.stone);
+	if ((p.X + p.Y + p.Z) % 2 == 0 && p.Y < 10)
+		return MapNode(n.stair, LIGHT_SUN, (p.X + p.Z) & 3);
+	return air();
+}
+
+MapNode meshes(const Nodes &n, v3s16 p)
+{
+	if (p.Y < 4)
+		return MapNode(n.stone);
+	if (p.Y < 6 && (p.X + p.Z) % 2 == 0)
+		return MapNode(n.post, LIGHT_SUN, (p.X * 3 + p.Z) & 3);
+	return air();
+}
+
+// Like MeshUpdateQueue::fillDataFromMapBlocks(): the block at (0,0,0) and its
+// neighbors
+void fill_data(MeshMakeData &data, const Scene &scene)
+{
+	data.fillBlockDataBegin(v3s16(0, 0, 0));
+	MapNode nodes[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
+	v3s16 bp;
+	for (bp.Z = -1; bp.Z <= 1; bp.Z++)
+	for (bp.Y = -1; bp.Y <= 1; bp.Y++)
+	for (bp.X = -1; bp.X <= 1; bp.X++) {
+		v3s16 p;
+		u32 i = 0;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+			nodes[i++] = scene(bp * MAP_BLOCKSIZE + p);
+		data.fillBlockData(bp, nodes);
+	}
+}
+
+struct MeshStats {
+	u32 buffers = 0;
+	u32 vertices = 0;
+	u32 indices = 0;
+	size_t bytes = 0; // allocated for vertices and indices
+
+	void add(const MeshCollector &collector)
+	{
+		for (auto &prebuffers : collector.prebuffers) {
+			for (auto &p : prebuffers) {
+				buffers++;
+				vertices += p.vertices.size();
+				indices += p.indices.size();
+				bytes += p.vertices.capacity() * sizeof(p.vertices[0]) +
+					p.indices.capacity() * sizeof(p.indices[0]);
+			}
+		}
+	}
+};
+
+}
+
+TEST_CASE("benchmark_mapblock_mesh")
+{
+	// Only meaningful with the numbers, so unit test runs skip the meshing
+	if (Catch::getCurrentContext().getConfig()->skipBenchmarks())
+		SKIP("only run with --run-benchmarks");
+
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	const Nodes n = register_nodes(ndef);
+	set_light_table(g_settings->getFloat("display_gamma"));
+
+	DummyTextureSource tsrc;
+	DummyShaderSource shdrsrc;
+
+	const std::string cache_dir = fs::CreateTempDir();
+	REQUIRE(!cache_dir.empty());
+	MeshDiskCache disk_cache(cache_dir, U64_MAX, "benchmark", ndef, &tsrc, &shdrsrc);
+
+	const std::pair<const char *, Scene> scenes[] = {
+		{"terrain", [&] (v3s16 p) { return terrain(n, p); }},
+		{"foliage", [&] (v3s16 p) { return foliage(n, p); }},
+		{"liquids", [&] (v3s16 p) { return liquids(n, p); }},
+		{"nodeboxes", [&] (v3s16 p) { return nodeboxes(n, p); }},
+		{"meshes", [&] (v3s16 p) { return meshes(n, p); }},
+	};
+
+	for (auto &[name, scene] : scenes) {
+		MeshMakeData data(ndef, MAP_BLOCKSIZE, MeshGrid{1});
+		data.m_smooth_lighting = g_settings->getBool("smooth_lighting");
+		data.m_greedy_meshing = g_settings->getBool("greedy_meshing");
+		fill_data(data, scene);
+
+		MeshStats stats;
+		{
+			MeshCollector collector(v3f(0.5f * MAP_BLOCKSIZE * BS), v3f());
+			MapblockMeshGenerator(&data, &collector).generate();
+			stats.add(collector);
+		}
+		CHECK(stats.vertices > 0);
+
+		const std::string key = disk_cache.getKey(&data);
+		{
+			MeshCollector collector(v3f(0.5f * MAP_BLOCKSIZE * BS), v3f());
+			MapblockMeshGenerator(&data, &collector).generate();
+			disk_cache.store(key, collector);
+
+			MeshCollector loaded(v3f(0.5f * MAP_BLOCKSIZE * BS), v3f());
+			REQUIRE(disk_cache.load(key, loaded));
+			MeshStats loaded_stats;
+			loaded_stats.add(loaded);
+			CHECK(loaded_stats.vertices == stats.vertices);
+			CHECK(loaded_stats.indices == stats.indices);
+		}
+
+		WARN("mesh_" << name << ": "
+			<< stats.buffers << " buffers, " << stats.vertices << " vertices, "
+			<< stats.indices << " indices, " << stats.bytes / 1024 << " KiB per block");
+
+		BENCHMARK(std::string("generate_") + name) {
+			MeshCollector collector(v3f(0.5f * MAP_BLOCKSIZE * BS), v3f());
+			MapblockMeshGenerator(&data, &collector).generate();
+			return collector.m_bounding_radius_sq;
+		};
+
+		BENCHMARK(std::string("mapblock_mesh_") + name) {
+			MapBlockMesh mesh(&tsrc, &shdrsrc, &data);
+			return mesh.getMesh()->getMeshBufferCount();
+		};
+
+		// what MapBlockMesh does instead of generating if mesh_disk_cache is on
+		BENCHMARK(std::string("disk_cache_load_") + name) {
+			MeshCollector collector(v3f(0.5f * MAP_BLOCKSIZE * BS), v3f());
+			bool ok = disk_cache.load(disk_cache.getKey(&data), collector);
+			return ok;
+		};
+	}
+
+	fs::RecursiveDelete(cache_dir);
+}
@@ -0,0 +1,38 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "noise.h"
+
+// Parameters roughly matching typical mapgen terrain noises
+static NoiseParams make_params(u16 octaves, u32 flags)
+{
+	return NoiseParams(0, 1, v3f(250, 250, 250), 5934, octaves, 0.6, 2.0, flags);
+}
+
+#define BENCH_2D(_size, _octaves, _flags, _label) \
+	BENCHMARK_ADVANCED("perlinMap2D_" #_size "_" #_octaves _label)(Catch::Benchmark::Chronometer meter) { \
+		NoiseParams np = make_params(_octaves, _flags); \
+		Noise noise(&np, 1337, _size, _size); \
+		meter.measure([&] { return noise.perlinMap2D(-2000, 1500)[0]; }); \
+	};
+
+#define BENCH_3D(_size, _octaves, _flags, _label) \
+	BENCHMARK_ADVANCED("perlinMap3D_" #_size "_" #_octaves _label)(Catch::Benchmark::Chronometer meter) { \
+		NoiseParams np = make_params(_octaves, _flags); \
+		Noise noise(&np, 1337, _size, _size + 2, _size); \
+		meter.measure([&] { return noise.perlinMap3D(-2000, -50, 1500)[0]; }); \
+	};
+
+TEST_CASE("benchmark_noise")
+{
+	BENCH_2D(16, 3, NOISE_FLAG_DEFAULTS, "")
+	BENCH_2D(80, 3, NOISE_FLAG_DEFAULTS, "")
+	BENCH_2D(80, 6, NOISE_FLAG_DEFAULTS, "")
+	BENCH_2D(80, 6, NOISE_FLAG_DEFAULTS | NOISE_FLAG_ABSVALUE, "_abs")
+
+	BENCH_3D(16, 3, 0, "")
+	BENCH_3D(80, 3, 0, "")
+	BENCH_3D(80, 6, 0, "")
+	BENCH_3D(80, 3, NOISE_FLAG_EASED, "_eased")
+}
@@ -0,0 +1,112 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include <memory>
+#include "filesys.h"
+#include "porting.h"
+#include "script/common/c_packer.h"
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+namespace {
+
+// Something like the staticdata of a mob or the data of a mod
+const char *test_value = R"(
+	local t = {
+		name = "mobs:sheep", owner = "singleplayer", hp = 17, tamed = true,
+		pos = {x = 1234.5, y = 12, z = -873.25},
+		timers = {breed = 12.5, follow = 0, jump = 0.3},
+		inventory = {},
+		path = {},
+	}
+	for i = 1, 32 do
+		t.inventory[i] = "default:item_" .. i .. " " .. i * 3
+	end
+	for i = 1, 50 do
+		t.path[i] = {x = i, y = i * 0.5, z = -i}
+	end
+	return t
+)";
+
+// Calls the function on top of the stack with the value at `idx`
+void call(lua_State *L, int idx)
+{
+	lua_pushvalue(L, idx);
+	if (lua_pcall(L, 1, 1, 0) != 0)
+		FAIL(lua_tostring(L, -1));
+}
+
+}
+
+TEST_CASE("benchmark_packer")
+{
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	// Lua implementation from builtin
+	lua_newtable(L);
+	lua_setglobal(L, "core");
+	const std::string path = porting::path_share + DIR_DELIM "builtin" DIR_DELIM
+		"common" DIR_DELIM "serialize.lua";
+	REQUIRE(luaL_dofile(L, path.c_str()) == 0);
+	lua_getglobal(L, "core");
+	const int core = lua_gettop(L);
+
+	REQUIRE(luaL_dostring(L, test_value) == 0);
+	const int value = lua_gettop(L);
+
+	lua_getfield(L, core, "serialize");
+	call(L, value);
+	const std::string lua_data = lua_tostring(L, -1);
+	lua_pop(L, 1);
+
+	std::unique_ptr<PackedValue> pv(script_pack(L, value));
+	const std::string binary_data = script_serialize_packed(pv.get());
+	pv.reset();
+
+	WARN("size_lua: " << lua_data.size() << " bytes, size_binary: "
+		<< binary_data.size() << " bytes");
+
+	BENCHMARK("serialize_lua") {
+		lua_getfield(L, core, "serialize");
+		call(L, value);
+		size_t len;
+		lua_tolstring(L, -1, &len);
+		lua_pop(L, 1);
+		return len;
+	};
+
+	// what core.serialize_binary does
+	BENCHMARK("serialize_binary") {
+		std::unique_ptr<PackedValue> pv(script_pack(L, value));
+		std::string data = script_serialize_packed(pv.get());
+		lua_pushlstring(L, data.data(), data.size());
+		lua_pop(L, 1);
+		return data.size();
+	};
+
+	lua_pushlstring(L, lua_data.data(), lua_data.size());
+	const int lua_string = lua_gettop(L);
+
+	BENCHMARK("deserialize_lua") {
+		lua_getfield(L, core, "deserialize");
+		call(L, lua_string);
+		bool ok = lua_istable(L, -1);
+		lua_pop(L, 1);
+		return ok;
+	};
+
+	BENCHMARK("deserialize_binary") {
+		std::unique_ptr<PackedValue> pv(script_deserialize_packed(binary_data));
+		script_unpack(L, pv.get());
+		bool ok = lua_istable(L, -1);
+		lua_pop(L, 1);
+		return ok;
+	};
+
+	lua_close(L);
+}
@@ -0,0 +1,139 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include <algorithm>
+#include <random>
+#include "network/mtp/internal.h"
+#include "network/networkpacket.h"
+
+using namespace con;
+
+namespace {
+
+constexpr u32 WINDOW = 2048;
+constexpr u16 NEXT_EXPECTED = 65000; // so that the window wraps around
+
+std::vector<BufferedPacketPtr> make_reliables()
+{
+	std::vector<BufferedPacketPtr> packets;
+	SharedBuffer<u8> data(500);
+	for (u32 i = 1; i <= WINDOW; i++) {
+		packets.push_back(makePacket(Address(127, 0, 0, 1, 30000),
+			makeReliablePacket(data, NEXT_EXPECTED + i), PROTOCOL_ID, 2, 0));
+	}
+	return packets;
+}
+
+void fill(ReliablePacketBuffer &buf, std::vector<BufferedPacketPtr> &packets)
+{
+	for (auto &p : packets)
+		buf.insert(p, NEXT_EXPECTED);
+}
+
+}
+
+TEST_CASE("benchmark_packetbuffers")
+{
+	std::vector<BufferedPacketPtr> packets = make_reliables();
+
+	std::vector<u16> in_order, shuffled;
+	for (auto &p : packets)
+		in_order.push_back(p->getSeqnum());
+	shuffled = in_order;
+	std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+
+	BENCHMARK_ADVANCED("insert_2048")(Catch::Benchmark::Chronometer meter) {
+		meter.measure([&] {
+			ReliablePacketBuffer buf;
+			fill(buf, packets);
+			return buf.size();
+		});
+	};
+
+	// acks usually arrive in order, but the buffer is searched for each one
+	BENCHMARK_ADVANCED("ack_in_order_2048")(Catch::Benchmark::Chronometer meter) {
+		std::vector<ReliablePacketBuffer> bufs(meter.runs());
+		for (auto &buf : bufs)
+			fill(buf, packets);
+		meter.measure([&] (int i) {
+			for (u16 seqnum : in_order)
+				bufs[i].popSeqnum(seqnum);
+			return bufs[i].size();
+		});
+	};
+
+	BENCHMARK_ADVANCED("ack_shuffled_2048")(Catch::Benchmark::Chronometer meter) {
+		std::vector<ReliablePacketBuffer> bufs(meter.runs());
+		for (auto &buf : bufs)
+			fill(buf, packets);
+		meter.measure([&] (int i) {
+			for (u16 seqnum : shuffled)
+				bufs[i].popSeqnum(seqnum);
+			return bufs[i].size();
+		});
+	};
+
+	// what the send thread does every iteration for each channel
+	BENCHMARK_ADVANCED("resend_scan_2048")(Catch::Benchmark::Chronometer meter) {
+		ReliablePacketBuffer buf;
+		fill(buf, packets);
+		meter.measure([&] {
+			buf.incrementTimeouts(0.001f);
+			return buf.getResend(1000.0f, 64).size();
+		});
+	};
+
+	BENCHMARK_ADVANCED("split_reassemble_64k")(Catch::Benchmark::Chronometer meter) {
+		SharedBuffer<u8> data(64 * 1024);
+		std::list<SharedBuffer<u8>> chunks;
+		u16 split_seqnum = 0;
+		makeAutoSplitPacket(data, 512, split_seqnum, &chunks);
+
+		std::vector<BufferedPacketPtr> split_packets;
+		for (auto &chunk : chunks) {
+			split_packets.push_back(makePacket(Address(127, 0, 0, 1, 30000),
+				chunk, PROTOCOL_ID, 2, 0));
+		}
+		std::shuffle(split_packets.begin(), split_packets.end(), std::mt19937(42));
+
+		meter.measure([&] {
+			IncomingSplitBuffer buf;
+			SharedBuffer<u8> result;
+			for (auto &p : split_packets)
+				result = buf.insert(p, true);
+			return result.getSize();
+		});
+	};
+
+	// from building the packet in Server::SendBlockNoLock() to the datagrams
+	const std::string block(40 * 1024, 'x');
+	BENCHMARK("send_block_40k") {
+		NetworkPacket pkt(TOCLIENT_BLOCKDATA, 6 + block.size(), 2);
+		pkt << v3s16(1, 2, 3);
+		pkt.putRawString(block);
+
+		auto c = ConnectionCommand::send(2, 2, &pkt, true);
+		std::vector<BufferedPacketPtr> packets;
+		u16 split_seqnum = 0;
+		makeReliablePackets(Address(), c->data, false,
+			512 - BASE_HEADER_SIZE - RELIABLE_HEADER_SIZE, PROTOCOL_ID, 1, 2,
+			split_seqnum, packets);
+		u16 seqnum = 0;
+		for (auto &p : packets)
+			p->setSeqnum(seqnum++);
+		return packets.size();
+	};
+
+	BENCHMARK("small_packets_100") {
+		u32 size = 0;
+		for (int i = 0; i < 100; i++) {
+			NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_MESSAGES, 0, 2);
+			for (int j = 0; j < 10; j++)
+				pkt << (u16)j << v3f(1, 2, 3);
+			auto c = ConnectionCommand::send(2, 0, &pkt, false);
+			size += c->data.getSize();
+		}
+		return size;
+	};
+}
@@ -0,0 +1,65 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "catch.h"
+#include "network/socket.h"
+#include <vector>
+
+// Datagrams sent per round, small enough to fit in the socket receive buffer
+static constexpr size_t ROUND_SIZE = 64;
+static constexpr int PACKET_SIZE = 512;
+static constexpr u16 PORT = 30010;
+
+// Receives until 'count' datagrams arrived or the socket times out
+static size_t receive_single(UDPSocket &socket, size_t count)
+{
+	char buf[1500];
+	Address sender;
+	size_t received = 0;
+	while (received < count && socket.Receive(sender, buf, sizeof(buf)) >= 0)
+		received++;
+	return received;
+}
+
+static size_t receive_batch(UDPSocket &socket, size_t count)
+{
+	std::vector<char> buf(ROUND_SIZE * 1500);
+	std::vector<UDPSocket::IncomingDatagram> datagrams(ROUND_SIZE);
+	for (size_t i = 0; i < datagrams.size(); i++) {
+		datagrams[i].data = &buf[i * 1500];
+		datagrams[i].capacity = 1500;
+	}
+
+	size_t received = 0;
+	while (received < count) {
+		size_t n = socket.ReceiveBatch(datagrams.data(), count - received);
+		if (n == 0)
+			break;
+		received += n;
+	}
+	return received;
+}
+
+TEST_CASE("benchmark_socket")
+{
+	const Address dest(127, 0, 0, 1, PORT);
+	UDPSocket receiver(false);
+	receiver.Bind(dest);
+	receiver.setTimeoutMs(100);
+	UDPSocket sender(false);
+
+	std::vector<char> payload(PACKET_SIZE, 'x');
+	std::vector<UDPSocket::OutgoingDatagram> outgoing(ROUND_SIZE,
+		{dest, payload.data(), PACKET_SIZE});
+
+	BENCHMARK("loopback_single_64x512") {
+		for (size_t i = 0; i < ROUND_SIZE; i++)
+			sender.Send(dest, payload.data(), PACKET_SIZE);
+		return receive_single(receiver, ROUND_SIZE);
+	};
+
+	BENCHMARK("loopback_batch_64x512") {
+		sender.SendBatch(outgoing.data(), outgoing.size());
+		return receive_batch(receiver, ROUND_SIZE);
+	};
+}
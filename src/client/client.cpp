@@ -1868,6 +1868,28 @@ void Client::afterContentReceived()
 	tu_args.tsrc = m_tsrc;
 	m_nodedef->updateTextures(this, &tu_args);
 
+	if (g_settings->getBool("mesh_disk_cache")) {
+		// Everything besides the nodes the generated meshes depend on
+		std::ostringstream os(std::ios::binary);
+		os << g_version_hash << '\n';
+		for (const char *name : {"texture_path", "connected_glass",
+				"translucent_liquids", "texture_min_size", "leaves_style",
+				"world_aligned_mode", "autoscale_mode", "ambient_occlusion_gamma",
+				// these make up the light table
+				"display_gamma", "lighting_alpha", "lighting_beta", "lighting_boost",
+				"lighting_boost_center", "lighting_boost_spread"})
+			os << g_settings->get(name) << '\n';
+		m_nodedef->serialize(os, LATEST_PROTOCOL_VERSION);
+		std::map<std::string, std::string> mesh_data(m_mesh_data.begin(), m_mesh_data.end());
+		for (const auto &it : mesh_data)
+			os << serializeString16(it.first) << serializeString32(it.second);
+
+		const u64 max_size = (u64)g_settings->getU32("mesh_disk_cache_size") * 1024 * 1024;
+		m_mesh_update_manager->setDiskCache(std::make_unique<MeshDiskCache>(
+				porting::path_cache + DIR_DELIM + "meshes", max_size, os.str(),
+				m_nodedef, m_tsrc, m_shsrc));
+	}
+
 	// Start mesh update thread after setting up content definitions
 	infostream<<"- Starting mesh update thread"<<std::endl;
 	m_mesh_update_manager->start();
@@ -67,6 +67,12 @@ MapblockMeshGenerator::MapblockMeshGenerator(MeshMakeData *input, MeshCollector
 	nodedef(data->m_nodedef),
 	blockpos_nodes(data->m_blockpos * MAP_BLOCKSIZE)
 {
+	if (data->m_greedy_meshing) {
+		const u32 volume = data->m_side_length * data->m_side_length *
+				data->m_side_length;
+		for (auto &faces : merge_faces)
+			faces.resize(volume);
+	}
 }
 
 void MapblockMeshGenerator::useTile(TileSpec *tile_ret, int index, u8 set_flags,
@@ -395,6 +401,7 @@ void MapblockMeshGenerator::drawAutoLightedCuboid(aabb3f box,
 void MapblockMeshGenerator::drawSolidNode()
 {
 	u8 faces = 0; // k-th bit will be set if k-th face is to be drawn.
+	u8 tileable = 0; // k-th bit will be set if k-th face allows repeating the texture
 	static const v3s16 tile_dirs[6] = {
 		v3s16(0, 1, 0),
 		v3s16(0, -1, 0),
@@ -427,7 +434,11 @@ void MapblockMeshGenerator::drawSolidNode()
 		}
 		faces |= 1 << face;
 		getTile(tile_dirs[face], &tiles[face]);
+		tileable |= 1 << face;
 		for (auto &layer : tiles[face].layers) {
+			const u8 both = MATERIAL_FLAG_TILEABLE_HORIZONTAL | MATERIAL_FLAG_TILEABLE_VERTICAL;
+			if (layer.texture_id != 0 && (layer.material_flags & both) != both)
+				tileable &= ~(1 << face);
 			if (backface_culling)
 				layer.material_flags |= MATERIAL_FLAG_BACKFACE_CULLING;
 			layer.material_flags |= MATERIAL_FLAG_TILEABLE_HORIZONTAL;
@@ -446,6 +457,7 @@ void MapblockMeshGenerator::drawSolidNode()
 	box.MinEdge += cur_node.origin;
 	box.MaxEdge += cur_node.origin;
 	generateCuboidTextureCoords(box, texture_coord_buf);
+	const bool merge = data->m_greedy_meshing && cur_node.f->drawtype == NDT_NORMAL;
 	if (data->m_smooth_lighting) {
 		LightPair lights[6][4];
 		for (int face = 0; face < 6; ++face) {
@@ -456,6 +468,16 @@ void MapblockMeshGenerator::drawSolidNode()
 				lights[face][k] = LightPair(getSmoothLightSolid(
 						blockpos_nodes + cur_node.p, tile_dirs[face], corner, data));
 			}
+			// Only faces with the same light at all corners can be merged
+			if (merge && (tileable & (1 << face)) && lights[face][0] == lights[face][1] &&
+					lights[face][0] == lights[face][2] &&
+					lights[face][0] == lights[face][3]) {
+				video::SColor color = encode_light(lights[face][0], cur_node.f->light_source);
+				if (!cur_node.f->light_source)
+					applyFacesShading(color, intToFloat(tile_dirs[face], 1.0f));
+				if (addMergeableFace(face, tiles[face], color))
+					mask |= 1 << face;
+			}
 		}
 
 		drawCuboid(box, tiles, 6, texture_coord_buf, mask, [&] (int face, video::S3DVertex vertices[4]) {
@@ -471,6 +493,16 @@ void MapblockMeshGenerator::drawSolidNode()
 			return QuadDiagonal::Diag02;
 		});
 	} else {
+		for (int face = 0; merge && face < 6; ++face) {
+			if ((mask & (1 << face)) || !(tileable & (1 << face)))
+				continue;
+			video::SColor color = encode_light(lights[face], cur_node.f->light_source);
+			if (!cur_node.f->light_source)
+				applyFacesShading(color, intToFloat(tile_dirs[face], 1.0f));
+			if (addMergeableFace(face, tiles[face], color))
+				mask |= 1 << face;
+		}
+
 		drawCuboid(box, tiles, 6, texture_coord_buf, mask, [&] (int face, video::S3DVertex vertices[4]) {
 			video::SColor color = encode_light(lights[face], cur_node.f->light_source);
 			if (!cur_node.f->light_source)
@@ -484,6 +516,101 @@ void MapblockMeshGenerator::drawSolidNode()
 	}
 }
 
+static bool isSameTile(const TileSpec &a, const TileSpec &b)
+{
+	for (int layer = 0; layer < MAX_TILE_LAYERS; layer++) {
+		if (a.layers[layer] != b.layers[layer])
+			return false;
+	}
+	return a.world_aligned == b.world_aligned && a.rotation == b.rotation &&
+			a.emissive_light == b.emissive_light;
+}
+
+// Records a face of the current node to be drawn by drawMergedFaces().
+// Returns false if the face has to be drawn right away.
+bool MapblockMeshGenerator::addMergeableFace(int face, const TileSpec &tile,
+		video::SColor color)
+{
+	// Merged faces repeat the texture, which needs the tiles to be opaque
+	for (auto &layer : tile.layers) {
+		if (layer.texture_id != 0 && layer.isTransparent())
+			return false;
+	}
+
+	u16 index = 0;
+	while (index < merge_tiles.size() && !isSameTile(merge_tiles[index], tile))
+		index++;
+	if (index == merge_tiles.size()) {
+		// Nodes with many colors (e.g. palettes) are not worth the search
+		if (merge_tiles.size() >= 64)
+			return false;
+		merge_tiles.push_back(tile);
+	}
+
+	const v3s16 p = cur_node.p;
+	const s16 side = data->m_side_length;
+	merge_faces[face][(p.Z * side + p.Y) * side + p.X] = {(u16)(index + 1), color};
+	return true;
+}
+
+// Draws the faces recorded by addMergeableFace(), merging neighboring
+// faces with the same tile and color into rectangles.
+void MapblockMeshGenerator::drawMergedFaces()
+{
+	const s16 side = data->m_side_length;
+	for (int face = 0; face < 6; face++) {
+		std::vector<MergeableFace> &faces = merge_faces[face];
+		// Faces are merged in the plane spanned by the u and v axes,
+		// one slice along the face normal at a time.
+		const int axis = face / 2; // Y, X or Z
+		auto pos = [axis] (s16 slice, s16 u, s16 v) {
+			if (axis == 0)
+				return v3s16(u, slice, v);
+			if (axis == 1)
+				return v3s16(slice, u, v);
+			return v3s16(u, v, slice);
+		};
+		auto at = [&] (v3s16 p) -> MergeableFace & {
+			return faces[(p.Z * side + p.Y) * side + p.X];
+		};
+
+		for (s16 slice = 0; slice < side; slice++)
+		for (s16 v = 0; v < side; v++)
+		for (s16 u = 0; u < side; u++) {
+			const MergeableFace f = at(pos(slice, u, v));
+			if (!f.tile)
+				continue;
+
+			s16 width = 1;
+			while (u + width < side && at(pos(slice, u + width, v)) == f)
+				width++;
+			s16 height = 1;
+			for (; v + height < side; height++) {
+				bool same = true;
+				for (s16 i = 0; i < width && same; i++)
+					same = at(pos(slice, u + i, v + height)) == f;
+				if (!same)
+					break;
+			}
+			for (s16 j = 0; j < height; j++)
+			for (s16 i = 0; i < width; i++)
+				at(pos(slice, u + i, v + j)).tile = 0;
+
+			// Draw the face of the cuboid covering the merged nodes, so that
+			// the texture coordinates continue across the nodes
+			const TileSpec &tile = merge_tiles[f.tile - 1];
+			aabb3f box(intToFloat(pos(slice, u, v), BS) - 0.5f * BS,
+					intToFloat(pos(slice, u + width - 1, v + height - 1), BS) + 0.5f * BS);
+			f32 texture_coord_buf[24];
+			generateCuboidTextureCoords(box, texture_coord_buf);
+			auto vertices = setupCuboidVertices(box, texture_coord_buf, &tile, 1);
+			for (int j = 0; j < 4; j++)
+				vertices[4 * face + j].Color = f.color;
+			collector->append(tile, &vertices[4 * face], 4, quad_indices, 6);
+		}
+	}
+}
+
 u8 MapblockMeshGenerator::getNodeBoxMask(aabb3f box, u8 solid_neighbors, u8 sametype_neighbors) const
 {
 	const f32 NODE_BOUNDARY = 0.5 * BS;
@@ -1782,4 +1909,7 @@ void MapblockMeshGenerator::generate()
 		cur_node.f = &nodedef->get(cur_node.n);
 		drawNode();
 	}
+
+	if (data->m_greedy_meshing)
+		drawMergedFaces();
 }
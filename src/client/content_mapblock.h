@@ -91,6 +91,23 @@ class MapblockMeshGenerator
 	void drawAutoLightedCuboid(aabb3f box, const TileSpec *tiles, int tile_count, f32 const *txc = nullptr, u8 mask = 0);
 	u8 getNodeBoxMask(aabb3f box, u8 solid_neighbors, u8 sametype_neighbors) const;
 
+// greedy meshing of solid nodes
+	struct MergeableFace {
+		u16 tile = 0; // index into merge_tiles plus one, 0 if there is no face
+		video::SColor color;
+
+		bool operator==(const MergeableFace &other) const
+		{
+			return tile == other.tile && color == other.color;
+		}
+	};
+	// visible faces of solid nodes, for each direction, indexed by node position
+	std::vector<MergeableFace> merge_faces[6];
+	std::vector<TileSpec> merge_tiles;
+
+	bool addMergeableFace(int face, const TileSpec &tile, video::SColor color);
+	void drawMergedFaces();
+
 // liquid-specific
 	struct LiquidData {
 		struct NeighborData {
@@ -16,6 +16,7 @@
 #include "util/directiontables.h"
 #include "util/tracy_wrapper.h"
 #include "client/meshgen/collector.h"
+#include "client/meshgen/diskcache.h"
 #include "client/renderingengine.h"
 #include <array>
 #include <algorithm>
@@ -611,9 +612,10 @@ void PartialMeshBuffer::draw(video::IVideoDriver *driver) const
 	MapBlockMesh
 */
 
-MapBlockMesh::MapBlockMesh(Client *client, MeshMakeData *data):
-	m_tsrc(client->getTextureSource()),
-	m_shdrsrc(client->getShaderSource()),
+MapBlockMesh::MapBlockMesh(ITextureSource *tsrc, IShaderSource *shdrsrc,
+		MeshMakeData *data, MeshDiskCache *disk_cache):
+	m_tsrc(tsrc),
+	m_shdrsrc(shdrsrc),
 	m_bounding_sphere_center((data->m_side_length * 0.5f - 0.5f) * BS),
 	m_animation_force_timer(0), // force initial animation
 	m_last_crack(-1)
@@ -650,9 +652,20 @@ MapBlockMesh::MapBlockMesh(Client *client, MeshMakeData *data):
 
 	MeshCollector collector(m_bounding_sphere_center, offset);
 
-	{
+	std::string cache_key;
+	if (disk_cache)
+		cache_key = disk_cache->getKey(data);
+
+	if (!cache_key.empty() && disk_cache->load(cache_key, collector)) {
+		g_profiler->avg("Client: Mesh disk cache hits [%]", 100);
+	} else {
 		// Generate everything
 		MapblockMeshGenerator(data, &collector).generate();
+
+		if (!cache_key.empty()) {
+			g_profiler->avg("Client: Mesh disk cache hits [%]", 0);
+			disk_cache->store(cache_key, collector);
+		}
 	}
 
 	/*
@@ -21,6 +21,7 @@ namespace irr::video {
 }
 
 class Client;
+class MeshDiskCache;
 class NodeDefManager;
 class IShaderSource;
 class ITextureSource;
@@ -51,6 +52,7 @@ struct MeshMakeData
 	bool m_generate_minimap = false;
 	bool m_smooth_lighting = false;
 	bool m_enable_water_reflections = false;
+	bool m_greedy_meshing = false;
 
 	const NodeDefManager *m_nodedef;
 
@@ -179,8 +181,9 @@ class PartialMeshBuffer
 class MapBlockMesh
 {
 public:
-	// Builds the mesh given
-	MapBlockMesh(Client *client, MeshMakeData *data);
+	// Builds the mesh given, using the geometry from disk_cache if available
+	MapBlockMesh(ITextureSource *tsrc, IShaderSource *shdrsrc, MeshMakeData *data,
+			MeshDiskCache *disk_cache = nullptr);
 	~MapBlockMesh();
 
 	// Main animation function, parameters:
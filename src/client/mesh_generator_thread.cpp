@@ -6,6 +6,7 @@
 #include "settings.h"
 #include "profiler.h"
 #include "client.h"
+#include "client/shader.h"
 #include "mapblock.h"
 #include "map.h"
 #include "util/directiontables.h"
@@ -41,6 +42,7 @@ MeshUpdateQueue::MeshUpdateQueue(Client *client):
 {
 	m_cache_smooth_lighting = g_settings->getBool("smooth_lighting");
 	m_cache_enable_water_reflections = g_settings->getBool("enable_water_reflections");
+	m_cache_greedy_meshing = g_settings->getBool("greedy_meshing");
 }
 
 MeshUpdateQueue::~MeshUpdateQueue()
@@ -183,19 +185,27 @@ void MeshUpdateQueue::fillDataFromMapBlocks(QueuedMeshUpdate *q)
 
 	data->fillBlockDataBegin(q->p);
 
+	// Copied instead of using getData(), which would expand compact blocks
+	auto nodes = std::make_unique<MapNode[]>(MapBlock::nodecount);
 	v3s16 pos;
 	int i = 0;
 	for (pos.X = q->p.X - 1; pos.X <= q->p.X + mesh_grid.cell_size; pos.X++)
 	for (pos.Z = q->p.Z - 1; pos.Z <= q->p.Z + mesh_grid.cell_size; pos.Z++)
 	for (pos.Y = q->p.Y - 1; pos.Y <= q->p.Y + mesh_grid.cell_size; pos.Y++) {
 		MapBlock *block = q->map_blocks[i++];
-		data->fillBlockData(pos, block ? block->getData() : block_placeholder.data);
+		if (block) {
+			block->copyNodesTo(nodes.get());
+			data->fillBlockData(pos, nodes.get());
+		} else {
+			data->fillBlockData(pos, block_placeholder.data);
+		}
 	}
 
 	data->setCrack(q->crack_level, q->crack_pos);
 	data->m_generate_minimap = !!m_client->getMinimap();
 	data->m_smooth_lighting = m_cache_smooth_lighting;
 	data->m_enable_water_reflections = m_cache_enable_water_reflections;
+	data->m_greedy_meshing = m_cache_greedy_meshing;
 }
 
 /*
@@ -220,7 +230,8 @@ void MeshUpdateWorkerThread::doUpdate()
 
 		ScopeProfiler sp(g_profiler, "Client: Mesh making (sum)");
 
-		MapBlockMesh *mesh_new = new MapBlockMesh(m_client, q->data);
+		MapBlockMesh *mesh_new = new MapBlockMesh(m_client->getTextureSource(),
+			m_client->getShaderSource(), q->data, m_manager->getDiskCache());
 
 		MeshUpdateResult r;
 		r.p = q->p;
@@ -9,6 +9,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include "mapblock_mesh.h"
+#include "meshgen/diskcache.h"
 #include "threading/mutex_auto_lock.h"
 #include "util/thread.h"
 #include <vector>
@@ -72,6 +73,7 @@ class MeshUpdateQueue
 	// TODO: Add callback to update these when g_settings changes, and update all meshes
 	bool m_cache_smooth_lighting;
 	bool m_cache_enable_water_reflections;
+	bool m_cache_greedy_meshing;
 
 	void fillDataFromMapBlocks(QueuedMeshUpdate *q);
 };
@@ -126,6 +128,10 @@ class MeshUpdateManager
 
 	bool isRunning();
 
+	// Must be set before the threads are started
+	void setDiskCache(std::unique_ptr<MeshDiskCache> cache) { m_disk_cache = std::move(cache); }
+	MeshDiskCache *getDiskCache() { return m_disk_cache.get(); }
+
 private:
 	void deferUpdate();
 
@@ -135,4 +141,6 @@ class MeshUpdateManager
 	MutexedQueue<MeshUpdateResult> m_queue_out_urgent;
 
 	std::vector<std::unique_ptr<MeshUpdateWorkerThread>> m_workers;
+
+	std::unique_ptr<MeshDiskCache> m_disk_cache;
 };
@@ -0,0 +1,301 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "diskcache.h"
+#include <algorithm>
+#include <sstream>
+#include "collector.h"
+#include "client/mapblock_mesh.h"
+#include "client/shader.h"
+#include "client/texturesource.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "log.h"
+#include "nodedef.h"
+#include "serialization.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/hashing.h"
+#include "util/hex.h"
+#include "util/serialize.h"
+
+// Increase this when the format or the output of MapblockMeshGenerator
+// changes in an incompatible way
+constexpr u8 MESH_DISK_CACHE_VERSION = 1;
+
+MeshDiskCache::MeshDiskCache(const std::string &dir, u64 max_size,
+		std::string_view content_id, const NodeDefManager *ndef,
+		ITextureSource *tsrc, IShaderSource *shdrsrc) :
+	m_dir(dir),
+	m_max_size(max_size),
+	m_files(dir)
+{
+	m_content_hash = hashing::sha1(content_id);
+
+	// Collect the tile layers meshes can be made of
+	auto add_layer = [&] (const TileLayer &layer) {
+		if (layer.texture_id == 0)
+			return;
+		LayerId id(layer.texture_id, layer.shader_id,
+				layer.animation_frame_count, layer.animation_frame_length_ms);
+		if (m_layer_names.count(id))
+			return;
+
+		ShaderInfo shader = shdrsrc->getShaderInfo(layer.shader_id);
+		std::ostringstream os(std::ios::binary);
+		// The size matters for the scale of world-aligned textures
+		core::dimension2du size = layer.texture ?
+				layer.texture->getOriginalSize() : core::dimension2du(0, 0);
+		os << tsrc->getTextureName(layer.texture_id) << '\n'
+				<< size.Width << 'x' << size.Height << '\n' << shader.name << '\n'
+				<< (int)shader.material_type << '\n' << (int)shader.drawtype << '\n'
+				<< layer.animation_frame_count << '\n' << layer.animation_frame_length_ms;
+		std::string name = os.str();
+
+		m_layer_names[id] = name;
+		m_layers[name] = {layer.texture, layer.texture_id, layer.shader_id, layer.frames};
+	};
+
+	const ContentFeatures &unknown = ndef->get(CONTENT_UNKNOWN);
+	for (u32 c = 0; c <= MAX_REGISTERED_CONTENT; c++) {
+		const ContentFeatures &f = ndef->get(c);
+		if (&f == &unknown && c != CONTENT_UNKNOWN)
+			continue;
+		for (const TileSpec &tile : f.tiles) {
+			for (const TileLayer &layer : tile.layers)
+				add_layer(layer);
+		}
+		for (const TileSpec &tile : f.special_tiles) {
+			for (const TileLayer &layer : tile.layers)
+				add_layer(layer);
+		}
+	}
+
+	// Index the entries of previous sessions, oldest first
+	std::vector<std::tuple<int64_t, std::string, u64>> files;
+	for (const fs::DirListNode &node : fs::GetDirListing(dir)) {
+		uint64_t size;
+		int64_t mtime;
+		if (!node.dir && fs::GetFileInfo(dir + DIR_DELIM + node.name, size, mtime))
+			files.emplace_back(mtime, node.name, size);
+	}
+	std::sort(files.begin(), files.end());
+
+	MutexAutoLock lock(m_entries_mutex);
+	for (auto &[mtime, name, size] : files)
+		add(name, size);
+	evict();
+
+	infostream << "MeshDiskCache: " << m_layers.size() << " tile layers, "
+			<< m_entries.size() << " entries (" << m_size / 1024 << " KiB) in \""
+			<< dir << "\"" << std::endl;
+}
+
+void MeshDiskCache::touch(const std::string &key)
+{
+	MutexAutoLock lock(m_entries_mutex);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		m_lru.splice(m_lru.end(), m_lru, it->second);
+}
+
+void MeshDiskCache::add(const std::string &key, u64 size)
+{
+	auto it = m_entries.find(key);
+	if (it != m_entries.end()) {
+		m_size -= it->second->size;
+		m_lru.erase(it->second);
+	}
+	m_lru.push_back({key, size});
+	m_entries[key] = std::prev(m_lru.end());
+	m_size += size;
+}
+
+void MeshDiskCache::evict()
+{
+	while (m_size > m_max_size && !m_lru.empty()) {
+		const Entry &entry = m_lru.front();
+		fs::DeleteSingleFileOrEmptyDirectory(m_dir + DIR_DELIM + entry.key);
+		m_size -= entry.size;
+		m_entries.erase(entry.key);
+		m_lru.pop_front();
+	}
+}
+
+std::string MeshDiskCache::getKey(const MeshMakeData *data) const
+{
+	// Cracks are temporary
+	if (data->m_crack_pos_relative != v3s16(-1337, -1337, -1337))
+		return "";
+
+	std::string buf;
+	const s16 side = data->m_side_length;
+	buf.reserve(m_content_hash.size() + 16 + (side + 2) * (side + 2) * (side + 2) * 4);
+	buf.append(m_content_hash);
+
+	// The node positions matter for world-aligned textures and random offsets
+	char tmp[8];
+	writeV3S16((u8 *)tmp, data->m_blockpos);
+	buf.append(tmp, 6);
+	writeU16((u8 *)tmp, side);
+	buf.append(tmp, 2);
+	buf.push_back(data->m_smooth_lighting);
+	buf.push_back(data->m_enable_water_reflections);
+	buf.push_back(data->m_greedy_meshing);
+
+	// The block and the border of its neighbors
+	const v3s16 minp = data->m_blockpos * MAP_BLOCKSIZE - 1;
+	const v3s16 maxp = minp + side + 1;
+	v3s16 p;
+	for (p.Z = minp.Z; p.Z <= maxp.Z; p.Z++)
+	for (p.Y = minp.Y; p.Y <= maxp.Y; p.Y++)
+	for (p.X = minp.X; p.X <= maxp.X; p.X++) {
+		MapNode n = data->m_vmanip.getNodeNoExNoEmerge(p);
+		writeU16((u8 *)tmp, n.param0);
+		tmp[2] = n.param1;
+		tmp[3] = n.param2;
+		buf.append(tmp, 4);
+	}
+
+	return hex_encode(hashing::sha1(buf));
+}
+
+bool MeshDiskCache::load(const std::string &key, MeshCollector &collector)
+{
+	std::ostringstream compressed(std::ios::binary);
+	if (!m_files.load(key, compressed))
+		return false;
+
+	auto clear = [&] () {
+		for (auto &prebuffers : collector.prebuffers)
+			prebuffers.clear();
+		collector.m_bounding_radius_sq = 0.0f;
+	};
+
+	try {
+		std::string data;
+		{
+			std::istringstream is(compressed.str(), std::ios::binary);
+			std::ostringstream os(std::ios::binary);
+			decompressZstd(is, os);
+			data = os.str();
+		}
+		std::istringstream is(data, std::ios::binary);
+		// Checks that 'count' elements can be read before allocating them
+		auto check_count = [&] (u32 count, u32 element_size) {
+			if (!is.good() || (u64)count * element_size > data.size() - (u64)is.tellg())
+				throw SerializationError("truncated entry");
+			return count;
+		};
+
+		if (readU8(is) != MESH_DISK_CACHE_VERSION)
+			return false;
+		collector.m_bounding_radius_sq = readF32(is);
+
+		for (auto &prebuffers : collector.prebuffers) {
+			u16 count = readU16(is);
+			for (u16 i = 0; i < count; i++) {
+				auto it = m_layers.find(deSerializeString16(is));
+				if (it == m_layers.end()) {
+					// e.g. the textures changed
+					clear();
+					return false;
+				}
+
+				PreMeshBuffer &p = prebuffers.emplace_back();
+				p.layer.texture = it->second.texture;
+				p.layer.texture_id = it->second.texture_id;
+				p.layer.shader_id = it->second.shader_id;
+				p.layer.frames = it->second.frames;
+				p.layer.animation_frame_count = readU16(is);
+				p.layer.animation_frame_length_ms = readU16(is);
+				p.layer.material_type = readU8(is);
+				p.layer.material_flags = readU8(is);
+				p.layer.color = readARGB8(is);
+				p.layer.has_color = readU8(is);
+				p.layer.scale = readU8(is);
+
+				// Bulk data is decoded from the buffer directly, which is much
+				// faster than reading it field by field from the stream
+				p.vertices.resize(check_count(readU32(is), 36));
+				if (p.vertices.size() > U16_MAX + 1)
+					throw SerializationError("too many vertices");
+				const u8 *ptr = (const u8 *)data.data() + is.tellg();
+				for (auto &v : p.vertices) {
+					v.Pos = readV3F32(ptr);
+					v.Normal = readV3F32(ptr + 12);
+					v.Color = readARGB8(ptr + 24);
+					v.TCoords = readV2F32(ptr + 28);
+					ptr += 36;
+				}
+				is.seekg(p.vertices.size() * 36, std::ios::cur);
+
+				p.indices.resize(check_count(readU32(is), 2));
+				ptr = (const u8 *)data.data() + is.tellg();
+				for (auto &index : p.indices) {
+					index = readU16(ptr);
+					ptr += 2;
+					if (index >= p.vertices.size())
+						throw SerializationError("invalid index");
+				}
+				is.seekg(p.indices.size() * 2, std::ios::cur);
+			}
+		}
+		check_count(0, 0);
+	} catch (SerializationError &e) {
+		warningstream << "MeshDiskCache: invalid entry " << key << ": "
+				<< e.what() << std::endl;
+		clear();
+		return false;
+	}
+
+	touch(key);
+	return true;
+}
+
+void MeshDiskCache::store(const std::string &key, const MeshCollector &collector)
+{
+	std::ostringstream os(std::ios::binary);
+	writeU8(os, MESH_DISK_CACHE_VERSION);
+	writeF32(os, collector.m_bounding_radius_sq);
+
+	for (auto &prebuffers : collector.prebuffers) {
+		writeU16(os, prebuffers.size());
+		for (auto &p : prebuffers) {
+			auto it = m_layer_names.find(LayerId(p.layer.texture_id, p.layer.shader_id,
+					p.layer.animation_frame_count, p.layer.animation_frame_length_ms));
+			// Not made of node tiles, can't be restored
+			if (it == m_layer_names.end())
+				return;
+
+			os << serializeString16(it->second);
+			writeU16(os, p.layer.animation_frame_count);
+			writeU16(os, p.layer.animation_frame_length_ms);
+			writeU8(os, p.layer.material_type);
+			writeU8(os, p.layer.material_flags);
+			writeARGB8(os, p.layer.color);
+			writeU8(os, p.layer.has_color);
+			writeU8(os, p.layer.scale);
+
+			writeU32(os, p.vertices.size());
+			for (auto &v : p.vertices) {
+				writeV3F32(os, v.Pos);
+				writeV3F32(os, v.Normal);
+				writeARGB8(os, v.Color);
+				writeV2F32(os, v.TCoords);
+			}
+			writeU32(os, p.indices.size());
+			for (u16 index : p.indices)
+				writeU16(os, index);
+		}
+	}
+
+	std::ostringstream compressed(std::ios::binary);
+	compressZstd(os.str(), compressed);
+	const std::string data = compressed.str();
+	if (!m_files.update(key, data))
+		return;
+
+	MutexAutoLock lock(m_entries_mutex);
+	add(key, data.size());
+	evict();
+}
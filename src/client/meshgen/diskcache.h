@@ -0,0 +1,99 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes.h"
+#include "client/filecache.h"
+#include "client/tile.h"
+
+class IShaderSource;
+class ITextureSource;
+class NodeDefManager;
+struct MeshCollector;
+struct MeshMakeData;
+
+/*
+	Persistent cache of the geometry generated by MapblockMeshGenerator.
+
+	Entries are keyed by a hash of the nodes of the block and the border of
+	its neighbors, and of everything else the geometry depends on (node
+	definitions, mesh media, settings), so they remain valid between sessions
+	on the same server.
+	Textures and shaders are stored by name and resolved against the tiles of
+	the current node definitions when loading.
+	When the entries take more than the maximum size, the least recently used
+	ones are deleted. Entries from previous sessions are ordered by their
+	modification time.
+
+	All methods besides the constructor may be called from any thread.
+*/
+class MeshDiskCache
+{
+public:
+	/*
+		'dir' is the cache directory to use.
+		'max_size' is the maximum size of all entries in bytes.
+		'content_id' identifies the content definitions the meshes depend on.
+		Must be called from the main thread after the node textures were
+		updated.
+	*/
+	MeshDiskCache(const std::string &dir, u64 max_size, std::string_view content_id,
+			const NodeDefManager *ndef, ITextureSource *tsrc, IShaderSource *shdrsrc);
+
+	// Returns the key for the mesh of 'data', or "" if it must not be cached
+	std::string getKey(const MeshMakeData *data) const;
+
+	// Fills an empty collector. Returns false if there is no usable entry.
+	bool load(const std::string &key, MeshCollector &collector);
+	void store(const std::string &key, const MeshCollector &collector);
+
+private:
+	// The parts of a tile layer that are specific to the session
+	struct LayerResources {
+		video::ITexture *texture;
+		u32 texture_id;
+		u32 shader_id;
+		std::vector<FrameSpec> *frames;
+	};
+
+	// (texture id, shader id, animation frame count, frame length) of a layer
+	using LayerId = std::tuple<u32, u32, u16, u16>;
+
+	struct Entry {
+		std::string key;
+		u64 size;
+	};
+	using EntryIt = std::list<Entry>::iterator;
+
+	// Makes the entry the most recently used one
+	void touch(const std::string &key);
+	// These require m_entries_mutex to be locked
+	void add(const std::string &key, u64 size);
+	// Deletes entries until the size limit is met
+	void evict();
+
+	const std::string m_dir;
+	const u64 m_max_size;
+	FileCache m_files;
+
+	std::mutex m_entries_mutex;
+	// Least recently used first
+	std::list<Entry> m_lru;
+	std::unordered_map<std::string, EntryIt> m_entries;
+	u64 m_size = 0;
+
+	std::string m_content_hash;
+
+	// Persistent names of the tile layers of all nodes
+	std::map<LayerId, std::string> m_layer_names;
+	std::unordered_map<std::string, LayerResources> m_layers;
+};
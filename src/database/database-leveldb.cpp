@@ -61,6 +61,25 @@ void Database_LevelDB::loadBlock(const v3s16 &pos, std::string *block)
 		block->clear();
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->resize(positions.size());
+
+	// Keys are not ordered by position, so an iterator does not help here.
+	// Read all blocks from one snapshot instead.
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+	for (size_t i = 0; i < positions.size(); i++) {
+		std::string *block = &(*blocks)[i];
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(positions[i])), block);
+		if (!status.ok())
+			block->clear();
+	}
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
 	leveldb::Status status = m_database->Delete(leveldb::WriteOptions(),
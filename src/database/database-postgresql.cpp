@@ -21,6 +21,8 @@
 #include "remoteplayer.h"
 #include "server/player_sao.h"
 #include <cstdlib>
+#include <cstring>
+#include <unordered_map>
 
 Database_PostgreSQL::Database_PostgreSQL(const std::string &connect_string,
 	const char *type) :
@@ -202,6 +204,14 @@ void MapDatabasePostgreSQL::initStatements()
 				"UPDATE SET data = $4::bytea");
 	}
 
+	// multi-argument unnest() needs 9.4
+	if (getPGVersion() >= 90400) {
+		prepareStatement("read_blocks",
+			"SELECT posX, posY, posZ, data FROM blocks "
+				"WHERE (posX, posY, posZ) IN (SELECT * FROM "
+				"unnest($1::int4[], $2::int4[], $3::int4[]))");
+	}
+
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
 		"posX = $1::int4 AND posY = $2::int4 AND posZ = $3::int4");
 
@@ -265,6 +275,58 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	if (getPGVersion() < 90400) {
+		MapDatabase::loadBlocks(positions, blocks);
+		return;
+	}
+
+	verifyDatabase();
+
+	blocks->assign(positions.size(), std::string());
+	if (positions.empty())
+		return;
+
+	// The coordinates are passed as three arrays in text format
+	std::string xs = "{", ys = "{", zs = "{";
+	std::unordered_map<v3s16, size_t> index;
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 &pos = positions[i];
+		const char *sep = i == 0 ? "" : ",";
+		xs.append(sep).append(itos(pos.X));
+		ys.append(sep).append(itos(pos.Y));
+		zs.append(sep).append(itos(pos.Z));
+		index.emplace(pos, i);
+	}
+	xs += "}";
+	ys += "}";
+	zs += "}";
+
+	const char *args[] = { xs.c_str(), ys.c_str(), zs.c_str() };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+		false, true);
+
+	// results are in binary format
+	auto to_s16 = [&] (int row, int col) -> s16 {
+		u32 v;
+		memcpy(&v, PQgetvalue(results, row, col), sizeof(v));
+		return (s32)ntohl(v);
+	};
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		v3s16 pos(to_s16(row, 0), to_s16(row, 1), to_s16(row, 2));
+		auto it = index.find(pos);
+		if (it != index.end())
+			(*blocks)[it->second] = pg_to_string(results, row, 3);
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
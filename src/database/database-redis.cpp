@@ -152,6 +152,50 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->assign(positions.size(), std::string());
+	if (positions.empty())
+		return;
+
+	std::vector<std::string> keys;
+	keys.reserve(positions.size());
+	for (const v3s16 &pos : positions)
+		keys.push_back(i64tos(getBlockAsInteger(pos)));
+
+	std::vector<const char *> argv = { "HMGET", hash.c_str() };
+	std::vector<size_t> argvlen = { 5, hash.size() };
+	for (const std::string &key : keys) {
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			(int)argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		throw DatabaseException("Redis command 'HMGET' errored: " + errstr);
+	}
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != positions.size()) {
+		freeReplyObject(reply);
+		throw DatabaseException("Redis command 'HMGET' gave invalid reply.");
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		const redisReply *element = reply->element[i];
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
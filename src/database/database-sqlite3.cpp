@@ -22,6 +22,7 @@ SQLite format specification:
 #include "irrlicht_changes/printing.h"
 #include "server/player_sao.h"
 
+#include <algorithm>
 #include <cassert>
 
 // When to print messages when the database is being held locked by another process
@@ -192,6 +193,7 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_range)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
@@ -214,6 +216,7 @@ void MapDatabaseSQLite3::createDatabase()
 void MapDatabaseSQLite3::initStatements()
 {
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	PREPARE_STATEMENT(read_range, "SELECT `pos`, `data` FROM `blocks` WHERE `pos` BETWEEN ? AND ?");
 	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
@@ -276,6 +279,40 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->assign(positions.size(), std::string());
+
+	std::vector<std::pair<s64, size_t>> keys;
+	keys.reserve(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		keys.emplace_back(getBlockAsInteger(positions[i]), i);
+	std::sort(keys.begin(), keys.end());
+
+	// Blocks next to each other along X have consecutive keys, so a
+	// neighbourhood of blocks is read with a few range queries
+	for (size_t start = 0; start < keys.size();) {
+		size_t end = start + 1;
+		while (end < keys.size() && keys[end].first == keys[end - 1].first + 1)
+			end++;
+
+		const s64 first = keys[start].first;
+		int64_to_sqlite(m_stmt_read_range, 1, first);
+		int64_to_sqlite(m_stmt_read_range, 2, keys[end - 1].first);
+		while (sqlite3_step(m_stmt_read_range) == SQLITE_ROW) {
+			const s64 key = sqlite_to_int64(m_stmt_read_range, 0);
+			const size_t i = keys[start + (key - first)].second;
+			(*blocks)[i].assign(sqlite_to_blob(m_stmt_read_range, 1));
+		}
+		sqlite3_reset(m_stmt_read_range);
+
+		start = end;
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
@@ -149,6 +149,8 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, std::string_view data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
@@ -163,6 +165,7 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
+	sqlite3_stmt *m_stmt_read_range = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
@@ -28,6 +28,13 @@ class MapDatabase : public Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	// Loads several blocks at once. blocks is resized to positions.size(),
+	// blocks that do not exist are returned as empty strings. positions
+	// must not contain duplicates.
+	// The default implementation calls loadBlock() for each position.
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
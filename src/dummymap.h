@@ -32,7 +32,7 @@ class DummyMap : public Map
 			MapBlock *block = getBlockNoCreateNoEx({x, y, z});
 			if (block) {
 				for (size_t i = 0; i < MapBlock::nodecount; i++)
-					block->getData()[i] = n;
+					block->getDataForWrite()[i] = n;
 				block->expireIsAirCache();
 			}
 		}
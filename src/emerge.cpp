@@ -23,6 +23,7 @@
 #include "mapgen/mg_decoration.h"
 #include "mapgen/mg_schematic.h"
 #include "nodedef.h"
+#include "porting.h"
 #include "profiler.h"
 #include "scripting_server.h"
 #include "scripting_emerge.h"
@@ -110,8 +111,10 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_diskonly = rangelim(m_qlimit_diskonly, 1, 1000000);
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
 
+	m_peer_queue_count.reset(new std::atomic<u32>[U16_MAX + 1]());
+
 	for (s16 i = 0; i < nthreads; i++)
-		m_threads.push_back(new EmergeThread(server, i));
+		m_threads.push_back(new EmergeThread(server, i, mb));
 
 	infostream << "EmergeManager: using " << nthreads << " threads" << std::endl;
 }
@@ -278,23 +281,17 @@ bool EmergeManager::enqueueBlockEmergeEx(
 	EmergeCompletionCallback callback,
 	void *callback_param)
 {
-	EmergeThread *thread = NULL;
 	bool entry_already_exists = false;
 
-	{
-		MutexAutoLock queuelock(m_queue_mutex);
-
-		if (!pushBlockEmergeData(blockpos, peer_id, flags,
-				callback, callback_param, &entry_already_exists))
-			return false;
-
-		if (entry_already_exists)
-			return true;
+	if (!pushBlockEmergeData(blockpos, peer_id, flags,
+			callback, callback_param, &entry_already_exists))
+		return false;
 
-		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
-	}
+	if (entry_already_exists)
+		return true;
 
+	EmergeThread *thread = getOptimalThread();
+	thread->pushBlock(blockpos);
 	thread->signal();
 
 	return true;
@@ -303,14 +300,14 @@ bool EmergeManager::enqueueBlockEmergeEx(
 
 size_t EmergeManager::getQueueSize()
 {
-	MutexAutoLock queuelock(m_queue_mutex);
-	return m_blocks_enqueued.size();
+	return m_queue_size;
 }
 
 bool EmergeManager::isBlockInQueue(v3s16 pos)
 {
-	MutexAutoLock queuelock(m_queue_mutex);
-	return m_blocks_enqueued.find(pos) != m_blocks_enqueued.end();
+	QueueShard &shard = getQueueShard(pos);
+	MutexAutoLock queuelock(shard.mutex);
+	return shard.blocks.find(pos) != shard.blocks.end();
 }
 
 
@@ -349,6 +346,11 @@ bool EmergeManager::isBlockUnderground(v3s16 blockpos)
 	return blockpos.Y * (MAP_BLOCKSIZE + 1) <= mgparams->water_level;
 }
 
+EmergeManager::QueueShard &EmergeManager::getQueueShard(v3s16 pos)
+{
+	return m_queue_shards[std::hash<v3s16>()(pos) % QUEUE_SHARDS];
+}
+
 bool EmergeManager::pushBlockEmergeData(
 	v3s16 pos,
 	u16 peer_requested,
@@ -357,10 +359,13 @@ bool EmergeManager::pushBlockEmergeData(
 	void *callback_param,
 	bool *entry_already_exists)
 {
-	u32 &count_peer = m_peer_queue_count[peer_requested];
+	std::atomic<u32> &count_peer = m_peer_queue_count[peer_requested];
+
+	QueueShard &shard = getQueueShard(pos);
+	MutexAutoLock queuelock(shard.mutex);
 
 	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
-		if (m_blocks_enqueued.size() >= m_qlimit_total)
+		if (m_queue_size >= m_qlimit_total)
 			return false;
 
 		if (peer_requested != PEER_ID_INEXISTENT) {
@@ -376,7 +381,7 @@ bool EmergeManager::pushBlockEmergeData(
 	}
 
 	std::pair<std::map<v3s16, BlockEmergeData>::iterator, bool> findres;
-	findres = m_blocks_enqueued.insert(std::make_pair(pos, BlockEmergeData()));
+	findres = shard.blocks.insert(std::make_pair(pos, BlockEmergeData()));
 
 	BlockEmergeData &bedata = findres.first->second;
 	*entry_already_exists   = !findres.second;
@@ -389,8 +394,10 @@ bool EmergeManager::pushBlockEmergeData(
 	} else {
 		bedata.flags = flags;
 		bedata.peer_requested = peer_requested;
+		bedata.queued_at = porting::getTimeUs();
 
 		count_peer++;
+		m_queue_size++;
 	}
 
 	return true;
@@ -399,22 +406,20 @@ bool EmergeManager::pushBlockEmergeData(
 
 bool EmergeManager::popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata)
 {
-	auto it = m_blocks_enqueued.find(pos);
-	if (it == m_blocks_enqueued.end())
-		return false;
+	QueueShard &shard = getQueueShard(pos);
+	MutexAutoLock queuelock(shard.mutex);
 
-	*bedata = it->second;
-
-	auto it2 = m_peer_queue_count.find(bedata->peer_requested);
-	if (it2 == m_peer_queue_count.end())
+	auto it = shard.blocks.find(pos);
+	if (it == shard.blocks.end())
 		return false;
 
-	u32 &count_peer = it2->second;
+	*bedata = std::move(it->second);
+	shard.blocks.erase(it);
 
+	std::atomic<u32> &count_peer = m_peer_queue_count[bedata->peer_requested];
 	assert(count_peer != 0);
 	count_peer--;
-
-	m_blocks_enqueued.erase(it);
+	m_queue_size--;
 
 	return true;
 }
@@ -427,10 +432,10 @@ EmergeThread *EmergeManager::getOptimalThread()
 	FATAL_ERROR_IF(nthreads == 0, "No emerge threads!");
 
 	size_t index = 0;
-	size_t nitems_lowest = m_threads[0]->m_block_queue.size();
+	size_t nitems_lowest = m_threads[0]->getQueueSize();
 
 	for (size_t i = 1; i < nthreads; i++) {
-		size_t nitems = m_threads[i]->m_block_queue.size();
+		size_t nitems = m_threads[i]->getQueueSize();
 		if (nitems < nitems_lowest) {
 			index = i;
 			nitems_lowest = nitems;
@@ -451,7 +456,7 @@ void EmergeManager::reportCompletedEmerge(EmergeAction action)
 //// EmergeThread
 ////
 
-EmergeThread::EmergeThread(Server *server, int ethreadid) :
+EmergeThread::EmergeThread(Server *server, int ethreadid, MetricsBackend *mb) :
 	enable_mapgen_debug_info(false),
 	id(ethreadid),
 	m_server(server),
@@ -461,6 +466,14 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_trans_liquid(nullptr)
 {
 	m_name = "Emerge-" + itos(ethreadid);
+
+	const std::string thread_id = itos(ethreadid);
+	m_queue_wait_counter = mb->addCounter("minetest_emerge_queue_wait_time",
+		"Time blocks processed by the emerge thread spent in the queue (in microseconds)",
+		{{"thread", thread_id}});
+	m_stolen_counter = mb->addCounter("minetest_emerge_stolen_blocks",
+		"Number of blocks the emerge thread took from the queues of other threads",
+		{{"thread", thread_id}});
 }
 
 
@@ -470,24 +483,55 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(v3s16 pos)
+void EmergeThread::pushBlock(v3s16 pos)
 {
-	m_block_queue.push(pos);
-	return true;
+	MutexAutoLock queuelock(m_block_queue_mutex);
+	m_block_queue.push_back(pos);
+	m_block_queue_size++;
 }
 
 
-void EmergeThread::cancelPendingItems()
+bool EmergeThread::popBlock(v3s16 *pos)
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+	MutexAutoLock queuelock(m_block_queue_mutex);
+	if (m_block_queue.empty())
+		return false;
+
+	*pos = m_block_queue.front();
+	m_block_queue.pop_front();
+	m_block_queue_size--;
+	return true;
+}
 
-	while (!m_block_queue.empty()) {
-		BlockEmergeData bedata;
-		v3s16 pos;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+bool EmergeThread::stealBlock(v3s16 *pos)
+{
+	// the sizes are only a hint, the victim may have run empty meanwhile
+	while (true) {
+		EmergeThread *victim = nullptr;
+		size_t nitems_highest = 0;
+		for (EmergeThread *thread : m_emerge->m_threads) {
+			size_t nitems = thread->getQueueSize();
+			if (thread != this && nitems > nitems_highest) {
+				victim = thread;
+				nitems_highest = nitems;
+			}
+		}
+		if (!victim)
+			return false;
+		if (victim->popBlock(pos)) {
+			m_stolen_counter->increment();
+			return true;
+		}
+	}
+}
 
+
+void EmergeThread::cancelPendingItems()
+{
+	v3s16 pos;
+	while (popBlock(&pos)) {
+		BlockEmergeData bedata;
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
 		runCompletionCallbacks(pos, EMERGE_CANCELLED, bedata.callbacks);
@@ -514,22 +558,19 @@ void EmergeThread::runCompletionCallbacks(v3s16 pos, EmergeAction action,
 
 bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 {
-	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
-
-	if (m_block_queue.empty())
+	if (!popBlock(pos) && !stealBlock(pos))
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
-
-	m_emerge->popBlockEmergeData(*pos, bedata);
+	if (m_emerge->popBlockEmergeData(*pos, bedata))
+		m_queue_wait_counter->increment(porting::getTimeUs() - bedata->queued_at);
 
 	return true;
 }
 
 
 EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 pos, bool allow_gen,
-	 const std::string *from_db, MapBlock **block, BlockMakeData *bmdata)
+	 ServerMap::DecodedBlock *from_db, MapBlock **block, BlockMakeData *bmdata,
+	 std::vector<v3s16> *prefetch)
 {
 	//TimeTaker tt("", nullptr, PRECISION_MICRO);
 	Server::EnvAutoLock envlock(m_server);
@@ -552,11 +593,13 @@ EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 pos, bool allow_gen,
 	} else {
 		if (!from_db) {
 			// 2). We should attempt loading it
+			if (prefetch)
+				getPrefetchPositions(pos, *prefetch);
 			return EMERGE_FROM_DISK;
 		}
 		// 2). Second invocation, we have the data
-		if (!from_db->empty()) {
-			*block = m_map->loadBlock(*from_db, pos);
+		if (from_db->block) {
+			*block = m_map->insertDecodedBlock(std::move(*from_db));
 			if (block_ok(*block))
 				return EMERGE_FROM_DISK;
 		}
@@ -571,6 +614,66 @@ EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 pos, bool allow_gen,
 }
 
 
+void EmergeThread::getPrefetchPositions(v3s16 pos, std::vector<v3s16> &positions)
+{
+	// Radius of the neighbourhood that is read along with a block
+	constexpr s16 PREFETCH_RADIUS = 1;
+
+	positions.clear();
+	if (m_prefetched.count(pos))
+		return;
+	v3s16 d;
+	for (d.Z = -PREFETCH_RADIUS; d.Z <= PREFETCH_RADIUS; d.Z++)
+	for (d.Y = -PREFETCH_RADIUS; d.Y <= PREFETCH_RADIUS; d.Y++)
+	for (d.X = -PREFETCH_RADIUS; d.X <= PREFETCH_RADIUS; d.X++) {
+		v3s16 p = pos + d;
+		if (d == v3s16(0, 0, 0) || blockpos_over_max_limit(p) ||
+				m_prefetched.count(p) || m_map->getBlockNoCreateNoEx(p))
+			continue;
+		positions.push_back(p);
+	}
+}
+
+
+void EmergeThread::loadBlockData(v3s16 pos, const std::vector<v3s16> &prefetch,
+	std::string &ret)
+{
+	// Drop prefetched blocks that were never requested at some point
+	constexpr size_t PREFETCH_MAX = 1024;
+
+	auto &db = *m_emerge->m_db;
+
+	// A block may have been saved or deleted since it was read
+	if (db.write_count != m_prefetch_write_count || m_prefetched.size() > PREFETCH_MAX)
+		m_prefetched.clear();
+
+	auto it = m_prefetched.find(pos);
+	if (it != m_prefetched.end()) {
+		ret = std::move(it->second);
+		m_prefetched.erase(it);
+		g_profiler->add(m_name + ": prefetched blocks used [#]", 1);
+		return;
+	}
+
+	std::vector<v3s16> positions;
+	positions.reserve(prefetch.size() + 1);
+	positions.push_back(pos);
+	positions.insert(positions.end(), prefetch.begin(), prefetch.end());
+
+	std::vector<std::string> blocks;
+	{
+		MutexAutoLock dblock(db.mutex);
+		if (m_prefetched.empty())
+			m_prefetch_write_count = db.write_count;
+		db.loadBlocks(positions, blocks);
+	}
+
+	ret = std::move(blocks[0]);
+	for (size_t i = 1; i < positions.size(); i++)
+		m_prefetched[positions[i]] = std::move(blocks[i]);
+}
+
+
 MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 	std::map<v3s16, MapBlock *> *modified_blocks)
 {
@@ -661,11 +764,16 @@ bool EmergeThread::initScripting()
 
 void *EmergeThread::run()
 {
+	// Number of modified blocks after which a map edit event is sent, even if
+	// there are more blocks in the queue
+	constexpr size_t MAX_PENDING_EVENT_BLOCKS = 64;
+
 	BEGIN_DEBUG_EXCEPTION_HANDLER
 
 	v3s16 pos;
 	std::map<v3s16, MapBlock*> modified_blocks;
 	std::string databuf;
+	std::vector<v3s16> prefetch;
 
 	m_map    = &m_server->m_env->getServerMap();
 	m_emerge = m_server->getEmergeManager();
@@ -699,18 +807,21 @@ void *EmergeThread::run()
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" << pos << " allow_gen=" << allow_gen);
 
-		action = getBlockOrStartGen(pos, allow_gen, nullptr, &block, &bmdata);
+		action = getBlockOrStartGen(pos, allow_gen, nullptr, &block, &bmdata,
+			&prefetch);
 
 		/* Try to load it */
 		if (action == EMERGE_FROM_DISK) {
-			auto &m_db = *m_emerge->m_db;
+			ServerMap::DecodedBlock loaded;
 			{
 				ScopeProfiler sp(g_profiler, "EmergeThread: load block - async (sum)");
-				MutexAutoLock dblock(m_db.mutex);
-				m_db.loadBlock(pos, databuf);
+				loadBlockData(pos, prefetch, databuf);
+				// decompressing and deserializing don't need the env lock
+				if (!databuf.empty())
+					loaded = m_map->decodeBlock(databuf, pos);
 			}
 			// actually load it, then decide again
-			action = getBlockOrStartGen(pos, allow_gen, &databuf, &block, &bmdata);
+			action = getBlockOrStartGen(pos, allow_gen, &loaded, &block, &bmdata);
 			databuf.clear();
 		}
 
@@ -751,14 +862,18 @@ void *EmergeThread::run()
 		if (block)
 			modified_blocks[pos] = block;
 
-		if (!modified_blocks.empty()) {
+		// While there is more to do, collect the modified blocks of several
+		// emerges instead of taking the env lock for each of them
+		if (!modified_blocks.empty() && (action == EMERGE_GENERATED ||
+				modified_blocks.size() >= MAX_PENDING_EVENT_BLOCKS ||
+				getQueueSize() == 0)) {
 			MapEditEvent event;
 			event.type = MEET_OTHER;
 			event.setModifiedBlocks(modified_blocks);
 			Server::EnvAutoLock envlock(m_server);
 			m_map->dispatchEvent(event);
+			modified_blocks.clear();
 		}
-		modified_blocks.clear();
 	}
 	} catch (VersionMismatchException &e) {
 		std::ostringstream err;
@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
 #include "network/networkprotocol.h"
 #include "irr_v3d.h"
@@ -78,6 +80,7 @@ typedef std::vector<
 struct BlockEmergeData {
 	u16 peer_requested;
 	u16 flags;
+	u64 queued_at; // microseconds
 	EmergeCallbackList callbacks;
 };
 
@@ -199,9 +202,21 @@ class EmergeManager {
 	// The map database
 	MapDatabaseAccessor *m_db = nullptr;
 
-	std::mutex m_queue_mutex;
-	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
-	std::unordered_map<u16, u32> m_peer_queue_count;
+	/*
+		The queued blocks are split into shards by position, so that the
+		server thread and the emerge threads rarely wait for each other.
+		The queue limits are checked without a global lock, they can be
+		exceeded by the number of threads enqueueing at the same time.
+	*/
+	struct QueueShard {
+		std::mutex mutex;
+		std::map<v3s16, BlockEmergeData> blocks;
+	};
+	static constexpr size_t QUEUE_SHARDS = 16;
+	QueueShard m_queue_shards[QUEUE_SHARDS];
+	std::atomic<size_t> m_queue_size{0};
+	// indexed by peer id
+	std::unique_ptr<std::atomic<u32>[]> m_peer_queue_count;
 
 	u32 m_qlimit_total;
 	u32 m_qlimit_diskonly;
@@ -218,7 +233,8 @@ class EmergeManager {
 	DecorationManager *decomgr;
 	SchematicManager *schemmgr;
 
-	// Requires m_queue_mutex held
+	QueueShard &getQueueShard(v3s16 pos);
+
 	EmergeThread *getOptimalThread();
 
 	bool pushBlockEmergeData(
@@ -229,6 +245,7 @@ class EmergeManager {
 		void *callback_param,
 		bool *entry_already_exists);
 
+	// Removes the data of a block that was taken off a thread's queue
 	bool popBlockEmergeData(v3s16 pos, BlockEmergeData *bedata);
 
 	void reportCompletedEmerge(EmergeAction action);
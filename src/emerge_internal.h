@@ -9,8 +9,10 @@
 /******************************************************************/
 
 #include "emerge.h"
+#include "servermap.h"
 
-#include <queue>
+#include <deque>
+#include <unordered_map>
 
 #include "util/thread.h"
 #include "threading/event.h"
@@ -27,14 +29,14 @@ class EmergeThread : public Thread {
 	bool enable_mapgen_debug_info;
 	const int id; // Index of this thread
 
-	EmergeThread(Server *server, int ethreadid);
+	EmergeThread(Server *server, int ethreadid, MetricsBackend *mb);
 	~EmergeThread() = default;
 
 	void *run();
 	void signal();
 
-	// Requires queue mutex held
-	bool pushBlock(v3s16 pos);
+	void pushBlock(v3s16 pos);
+	size_t getQueueSize() const { return m_block_queue_size; }
 
 	void cancelPendingItems();
 
@@ -58,25 +60,57 @@ class EmergeThread : public Thread {
 	UniqueQueue<v3s16> *m_trans_liquid; //< non-null only when generating a mapblock
 
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	// Blocks assigned to this thread, oldest first. Other threads may
+	// take blocks from here when they run out of work.
+	std::mutex m_block_queue_mutex;
+	std::deque<v3s16> m_block_queue;
+	std::atomic<size_t> m_block_queue_size{0};
+
+	MetricCounterPtr m_queue_wait_counter;
+	MetricCounterPtr m_stolen_counter;
+
+	// Blocks read from the database along with a requested block
+	std::unordered_map<v3s16, std::string> m_prefetched;
+	// MapDatabaseAccessor::write_count when m_prefetched was filled
+	u32 m_prefetch_write_count = 0;
 
 	bool initScripting();
 
+	// Finds the neighbours of a block that are neither loaded nor prefetched.
+	// The env lock must be held.
+	void getPrefetchPositions(v3s16 pos, std::vector<v3s16> &positions);
+
+	/**
+	 * Read a block from the database.
+	 *
+	 * The given neighbours of the block are read in the same call and kept
+	 * for later, as they are likely to be requested next.
+	 */
+	void loadBlockData(v3s16 pos, const std::vector<v3s16> &prefetch,
+		std::string &ret);
+
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	// Takes the oldest block off the queue
+	bool popBlock(v3s16 *pos);
+	// Takes the oldest block off the longest queue of another thread
+	bool stealBlock(v3s16 *pos);
 
 	/**
 	 * Try to get a block from memory and decide what to do.
 	 *
 	 * @param pos block position
-	 * @param from_db serialized block data, optional
+	 * @param from_db block decoded with ServerMap::decodeBlock(), optional
 	 *                (for second call after EMERGE_FROM_DISK was returned)
 	 * @param allow_gen allow invoking mapgen?
 	 * @param block output pointer for block
 	 * @param data info for mapgen
+	 * @param prefetch output for the neighbours to read along with the block,
+	 *                 optional (set if EMERGE_FROM_DISK is returned)
 	 * @return what to do for this block
 	 */
 	EmergeAction getBlockOrStartGen(v3s16 pos, bool allow_gen,
-		const std::string *from_db,  MapBlock **block, BlockMakeData *data);
+		ServerMap::DecodedBlock *from_db, MapBlock **block, BlockMakeData *data,
+		std::vector<v3s16> *prefetch = nullptr);
 
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
 		std::map<v3s16, MapBlock *> *modified_blocks);
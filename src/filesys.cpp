@@ -142,6 +142,19 @@ bool IsExecutable(const std::string &path)
 	return GetBinaryType(path.c_str(), &type) != 0;
 }
 
+bool GetFileInfo(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+		return false;
+	size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	// 100 ns intervals since 1601-01-01
+	const uint64_t time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+			data.ftLastWriteTime.dwLowDateTime;
+	mtime = (int64_t)(time / 10000000) - 11644473600LL;
+	return true;
+}
+
 bool IsDirDelimiter(char c)
 {
 	return c == '/' || c == '\\';
@@ -358,6 +371,16 @@ bool IsExecutable(const std::string &path)
 	return access(path.c_str(), X_OK) == 0;
 }
 
+bool GetFileInfo(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+	struct stat st{};
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+	size = st.st_size;
+	mtime = st.st_mtime;
+	return true;
+}
+
 bool IsDirDelimiter(char c)
 {
 	return c == '/';
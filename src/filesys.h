@@ -5,6 +5,7 @@
 #pragma once
 
 #include "config.h"
+#include <cstdint>
 #include <set>
 #include <string>
 #include <string_view>
@@ -54,6 +55,10 @@ inline bool IsFile(const std::string &path)
 	return PathExists(path) && !IsDir(path);
 }
 
+// Gets the size in bytes and the modification time in seconds since the
+// Unix epoch of a file. Returns false on error.
+bool GetFileInfo(const std::string &path, uint64_t &size, int64_t &mtime);
+
 bool IsDirDelimiter(char c);
 
 // Only pass full paths to this one. True on success.
@@ -4,6 +4,8 @@
 
 #include "mapblock.h"
 
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -50,11 +52,19 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+u64 MapBlock::newChangeStamp()
+{
+	// The upper half is unique per instance (or deserialization), the lower
+	// half is incremented by raiseModified().
+	static std::atomic<u32> next_instance(0);
+	return static_cast<u64>(next_instance.fetch_add(1, std::memory_order_relaxed)) << 32;
+}
+
 MapBlock::MapBlock(v3s16 pos, IGameDef *gamedef):
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
-		data(new MapNode[nodecount]),
-		m_gamedef(gamedef)
+		m_gamedef(gamedef),
+		m_change_stamp(newChangeStamp())
 {
 	reallocate();
 	assert(m_modified > MOD_STATE_CLEAN);
@@ -69,8 +79,169 @@ MapBlock::~MapBlock()
 	}
 #endif
 
-	delete[] data;
-	porting::TrackFreedMemory(sizeof(MapNode) * nodecount);
+	porting::TrackFreedMemory(getNodeDataSize());
+}
+
+void MapBlock::reallocate()
+{
+	if (m_data || m_indices)
+		porting::TrackFreedMemory(getNodeDataSize());
+	m_data.reset();
+	m_indices.reset();
+	m_palette.assign(1, MapNode(CONTENT_IGNORE));
+	updateContentCache();
+	raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
+}
+
+// The palette must be addressable by an u8
+static constexpr u32 MAX_PALETTE_SIZE = 256;
+
+void MapBlock::copyNodesTo(MapNode *dst) const
+{
+	if (m_data) {
+		memcpy(dst, m_data.get(), nodecount * sizeof(MapNode));
+	} else if (!m_indices) {
+		std::fill(dst, dst + nodecount, m_palette[0]);
+	} else {
+		const MapNode *palette = m_palette.data();
+		for (u32 i = 0; i < nodecount; i++)
+			dst[i] = palette[m_indices[i]];
+	}
+}
+
+void MapBlock::compactNodes()
+{
+	if (!m_data)
+		return;
+
+	// open addressing hash table of palette index + 1
+	constexpr u32 table_size = MAX_PALETTE_SIZE * 2;
+	u16 table[table_size] = {};
+	MapNode palette[MAX_PALETTE_SIZE];
+	u32 palette_size = 0;
+	std::unique_ptr<u8[]> indices(new u8[nodecount]);
+
+	for (u32 i = 0; i < nodecount; i++) {
+		const MapNode n = m_data[i];
+		// runs of the same node are common
+		if (i > 0 && n == m_data[i - 1]) {
+			indices[i] = indices[i - 1];
+			continue;
+		}
+
+		u32 h = (n.param0 * 0x9E3779B1U ^ n.param1 * 0x85EBCA6BU ^
+				n.param2 * 0xC2B2AE35U) >> 23;
+		while (table[h] != 0 && !(palette[table[h] - 1] == n))
+			h = (h + 1) % table_size;
+		if (table[h] == 0) {
+			if (palette_size == MAX_PALETTE_SIZE)
+				return; // too diverse, keep the plain array
+			palette[palette_size++] = n;
+			table[h] = palette_size;
+		}
+		indices[i] = table[h] - 1;
+	}
+
+	porting::TrackFreedMemory(getNodeDataSize());
+	m_data.reset();
+	m_palette.assign(palette, palette + palette_size);
+	m_palette.shrink_to_fit();
+	if (palette_size > 1)
+		m_indices = std::move(indices);
+}
+
+// Blocks with more different contents are not worth caching
+static constexpr size_t CONTENT_TYPE_CACHE_MAX = 64;
+
+bool MapBlock::addToContentCache(content_t c)
+{
+	if (do_not_cache_contents)
+		return false;
+	if (CONTAINS(contents, c))
+		return true;
+	if (contents.size() >= CONTENT_TYPE_CACHE_MAX) {
+		// Too many different nodes... don't try to cache
+		do_not_cache_contents = true;
+		contents.clear();
+		contents.shrink_to_fit();
+		return false;
+	}
+	contents.push_back(c);
+	return true;
+}
+
+void MapBlock::updateContentCache()
+{
+	clearContentCache();
+
+	if (!m_data) {
+		// the palette lists every node there is (and maybe some more)
+		for (const MapNode &n : m_palette) {
+			if (!addToContentCache(n.getContent()))
+				return;
+		}
+		return;
+	}
+
+	content_t previous_c = m_data[0].getContent();
+	if (!addToContentCache(previous_c))
+		return;
+	for (u32 i = 1; i < nodecount; i++) {
+		const content_t c = m_data[i].getContent();
+		// runs of the same content are common
+		if (c == previous_c)
+			continue;
+		if (!addToContentCache(c))
+			return;
+		previous_c = c;
+	}
+}
+
+size_t MapBlock::getNodeDataSize() const
+{
+	size_t ret = m_palette.capacity() * sizeof(MapNode);
+	if (m_data)
+		ret += nodecount * sizeof(MapNode);
+	if (m_indices)
+		ret += nodecount;
+	return ret;
+}
+
+void MapBlock::setCompactNodeAt(u32 i, MapNode n)
+{
+	u32 index = 0;
+	while (index < m_palette.size() && !(m_palette[index] == n))
+		index++;
+	if (index == m_palette.size()) {
+		if (index == MAX_PALETTE_SIZE) {
+			expandNodes()[i] = n;
+			return;
+		}
+		m_palette.push_back(n);
+	}
+
+	if (!m_indices) {
+		if (index == 0)
+			return;
+		// zero-initialized, i.e. everything is still m_palette[0]
+		m_indices = std::make_unique<u8[]>(nodecount);
+	}
+	m_indices[i] = index;
+}
+
+MapNode *MapBlock::expandNodes(bool preserve)
+{
+	if (m_data)
+		return m_data.get();
+
+	std::unique_ptr<MapNode[]> nodes(new MapNode[nodecount]);
+	if (preserve)
+		copyNodesTo(nodes.get());
+	m_data = std::move(nodes);
+	m_indices.reset();
+	m_palette.clear();
+	m_palette.shrink_to_fit();
+	return m_data.get();
 }
 
 static inline size_t get_max_objects_per_block()
@@ -165,8 +336,17 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
 	// Copy from data to VoxelManipulator
-	dst.copyFrom(data, data_area, v3s16(0,0,0),
-			getPosRelative(), data_size);
+	if (m_data) {
+		dst.copyFrom(m_data.get(), data_area, v3s16(0,0,0),
+				getPosRelative(), data_size);
+	} else {
+		thread_local std::unique_ptr<MapNode[]> tmp_nodes;
+		if (!tmp_nodes)
+			tmp_nodes.reset(new MapNode[nodecount]);
+		copyNodesTo(tmp_nodes.get());
+		dst.copyFrom(tmp_nodes.get(), data_area, v3s16(0,0,0),
+				getPosRelative(), data_size);
+	}
 }
 
 void MapBlock::copyFrom(const VoxelManipulator &src)
@@ -175,8 +355,9 @@ void MapBlock::copyFrom(const VoxelManipulator &src)
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
 	// Copy from VoxelManipulator to data
-	src.copyTo(data, data_area, v3s16(0,0,0),
+	src.copyTo(expandNodes(false), data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	updateContentCache();
 }
 
 void MapBlock::actuallyUpdateIsAir()
@@ -185,11 +366,14 @@ void MapBlock::actuallyUpdateIsAir()
 	m_is_air_expired = false;
 
 	bool only_air = true;
-	for (u32 i = 0; i < nodecount; i++) {
-		MapNode &n = data[i];
-		if (n.getContent() != CONTENT_AIR) {
-			only_air = false;
-			break;
+	if (!m_data && !m_indices) {
+		only_air = m_palette[0].getContent() == CONTENT_AIR;
+	} else {
+		for (u32 i = 0; i < nodecount; i++) {
+			if (getNodeAt(i).getContent() != CONTENT_AIR) {
+				only_air = false;
+				break;
+			}
 		}
 	}
 
@@ -247,10 +431,10 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 }
 
 // Correct ids in the block to match nodedef based on names.
-// Unknown ones are added to nodedef.
+// Unknown ones are added to nodedef, or recorded in `unknown` if given.
 // Will not update itself to match id-name pairs in nodedef.
 static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-		IGameDef *gamedef)
+		IGameDef *gamedef, MapBlock::UnknownNodes *unknown)
 {
 	const NodeDefManager *nodedef = gamedef->ndef();
 	// This means the block contains incorrect ids, and we contain
@@ -284,6 +468,16 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 
 		content_t global_id;
 		if (!nodedef->getId(name, global_id)) {
+			if (unknown) {
+				// resolved later by resolveUnknownNodes()
+				auto it = std::find(unknown->names.begin(), unknown->names.end(), name);
+				if (it == unknown->names.end())
+					it = unknown->names.insert(it, name);
+				unknown->nodes.emplace_back(i, it - unknown->names.begin());
+				nodes[i].setContent(CONTENT_UNKNOWN);
+				previous_exists = false;
+				continue;
+			}
 			global_id = gamedef->allocateUnknownNodeId(name);
 			if (global_id == CONTENT_IGNORE) {
 				unallocatable_contents.insert(name);
@@ -312,12 +506,28 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 }
 
 void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int compression_level)
+{
+	serialize_(os_compressed, version, disk, compression_level, true);
+}
+
+void MapBlock::serializeUncompressed(std::ostream &os, u8 version, bool disk)
+{
+	if (version < 29)
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	serialize_(os, version, disk, 0, false);
+}
+
+void MapBlock::serialize_(std::ostream &os_compressed, u8 version, bool disk,
+		int compression_level, bool compress_whole)
 {
 	if (!ser_ver_supported_write(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
+	// Since version 29 everything is written to os_raw, then compressed at once
+	compress_whole = compress_whole && version >= 29;
 	std::ostringstream os_raw(std::ios_base::binary);
-	std::ostream &os = version >= 29 ? os_raw : os_compressed;
+	std::ostream &os = compress_whole ? os_raw : os_compressed;
 
 	// First byte
 	u8 flags = 0;
@@ -347,7 +557,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 	if(disk)
 	{
 		MapNode *tmp_nodes = new MapNode[nodecount];
-		memcpy(tmp_nodes, data, nodecount * sizeof(MapNode));
+		copyNodesTo(tmp_nodes);
 		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
 
 		buf = MapNode::serializeBulk(version, tmp_nodes, nodecount,
@@ -361,9 +571,16 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			nimap.serialize(os);
 		}
 	}
+	else if (m_data)
+	{
+		buf = MapNode::serializeBulk(version, m_data.get(), nodecount,
+				content_width, params_width);
+	}
 	else
 	{
-		buf = MapNode::serializeBulk(version, data, nodecount,
+		std::unique_ptr<MapNode[]> tmp_nodes(new MapNode[nodecount]);
+		copyNodesTo(tmp_nodes.get());
+		buf = MapNode::serializeBulk(version, tmp_nodes.get(), nodecount,
 				content_width, params_width);
 	}
 
@@ -414,7 +631,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 		}
 	}
 
-	if (version >= 29) {
+	if (compress_whole) {
 		// now compress the whole thing
 		compress(os_raw.str(), os_compressed, version, compression_level);
 	}
@@ -425,7 +642,8 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
+void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk,
+		UnknownNodes *unknown)
 {
 	if (!ser_ver_supported_read(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -433,13 +651,20 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()<<std::endl);
 
 	m_is_air_expired = true;
+	m_change_stamp = newChangeStamp();
+	// in case of an exception the cache must not be left over
+	clearContentCache();
 
 	if(version <= 21)
 	{
-		deSerialize_pre22(in_compressed, version, disk);
+		deSerialize_pre22(in_compressed, version, disk, unknown);
+		updateContentCache();
 		return;
 	}
 
+	// all nodes are overwritten
+	MapNode *nodes = expandNodes(false);
+
 	// Decompress the whole block (version >= 29)
 	std::stringstream in_raw(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
 	if (version >= 29)
@@ -484,12 +709,12 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		Bulk node data
 	*/
 	if (version >= 29) {
-		MapNode::deSerializeBulk(is, version, data, nodecount,
+		MapNode::deSerializeBulk(is, version, nodes, nodecount,
 			content_width, params_width);
 	} else {
 		// use in_raw from above to avoid allocating another stream object
 		decompress(is, in_raw, version);
-		MapNode::deSerializeBulk(in_raw, version, data, nodecount,
+		MapNode::deSerializeBulk(in_raw, version, nodes, nodecount,
 			content_width, params_width);
 	}
 
@@ -553,7 +778,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		}
 
 		// Dynamically re-set ids based on node names
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		correctBlockNodeIds(&nimap, nodes, m_gamedef, unknown);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
@@ -566,10 +791,36 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 		m_is_air_expired = false;
 	}
 
+	updateContentCache();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<getPos()
 			<<": Done."<<std::endl);
 }
 
+void MapBlock::resolveUnknownNodes(const UnknownNodes &unknown)
+{
+	if (unknown.empty())
+		return;
+
+	std::vector<content_t> ids;
+	ids.reserve(unknown.names.size());
+	for (const std::string &name : unknown.names) {
+		content_t id = m_gamedef->allocateUnknownNodeId(name);
+		if (id == CONTENT_IGNORE) {
+			errorstream << "MapBlock::resolveUnknownNodes(): IGNORING ERROR: "
+					<< "Could not allocate global id for node name \""
+					<< name << "\"" << std::endl;
+			id = CONTENT_UNKNOWN;
+		}
+		ids.push_back(id);
+	}
+
+	MapNode *nodes = expandNodes();
+	for (auto [i, name_index] : unknown.nodes)
+		nodes[i].setContent(ids[name_index]);
+	updateContentCache();
+}
+
 void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 {
 	try {
@@ -608,7 +859,8 @@ u32 MapBlock::clearObjects()
 	Legacy serialization
 */
 
-void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
+void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk,
+		UnknownNodes *unknown)
 {
 	// Initialize default flags
 	is_underground = false;
@@ -616,6 +868,8 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 	m_lighting_complete = 0xFFFF;
 	m_generated = true;
 
+	MapNode *nodes = expandNodes(false);
+
 	// Make a temporary buffer
 	u32 ser_length = MapNode::serializedLength(version);
 	Buffer<u8> databuf_nodelist(nodecount * ser_length);
@@ -726,7 +980,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 
 	// Deserialize node data
 	for (u32 i = 0; i < nodecount; i++) {
-		data[i].deSerialize(&databuf_nodelist[i * ser_length], version);
+		nodes[i].deSerialize(&databuf_nodelist[i * ser_length], version);
 	}
 
 	if (disk) {
@@ -770,36 +1024,36 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 			m_is_air = false;
 			m_is_air_expired = true;
 		}
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		correctBlockNodeIds(&nimap, nodes, m_gamedef, unknown);
 	}
 
 	// Legacy data changes
 	// This code has to convert from pre-22 to post-22 format.
 	const NodeDefManager *nodedef = m_gamedef->ndef();
 	for (u32 i = 0; i < nodecount; i++) {
-		const ContentFeatures &f = nodedef->get(data[i].getContent());
+		const ContentFeatures &f = nodedef->get(nodes[i].getContent());
 		// Mineral
-		if(nodedef->getId("default:stone") == data[i].getContent()
-				&& data[i].getParam1() == 1)
+		if(nodedef->getId("default:stone") == nodes[i].getContent()
+				&& nodes[i].getParam1() == 1)
 		{
-			data[i].setContent(nodedef->getId("default:stone_with_coal"));
-			data[i].setParam1(0);
+			nodes[i].setContent(nodedef->getId("default:stone_with_coal"));
+			nodes[i].setParam1(0);
 		}
-		else if(nodedef->getId("default:stone") == data[i].getContent()
-				&& data[i].getParam1() == 2)
+		else if(nodedef->getId("default:stone") == nodes[i].getContent()
+				&& nodes[i].getParam1() == 2)
 		{
-			data[i].setContent(nodedef->getId("default:stone_with_iron"));
-			data[i].setParam1(0);
+			nodes[i].setContent(nodedef->getId("default:stone_with_iron"));
+			nodes[i].setParam1(0);
 		}
 		// facedir_simple
 		if (f.legacy_facedir_simple) {
-			data[i].setParam2(data[i].getParam1());
-			data[i].setParam1(0);
+			nodes[i].setParam2(nodes[i].getParam1());
+			nodes[i].setParam1(0);
 		}
 		// wall_mounted
 		if (f.legacy_wallmounted) {
 			u8 wallmounted_new_to_old[8] = {0x04, 0x08, 0x01, 0x02, 0x10, 0x20, 0, 0};
-			u8 dir_old_format = data[i].getParam2();
+			u8 dir_old_format = nodes[i].getParam2();
 			u8 dir_new_format = 0;
 			for (u8 j = 0; j < 8; j++) {
 				if ((dir_old_format & wallmounted_new_to_old[j]) != 0) {
@@ -807,7 +1061,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 					break;
 				}
 			}
-			data[i].setParam2(dir_new_format);
+			nodes[i].setParam2(dir_new_format);
 		}
 	}
 }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -50,6 +51,14 @@ enum ModReason : u32 {
 	MOD_REASON_UNKNOWN                    = 1 << 18,
 };
 
+// Reasons that only concern data which is never sent to clients
+constexpr u32 MOD_REASONS_NOT_SENT = MOD_REASON_SET_TIMESTAMP |
+	MOD_REASON_CLEAR_ALL_OBJECTS | MOD_REASON_BLOCK_EXPIRED |
+	MOD_REASON_ADD_ACTIVE_OBJECT_RAW | MOD_REASON_REMOVE_OBJECTS_REMOVE |
+	MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | MOD_REASON_TOO_MANY_OBJECTS |
+	MOD_REASON_STATIC_DATA_ADDED | MOD_REASON_STATIC_DATA_REMOVED |
+	MOD_REASON_STATIC_DATA_CHANGED;
+
 ////
 //// MapBlock itself
 ////
@@ -73,18 +82,36 @@ class MapBlock
 		m_orphan = true;
 	}
 
-	void reallocate()
+	void reallocate();
+
+	// Returns the node data as a plain array of `nodecount` nodes.
+	// This expands compact storage, so it modifies the block even though the
+	// nodes are not changed. Prefer the node accessors or copyNodesTo().
+	// Only for reading, use getDataForWrite() to modify the nodes.
+	MapNode* getData()
 	{
-		for (u32 i = 0; i < nodecount; i++)
-			data[i] = MapNode(CONTENT_IGNORE);
-		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
+		return expandNodes();
 	}
 
-	MapNode* getData()
+	// Same as getData(), but drops the content cache since the caller
+	// writes to the array.
+	MapNode* getDataForWrite()
 	{
-		return data;
+		clearContentCache();
+		return expandNodes();
 	}
 
+	// Copies all nodes to dst, which must hold `nodecount` nodes
+	void copyNodesTo(MapNode *dst) const;
+
+	// Switches to a compact representation of the node data if possible.
+	// Not safe while other threads might be reading the block's data,
+	// which is why the server calls this but the client does not.
+	void compactNodes();
+
+	// Approximate heap memory used by the node data
+	size_t getNodeDataSize() const;
+
 	////
 	//// Modification tracking methods
 	////
@@ -98,8 +125,16 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents.clear();
+		if (reason & ~MOD_REASONS_NOT_SENT)
+			m_change_stamp++;
+	}
+
+	// Changes whenever the data sent to clients may have changed.
+	// Different MapBlock instances never share a value, so this can be
+	// used to validate cached serializations.
+	inline u64 getChangeStamp() const
+	{
+		return m_change_stamp;
 	}
 
 	inline u32 getModified()
@@ -191,7 +226,7 @@ class MapBlock
 	//// Position stuff
 	////
 
-	inline v3s16 getPos()
+	inline v3s16 getPos() const
 	{
 		return m_pos;
 	}
@@ -236,7 +271,7 @@ class MapBlock
 		if (!*valid_position)
 			return {CONTENT_IGNORE};
 
-		return data[z * zstride + y * ystride + x];
+		return getNodeAt(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNode(v3s16 p, bool *valid_position)
@@ -255,7 +290,7 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		setNodeAt(z * zstride + y * ystride + x, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -270,7 +305,7 @@ class MapBlock
 
 	inline MapNode getNodeNoCheck(s16 x, s16 y, s16 z)
 	{
-		return data[z * zstride + y * ystride + x];
+		return getNodeAt(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNodeNoCheck(v3s16 p)
@@ -280,7 +315,7 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		data[z * zstride + y * ystride + x] = n;
+		setNodeAt(z * zstride + y * ystride + x, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -406,6 +441,22 @@ class MapBlock
 		m_node_timers.clear();
 	}
 
+	// See NodeTimerList::attach()
+	inline void attachNodeTimers(NodeTimerScheduler *scheduler)
+	{
+		m_node_timers.attach(scheduler, m_pos);
+	}
+
+	inline void detachNodeTimers()
+	{
+		m_node_timers.detach();
+	}
+
+	inline bool nodeTimersAttachedTo(const NodeTimerScheduler *scheduler) const
+	{
+		return m_node_timers.isAttachedTo(scheduler);
+	}
+
 	////
 	//// Serialization
 	///
@@ -414,11 +465,29 @@ class MapBlock
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &result, u8 version, bool disk, int compression_level);
-	// If disk == true: In addition to doing other things, will add
-	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
+	// Same as serialize(), but leaves out the final compression step, which
+	// the caller can do later (possibly on another thread) with compress().
+	// Precondition: version >= 29
+	void serializeUncompressed(std::ostream &result, u8 version, bool disk);
+	// Nodes with names that deSerialize() found no definition for
+	struct UnknownNodes {
+		std::vector<std::string> names;
+		// (node index, index into names)
+		std::vector<std::pair<u16, u16>> nodes;
+
+		bool empty() const { return nodes.empty(); }
+	};
 
-	void serializeNetworkSpecific(std::ostream &os);
+	// If disk == true: In addition to doing other things, will add
+	// unknown blocks from id-name mapping to wndef.
+	// If `unknown` is given, no ids are allocated. The unknown nodes are
+	// set to CONTENT_UNKNOWN and recorded there instead.
+	void deSerialize(std::istream &is, u8 version, bool disk,
+			UnknownNodes *unknown = nullptr);
+	// Allocates ids for the nodes recorded by deSerialize()
+	void resolveUnknownNodes(const UnknownNodes &unknown);
+
+	static void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
 
 	bool storeActiveObject(u16 id);
@@ -435,7 +504,36 @@ class MapBlock
 		Private methods
 	*/
 
-	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
+	void serialize_(std::ostream &result, u8 version, bool disk,
+			int compression_level, bool compress_whole);
+	void deSerialize_pre22(std::istream &is, u8 version, bool disk,
+			UnknownNodes *unknown);
+
+	static u64 newChangeStamp();
+
+	inline MapNode getNodeAt(u32 i) const
+	{
+		if (m_data)
+			return m_data[i];
+		return m_palette[m_indices ? m_indices[i] : 0];
+	}
+
+	inline void setNodeAt(u32 i, MapNode n)
+	{
+		if (m_data)
+			m_data[i] = n;
+		else
+			setCompactNodeAt(i, n);
+		// the replaced content may still be listed, which does no harm
+		if (!contents.empty())
+			addToContentCache(n.getContent());
+	}
+
+	void setCompactNodeAt(u32 i, MapNode n);
+
+	// Switches to plain storage and returns it.
+	// If preserve is false the contents are left undefined.
+	MapNode *expandNodes(bool preserve = true);
 
 	/*
 	 * PLEASE NOTE: When adding something here be mindful of position and size
@@ -474,11 +572,20 @@ class MapBlock
 	short m_refcount = 0;
 
 	/*
-	 * Note that this is not an inline array because that has implications for
-	 * heap fragmentation (the array is exactly 16K), CPU caches and/or
-	 * optimizability of algorithms working on this array.
+	 * Node data is kept in one of three forms:
+	 * - plain: m_data holds `nodecount` nodes
+	 * - palette: m_indices holds an index into m_palette for every node
+	 * - uniform: every node is m_palette[0], m_indices is null
+	 * The compact forms are created by compactNodes() and turned back into
+	 * a plain array when a write does not fit them anymore.
+	 *
+	 * Note that the plain array is not an inline array because that has
+	 * implications for heap fragmentation (the array is exactly 16K), CPU
+	 * caches and/or optimizability of algorithms working on this array.
 	 */
-	MapNode *const data; // of `nodecount` elements
+	std::unique_ptr<MapNode[]> m_data; // of `nodecount` elements
+	std::unique_ptr<u8[]> m_indices; // of `nodecount` elements
+	std::vector<MapNode> m_palette;
 
 	// provides the item and node definitions
 	IGameDef *m_gamedef;
@@ -490,12 +597,26 @@ class MapBlock
 	float m_usage_timer = 0;
 
 public:
-	//// ABM optimizations ////
+	//// ABM and LBM optimizations ////
+
+	// Adds c to the content cache.
+	// Returns false if the block has too many different contents to be cached.
+	bool addToContentCache(content_t c);
+	// Rebuilds the content cache from the node data
+	void updateContentCache();
+	void clearContentCache()
+	{
+		contents.clear();
+		do_not_cache_contents = false;
+	}
+
 	// True if we never want to cache content types for this block
 	bool do_not_cache_contents = false;
 	// Cache of content types
 	// This is actually a set but for the small sizes we have a vector should be
 	// more efficient.
+	// It is built when the node data is replaced as a whole and extended by
+	// setNode(), so it may also list contents that are no longer there.
 	// Can be empty, in which case nothing was cached yet.
 	std::vector<content_t> contents;
 
@@ -512,6 +633,9 @@ class MapBlock
 	u16 m_modified = MOD_STATE_CLEAN;
 	u32 m_modified_reason = 0;
 
+	// see getChangeStamp()
+	u64 m_change_stamp;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
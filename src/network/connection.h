@@ -68,6 +68,8 @@ class IConnection
 };
 
 // MTP = Minetest Protocol
-IConnection *createMTP(float timeout, bool ipv6, PeerHandler *handler);
+// num_threads: number of send and receive threads the peers are spread over
+IConnection *createMTP(float timeout, bool ipv6, PeerHandler *handler,
+		u32 num_threads = 1);
 
 } // namespace
@@ -53,6 +53,15 @@ u16 BufferedPacket::getSeqnum() const
 	return readU16(&data[BASE_HEADER_SIZE + 1]);
 }
 
+void BufferedPacket::setSeqnum(u16 seqnum)
+{
+	if (size() < BASE_HEADER_SIZE + 3) {
+		assert(false); // should never happen
+		return;
+	}
+	writeU16(&data[BASE_HEADER_SIZE + 1], seqnum);
+}
+
 void BufferedPacket::setSenderPeerId(session_t id)
 {
 	if (size() < BASE_HEADER_SIZE) {
@@ -159,6 +168,63 @@ SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
 	return b;
 }
 
+void makeReliablePackets(const Address &address, const Buffer<u8> &data,
+		bool raw, u32 chunksize_max, u32 protocol_id, session_t sender_peer_id,
+		u8 channel, u16 &split_seqnum, std::vector<BufferedPacketPtr> &packets)
+{
+	const u32 header_size = BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE;
+
+	// Adds a packet with the headers written, returns where its payload starts
+	auto add_packet = [&] (u32 payload_size) -> u8* {
+		auto p = std::make_shared<BufferedPacket>(header_size + payload_size);
+		p->address = address;
+
+		writeU32(&p->data[0], protocol_id);
+		writeU16(&p->data[4], sender_peer_id);
+		writeU8(&p->data[6], channel);
+		writeU8(&p->data[BASE_HEADER_SIZE], PACKET_TYPE_RELIABLE);
+		writeU16(&p->data[BASE_HEADER_SIZE + 1], 0);
+
+		packets.push_back(p);
+		return &p->data[header_size];
+	};
+
+	if (raw) {
+		u8 *payload = add_packet(data.getSize());
+		if (data.getSize() > 0)
+			memcpy(payload, *data, data.getSize());
+		return;
+	}
+
+	// Same as makeOriginalPacket()
+	if (data.getSize() + 1 <= chunksize_max) {
+		u8 *payload = add_packet(1 + data.getSize());
+		writeU8(&payload[0], PACKET_TYPE_ORIGINAL);
+		if (data.getSize() > 0)
+			memcpy(&payload[1], *data, data.getSize());
+		return;
+	}
+
+	// Same as makeSplitPacket()
+	const u32 chunk_header_size = 7;
+	const u32 maximum_data_size = chunksize_max - chunk_header_size;
+	const u32 chunk_count = (data.getSize() + maximum_data_size - 1) / maximum_data_size;
+	sanity_check(chunk_count <= 0xFFFF); // overflow
+
+	for (u32 chunk_num = 0; chunk_num < chunk_count; chunk_num++) {
+		const u32 start = chunk_num * maximum_data_size;
+		const u32 size = std::min(maximum_data_size, data.getSize() - start);
+
+		u8 *payload = add_packet(chunk_header_size + size);
+		writeU8(&payload[0], PACKET_TYPE_SPLIT);
+		writeU16(&payload[1], split_seqnum);
+		writeU16(&payload[3], chunk_count);
+		writeU16(&payload[5], chunk_num);
+		memcpy(&payload[chunk_header_size], &data[start], size);
+	}
+	split_seqnum++;
+}
+
 /*
 	ReliablePacketBuffer
 */
@@ -168,7 +234,10 @@ void ReliablePacketBuffer::print()
 	MutexAutoLock listlock(m_list_mutex);
 	LOG(dout_con<<"Dump of ReliablePacketBuffer:" << std::endl);
 	unsigned int index = 0;
-	for (BufferedPacketPtr &packet : m_list) {
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		const BufferedPacketPtr &packet = m_buf.at(i);
+		if (!packet)
+			continue;
 		LOG(dout_con<<index<< ":" << packet->getSeqnum() << std::endl);
 		index++;
 	}
@@ -177,69 +246,43 @@ void ReliablePacketBuffer::print()
 bool ReliablePacketBuffer::empty()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.empty();
+	return m_buf.empty();
 }
 
 u32 ReliablePacketBuffer::size()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	return m_list.size();
-}
-
-ReliablePacketBuffer::FindResult ReliablePacketBuffer::findPacketNoLock(u16 seqnum)
-{
-	for (auto it = m_list.begin(); it != m_list.end(); ++it) {
-		if ((*it)->getSeqnum() == seqnum)
-			return it;
-	}
-	return m_list.end();
+	return m_buf.size();
 }
 
 bool ReliablePacketBuffer::getFirstSeqnum(u16& result)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_buf.empty())
 		return false;
-	result = m_list.front()->getSeqnum();
+	result = m_buf.first();
 	return true;
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popFirst()
 {
 	MutexAutoLock listlock(m_list_mutex);
-	if (m_list.empty())
+	if (m_buf.empty())
 		throw NotFoundException("Buffer is empty");
 
-	BufferedPacketPtr p(m_list.front());
-	m_list.pop_front();
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return m_buf.take(m_buf.first());
 }
 
 BufferedPacketPtr ReliablePacketBuffer::popSeqnum(u16 seqnum)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	auto r = findPacketNoLock(seqnum);
-	if (r == m_list.end()) {
+	if (!m_buf.find(seqnum)) {
 		LOG(dout_con<<"Sequence number: " << seqnum
 				<< " not found in reliable buffer"<<std::endl);
 		throw NotFoundException("seqnum not found in buffer");
 	}
 
-	BufferedPacketPtr p(*r);
-	m_list.erase(r);
-
-	if (m_list.empty()) {
-		m_oldest_non_answered_ack = 0;
-	} else {
-		m_oldest_non_answered_ack = m_list.front()->getSeqnum();
-	}
-	return p;
+	return m_buf.take(seqnum);
 }
 
 void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
@@ -271,94 +314,58 @@ void ReliablePacketBuffer::insert(BufferedPacketPtr &p_ptr, u16 next_expected)
 		return;
 	}
 
-	sanity_check(m_list.size() <= SEQNUM_MAX); // FIXME: Handle the error?
-
-	// Find the right place for the packet and insert it there
-	// If list is empty, just add it
-	if (m_list.empty()) {
-		m_list.push_back(p_ptr);
-		m_oldest_non_answered_ack = seqnum;
-		// Done.
+	BufferedPacketPtr to_insert = p_ptr;
+	// can't fail, the window is not larger than the buffer's maximum span
+	const BufferedPacketPtr &i = *m_buf.insert(seqnum, std::move(to_insert),
+		next_expected);
+	if (i == p_ptr)
 		return;
-	}
 
-	// Otherwise find the right place
-	auto it = m_list.begin();
-	// Find the first packet in the list which has a higher seqnum
-	u16 s = (*it)->getSeqnum();
-
-	/* case seqnum is smaller then next_expected seqnum */
-	/* this is true e.g. on wrap around */
-	if (seqnum < next_expected) {
-		while(((s < seqnum) || (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-	/* non wrap around case (at least for incoming and next_expected */
-	else
+	/* nothing to do this seems to be a resent packet */
+	/* for paranoia reason data should be compared */
+	if (
+		(i->getSeqnum() != seqnum) ||
+		(i->size() != p.size()) ||
+		(i->address != p.address)
+		)
 	{
-		while(((s < seqnum) && (s >= next_expected)) && (it != m_list.end())) {
-			++it;
-			if (it != m_list.end())
-				s = (*it)->getSeqnum();
-		}
-	}
-
-	if (s == seqnum) {
-		/* nothing to do this seems to be a resent packet */
-		/* for paranoia reason data should be compared */
-		auto &i = *it;
-		if (
-			(i->getSeqnum() != seqnum) ||
-			(i->size() != p.size()) ||
-			(i->address != p.address)
-			)
-		{
-			/* if this happens your maximum transfer window may be to big */
-			char buf[200];
-			snprintf(buf, sizeof(buf),
-					"Duplicated seqnum %d non matching packet detected:\n",
-					seqnum);
-			warningstream << buf;
-			snprintf(buf, sizeof(buf),
-					"Old: seqnum: %05d size: %04zu, address: %s\n",
-					i->getSeqnum(), i->size(),
-					i->address.serializeString().c_str());
-			warningstream << buf;
-			snprintf(buf, sizeof(buf),
-					"New: seqnum: %05d size: %04zu, address: %s\n",
-					p.getSeqnum(), p.size(),
-					p.address.serializeString().c_str());
-			warningstream << buf << std::flush;
-			throw IncomingDataCorruption("duplicated packet isn't same as original one");
-		}
-	}
-	/* insert or push back */
-	else if (it != m_list.end()) {
-		m_list.insert(it, p_ptr);
-	} else {
-		m_list.push_back(p_ptr);
+		/* if this happens your maximum transfer window may be to big */
+		char buf[200];
+		snprintf(buf, sizeof(buf),
+				"Duplicated seqnum %d non matching packet detected:\n",
+				seqnum);
+		warningstream << buf;
+		snprintf(buf, sizeof(buf),
+				"Old: seqnum: %05d size: %04zu, address: %s\n",
+				i->getSeqnum(), i->size(),
+				i->address.serializeString().c_str());
+		warningstream << buf;
+		snprintf(buf, sizeof(buf),
+				"New: seqnum: %05d size: %04zu, address: %s\n",
+				p.getSeqnum(), p.size(),
+				p.address.serializeString().c_str());
+		warningstream << buf << std::flush;
+		throw IncomingDataCorruption("duplicated packet isn't same as original one");
 	}
-
-	/* update last packet number */
-	m_oldest_non_answered_ack = m_list.front()->getSeqnum();
 }
 
 void ReliablePacketBuffer::fixPeerId(session_t new_id)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list)
-		packet->setSenderPeerId(new_id);
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		if (BufferedPacketPtr &packet = m_buf.at(i))
+			packet->setSenderPeerId(new_id);
+	}
 }
 
 void ReliablePacketBuffer::incrementTimeouts(float dtime)
 {
 	MutexAutoLock listlock(m_list_mutex);
-	for (auto &packet : m_list) {
-		packet->time += dtime;
-		packet->totaltime += dtime;
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		if (BufferedPacketPtr &packet = m_buf.at(i)) {
+			packet->time += dtime;
+			packet->totaltime += dtime;
+		}
 	}
 }
 
@@ -366,8 +373,9 @@ u32 ReliablePacketBuffer::getTimedOuts(float timeout)
 {
 	MutexAutoLock listlock(m_list_mutex);
 	u32 count = 0;
-	for (auto &packet : m_list) {
-		if (packet->totaltime >= timeout)
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		const BufferedPacketPtr &packet = m_buf.at(i);
+		if (packet && packet->totaltime >= timeout)
 			count++;
 	}
 	return count;
@@ -378,7 +386,11 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 {
 	MutexAutoLock listlock(m_list_mutex);
 	std::vector<ConstSharedPtr<BufferedPacket>> timed_outs;
-	for (auto &packet : m_list) {
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		BufferedPacketPtr &packet = m_buf.at(i);
+		if (!packet)
+			continue;
+
 		// resend time scales exponentially with each cycle
 		const float pkt_timeout = timeout * powf(RESEND_SCALE_BASE, packet->resend_count);
 
@@ -401,18 +413,18 @@ std::vector<ConstSharedPtr<BufferedPacket>>
 	IncomingSplitPacket
 */
 
-bool IncomingSplitPacket::insert(u32 chunk_num, SharedBuffer<u8> &chunkdata)
+bool IncomingSplitPacket::insert(u32 chunk_num, const BufferedPacketPtr &p)
 {
 	sanity_check(chunk_num < chunk_count);
 
 	// If chunk already exists, ignore it.
 	// Sometimes two identical packets may arrive when there is network
 	// lag and the server re-sends stuff.
-	if (chunks.find(chunk_num) != chunks.end())
+	if (chunks[chunk_num])
 		return false;
 
-	// Set chunk data in buffer
-	chunks[chunk_num] = chunkdata;
+	chunks[chunk_num] = p;
+	received++;
 
 	return true;
 }
@@ -424,16 +436,16 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 	// Calculate total size
 	u32 totalsize = 0;
 	for (const auto &chunk : chunks)
-		totalsize += chunk.second.getSize();
+		totalsize += chunk->size() - HEADER_SIZE;
 
 	SharedBuffer<u8> fulldata(totalsize);
 
 	// Copy chunks to data buffer
 	u32 start = 0;
-	for (u32 chunk_i = 0; chunk_i < chunk_count; chunk_i++) {
-		const SharedBuffer<u8> &buf = chunks[chunk_i];
-		memcpy(&fulldata[start], *buf, buf.getSize());
-		start += buf.getSize();
+	for (const auto &chunk : chunks) {
+		const u32 size = chunk->size() - HEADER_SIZE;
+		memcpy(&fulldata[start], &chunk->data[HEADER_SIZE], size);
+		start += size;
 	}
 
 	return fulldata;
@@ -443,21 +455,12 @@ SharedBuffer<u8> IncomingSplitPacket::reassemble()
 	IncomingSplitBuffer
 */
 
-IncomingSplitBuffer::~IncomingSplitBuffer()
-{
-	MutexAutoLock listlock(m_map_mutex);
-	for (auto &i : m_buf) {
-		delete i.second;
-	}
-}
-
 SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reliable)
 {
 	MutexAutoLock listlock(m_map_mutex);
 	const BufferedPacket &p = *p_ptr;
 
-	u32 headersize = BASE_HEADER_SIZE + 7;
-	if (p.size() < headersize) {
+	if (p.size() < IncomingSplitPacket::HEADER_SIZE) {
 		errorstream << "Invalid data size for split packet" << std::endl;
 		return SharedBuffer<u8>();
 	}
@@ -477,14 +480,20 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 		return SharedBuffer<u8>();
 	}
 
-	// Add if doesn't exist
-	IncomingSplitPacket *sp;
-	if (m_buf.find(seqnum) == m_buf.end()) {
-		sp = new IncomingSplitPacket(chunk_count, reliable);
-		m_buf[seqnum] = sp;
-	} else {
-		sp = m_buf[seqnum];
+	// Add if doesn't exist. Split seqnums are only compared with each other,
+	// so order them by whether they are before or after the first one.
+	std::unique_ptr<IncomingSplitPacket> *found = m_buf.find(seqnum);
+	if (!found) {
+		found = m_buf.insert(seqnum,
+			std::make_unique<IncomingSplitPacket>(chunk_count, reliable),
+			seqnum - SEQNUM_MAX / 2);
 	}
+	if (!found) {
+		errorstream << "IncomingSplitBuffer::insert(): seqnum=" << seqnum
+				<< " is too far from the pending split packets" << std::endl;
+		return SharedBuffer<u8>();
+	}
+	std::unique_ptr<IncomingSplitPacket> &sp = *found;
 
 	if (chunk_count != sp->chunk_count) {
 		errorstream << "IncomingSplitBuffer::insert(): chunk_count="
@@ -497,12 +506,7 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 				<<" != sp->reliable="<<sp->reliable
 				<<std::endl);
 
-	// Cut chunk data out of packet
-	u32 chunkdatasize = p.size() - headersize;
-	SharedBuffer<u8> chunkdata(chunkdatasize);
-	memcpy(*chunkdata, &(p.data[headersize]), chunkdatasize);
-
-	if (!sp->insert(chunk_num, chunkdata))
+	if (!sp->insert(chunk_num, p_ptr))
 		return SharedBuffer<u8>();
 
 	// If not all chunks are received, return empty buffer
@@ -512,8 +516,7 @@ SharedBuffer<u8> IncomingSplitBuffer::insert(BufferedPacketPtr &p_ptr, bool reli
 	SharedBuffer<u8> fulldata = sp->reassemble();
 
 	// Remove sp from buffer
-	m_buf.erase(seqnum);
-	delete sp;
+	m_buf.take(seqnum);
 
 	return fulldata;
 }
@@ -522,22 +525,18 @@ void IncomingSplitBuffer::removeUnreliableTimedOuts(float dtime, float timeout)
 {
 	MutexAutoLock listlock(m_map_mutex);
 	std::vector<u16> remove_queue;
-	{
-		for (const auto &i : m_buf) {
-			IncomingSplitPacket *p = i.second;
-			// Reliable ones are not removed by timeout
-			if (p->reliable)
-				continue;
-			p->time += dtime;
-			if (p->time >= timeout)
-				remove_queue.push_back(i.first);
-		}
+	for (u32 i = 0; i < m_buf.span(); i++) {
+		IncomingSplitPacket *p = m_buf.at(i).get();
+		// Reliable ones are not removed by timeout
+		if (!p || p->reliable)
+			continue;
+		p->time += dtime;
+		if (p->time >= timeout)
+			remove_queue.push_back(m_buf.first() + i);
 	}
 	for (u16 j : remove_queue) {
 		LOG(dout_con<<"NOTE: Removing timed out unreliable split packet"<<std::endl);
-		auto it = m_buf.find(j);
-		delete it->second;
-		m_buf.erase(it);
+		m_buf.take(j);
 	}
 }
 
@@ -731,6 +730,13 @@ void Channel::UpdatePacketLossCounter(unsigned int count)
 {
 	MutexAutoLock internal(m_internal_mutex);
 	current_packet_loss += count;
+	m_rtt_control.onLoss(count);
+}
+
+void Channel::UpdateAcked(float rtt)
+{
+	MutexAutoLock internal(m_internal_mutex);
+	m_rtt_control.onAck(rtt);
 }
 
 void Channel::UpdatePacketTooLateCounter()
@@ -744,7 +750,19 @@ void Channel::UpdateTimers(float dtime)
 	bpm_counter += dtime;
 	packet_loss_counter += dtime;
 
-	if (packet_loss_counter > 1.0f) {
+	if (m_congestion_control == CONGESTION_CONTROL_RTT) {
+		const u32 in_flight = outgoing_reliables_sent.size();
+		u16 window_size;
+		{
+			MutexAutoLock internal(m_internal_mutex);
+			window_size = m_rtt_control.update(dtime, m_window_size, in_flight);
+			// only used by the loss based window control
+			current_packet_loss = 0;
+			current_packet_too_late = 0;
+			current_packet_successful = 0;
+		}
+		setWindowSize(window_size);
+	} else if (packet_loss_counter > 1.0f) {
 		packet_loss_counter -= 1.0f;
 
 		unsigned int packet_loss;
@@ -842,6 +860,115 @@ void Channel::UpdateTimers(float dtime)
 }
 
 
+/*
+	RTTWindowControl
+*/
+
+// Shortest interval over which delivery rate and round trip time are measured
+static constexpr float RTT_CONTROL_MIN_INTERVAL = 0.2f;
+// After this time the minimum round trip time is measured anew, in case the
+// route has changed. For this the window is reduced for one interval so that
+// the queue our own packets have built up drains.
+static constexpr float RTT_CONTROL_MIN_RTT_LIFETIME = 10.0f;
+
+void RTTWindowControl::onAck(float rtt)
+{
+	m_acked++;
+	if (rtt < 0)
+		return;
+	m_interval_min_rtt = std::min(m_interval_min_rtt, rtt);
+	m_rtt_sum += rtt;
+	m_rtt_count++;
+}
+
+float RTTWindowControl::getMaxRate() const
+{
+	float ret = 0.0f;
+	for (float rate : m_rates)
+		ret = std::max(ret, rate);
+	return ret;
+}
+
+u16 RTTWindowControl::update(float dtime, u16 window_size, u32 in_flight)
+{
+	m_interval_time += dtime;
+	m_min_rtt_age += dtime;
+	m_max_in_flight = std::max(m_max_in_flight, in_flight);
+
+	const float interval = m_min_rtt == FLT_MAX ? RTT_CONTROL_MIN_INTERVAL :
+		std::max(RTT_CONTROL_MIN_INTERVAL, 2 * m_min_rtt);
+	if (m_interval_time < interval)
+		return window_size;
+
+	float target = window_size;
+
+	// nothing to learn from an idle interval
+	if (m_rtt_count > 0) {
+		if (m_interval_min_rtt < m_min_rtt || m_probe_rtt) {
+			m_min_rtt = m_interval_min_rtt;
+			m_min_rtt_age = 0.0f;
+		}
+		if (m_probe_rtt)
+			m_probe_rtt = false;
+		else if (m_min_rtt_age > RTT_CONTROL_MIN_RTT_LIFETIME)
+			m_probe_rtt = true;
+
+		// If the window was not used the rate says little about the link,
+		// unless it is higher than anything seen before.
+		const float rate = m_acked / m_interval_time;
+		const bool app_limited = m_max_in_flight < window_size / 2U;
+		if (!app_limited || rate > getMaxRate()) {
+			m_rates[m_rate_index] = rate;
+			m_rate_index = (m_rate_index + 1) % RATE_HISTORY;
+		}
+
+		const float avg_rtt = m_rtt_sum / m_rtt_count;
+		// some slack for timer and scheduling jitter
+		const bool queuing = avg_rtt > m_min_rtt * 1.25f + 0.01f;
+		const float loss_ratio = (float)m_lost / (m_acked + m_lost);
+		const float bdp = getMaxRate() * m_min_rtt;
+
+		if (m_startup) {
+			if (queuing || loss_ratio > 0.05f) {
+				m_startup = false;
+			} else if (!app_limited) {
+				// double until the delivery rate stops growing
+				if (rate < m_startup_rate * 1.25f) {
+					if (++m_startup_rounds >= 3)
+						m_startup = false;
+				} else {
+					m_startup_rate = rate;
+					m_startup_rounds = 0;
+				}
+				target = window_size * 2.0f;
+			}
+		}
+
+		if (!m_startup) {
+			// twice the bandwidth-delay product leaves room to find out
+			// whether more bandwidth is available
+			target = queuing ? bdp * 1.25f : bdp * 2.0f;
+			if (loss_ratio > 0.1f)
+				target = std::min(target, window_size * 0.75f);
+			else if (app_limited && !queuing)
+				target = std::max(target, (float)window_size);
+		}
+
+		if (m_probe_rtt)
+			target = std::min(target, bdp * 0.5f);
+	}
+
+	m_interval_time = 0.0f;
+	m_acked = 0;
+	m_lost = 0;
+	m_max_in_flight = 0;
+	m_interval_min_rtt = FLT_MAX;
+	m_rtt_sum = 0.0f;
+	m_rtt_count = 0;
+
+	return rangelim(target, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE_SEND);
+}
+
 /*
 	Peer
 */
@@ -979,8 +1106,11 @@ void Peer::Drop()
 UDPPeer::UDPPeer(session_t id, const Address &address, Connection *connection) :
 	Peer(id, address, connection)
 {
-	for (Channel &channel : channels)
+	for (Channel &channel : channels) {
 		channel.setWindowSize(START_RELIABLE_WINDOW_SIZE);
+		if (connection)
+			channel.setCongestionControl(connection->getCongestionControl());
+	}
 }
 
 bool UDPPeer::isTimedOut(float timeout, std::string &reason)
@@ -1085,24 +1215,22 @@ bool UDPPeer::processReliableSendCommand(
 							- BASE_HEADER_SIZE
 							- RELIABLE_HEADER_SIZE;
 
-	std::list<SharedBuffer<u8>> originals;
-
-	if (c.raw) {
-		originals.emplace_back(c.data);
-	} else {
-		u16 split_seqnum = chan.readNextSplitSeqNum();
-		makeAutoSplitPacket(c.data, chunksize_max, split_seqnum, &originals);
+	std::vector<BufferedPacketPtr> packets;
+	u16 split_seqnum = chan.readNextSplitSeqNum();
+	makeReliablePackets(address, c.data, c.raw, chunksize_max,
+			m_connection->GetProtocolID(), m_connection->GetPeerID(),
+			c.channelnum, split_seqnum, packets);
+	if (!c.raw)
 		chan.setNextSplitSeqNum(split_seqnum);
-	}
 
-	sanity_check(originals.size() < MAX_RELIABLE_WINDOW_SIZE);
+	sanity_check(packets.size() < MAX_RELIABLE_WINDOW_SIZE);
 
 	bool have_sequence_number = false;
 	bool have_initial_sequence_number = false;
 	std::queue<BufferedPacketPtr> toadd;
 	u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (BufferedPacketPtr &p : packets) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1115,13 +1243,7 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
-
-		// Add base headers and make a packet
-		BufferedPacketPtr p = con::makePacket(address, reliable,
-				m_connection->GetProtocolID(), m_connection->GetPeerID(),
-				c.channelnum);
-
+		p->setSeqnum(seqnum);
 		toadd.push(p);
 	}
 
@@ -1287,11 +1409,9 @@ ConnectionEventPtr ConnectionEvent::bindFailed()
 */
 
 Connection::Connection(u32 max_packet_size, float timeout,
-		bool ipv6, PeerHandler *peerhandler) :
+		bool ipv6, PeerHandler *peerhandler, u32 num_threads) :
 	m_udpSocket(ipv6),
 	m_protocol_id(PROTOCOL_ID),
-	m_sendThread(new ConnectionSendThread(max_packet_size, timeout)),
-	m_receiveThread(new ConnectionReceiveThread()),
 	m_bc_peerhandler(peerhandler)
 
 {
@@ -1299,11 +1419,25 @@ Connection::Connection(u32 max_packet_size, float timeout,
 	 * from the connection timeout */
 	m_udpSocket.setTimeoutMs(500);
 
-	m_sendThread->setParent(this);
-	m_receiveThread->setParent(this);
+	if (g_settings->get("network_congestion_control") == "rtt")
+		m_congestion_control = CONGESTION_CONTROL_RTT;
+
+	num_threads = MYMAX(num_threads, 1);
+	for (u32 i = 0; i < num_threads; i++) {
+		m_sendThreads.emplace_back(new ConnectionSendThread(max_packet_size,
+			timeout, i));
+		m_receiveThreads.emplace_back(new ConnectionReceiveThread(i));
+	}
+
+	for (auto &thread : m_sendThreads)
+		thread->setParent(this);
+	for (auto &thread : m_receiveThreads)
+		thread->setParent(this);
 
-	m_sendThread->start();
-	m_receiveThread->start();
+	for (auto &thread : m_sendThreads)
+		thread->start();
+	for (auto &thread : m_receiveThreads)
+		thread->start();
 }
 
 
@@ -1311,17 +1445,22 @@ Connection::~Connection()
 {
 	m_shutting_down = true;
 	// request threads to stop
-	m_sendThread->stop();
-	m_receiveThread->stop();
+	for (auto &thread : m_sendThreads)
+		thread->stop();
+	for (auto &thread : m_receiveThreads)
+		thread->stop();
 
 	//TODO for some unkonwn reason send/receive threads do not exit as they're
 	// supposed to be but wait on peer timeout. To speed up shutdown we reduce
 	// timeout to half a second.
-	m_sendThread->setPeerTimeout(0.5);
+	for (auto &thread : m_sendThreads)
+		thread->setPeerTimeout(0.5);
 
 	// wait for threads to finish
-	m_sendThread->wait();
-	m_receiveThread->wait();
+	for (auto &thread : m_sendThreads)
+		thread->wait();
+	for (auto &thread : m_receiveThreads)
+		thread->wait();
 
 	// Delete peers
 	for (auto &peer : m_peers) {
@@ -1337,9 +1476,9 @@ void Connection::putEvent(ConnectionEventPtr e)
 	m_event_queue.push_back(e);
 }
 
-void Connection::TriggerSend()
+void Connection::TriggerSend(session_t peer_id)
 {
-	m_sendThread->Trigger();
+	getSendThread(peer_id)->Trigger();
 }
 
 PeerHelper Connection::getPeerNoEx(session_t peer_id)
@@ -1373,11 +1512,13 @@ session_t Connection::lookupPeer(const Address& sender)
 	return PEER_ID_INEXISTENT;
 }
 
-u32 Connection::getActiveCount()
+u32 Connection::getActiveCount(u32 thread_index)
 {
 	MutexAutoLock peerlock(m_peers_mutex);
 	u32 count = 0;
 	for (auto &it : m_peers) {
+		if (getThreadIndex(it.first) != thread_index)
+			continue;
 		Peer *peer = it.second;
 		if (peer->isPendingDeletion())
 			continue;
@@ -1423,9 +1564,26 @@ ConnectionEventPtr Connection::waitEvent(u32 timeout_ms)
 
 void Connection::putCommand(ConnectionCommandPtr c)
 {
-	if (!m_shutting_down) {
-		m_command_queue.push_back(c);
-		m_sendThread->Trigger();
+	if (m_shutting_down)
+		return;
+
+	switch (c->type) {
+	case CONNCMD_SERVE:
+		m_sendThreads[0]->putCommand(c);
+		break;
+	case CONNCMD_CONNECT:
+		getSendThread(PEER_ID_SERVER)->putCommand(c);
+		break;
+	case CONNCMD_DISCONNECT:
+	case CONNCMD_PEER_ID_SET:
+	case CONNCMD_SEND_TO_ALL:
+		// every thread takes care of its own peers
+		for (auto &thread : m_sendThreads)
+			thread->putCommand(c);
+		break;
+	default:
+		getSendThread(c->peer_id)->putCommand(c);
+		break;
 	}
 }
 
@@ -1667,7 +1825,6 @@ void Connection::sendAck(session_t peer_id, u8 channelnum, u16 seqnum)
 	writeU16(&ack[2], seqnum);
 
 	putCommand(ConnectionCommand::ack(peer_id, channelnum, ack));
-	m_sendThread->Trigger();
 }
 
 UDPPeer* Connection::createServerPeer(const Address &address)
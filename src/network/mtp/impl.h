@@ -92,6 +92,13 @@ typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
 class Connection;
 class PeerHandler;
 
+enum CongestionControlType : u8 {
+	// Grows or shrinks the window depending on packet loss
+	CONGESTION_CONTROL_LOSS,
+	// Sizes the window from delivery rate and round trip time
+	CONGESTION_CONTROL_RTT,
+};
+
 class Peer : public IPeer {
 	public:
 		friend class PeerHelper;
@@ -226,7 +233,7 @@ class Connection final : public IConnection
 	friend class ConnectionReceiveThread;
 
 	Connection(u32 max_packet_size, float timeout, bool ipv6,
-			PeerHandler *peerhandler);
+			PeerHandler *peerhandler, u32 num_threads = 1);
 	~Connection();
 
 	/* Interface */
@@ -245,6 +252,7 @@ class Connection final : public IConnection
 	float getPeerStat(session_t peer_id, rtt_stat_type type);
 	float getLocalStat(rate_stat_type type);
 	u32 GetProtocolID() const { return m_protocol_id; };
+	CongestionControlType getCongestionControl() const { return m_congestion_control; }
 	const std::string getDesc();
 	void DisconnectPeer(session_t peer_id);
 
@@ -268,15 +276,32 @@ class Connection final : public IConnection
 		return m_peer_ids;
 	}
 
-	u32 getActiveCount();
+	// Number of active peers handled by the given thread
+	u32 getActiveCount(u32 thread_index);
+
+	/*
+		Each peer is handled by exactly one send and one receive thread,
+		so that no two threads work on the state of the same peer.
+	*/
+	u32 getThreadIndex(session_t peer_id) const
+	{
+		return peer_id % m_sendThreads.size();
+	}
+	ConnectionSendThread *getSendThread(session_t peer_id)
+	{
+		return m_sendThreads[getThreadIndex(peer_id)].get();
+	}
+	ConnectionReceiveThread *getReceiveThread(session_t peer_id)
+	{
+		return m_receiveThreads[getThreadIndex(peer_id)].get();
+	}
 
 	UDPSocket m_udpSocket;
-	// Command queue: user -> SendThread
-	MutexedQueue<ConnectionCommandPtr> m_command_queue;
 
 	void putEvent(ConnectionEventPtr e);
 
-	void TriggerSend();
+	// Wakes up the send thread of the peer
+	void TriggerSend(session_t peer_id);
 
 	bool ConnectedToServer()
 	{
@@ -288,13 +313,14 @@ class Connection final : public IConnection
 
 	session_t m_peer_id = 0;
 	u32 m_protocol_id;
+	CongestionControlType m_congestion_control = CONGESTION_CONTROL_LOSS;
 
 	std::map<session_t, Peer *> m_peers;
 	std::vector<session_t> m_peer_ids;
 	std::mutex m_peers_mutex;
 
-	std::unique_ptr<ConnectionSendThread> m_sendThread;
-	std::unique_ptr<ConnectionReceiveThread> m_receiveThread;
+	std::vector<std::unique_ptr<ConnectionSendThread>> m_sendThreads;
+	std::vector<std::unique_ptr<ConnectionReceiveThread>> m_receiveThreads;
 
 	mutable std::mutex m_info_mutex;
 
@@ -178,18 +178,20 @@ class IncomingDataCorruption : public BaseException
 		u8[] packet data (usually copied from SharedBuffer<u8>)
 */
 struct BufferedPacket {
-	BufferedPacket(u32 a_size)
+	// The data is left uninitialized, as it is always written right after
+	BufferedPacket(u32 a_size) :
+		m_data(new u8[a_size]), m_size(a_size)
 	{
-		m_data.resize(a_size);
-		data = &m_data[0];
+		data = m_data.get();
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
+	void setSeqnum(u16 seqnum);
 	void setSenderPeerId(session_t id);
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_size; }
 
 	u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
@@ -199,7 +201,8 @@ struct BufferedPacket {
 	unsigned int resend_count = 0;
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	std::unique_ptr<u8[]> m_data; // Data of the packet, including headers
+	size_t m_size;
 };
 
 
@@ -215,10 +218,22 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 // Add the TYPE_RELIABLE header to the data
 SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
 
+/*
+	Makes TYPE_RELIABLE packets with base headers out of the data, like
+	makeAutoSplitPacket(), makeReliablePacket() and makePacket() together
+	but copying the data only once. The seqnum is left to be filled in with
+	BufferedPacket::setSeqnum().
+	If raw is set the data is not wrapped in TYPE_ORIGINAL or TYPE_SPLIT.
+	Increments split_seqnum if split packets are made.
+*/
+void makeReliablePackets(const Address &address, const Buffer<u8> &data,
+		bool raw, u32 chunksize_max, u32 protocol_id, session_t sender_peer_id,
+		u8 channel, u16 &split_seqnum, std::vector<BufferedPacketPtr> &packets);
+
 struct IncomingSplitPacket
 {
 	IncomingSplitPacket(u32 cc, bool r):
-		chunk_count(cc), reliable(r) {}
+		chunk_count(cc), reliable(r), chunks(cc) {}
 
 	IncomingSplitPacket() = delete;
 
@@ -228,14 +243,144 @@ struct IncomingSplitPacket
 
 	bool allReceived() const
 	{
-		return (chunks.size() == chunk_count);
+		return received == chunk_count;
 	}
-	bool insert(u32 chunk_num, SharedBuffer<u8> &chunkdata);
+	bool insert(u32 chunk_num, const BufferedPacketPtr &p);
 	SharedBuffer<u8> reassemble();
 
+	// Offset of the chunk data in the packets
+	static constexpr u32 HEADER_SIZE = BASE_HEADER_SIZE + 7;
+
 private:
-	// Key is chunk number, value is data without headers
-	std::map<u16, SharedBuffer<u8>> chunks;
+	u32 received = 0;
+	// Index is chunk number, the packets are kept as they were received
+	// so that the chunk data is only copied once
+	std::vector<BufferedPacketPtr> chunks;
+};
+
+/*
+	Stores values indexed by 16-bit sequence number in a ring buffer, which
+	grows to the next power of two when it cannot hold the range of sequence
+	numbers anymore. Lookups by sequence number are O(1), iteration is in
+	sequence number order.
+
+	T must be default constructible and convert to false when empty
+	(e.g. a smart pointer).
+*/
+template <typename T>
+class SeqnumRing
+{
+public:
+	bool empty() const { return m_count == 0; }
+	u32 size() const { return m_count; }
+
+	// Only valid if not empty
+	u16 first() const { return m_first; }
+
+	// Number of sequence numbers between the first and the last value
+	// (inclusive), use with at() to iterate
+	u32 span() const { return m_span; }
+	T &at(u32 offset) { return slot(m_first + offset); }
+
+	// Returns nullptr if there is no value for the sequence number
+	T *find(u16 seqnum)
+	{
+		if ((u16)(seqnum - m_first) >= m_span)
+			return nullptr;
+		T &value = slot(seqnum);
+		return value ? &value : nullptr;
+	}
+
+	/*
+		Values are ordered by their distance from `base`, which must not be
+		after any sequence number in the buffer. Returns the value stored
+		for the sequence number, which is not replaced if it already exists.
+		Returns nullptr if the buffer would span more than MAX_SPAN sequence
+		numbers, beyond which their order is ambiguous.
+	*/
+	T *insert(u16 seqnum, T &&value, u16 base)
+	{
+		if (m_count == 0) {
+			reserve(1);
+			m_first = seqnum;
+			m_span = 1;
+		} else if ((u16)(seqnum - m_first) < m_span) {
+			// already covered
+		} else if ((u16)(seqnum - base) < (u16)(m_first - base)) {
+			const u32 span = m_span + (u16)(m_first - seqnum);
+			if (span > MAX_SPAN)
+				return nullptr;
+			reserve(span);
+			m_first = seqnum;
+			m_span = span;
+		} else {
+			const u32 span = (u16)(seqnum - m_first) + 1;
+			if (span > MAX_SPAN)
+				return nullptr;
+			reserve(span);
+			m_span = span;
+		}
+
+		T &stored = slot(seqnum);
+		if (!stored) {
+			stored = std::move(value);
+			m_count++;
+		}
+		return &stored;
+	}
+
+	// The sequence number must exist in the buffer
+	T take(u16 seqnum)
+	{
+		T value = std::move(slot(seqnum));
+		slot(seqnum) = T();
+		m_count--;
+
+		if (m_count == 0) {
+			m_span = 0;
+			// don't keep a large buffer around after a burst
+			if (m_slots.size() > DEFAULT_CAPACITY)
+				std::vector<T>(DEFAULT_CAPACITY).swap(m_slots);
+		} else if (seqnum == m_first) {
+			while (!slot(m_first)) {
+				m_first++;
+				m_span--;
+			}
+		} else if (seqnum == (u16)(m_first + m_span - 1)) {
+			while (!slot(m_first + m_span - 1))
+				m_span--;
+		}
+		return value;
+	}
+
+	static constexpr u32 MAX_SPAN = 0x8000;
+
+private:
+	static constexpr u32 DEFAULT_CAPACITY = 64;
+
+	T &slot(u16 seqnum) { return m_slots[seqnum & (m_slots.size() - 1)]; }
+
+	void reserve(u32 span)
+	{
+		if (span <= m_slots.size())
+			return;
+
+		u32 capacity = std::max<u32>(m_slots.size(), DEFAULT_CAPACITY);
+		while (capacity < span)
+			capacity *= 2;
+
+		std::vector<T> slots(capacity);
+		for (u32 i = 0; i < m_span; i++) {
+			const u16 seqnum = m_first + i;
+			slots[seqnum & (capacity - 1)] = std::move(slot(seqnum));
+		}
+		m_slots.swap(slots);
+	}
+
+	std::vector<T> m_slots;
+	u16 m_first = 0;
+	u32 m_span = 0;
+	u32 m_count = 0;
 };
 
 /*
@@ -265,13 +410,7 @@ class ReliablePacketBuffer
 
 
 private:
-	typedef std::list<BufferedPacketPtr>::iterator FindResult;
-
-	FindResult findPacketNoLock(u16 seqnum);
-
-	std::list<BufferedPacketPtr> m_list;
-
-	u16 m_oldest_non_answered_ack;
+	SeqnumRing<BufferedPacketPtr> m_buf;
 
 	std::mutex m_list_mutex;
 };
@@ -283,8 +422,6 @@ class ReliablePacketBuffer
 class IncomingSplitBuffer
 {
 public:
-	~IncomingSplitBuffer();
-
 	/*
 		Returns a reference counted buffer of length != 0 when a full split
 		packet is constructed. If not, returns one of length 0.
@@ -295,7 +432,7 @@ class IncomingSplitBuffer
 
 private:
 	// Key is seqnum
-	std::map<u16, IncomingSplitPacket*> m_buf;
+	SeqnumRing<std::unique_ptr<IncomingSplitPacket>> m_buf;
 
 	std::mutex m_map_mutex;
 };
@@ -363,6 +500,54 @@ struct ConnectionCommand
 /* minimum value for window size */
 #define MIN_RELIABLE_WINDOW_SIZE 32
 
+/*
+	Window control in the spirit of BBR: the window is kept at a multiple of
+	the bandwidth-delay product, estimated from the highest recent delivery
+	rate and the lowest recent round trip time. A round trip time well above
+	the minimum means a queue is building up on the path, so the window is
+	reduced until it drains.
+	Not thread-safe.
+*/
+class RTTWindowControl
+{
+public:
+	// rtt is negative if unknown (e.g. for re-sent packets)
+	void onAck(float rtt);
+	void onLoss(u32 count) { m_lost += count; }
+
+	// Returns the new window size, in_flight is the number of unacked packets
+	u16 update(float dtime, u16 window_size, u32 in_flight);
+
+	// in packets per second
+	float getMaxRate() const;
+	float getMinRTT() const { return m_min_rtt; }
+	bool inStartup() const { return m_startup; }
+
+private:
+	static constexpr u32 RATE_HISTORY = 10;
+
+	// current measurement interval
+	float m_interval_time = 0.0f;
+	u32 m_acked = 0;
+	u32 m_lost = 0;
+	u32 m_max_in_flight = 0;
+	float m_interval_min_rtt = FLT_MAX;
+	float m_rtt_sum = 0.0f;
+	u32 m_rtt_count = 0;
+
+	float m_min_rtt = FLT_MAX;
+	float m_min_rtt_age = 0.0f;
+	// the next interval measures the minimum round trip time
+	bool m_probe_rtt = false;
+	// delivery rates of the last intervals
+	float m_rates[RATE_HISTORY] = {};
+	u32 m_rate_index = 0;
+
+	bool m_startup = true;
+	float m_startup_rate = 0.0f;
+	u32 m_startup_rounds = 0;
+};
+
 class Channel
 {
 
@@ -397,6 +582,8 @@ class Channel
 
 	void UpdatePacketLossCounter(unsigned int count);
 	void UpdatePacketTooLateCounter();
+	// Called for every acknowledged reliable packet, rtt < 0 if unknown
+	void UpdateAcked(float rtt);
 	void UpdateBytesSent(unsigned int bytes,unsigned int packages=1);
 	void UpdateBytesLost(unsigned int bytes);
 	void UpdateBytesReceived(unsigned int bytes);
@@ -432,9 +619,14 @@ class Channel
 		m_window_size = (u16)rangelim(size, MIN_RELIABLE_WINDOW_SIZE, MAX_RELIABLE_WINDOW_SIZE_SEND);
 	}
 
+	void setCongestionControl(CongestionControlType type)
+		{ m_congestion_control = type; }
+
 private:
 	std::mutex m_internal_mutex;
 	u16 m_window_size = MIN_RELIABLE_WINDOW_SIZE;
+	CongestionControlType m_congestion_control = CONGESTION_CONTROL_LOSS;
+	RTTWindowControl m_rtt_control;
 
 	u16 next_incoming_seqnum = SEQNUM_INITIAL;
 
@@ -4,6 +4,7 @@
 // Copyright (C) 2017 celeron55, Loic Blot <loic.blot@unix-experience.fr>
 
 #include "network/mtp/threads.h"
+#include <algorithm>
 #include "log.h"
 #include "profiler.h"
 #include "settings.h"
@@ -30,6 +31,10 @@ namespace con
 
 #define MAX_NEW_PEERS_PER_SEC 30
 
+// Number of datagrams handed to the socket at once by the connection threads
+#define SEND_BATCH_SIZE 64
+#define RECEIVE_BATCH_SIZE 32
+
 static inline session_t readPeerId(const u8 *packetdata)
 {
 	return readU16(&packetdata[4]);
@@ -46,8 +51,9 @@ static inline u8 readChannel(const u8 *packetdata)
 #define MPPI_SETTING "max_packets_per_iteration"
 
 ConnectionSendThread::ConnectionSendThread(unsigned int max_packet_size,
-	float timeout) :
+	float timeout, u32 thread_index) :
 	Thread("ConnectionSend"),
+	m_thread_index(thread_index),
 	m_max_packet_size(max_packet_size),
 	m_timeout(timeout),
 	m_max_data_packets_per_iteration(g_settings->getU16(MPPI_SETTING))
@@ -95,7 +101,7 @@ void *ConnectionSendThread::run()
 
 		m_iteration_packets_avaialble = m_max_data_packets_per_iteration;
 		const auto &calculate_quota = [&] () -> u32 {
-			u32 numpeers = m_connection->getActiveCount();
+			u32 numpeers = m_connection->getActiveCount(m_thread_index);
 			if (numpeers > 0)
 				return MYMAX(1, m_iteration_packets_avaialble / numpeers);
 			return m_iteration_packets_avaialble;
@@ -110,19 +116,21 @@ void *ConnectionSendThread::run()
 		}
 
 		/* translate commands to packets */
-		auto c = m_connection->m_command_queue.pop_frontNoEx(0);
+		auto c = m_command_queue.pop_frontNoEx(0);
 		while (c && c->type != CONNCMD_NONE) {
 			if (c->reliable)
 				processReliableCommand(c);
 			else
 				processNonReliableCommand(c);
 
-			c = m_connection->m_command_queue.pop_frontNoEx(0);
+			c = m_command_queue.pop_frontNoEx(0);
 		}
 
 		/* send queued packets */
 		sendPackets(dtime, calculate_quota());
 
+		flushSendBatch();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -135,9 +143,25 @@ void ConnectionSendThread::Trigger()
 	m_send_sleep_semaphore.post();
 }
 
+void ConnectionSendThread::putCommand(const ConnectionCommandPtr &c)
+{
+	m_command_queue.push_back(c);
+	Trigger();
+}
+
+std::vector<session_t> ConnectionSendThread::getPeerIDs()
+{
+	std::vector<session_t> peer_ids = m_connection->getPeerIDs();
+	peer_ids.erase(std::remove_if(peer_ids.begin(), peer_ids.end(),
+		[this] (session_t peer_id) {
+			return m_connection->getThreadIndex(peer_id) != m_thread_index;
+		}), peer_ids.end());
+	return peer_ids;
+}
+
 bool ConnectionSendThread::packetsQueued()
 {
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = getPeerIDs();
 
 	if (!m_outgoing_queue.empty() && !peerIds.empty())
 		return true;
@@ -165,7 +189,7 @@ bool ConnectionSendThread::packetsQueued()
 void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 {
 	std::vector<session_t> timeouted_peers;
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = getPeerIDs();
 
 	for (const session_t peerId : peerIds) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerId);
@@ -239,7 +263,7 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 				m_iteration_packets_avaialble = 0;
 
 			for (const auto &k : timed_outs)
-				resendReliable(channel, k.get(), resend_timeout);
+				resendReliable(channel, k, resend_timeout);
 
 			auto ws_old = channel.getWindowSize();
 			channel.UpdateTimers(dtime);
@@ -269,9 +293,10 @@ void ConnectionSendThread::runTimeouts(float dtime, u32 peer_packet_quota)
 	}
 }
 
-void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout)
+void ConnectionSendThread::resendReliable(Channel &channel,
+	const ConstSharedPtr<BufferedPacket> &k, float resend_timeout)
 {
-	assert(k);
+	assert(k.get());
 	u8 channelnum = readChannel(k->data);
 	u16 seqnum = k->getSeqnum();
 
@@ -296,25 +321,41 @@ void ConnectionSendThread::resendReliable(Channel &channel, const BufferedPacket
 	// lost or really takes more time to transmit
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
+{
+	assert(p.get());
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= SEND_BATCH_SIZE)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
 {
-	assert(p);
+	if (m_send_batch.empty())
+		return;
+
+	m_send_datagrams.clear();
+	for (const auto &p : m_send_batch)
+		m_send_datagrams.push_back({p->address, p->data, (int)p->size()});
+
 	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
+		m_connection->m_udpSocket.SendBatch(m_send_datagrams.data(),
+			m_send_datagrams.size());
 		//LOG(dout_con << m_connection->getDesc()
-		//	<< " rawSend: " << p->size()
-		//	<< " bytes sent" << std::endl);
+		//	<< " flushSendBatch: " << m_send_batch.size()
+		//	<< " packets sent" << std::endl);
 	} catch (SendFailedException &e) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "SendFailedException: " << e.what() << " to "
-			<< p->address.serializeString() << std::endl);
+			<< "SendFailedException: " << e.what() << std::endl);
 	}
+
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
 {
 	try {
-		p->absolute_send_time = porting::getTimeMs();
+		p->absolute_send_time = porting::getTimeUs();
 		// Buffer the packet
 		channel->outgoing_reliables_sent.insert(p,
 			(channel->readOutgoingSequenceNumber() - MAX_RELIABLE_WINDOW_SIZE)
@@ -328,7 +369,7 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
@@ -381,7 +422,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		channelnum);
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 	return true;
 }
 
@@ -428,7 +469,7 @@ void ConnectionSendThread::processReliableCommand(ConnectionCommandPtr &c)
 			auto list = channel.outgoing_reliables_sent.getResend(0, 1);
 
 			if (!list.empty())
-				resendReliable(channel, list.front().get(), -1);
+				resendReliable(channel, list.front(), -1);
 
 			return;
 		}
@@ -555,7 +596,7 @@ void ConnectionSendThread::disconnect()
 
 
 	// Send to all
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		sendAsPacket(peerid, 0, data, false);
@@ -586,7 +627,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 
 void ConnectionSendThread::fix_peer_id(session_t own_peer_id)
 {
-	auto peer_ids = m_connection->getPeerIDs();
+	auto peer_ids = getPeerIDs();
 	for (const session_t peer_id : peer_ids) {
 		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 		if (!peer)
@@ -647,7 +688,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		send(peerid, channelnum, data);
@@ -656,7 +697,7 @@ void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data
 
 void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 {
-	std::vector<session_t> peerids = m_connection->getPeerIDs();
+	std::vector<session_t> peerids = getPeerIDs();
 
 	for (session_t peerid : peerids) {
 		PeerHelper peer = m_connection->getPeerNoEx(peerid);
@@ -670,7 +711,7 @@ void ConnectionSendThread::sendToAllReliable(ConnectionCommandPtr &c)
 
 void ConnectionSendThread::sendPackets(float dtime, u32 peer_packet_quota)
 {
-	std::vector<session_t> peerIds = m_connection->getPeerIDs();
+	std::vector<session_t> peerIds = getPeerIDs();
 	std::vector<session_t> pendingDisconnect;
 	std::map<session_t, bool> pending_unreliable;
 
@@ -824,8 +865,9 @@ void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
 	m_outgoing_queue.push(packet);
 }
 
-ConnectionReceiveThread::ConnectionReceiveThread() :
-	Thread("ConnectionReceive")
+ConnectionReceiveThread::ConnectionReceiveThread(u32 thread_index) :
+	Thread("ConnectionReceive"),
+	m_thread_index(thread_index)
 {
 }
 
@@ -844,7 +886,12 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	Buffer<u8> packetdata(packet_maxsize * RECEIVE_BATCH_SIZE);
+	std::vector<UDPSocket::IncomingDatagram> datagrams(RECEIVE_BATCH_SIZE);
+	for (size_t i = 0; i < datagrams.size(); i++) {
+		datagrams[i].data = &packetdata[i * packet_maxsize];
+		datagrams[i].capacity = packet_maxsize;
+	}
 
 	bool packet_queued = true;
 
@@ -866,7 +913,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(datagrams, packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -926,159 +973,214 @@ void *ConnectionReceiveThread::run()
 }
 
 // Receive packets from the network and buffers and create ConnectionEvents
-void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+void ConnectionReceiveThread::receive(
+		std::vector<UDPSocket::IncomingDatagram> &datagrams, bool &packet_queued)
 {
 	try {
 		// First, see if there any buffered packets we can process now
 		if (packet_queued) {
-			session_t peer_id;
-			SharedBuffer<u8> resultdata;
-			while (true) {
-				try {
-					if (!getFromBuffers(peer_id, resultdata))
-						break;
-
-					m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-				}
-				catch (ProcessedSilentlyException &e) {
-					/* try reading again */
-				}
-			}
+			processBufferedPackets();
 			packet_queued = false;
 		}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
+		if (m_thread_index != 0) {
+			// Only the first thread reads the socket. Wait as long as it does.
+			ReceivedDatagram d = m_datagram_queue.pop_frontNoEx(500);
+			if (d.data.getSize() == 0)
+				return;
+			processPeerDatagram(d.peer_id, d.knew_peer_id, d.sender,
+				*d.data, d.data.getSize(), packet_queued);
 			return;
+		}
 
-		if ((received_size < BASE_HEADER_SIZE) ||
-				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid incoming packet, "
-				<< "size: " << received_size
-				<< ", protocol: "
-				<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
-				<< std::endl);
-			return;
+		// Wait for incoming data and take everything that is queued up to
+		// the batch size
+		size_t count = m_connection->m_udpSocket.ReceiveBatch(datagrams.data(),
+			datagrams.size());
+
+		for (size_t i = 0; i < count; i++) {
+			// Keep the order of events the same as if the datagrams had
+			// been received one at a time
+			if (packet_queued) {
+				processBufferedPackets();
+				packet_queued = false;
+			}
+
+			const UDPSocket::IncomingDatagram &d = datagrams[i];
+			try {
+				processDatagram(d.sender, static_cast<const u8 *>(d.data),
+					d.size, packet_queued);
+			}
+			catch (InvalidIncomingDataException &e) {
+			}
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+	}
+}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+void ConnectionReceiveThread::processBufferedPackets()
+{
+	session_t peer_id;
+	SharedBuffer<u8> resultdata;
+	while (true) {
+		try {
+			if (!getFromBuffers(peer_id, resultdata))
+				break;
 
-		if (channelnum >= CHANNEL_COUNT) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
-			return;
+			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
+		}
+		catch (ProcessedSilentlyException &e) {
+			/* try reading again */
 		}
+	}
+}
 
-		const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
-
-		if (!m_connection->ConnectedToServer()) {
-			// Try to identify peer by sender address
-			if (peer_id == PEER_ID_INEXISTENT) {
-				peer_id = m_connection->lookupPeer(sender);
-				if (peer_id != PEER_ID_INEXISTENT) {
-					/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
-					 * packet is lost. Since resends are not active at this stage
-					 * we need to remind the peer manually. */
-					m_connection->doResendOne(peer_id);
-				}
+void ConnectionReceiveThread::processDatagram(const Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	if ((received_size < BASE_HEADER_SIZE) ||
+			(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid incoming packet, "
+			<< "size: " << received_size
+			<< ", protocol: "
+			<< ((received_size >= 4) ? readU32(&packetdata[0]) : -1)
+			<< std::endl);
+		return;
+	}
+
+	session_t peer_id = readPeerId(packetdata);
+	u8 channelnum = readChannel(packetdata);
+
+	if (channelnum >= CHANNEL_COUNT) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): Invalid channel " << (int)channelnum << std::endl);
+		return;
+	}
+
+	const bool knew_peer_id = peer_id != PEER_ID_INEXISTENT;
+
+	if (!m_connection->ConnectedToServer()) {
+		// Try to identify peer by sender address
+		if (peer_id == PEER_ID_INEXISTENT) {
+			peer_id = m_connection->lookupPeer(sender);
+			if (peer_id != PEER_ID_INEXISTENT) {
+				/* During join it can happen that the CONTROLTYPE_SET_PEER_ID
+				 * packet is lost. Since resends are not active at this stage
+				 * we need to remind the peer manually. */
+				m_connection->doResendOne(peer_id);
 			}
+		}
 
-			// Someone new is trying to talk to us. Add them.
-			if (peer_id == PEER_ID_INEXISTENT) {
-				auto &l = m_new_peer_ratelimit;
-				l.tick();
-				if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
-					if (!l.logged) {
-						warningstream << m_connection->getDesc()
-							<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
-							<< " new clients within 1s. Throttling." << std::endl;
-					}
-					l.logged = true;
-					// We simply drop the packet, the client can try again.
-				} else {
-					peer_id = m_connection->createPeer(sender, 0);
+		// Someone new is trying to talk to us. Add them.
+		if (peer_id == PEER_ID_INEXISTENT) {
+			auto &l = m_new_peer_ratelimit;
+			l.tick();
+			if (++l.counter > MAX_NEW_PEERS_PER_SEC) {
+				if (!l.logged) {
+					warningstream << m_connection->getDesc()
+						<< "Receive(): More than " << MAX_NEW_PEERS_PER_SEC
+						<< " new clients within 1s. Throttling." << std::endl;
 				}
+				l.logged = true;
+				// We simply drop the packet, the client can try again.
+			} else {
+				peer_id = m_connection->createPeer(sender, 0);
 			}
 		}
+	}
 
-		PeerHelper peer = m_connection->getPeerNoEx(peer_id);
-		if (!peer) {
-			LOG(dout_con << m_connection->getDesc()
-				<< " got packet from unknown peer_id: "
-				<< peer_id << " Ignoring." << std::endl);
-			return;
-		}
+	ConnectionReceiveThread *owner = m_connection->getReceiveThread(peer_id);
+	if (owner != this) {
+		ReceivedDatagram d;
+		d.peer_id = peer_id;
+		d.knew_peer_id = knew_peer_id;
+		d.sender = sender;
+		d.data = Buffer<u8>(packetdata, received_size);
+		owner->queueDatagram(std::move(d));
+		return;
+	}
 
-		// Validate peer address
+	processPeerDatagram(peer_id, knew_peer_id, sender, packetdata,
+		received_size, packet_queued);
+}
 
-		if (sender != peer->getAddress()) {
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending from different address."
-				" Ignoring." << std::endl);
-			return;
-		}
+void ConnectionReceiveThread::processPeerDatagram(session_t peer_id,
+		bool knew_peer_id, const Address &sender, const u8 *packetdata,
+		s32 received_size, bool &packet_queued)
+{
+	u8 channelnum = readChannel(packetdata);
 
-		if (knew_peer_id) {
-			peer->SetFullyOpen();
-			// Setup phase has a fixed timeout
-			peer->ResetTimeout();
-		} else if (!peer->isHalfOpen()) {
-			// If the peer talks to us without a peer ID when it has done so
-			// before something is definitely fishy.
-			LOG(derr_con << m_connection->getDesc()
-				<< " Peer " << peer_id << " sending without peer id?!"
-				" Ignoring." << std::endl);
-			return;
-		}
+	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
+	if (!peer) {
+		LOG(dout_con << m_connection->getDesc()
+			<< " got packet from unknown peer_id: "
+			<< peer_id << " Ignoring." << std::endl);
+		return;
+	}
 
-		auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
-		if (!udpPeer) {
-			LOG(derr_con << m_connection->getDesc()
-				<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
-				" Ignoring." << std::endl);
-			return;
-		}
-		Channel *channel = &udpPeer->channels[channelnum];
+	// Validate peer address
 
-		channel->UpdateBytesReceived(received_size);
+	if (sender != peer->getAddress()) {
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending from different address."
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		// Throw the received packet to channel->processPacket()
+	if (knew_peer_id) {
+		peer->SetFullyOpen();
+		// Setup phase has a fixed timeout
+		peer->ResetTimeout();
+	} else if (!peer->isHalfOpen()) {
+		// If the peer talks to us without a peer ID when it has done so
+		// before something is definitely fishy.
+		LOG(derr_con << m_connection->getDesc()
+			<< " Peer " << peer_id << " sending without peer id?!"
+			" Ignoring." << std::endl);
+		return;
+	}
 
-		// Make a new SharedBuffer from the data without the base headers
-		SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
-		memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
-			strippeddata.getSize());
+	auto *udpPeer = dynamic_cast<UDPPeer *>(&peer);
+	if (!udpPeer) {
+		LOG(derr_con << m_connection->getDesc()
+			<< "Receive(): peer_id=" << peer_id << " isn't an UDPPeer?!"
+			" Ignoring." << std::endl);
+		return;
+	}
+	Channel *channel = &udpPeer->channels[channelnum];
 
-		try {
-			// Process it (the result is some data with no headers made by us)
-			SharedBuffer<u8> resultdata = processPacket
-				(channel, strippeddata, peer_id, channelnum, false);
+	channel->UpdateBytesReceived(received_size);
 
-			LOG(dout_con << m_connection->getDesc()
-				<< " ProcessPacket from peer_id: " << peer_id
-				<< ", channel: " << (u32)channelnum << ", returned "
-				<< resultdata.getSize() << " bytes" << std::endl);
+	// Throw the received packet to channel->processPacket()
 
-			m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
-		}
-		catch (ProcessedSilentlyException &e) {
-		}
-		catch (ProcessedQueued &e) {
-			// we set it to true anyway (see below)
-		}
+	// Make a new SharedBuffer from the data without the base headers
+	SharedBuffer<u8> strippeddata(received_size - BASE_HEADER_SIZE);
+	memcpy(*strippeddata, &packetdata[BASE_HEADER_SIZE],
+		strippeddata.getSize());
 
-		/* Every time we receive a packet it can happen that a previously
-		 * buffered packet is now ready to process. */
-		packet_queued = true;
+	try {
+		// Process it (the result is some data with no headers made by us)
+		SharedBuffer<u8> resultdata = processPacket
+			(channel, strippeddata, peer_id, channelnum, false);
+
+		LOG(dout_con << m_connection->getDesc()
+			<< " ProcessPacket from peer_id: " << peer_id
+			<< ", channel: " << (u32)channelnum << ", returned "
+			<< resultdata.getSize() << " bytes" << std::endl);
+
+		m_connection->putEvent(ConnectionEvent::dataReceived(peer_id, resultdata));
 	}
-	catch (InvalidIncomingDataException &e) {
+	catch (ProcessedSilentlyException &e) {
+	}
+	catch (ProcessedQueued &e) {
+		// we set it to true anyway (see below)
 	}
+
+	/* Every time we receive a packet it can happen that a previously
+	 * buffered packet is now ready to process. */
+	packet_queued = true;
 }
 
 bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8> &dst)
@@ -1086,6 +1188,9 @@ bool ConnectionReceiveThread::getFromBuffers(session_t &peer_id, SharedBuffer<u8
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
 	for (session_t peerid : peerids) {
+		if (m_connection->getThreadIndex(peerid) != m_thread_index)
+			continue;
+
 		PeerHelper peer = m_connection->getPeerNoEx(peerid);
 		if (!peer)
 			continue;
@@ -1201,31 +1306,30 @@ SharedBuffer<u8> ConnectionReceiveThread::handlePacketType_Control(Channel *chan
 			BufferedPacketPtr p = channel->outgoing_reliables_sent.popSeqnum(seqnum);
 
 			// the rtt calculation will be a bit off for re-sent packets but that's okay
+			float rtt = -1.0f;
 			{
 				// Get round trip time
-				u64 current_time = porting::getTimeMs();
+				u64 current_time = porting::getTimeUs();
 
 				// an overflow is quite unlikely but as it'd result in major
 				// rtt miscalculation we handle it here
-				if (current_time > p->absolute_send_time) {
-					float rtt = (current_time - p->absolute_send_time) / 1000.0f;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
+				if (current_time > p->absolute_send_time)
+					rtt = (current_time - p->absolute_send_time) / 1000000.0f;
+				else if (p->totaltime > 0)
+					rtt = p->totaltime;
+
+				// Let peer calculate stuff according to it
+				// (avg_rtt and resend_timeout)
+				if (rtt >= 0)
 					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				} else if (p->totaltime > 0) {
-					float rtt = p->totaltime;
-
-					// Let peer calculate stuff according to it
-					// (avg_rtt and resend_timeout)
-					dynamic_cast<UDPPeer *>(peer)->reportRTT(rtt);
-				}
 			}
 
 			// put bytes for max bandwidth calculation
 			channel->UpdateBytesSent(p->size(), 1);
+			// the window control needs exact samples
+			channel->UpdateAcked(p->resend_count == 0 ? rtt : -1.0f);
 			if (channel->outgoing_reliables_sent.size() == 0)
-				m_connection->TriggerSend();
+				m_connection->TriggerSend(peer->id);
 		} catch (NotFoundException &e) {
 			LOG(derr_con << m_connection->getDesc()
 				<< "WARNING: ACKed packet not in outgoing queue"
@@ -43,12 +43,15 @@ class ConnectionSendThread : public Thread
 public:
 	friend class UDPPeer;
 
-	ConnectionSendThread(unsigned int max_packet_size, float timeout);
+	ConnectionSendThread(unsigned int max_packet_size, float timeout,
+			u32 thread_index);
 
 	void *run();
 
 	void Trigger();
 
+	void putCommand(const ConnectionCommandPtr &c);
+
 	void setParent(Connection *parent)
 	{
 		assert(parent != NULL); // Pre-condition
@@ -58,9 +61,16 @@ class ConnectionSendThread : public Thread
 	void setPeerTimeout(float peer_timeout) { m_timeout = peer_timeout; }
 
 private:
+	// Returns the peers handled by this thread
+	std::vector<session_t> getPeerIDs();
+
 	void runTimeouts(float dtime, u32 peer_packet_quota);
-	void resendReliable(Channel &channel, const BufferedPacket *k, float resend_timeout);
-	void rawSend(const BufferedPacket *p);
+	void resendReliable(Channel &channel, const ConstSharedPtr<BufferedPacket> &k,
+			float resend_timeout);
+	// Queues the packet for sending, see flushSendBatch()
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	// Hands all packets queued by rawSend() to the socket at once
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
 			const SharedBuffer<u8> &data, bool reliable);
 
@@ -86,20 +96,40 @@ class ConnectionSendThread : public Thread
 	bool packetsQueued();
 
 	Connection *m_connection = nullptr;
+	const u32 m_thread_index;
 	unsigned int m_max_packet_size;
 	float m_timeout;
+	// Command queue: user -> SendThread
+	MutexedQueue<ConnectionCommandPtr> m_command_queue;
 	std::queue<OutgoingPacket> m_outgoing_queue;
 	Semaphore m_send_sleep_semaphore;
 
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
+	std::vector<UDPSocket::OutgoingDatagram> m_send_datagrams;
+
 	unsigned int m_iteration_packets_avaialble;
 	unsigned int m_max_data_packets_per_iteration;
 	unsigned int m_max_packets_requeued = 256;
 };
 
+// A datagram that was passed on by the thread reading the socket
+struct ReceivedDatagram
+{
+	session_t peer_id = PEER_ID_INEXISTENT;
+	bool knew_peer_id = false;
+	Address sender;
+	// Owned and moved, the reference count of SharedBuffer is not thread-safe
+	Buffer<u8> data;
+};
+
+/*
+	The receive thread with index 0 reads the socket, identifies the peer
+	and passes datagrams of peers handled by other threads on to them.
+*/
 class ConnectionReceiveThread : public Thread
 {
 public:
-	ConnectionReceiveThread();
+	ConnectionReceiveThread(u32 thread_index);
 
 	void *run();
 
@@ -109,8 +139,23 @@ class ConnectionReceiveThread : public Thread
 		m_connection = parent;
 	}
 
+	void queueDatagram(ReceivedDatagram &&datagram)
+	{
+		m_datagram_queue.push_back(std::move(datagram));
+	}
+
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	void receive(std::vector<UDPSocket::IncomingDatagram> &datagrams,
+			bool &packet_queued);
+	// Processes a single datagram that was received from the socket
+	void processDatagram(const Address &sender, const u8 *packetdata,
+			s32 received_size, bool &packet_queued);
+	// Processes a datagram once the peer it belongs to is known
+	void processPeerDatagram(session_t peer_id, bool knew_peer_id,
+			const Address &sender, const u8 *packetdata, s32 received_size,
+			bool &packet_queued);
+	// Turns buffered reliable packets that are now in order into events
+	void processBufferedPackets();
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
@@ -170,6 +215,10 @@ class ConnectionReceiveThread : public Thread
 	static const PacketTypeHandler packetTypeRouter[PACKET_TYPE_MAX];
 
 	Connection *m_connection = nullptr;
+	const u32 m_thread_index;
+
+	// Datagrams passed on by the thread reading the socket
+	MutexedQueue<ReceivedDatagram> m_datagram_queue;
 
 	RateLimitHelper m_new_peer_ratelimit;
 };
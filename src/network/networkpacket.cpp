@@ -8,6 +8,44 @@
 #include "util/serialize.h"
 #include "networkprotocol.h"
 
+// Limits for the per-thread buffer pool
+#define BUFFER_POOL_SIZE 16
+#define BUFFER_POOL_MAX_CAPACITY (64 * 1024)
+
+// Packets may outlive the pool when they are destroyed at thread exit
+static thread_local bool t_buffer_pool_gone = false;
+
+static thread_local struct BufferPool : std::vector<std::vector<u8>> {
+	~BufferPool() { t_buffer_pool_gone = true; }
+} t_buffer_pool;
+
+std::vector<u8> NetworkPacket::acquireBuffer(u32 preallocate)
+{
+	std::vector<u8> buffer;
+	if (!t_buffer_pool_gone && !t_buffer_pool.empty()) {
+		buffer = std::move(t_buffer_pool.back());
+		t_buffer_pool.pop_back();
+	}
+	buffer.reserve(preallocate);
+	return buffer;
+}
+
+void NetworkPacket::releaseBuffer(std::vector<u8> &&buffer)
+{
+	if (t_buffer_pool_gone || buffer.capacity() == 0 ||
+			buffer.capacity() > BUFFER_POOL_MAX_CAPACITY ||
+			t_buffer_pool.size() >= BUFFER_POOL_SIZE)
+		return;
+
+	buffer.clear();
+	t_buffer_pool.push_back(std::move(buffer));
+}
+
+NetworkPacket::~NetworkPacket()
+{
+	releaseBuffer(std::move(m_data));
+}
+
 void NetworkPacket::checkReadOffset(u32 from_offset, u32 field_size) const
 {
 	if (from_offset + field_size > m_datasize) {
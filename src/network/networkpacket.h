@@ -14,18 +14,16 @@ class NetworkPacket
 {
 public:
 	NetworkPacket(u16 command, u32 preallocate, session_t peer_id) :
-		m_command(command), m_peer_id(peer_id)
-	{
-		m_data.reserve(preallocate);
-	}
+		m_data(acquireBuffer(preallocate)), m_command(command), m_peer_id(peer_id)
+	{}
 	NetworkPacket(u16 command, u32 preallocate) :
-		m_command(command)
-	{
-		m_data.reserve(preallocate);
-	}
-	NetworkPacket() = default;
+		m_data(acquireBuffer(preallocate)), m_command(command)
+	{}
+	NetworkPacket() :
+		m_data(acquireBuffer(0))
+	{}
 
-	~NetworkPacket() = default;
+	~NetworkPacket();
 
 	void putRawPacket(const u8 *data, u32 datasize, session_t peer_id);
 	void clear();
@@ -112,6 +110,14 @@ class NetworkPacket
 	Buffer<u8> oldForgePacket();
 
 private:
+	/*
+		Buffers of destroyed packets are kept in a per-thread pool, as packets
+		are usually built and dropped right after on the same thread.
+		This saves the allocation and the reallocations while writing.
+	*/
+	static std::vector<u8> acquireBuffer(u32 preallocate);
+	static void releaseBuffer(std::vector<u8> &&buffer);
+
 	void checkReadOffset(u32 from_offset, u32 field_size) const;
 
 	inline void checkDataSize(u32 field_size)
@@ -37,6 +37,42 @@ typedef int socklen_t;
 
 static bool g_sockets_initialized = false;
 
+#ifdef __linux__
+// Upper bound for the datagrams passed to one sendmmsg/recvmmsg call
+static constexpr size_t MAX_MMSG_BATCH = 64;
+#endif
+
+static socklen_t toSockaddr(const Address &addr, struct sockaddr_storage &ret)
+{
+	memset(&ret, 0, sizeof(ret));
+	if (addr.getFamily() == AF_INET6) {
+		auto *address = reinterpret_cast<struct sockaddr_in6 *>(&ret);
+		address->sin6_family = AF_INET6;
+		address->sin6_addr = addr.getAddress6();
+		address->sin6_port = htons(addr.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *address = reinterpret_cast<struct sockaddr_in *>(&ret);
+	address->sin_family = AF_INET;
+	address->sin_addr = addr.getAddress();
+	address->sin_port = htons(addr.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address fromSockaddr(const struct sockaddr_storage &addr)
+{
+	if (addr.ss_family == AF_INET6) {
+		const auto *address = reinterpret_cast<const struct sockaddr_in6 *>(&addr);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(address->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(address->sin6_port));
+	}
+
+	const auto *address = reinterpret_cast<const struct sockaddr_in *>(&addr);
+	return Address(ntohl(address->sin_addr.s_addr), ntohs(address->sin_port));
+}
+
 // Initialize sockets
 void sockets_init()
 {
@@ -182,24 +218,11 @@ void UDPSocket::Send(const Address &destination, const void *data, int size)
 	if (destination.getFamily() != m_addr_family)
 		throw SendFailedException("Address family mismatch");
 
-	int sent;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address = {};
-		address.sin6_family = AF_INET6;
-		address.sin6_addr = destination.getAddress6();
-		address.sin6_port = htons(destination.getPort());
-
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in6));
-	} else {
-		struct sockaddr_in address = {};
-		address.sin_family = AF_INET;
-		address.sin_addr = destination.getAddress();
-		address.sin_port = htons(destination.getPort());
+	struct sockaddr_storage address;
+	socklen_t address_len = toSockaddr(destination, address);
 
-		sent = sendto(m_handle, (const char *)data, size, 0,
-				(struct sockaddr *)&address, sizeof(struct sockaddr_in));
-	}
+	int sent = sendto(m_handle, (const char *)data, size, 0,
+			(struct sockaddr *)&address, address_len);
 
 	if (sent != size)
 		throw SendFailedException("Failed to send packet");
@@ -212,43 +235,133 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	if (!WaitData(m_timeout_ms))
 		return -1;
 
+	return receiveNow(sender, data, size);
+}
+
+int UDPSocket::receiveNow(Address &sender, void *data, int size)
+{
 	size = MYMAX(size, 0);
 
-	int received;
-	if (m_addr_family == AF_INET6) {
-		struct sockaddr_in6 address;
-		memset(&address, 0, sizeof(address));
-		socklen_t address_len = sizeof(address);
+	struct sockaddr_storage address = {};
+	socklen_t address_len = sizeof(address);
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	int received = recvfrom(m_handle, (char *)data, size, 0,
+			(struct sockaddr *)&address, &address_len);
 
-		if (received < 0)
-			return -1;
+	if (received < 0)
+		return -1;
 
-		u16 address_port = ntohs(address.sin6_port);
-		const auto *bytes = reinterpret_cast<IPv6AddressBytes*>
-			(address.sin6_addr.s6_addr);
-		sender = Address(bytes, address_port);
-	} else {
-		struct sockaddr_in address;
-		memset(&address, 0, sizeof(address));
+	sender = fromSockaddr(address);
+	return received;
+}
 
-		socklen_t address_len = sizeof(address);
+void UDPSocket::SendBatch(const OutgoingDatagram *datagrams, size_t count)
+{
+	size_t failed = 0;
+
+#ifdef __linux__
+	if (!INTERNET_SIMULATOR) {
+		struct mmsghdr msgs[MAX_MMSG_BATCH];
+		struct iovec iovs[MAX_MMSG_BATCH];
+		struct sockaddr_storage addresses[MAX_MMSG_BATCH];
+
+		size_t i = 0;
+		while (i < count) {
+			size_t n = 0;
+			for (; n < MAX_MMSG_BATCH && i + n < count; n++) {
+				const OutgoingDatagram &d = datagrams[i + n];
+				if (d.destination.getFamily() != m_addr_family)
+					break;
+				iovs[n].iov_base = const_cast<void *>(d.data);
+				iovs[n].iov_len = d.size;
+				msgs[n] = {};
+				msgs[n].msg_hdr.msg_name = &addresses[n];
+				msgs[n].msg_hdr.msg_namelen = toSockaddr(d.destination, addresses[n]);
+				msgs[n].msg_hdr.msg_iov = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+			}
+
+			int sent = n > 0 ? sendmmsg(m_handle, msgs, n, 0) : -1;
+			if (sent < 0 && n > 0 && errno == EINTR)
+				continue;
+			if (sent <= 0) {
+				// the first datagram could not be sent, skip it
+				failed++;
+				i++;
+				continue;
+			}
+
+			for (int j = 0; j < sent; j++) {
+				if (msgs[j].msg_len != (unsigned int)datagrams[i + j].size)
+					failed++;
+			}
+			i += sent;
+		}
+	} else
+#endif
+	{
+		for (size_t i = 0; i < count; i++) {
+			try {
+				Send(datagrams[i].destination, datagrams[i].data, datagrams[i].size);
+			} catch (SendFailedException &e) {
+				failed++;
+			}
+		}
+	}
 
-		received = recvfrom(m_handle, (char *)data, size, 0,
-				(struct sockaddr *)&address, &address_len);
+	if (failed > 0) {
+		throw SendFailedException("Failed to send " + std::to_string(failed) +
+			" of " + std::to_string(count) + " packets");
+	}
+}
 
-		if (received < 0)
-			return -1;
+size_t UDPSocket::ReceiveBatch(IncomingDatagram *datagrams, size_t count)
+{
+	// Return on timeout
+	assert(m_timeout_ms >= 0);
+	if (count == 0 || !WaitData(m_timeout_ms))
+		return 0;
+
+#ifdef __linux__
+	count = MYMIN(count, MAX_MMSG_BATCH);
+
+	struct mmsghdr msgs[MAX_MMSG_BATCH];
+	struct iovec iovs[MAX_MMSG_BATCH];
+	struct sockaddr_storage addresses[MAX_MMSG_BATCH];
+
+	for (size_t i = 0; i < count; i++) {
+		iovs[i].iov_base = datagrams[i].data;
+		iovs[i].iov_len = MYMAX(datagrams[i].capacity, 0);
+		msgs[i] = {};
+		msgs[i].msg_hdr.msg_name = &addresses[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
 
-		u32 address_ip = ntohl(address.sin_addr.s_addr);
-		u16 address_port = ntohs(address.sin_port);
+	// only take what is already queued, WaitData() did the waiting
+	int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+	if (received <= 0)
+		return 0;
 
-		sender = Address(address_ip, address_port);
+	for (int i = 0; i < received; i++) {
+		datagrams[i].sender = fromSockaddr(addresses[i]);
+		datagrams[i].size = msgs[i].msg_len;
 	}
-
 	return received;
+#else
+	size_t received = 0;
+	while (received < count) {
+		if (received > 0 && !WaitData(0))
+			break;
+		IncomingDatagram &d = datagrams[received];
+		d.size = receiveNow(d.sender, d.data, d.capacity);
+		if (d.size < 0)
+			break;
+		received++;
+	}
+	return received;
+#endif
 }
 
 void UDPSocket::setTimeoutMs(int timeout_ms)
@@ -26,6 +26,33 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+
+	struct OutgoingDatagram {
+		Address destination;
+		const void *data;
+		int size;
+	};
+
+	struct IncomingDatagram {
+		void *data;
+		int capacity;
+		// set by ReceiveBatch()
+		Address sender;
+		int size;
+	};
+
+	/*
+		Sends all datagrams, using as few syscalls as the platform allows
+		(sendmmsg on Linux). Datagrams that fail are skipped, after which
+		SendFailedException is thrown.
+	*/
+	void SendBatch(const OutgoingDatagram *datagrams, size_t count);
+	/*
+		Waits for data like Receive(), then receives as many of the already
+		queued datagrams as fit (recvmmsg on Linux).
+		Returns the number of datagrams received.
+	*/
+	size_t ReceiveBatch(IncomingDatagram *datagrams, size_t count);
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
 	bool WaitData(int timeout_ms);
@@ -34,6 +61,9 @@ class UDPSocket
 	int GetHandle() const { return m_handle; };
 
 private:
+	// Receives a datagram without waiting, returns -1 on error
+	int receiveNow(Address &sender, void *data, int size);
+
 	int m_handle = -1;
 	int m_timeout_ms = -1;
 	unsigned short m_addr_family = 0;
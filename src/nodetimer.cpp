@@ -45,10 +45,11 @@ void NodeTimerList::serialize(std::ostream &os, u8 map_format_version) const
 		writeU16(os, m_timers.size());
 	}
 
+	const double time = getTime();
 	for (const auto &timer : m_timers) {
 		NodeTimer t = timer.second;
 		NodeTimer nt = NodeTimer(t.timeout,
-			t.timeout - (f32)(timer.first - m_time), t.position);
+			t.timeout - (f32)(timer.first - time), t.position);
 		v3s16 p = t.position;
 
 		u16 p16 = p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
@@ -113,15 +114,21 @@ void NodeTimerList::deSerialize(std::istream &is, u8 map_format_version)
 std::vector<NodeTimer> NodeTimerList::step(float dtime)
 {
 	std::vector<NodeTimer> elapsed_timers;
-	m_time += dtime;
-	if (m_next_trigger_time == -1. || m_time < m_next_trigger_time) {
+	if (m_scheduler)
+		m_time_offset -= dtime;
+	else
+		m_time += dtime;
+	const double time = getTime();
+	if (m_next_trigger_time == -1. || time < m_next_trigger_time) {
+		// the block might have been queued for a timer that was removed since
+		scheduleNext();
 		return elapsed_timers;
 	}
 	std::multimap<double, NodeTimer>::iterator i = m_timers.begin();
 	// Process timers
-	for (; i != m_timers.end() && i->first <= m_time; ++i) {
+	for (; i != m_timers.end() && i->first <= time; ++i) {
 		NodeTimer t = i->second;
-		t.elapsed = t.timeout + (f32)(m_time - i->first);
+		t.elapsed = t.timeout + (f32)(time - i->first);
 		elapsed_timers.push_back(t);
 		m_iterators.erase(t.position);
 	}
@@ -131,5 +138,68 @@ std::vector<NodeTimer> NodeTimerList::step(float dtime)
 		m_next_trigger_time = -1.;
 	else
 		m_next_trigger_time = m_timers.begin()->first;
+	scheduleNext();
 	return elapsed_timers;
 }
+
+void NodeTimerList::attach(NodeTimerScheduler *scheduler, v3s16 blockpos)
+{
+	if (m_scheduler)
+		detach();
+	m_scheduler = scheduler;
+	m_time_offset = scheduler->getTime() - m_time;
+	m_blockpos = blockpos;
+	scheduleNext();
+}
+
+void NodeTimerList::detach()
+{
+	if (!m_scheduler)
+		return;
+	m_time = getTime();
+	m_scheduler->unschedule(m_blockpos);
+	m_scheduler = nullptr;
+}
+
+/*
+	NodeTimerScheduler
+*/
+
+void NodeTimerScheduler::schedule(double trigger_time, v3s16 blockpos)
+{
+	auto it = m_due.find(blockpos);
+	if (it != m_due.end()) {
+		if (it->second <= trigger_time)
+			return;
+		it->second = trigger_time;
+	} else {
+		m_due.emplace(blockpos, trigger_time);
+	}
+	m_queue.push({trigger_time, blockpos});
+
+	// Get rid of superseded entries before they pile up
+	if (m_queue.size() > 2 * m_due.size() + 16) {
+		std::vector<Entry> entries;
+		entries.reserve(m_due.size());
+		for (auto &due : m_due)
+			entries.push_back({due.second, due.first});
+		m_queue = decltype(m_queue)(std::greater<Entry>(), std::move(entries));
+	}
+}
+
+std::vector<v3s16> NodeTimerScheduler::step(float dtime)
+{
+	m_time += dtime;
+
+	std::vector<v3s16> due_blocks;
+	while (!m_queue.empty() && m_queue.top().trigger_time <= m_time) {
+		const Entry entry = m_queue.top();
+		m_queue.pop();
+		auto it = m_due.find(entry.blockpos);
+		if (it == m_due.end() || it->second != entry.trigger_time)
+			continue;
+		m_due.erase(it);
+		due_blocks.push_back(entry.blockpos);
+	}
+	return due_blocks;
+}
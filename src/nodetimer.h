@@ -7,6 +7,8 @@
 #include "irr_v3d.h"
 #include <iostream>
 #include <map>
+#include <queue>
+#include <unordered_map>
 #include <vector>
 
 /*
@@ -35,6 +37,51 @@ class NodeTimer
 	v3s16 position;
 };
 
+/*
+	Server-wide clock for the node timers of active blocks.
+
+	Attached NodeTimerLists follow this clock instead of being stepped one
+	by one, and queue their block whenever their earliest timer gets earlier.
+	Only the blocks that have timers due then need to be stepped.
+	Each block has at most one live entry. If its earliest timer was removed
+	in the meantime, the block is stepped anyway and queues itself again for
+	its current earliest timer. Superseded entries are skipped, and the queue
+	is rebuilt once they outnumber the live ones.
+*/
+
+class NodeTimerScheduler
+{
+public:
+	double getTime() const { return m_time; }
+
+	// Queues the block to be stepped once the clock reaches trigger_time,
+	// unless it is already queued for that time or earlier
+	void schedule(double trigger_time, v3s16 blockpos);
+	// Drops the entry of the block, if any
+	void unschedule(v3s16 blockpos) { m_due.erase(blockpos); }
+
+	// Advances the clock, returns blocks that may have elapsed timers
+	std::vector<v3s16> step(float dtime);
+
+	size_t getQueueSize() const { return m_queue.size(); }
+
+private:
+	struct Entry {
+		double trigger_time;
+		v3s16 blockpos;
+
+		bool operator>(const Entry &other) const {
+			return trigger_time > other.trigger_time;
+		}
+	};
+
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_queue;
+	// trigger time of the live entry of each queued block
+	std::unordered_map<v3s16, double> m_due;
+	// total time stepped so far
+	double m_time = 0.0;
+};
+
 /*
 	List of timers of all the nodes of a block
 */
@@ -55,7 +102,7 @@ class NodeTimerList
 		if (n == m_iterators.end())
 			return NodeTimer();
 		NodeTimer t = n->second->second;
-		t.elapsed = t.timeout - (n->second->first - m_time);
+		t.elapsed = t.timeout - (n->second->first - getTime());
 		return t;
 	}
 	// Deletes timer
@@ -80,11 +127,13 @@ class NodeTimerList
 	// Undefined behavior if there already is a timer
 	void insert(const NodeTimer &timer) {
 		v3s16 p = timer.position;
-		double trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
+		double trigger_time = getTime() + (double)(timer.timeout - timer.elapsed);
 		std::multimap<double, NodeTimer>::iterator it = m_timers.emplace(trigger_time, timer);
 		m_iterators.emplace(p, it);
-		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time)
+		if (m_next_trigger_time == -1. || trigger_time < m_next_trigger_time) {
 			m_next_trigger_time = trigger_time;
+			scheduleNext();
+		}
 	}
 	// Deletes old timer and sets a new one
 	inline void set(const NodeTimer &timer) {
@@ -98,12 +147,35 @@ class NodeTimerList
 		m_next_trigger_time = -1.;
 	}
 
-	// Move forward in time, returns elapsed timers
+	// Move forward in time, returns elapsed timers.
+	// If attached, dtime is added on top of the scheduler clock.
 	std::vector<NodeTimer> step(float dtime);
 
+	// Follow the clock of the scheduler from now on
+	void attach(NodeTimerScheduler *scheduler, v3s16 blockpos);
+	// Stop following the scheduler, the timers keep their remaining time
+	void detach();
+	bool isAttachedTo(const NodeTimerScheduler *scheduler) const {
+		return scheduler && m_scheduler == scheduler;
+	}
+
 private:
+	double getTime() const {
+		return m_scheduler ? m_scheduler->getTime() - m_time_offset : m_time;
+	}
+	void scheduleNext() {
+		if (m_scheduler && m_next_trigger_time != -1.)
+			m_scheduler->schedule(m_next_trigger_time + m_time_offset, m_blockpos);
+	}
+
 	std::multimap<double, NodeTimer> m_timers;
 	std::map<v3s16, std::multimap<double, NodeTimer>::iterator> m_iterators;
 	double m_next_trigger_time = -1.0;
+	// only used while detached
 	double m_time = 0.0;
+
+	NodeTimerScheduler *m_scheduler = nullptr;
+	// difference between the scheduler clock and our own time
+	double m_time_offset = 0.0;
+	v3s16 m_blockpos;
 };
@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <vector>
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
@@ -199,6 +200,12 @@ class Noise {
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
+	// Scratch space of gradientMap2D/3D: lattice column and interpolation
+	// weight of each X position, and lattice rows interpolated along X
+	std::vector<u32> lattice_x;
+	std::vector<float> weight_x;
+	std::vector<float> interp_buf;
+
 };
 
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
@@ -6,12 +6,16 @@
 #include <cstring>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <limits>
 #include <unordered_set>
 #include <unordered_map>
 #include "c_packer.h"
 #include "c_internal.h"
 #include "log.h"
 #include "debug.h"
+#include "exceptions.h"
+#include "util/serialize.h"
 #include "threading/mutex_auto_lock.h"
 #include "common/c_types.h" // LuaError
 
@@ -598,7 +602,9 @@ void script_unpack(lua_State *L, PackedValue *pv)
 	}
 
 	// as part of the unpacking process all userdata is "used up"
-	pv->contains_userdata = false;
+	// (values without any may be unpacked by multiple threads at once)
+	if (pv->contains_userdata)
+		pv->contains_userdata = false;
 	// leave exactly one value on the stack
 	lua_settop(L, top+1);
 	lua_remove(L, top);
@@ -625,6 +631,556 @@ PackedValue::~PackedValue()
 	}
 }
 
+//
+// Binary serialization
+//
+
+/*
+	Format:
+	u8 version
+	varint number of instructions
+	for each instruction:
+		u8 header: instruction code (BIN_*) | flags (BIN_FLAG_*)
+		operands, unless BIN_FLAG_IMPLICIT says they are at the top of the stack:
+			SETTABLE: varint set_into, varint sidata1, varint sidata2
+			POP: varint sidata1, varint sidata2
+			others: [varint set_into] if BIN_FLAG_SET_INTO
+		type specific data:
+			PUSHREF: varint sidata1
+			SETMETATABLE, STRING: string sdata
+			INT: zigzag varint
+			FLOAT: f32
+			DOUBLE: f64
+			TABLE: varint narr, varint nrec
+		[key] if the value is set into a table (see has_key):
+			zigzag varint sidata1 if uses_sdata(type), string sdata otherwise
+
+	varints are unsigned LEB128, other integers are big-endian.
+	strings are either a varint (len << 1) followed by u8[len], or a varint
+	(n << 1 | 1) that repeats the n-th short string of the stream.
+*/
+
+static constexpr u8 BIN_VERSION = 1;
+
+enum : u8 {
+	BIN_NIL,
+	BIN_FALSE,
+	BIN_TRUE,
+	BIN_INT, // integral number with at most 53 bits
+	BIN_FLOAT, // number that is exactly representable as f32
+	BIN_DOUBLE,
+	BIN_STRING,
+	BIN_TABLE,
+	BIN_SETTABLE,
+	BIN_POP,
+	BIN_PUSHREF,
+	BIN_SETMETATABLE,
+	BIN_MAX,
+};
+
+static constexpr u8 BIN_CODE_MASK = 0x0f;
+static constexpr u8 BIN_FLAG_KEEP_REF = 0x10;
+static constexpr u8 BIN_FLAG_POP = 0x20;
+static constexpr u8 BIN_FLAG_SET_INTO = 0x40;
+static constexpr u8 BIN_FLAG_IMPLICIT = 0x80;
+
+// script_unpack() relies on lua_checkstack(), which has a fixed limit
+static constexpr size_t BIN_MAX_STACK = 4000;
+
+// strings up to this length are shared, to avoid repeating table keys
+static constexpr size_t BIN_MAX_SHARED_STRING = 64;
+
+// largest integer such that all smaller ones are exactly representable
+static constexpr lua_Number BIN_MAX_INT = 9007199254740992.0; // 2^53
+
+static_assert(std::numeric_limits<lua_Number>::is_iec559 && sizeof(lua_Number) == 8,
+	"lua_Number must be a double");
+
+// does the instruction carry a key for set_into?
+static inline bool has_key(const PackedInstr &i)
+{
+	return i.set_into && (i.type >= 0 || i.type == INSTR_PUSHREF);
+}
+
+// Note: the representations are compared since we're built with
+// -fno-signed-zeros, but want to keep -0 intact.
+static inline bool same_number(lua_Number a, lua_Number b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static inline u8 get_bin_code(const PackedInstr &i)
+{
+	switch (i.type) {
+		case INSTR_SETTABLE:
+			return BIN_SETTABLE;
+		case INSTR_POP:
+			return BIN_POP;
+		case INSTR_PUSHREF:
+			return BIN_PUSHREF;
+		case INSTR_SETMETATABLE:
+			return BIN_SETMETATABLE;
+		case LUA_TNIL:
+			return BIN_NIL;
+		case LUA_TBOOLEAN:
+			return i.bdata ? BIN_TRUE : BIN_FALSE;
+		case LUA_TNUMBER: {
+			const lua_Number n = i.ndata;
+			if (n >= -BIN_MAX_INT && n <= BIN_MAX_INT && same_number((s64)n, n))
+				return BIN_INT;
+			if (std::fabs(n) <= std::numeric_limits<f32>::max() && same_number((f32)n, n))
+				return BIN_FLOAT;
+			return BIN_DOUBLE;
+		}
+		case LUA_TSTRING:
+			return BIN_STRING;
+		case LUA_TTABLE:
+			return BIN_TABLE;
+		default:
+			// rejected by StackTracker
+			assert(false);
+			return BIN_MAX;
+	}
+}
+
+namespace {
+	class BinWriter {
+		std::string &os;
+		// short strings written so far -> index
+		std::unordered_map<std::string_view, u32> strings;
+	public:
+		BinWriter(std::string &os) : os(os) {}
+
+		void u8_(u8 v) { os.push_back((char)v); }
+		void varint(u64 v)
+		{
+			while (v >= 0x80) {
+				os.push_back((char)(v | 0x80));
+				v >>= 7;
+			}
+			os.push_back((char)v);
+		}
+		void zigzag(s64 v) { varint(((u64)v << 1) ^ (u64)(v >> 63)); }
+		void f32_(f32 v) { u8 buf[4]; writeF32(buf, v); append(buf, 4); }
+		void f64_(lua_Number v)
+		{
+			u64 bits;
+			memcpy(&bits, &v, sizeof(bits));
+			u8 buf[8];
+			writeU64(buf, bits);
+			append(buf, 8);
+		}
+		// note: v must stay valid as long as the BinWriter is used
+		void str_(const std::string &v)
+		{
+			if (v.size() <= BIN_MAX_SHARED_STRING) {
+				auto it = strings.find(v);
+				if (it != strings.end()) {
+					varint((u64)it->second << 1 | 1);
+					return;
+				}
+				strings.emplace(v, strings.size());
+			}
+			varint((u64)v.size() << 1);
+			os.append(v);
+		}
+	private:
+		void append(const u8 *buf, size_t len) { os.append((const char *)buf, len); }
+	};
+
+	class BinReader {
+		std::string_view data;
+		size_t pos = 0;
+		// short strings read so far
+		std::vector<std::string_view> strings;
+	public:
+		BinReader(std::string_view data) : data(data) {}
+
+		size_t remaining() const { return data.size() - pos; }
+
+		u8 u8_() { return *advance(1); }
+		u64 varint()
+		{
+			u64 v = 0;
+			for (int shift = 0; shift < 64; shift += 7) {
+				const u8 b = *advance(1);
+				v |= (u64)(b & 0x7f) << shift;
+				if (!(b & 0x80))
+					return v;
+			}
+			throw SerializationError("Invalid varint");
+		}
+		// varint that must fit into an s32 (indices)
+		s32 index()
+		{
+			u64 v = varint();
+			if (v > S32_MAX)
+				throw SerializationError("Invalid index");
+			return v;
+		}
+		s64 zigzag()
+		{
+			u64 v = varint();
+			return (s64)(v >> 1) ^ -(s64)(v & 1);
+		}
+		f32 f32_() { return readF32(advance(4)); }
+		lua_Number f64_()
+		{
+			u64 bits = readU64(advance(8));
+			lua_Number v;
+			memcpy(&v, &bits, sizeof(v));
+			return v;
+		}
+		std::string str_()
+		{
+			const u64 v = varint();
+			if (v & 1) {
+				if ((v >> 1) >= strings.size())
+					throw SerializationError("Invalid string reference");
+				return std::string(strings[v >> 1]);
+			}
+			const u64 len = v >> 1;
+			if (len > remaining())
+				throw SerializationError("Unexpected end of data");
+			std::string_view ret((const char *)advance(len), len);
+			if (len <= BIN_MAX_SHARED_STRING)
+				strings.push_back(ret);
+			return std::string(ret);
+		}
+	private:
+		const u8 *advance(size_t len)
+		{
+			if (len > remaining())
+				throw SerializationError("Unexpected end of data");
+			auto *ret = reinterpret_cast<const u8 *>(data.data() + pos);
+			pos += len;
+			return ret;
+		}
+	};
+
+	/*
+		Tracks what script_unpack() would do to the Lua stack, to make sure
+		that it can execute an instruction stream without misbehaving.
+		Instructions have to be fed in order.
+	*/
+	class StackTracker {
+		// what we need to know about the values on the stack
+		enum : u8 {
+			V_OTHER,
+			V_TABLE,
+			V_INVALID_KEY, // nil or NaN
+		};
+
+		std::vector<u8> stack; // stack[0] is at index 1
+
+		static u8 kind_of(const PackedInstr &i)
+		{
+			if (i.type == LUA_TTABLE)
+				return V_TABLE;
+			if (i.type == LUA_TNIL || (i.type == LUA_TNUMBER && std::isnan(i.ndata)))
+				return V_INVALID_KEY;
+			return V_OTHER;
+		}
+
+		bool valid_index(s32 idx) const
+		{
+			return idx >= 1 && (size_t)idx <= stack.size();
+		}
+
+		void remove(s32 idx)
+		{
+			stack.erase(stack.begin() + (idx - 1));
+		}
+
+	public:
+		size_t size() const { return stack.size(); }
+
+		// throws SerializationError if the instruction is not valid
+		void step(const PackedValue &pv, size_t packed_idx)
+		{
+			const auto &i = pv.i[packed_idx];
+
+			if (i.set_into && (!valid_index(i.set_into) || stack[i.set_into - 1] != V_TABLE))
+				throw SerializationError("Invalid table index");
+			if (i.type < 0 && i.keep_ref)
+				throw SerializationError("Invalid reference");
+
+			switch (i.type) {
+				/* Instructions */
+				case INSTR_SETTABLE:
+					if (!i.set_into || !valid_index(i.sidata1) || !valid_index(i.sidata2))
+						throw SerializationError("Invalid stack index");
+					if (stack[i.sidata1 - 1] == V_INVALID_KEY)
+						throw SerializationError("Invalid table key");
+					if (i.pop) {
+						remove(std::max(i.sidata1, i.sidata2));
+						if (i.sidata1 != i.sidata2)
+							remove(std::min(i.sidata1, i.sidata2));
+					}
+					return;
+				case INSTR_POP:
+					if (i.set_into || !valid_index(i.sidata1))
+						throw SerializationError("Invalid stack index");
+					remove(i.sidata1);
+					if (i.sidata2 != 0) {
+						if (!valid_index(i.sidata2))
+							throw SerializationError("Invalid stack index");
+						remove(i.sidata2);
+					}
+					return;
+				case INSTR_PUSHREF:
+					if (i.sidata1 < 0 || (size_t)i.sidata1 >= packed_idx ||
+							!pv.i[i.sidata1].keep_ref)
+						throw SerializationError("Invalid reference");
+					stack.push_back(kind_of(pv.i[i.sidata1]));
+					break;
+				case INSTR_SETMETATABLE:
+					if (!i.set_into)
+						throw SerializationError("Invalid table index");
+					return;
+
+				/* Lua types */
+				case LUA_TNIL:
+				case LUA_TBOOLEAN:
+				case LUA_TNUMBER:
+				case LUA_TSTRING:
+				case LUA_TTABLE:
+					stack.push_back(kind_of(i));
+					break;
+				case LUA_TFUNCTION:
+				case LUA_TUSERDATA: {
+					std::string err = "Cannot serialize type ";
+					err += lua_typename(nullptr, i.type);
+					throw SerializationError(err);
+				}
+
+				default:
+					throw SerializationError("Unknown instruction");
+			}
+
+			if (stack.size() > BIN_MAX_STACK)
+				throw SerializationError("Value is nested too deeply");
+
+			if (i.set_into) {
+				// (-> lua_setfield)
+				if (!uses_sdata(i.type) && i.sdata.find('\0') != std::string::npos)
+					throw SerializationError("Invalid table key");
+				if (i.pop)
+					stack.pop_back();
+			} else if (i.pop) {
+				stack.pop_back();
+			}
+		}
+
+		void finish() const
+		{
+			// script_unpack() returns the first value
+			if (stack.size() != 1)
+				throw SerializationError("Invalid stack size");
+		}
+	};
+}
+
+std::string script_serialize_packed(const PackedValue *pv)
+{
+	assert(pv);
+
+	std::string ret;
+	BinWriter os(ret);
+	os.u8_(BIN_VERSION);
+	os.varint(pv->i.size());
+
+	StackTracker tracker;
+	for (size_t packed_idx = 0; packed_idx < pv->i.size(); packed_idx++) {
+		const auto &i = pv->i[packed_idx];
+		const s32 top = tracker.size();
+		tracker.step(*pv, packed_idx);
+
+		const u8 code = get_bin_code(i);
+		u8 header = code;
+		if (i.keep_ref)
+			header |= BIN_FLAG_KEEP_REF;
+		if (i.pop)
+			header |= BIN_FLAG_POP;
+		if (i.set_into)
+			header |= BIN_FLAG_SET_INTO;
+		bool implicit;
+		if (code == BIN_SETTABLE)
+			implicit = i.set_into == top - 2 && i.sidata1 == top - 1 && i.sidata2 == top;
+		else if (code == BIN_POP)
+			implicit = i.sidata1 == top && i.sidata2 == 0;
+		else
+			implicit = i.set_into && i.set_into == top;
+		if (implicit)
+			header |= BIN_FLAG_IMPLICIT;
+		os.u8_(header);
+
+		if (!implicit) {
+			if (code == BIN_SETTABLE) {
+				os.varint(i.set_into);
+				os.varint(i.sidata1);
+				os.varint(i.sidata2);
+			} else if (code == BIN_POP) {
+				os.varint(i.sidata1);
+				os.varint(i.sidata2);
+			} else if (i.set_into) {
+				os.varint(i.set_into);
+			}
+		}
+
+		switch (code) {
+			case BIN_PUSHREF:
+				os.varint(i.sidata1);
+				break;
+			case BIN_SETMETATABLE:
+			case BIN_STRING:
+				os.str_(i.sdata);
+				break;
+			case BIN_INT:
+				os.zigzag((s64)i.ndata);
+				break;
+			case BIN_FLOAT:
+				os.f32_((f32)i.ndata);
+				break;
+			case BIN_DOUBLE:
+				os.f64_(i.ndata);
+				break;
+			case BIN_TABLE:
+				os.varint(i.uidata1);
+				os.varint(i.uidata2);
+				break;
+			default:
+				break;
+		}
+
+		if (has_key(i)) {
+			if (uses_sdata(i.type))
+				os.zigzag(i.sidata1);
+			else
+				os.str_(i.sdata);
+		}
+	}
+	tracker.finish();
+
+	return ret;
+}
+
+PackedValue *script_deserialize_packed(std::string_view data)
+{
+	BinReader is(data);
+	if (is.u8_() != BIN_VERSION)
+		throw SerializationError("Unsupported version");
+	// every instruction takes at least one byte
+	const u64 count = is.varint();
+	if (count == 0 || count > is.remaining())
+		throw SerializationError("Invalid number of instructions");
+
+	PackedValue pv;
+	pv.i.resize(count);
+	StackTracker tracker;
+	for (size_t packed_idx = 0; packed_idx < count; packed_idx++) {
+		auto &i = pv.i[packed_idx];
+		const s32 top = tracker.size();
+
+		const u8 header = is.u8_();
+		const u8 code = header & BIN_CODE_MASK;
+		i.keep_ref = header & BIN_FLAG_KEEP_REF;
+		i.pop = header & BIN_FLAG_POP;
+		const bool set_into = header & BIN_FLAG_SET_INTO;
+		const bool implicit = header & BIN_FLAG_IMPLICIT;
+
+		if (code == BIN_SETTABLE) {
+			i.type = INSTR_SETTABLE;
+			if (!set_into)
+				throw SerializationError("Invalid table index");
+			const s32 into = implicit ? top - 2 : is.index();
+			i.sidata1 = implicit ? top - 1 : is.index();
+			i.sidata2 = implicit ? top : is.index();
+			if (into < 0 || into > U16_MAX)
+				throw SerializationError("Invalid table index");
+			i.set_into = into;
+		} else if (code == BIN_POP) {
+			i.type = INSTR_POP;
+			i.sidata1 = implicit ? top : is.index();
+			i.sidata2 = implicit ? 0 : is.index();
+		} else if (set_into) {
+			const s32 into = implicit ? top : is.index();
+			if (into > U16_MAX)
+				throw SerializationError("Invalid table index");
+			i.set_into = into;
+		}
+		// set_into = 0 is caught by StackTracker
+
+		switch (code) {
+			case BIN_SETTABLE:
+			case BIN_POP:
+				break;
+			case BIN_PUSHREF:
+				i.type = INSTR_PUSHREF;
+				i.sidata1 = is.index();
+				break;
+			case BIN_SETMETATABLE:
+				i.type = INSTR_SETMETATABLE;
+				i.sdata = is.str_();
+				break;
+			case BIN_NIL:
+				i.type = LUA_TNIL;
+				break;
+			case BIN_FALSE:
+			case BIN_TRUE:
+				i.type = LUA_TBOOLEAN;
+				i.bdata = code == BIN_TRUE;
+				break;
+			case BIN_INT:
+				i.type = LUA_TNUMBER;
+				i.ndata = is.zigzag();
+				break;
+			case BIN_FLOAT:
+				i.type = LUA_TNUMBER;
+				i.ndata = is.f32_();
+				break;
+			case BIN_DOUBLE:
+				i.type = LUA_TNUMBER;
+				i.ndata = is.f64_();
+				break;
+			case BIN_STRING:
+				i.type = LUA_TSTRING;
+				i.sdata = is.str_();
+				break;
+			case BIN_TABLE: {
+				i.type = LUA_TTABLE;
+				// the sizes are only hints, but avoid huge allocations:
+				// every entry takes at least one instruction
+				const u64 left = count - packed_idx - 1;
+				i.uidata1 = std::min<u64>(is.varint(), std::min<u64>(left, U16_MAX));
+				i.uidata2 = std::min<u64>(is.varint(), std::min<u64>(left, U16_MAX));
+				break;
+			}
+			default:
+				throw SerializationError("Unknown instruction");
+		}
+
+		if (has_key(i)) {
+			if (uses_sdata(i.type)) {
+				s64 key = is.zigzag();
+				if (key < S32_MIN || key > S32_MAX)
+					throw SerializationError("Invalid table key");
+				i.sidata1 = key;
+			} else {
+				i.sdata = is.str_();
+			}
+		}
+
+		tracker.step(pv, packed_idx);
+	}
+	tracker.finish();
+
+	if (is.remaining() != 0)
+		throw SerializationError("Trailing data");
+
+	return new PackedValue(std::move(pv));
+}
+
 //
 // script_dump_packed
 //
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include "irrlichttypes.h"
 #include "util/basic_macros.h"
@@ -17,6 +18,8 @@ extern "C" {
 	This file defines an in-memory representation of Lua objects including
 	support for functions and userdata. It it used to move data between Lua
 	states and cannot be used for persistence or network transfer.
+	The exception is the binary format produced by script_serialize_packed(),
+	which only supports plain data.
 */
 
 #define INSTR_SETTABLE     (-10)
@@ -107,8 +110,16 @@ void script_register_packer(lua_State *L, const char *regname,
 // Pack a Lua value
 PackedValue *script_pack(lua_State *L, int idx);
 // Unpack a Lua value (left on top of stack)
-// Note that this may modify the PackedValue, reusability is not guaranteed!
+// Note that this may modify the PackedValue if it contains userdata,
+// reusability is not guaranteed in that case!
 void script_unpack(lua_State *L, PackedValue *val);
 
+// Serialize a PackedValue into a compact binary format for persistence.
+// Throws SerializationError if it contains functions or userdata.
+std::string script_serialize_packed(const PackedValue *val);
+// Deserialize a PackedValue that is safe to unpack from untrusted data.
+// Throws SerializationError if the data is invalid.
+PackedValue *script_deserialize_packed(std::string_view data);
+
 // Dump contents of PackedValue to stdout for debugging
 void script_dump_packed(const PackedValue *val);
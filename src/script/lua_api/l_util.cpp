@@ -7,6 +7,7 @@
 #include "lua_api/l_settings.h"
 #include "common/c_converter.h"
 #include "common/c_content.h"
+#include "common/c_packer.h"
 #include "cpp_api/s_async.h"
 #include "network/networkprotocol.h"
 #include "serialization.h"
@@ -363,6 +364,43 @@ int ModApiUtil::l_decompress(lua_State *L)
 	return 1;
 }
 
+// serialize_binary(value)
+int ModApiUtil::l_serialize_binary(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::unique_ptr<PackedValue> pv(script_pack(L, 1));
+	std::string out;
+	try {
+		out = script_serialize_packed(pv.get());
+	} catch (SerializationError &e) {
+		throw LuaError(e.what());
+	}
+
+	lua_pushlstring(L, out.data(), out.size());
+	return 1;
+}
+
+// deserialize_binary(data) -> value or nil and error message
+int ModApiUtil::l_deserialize_binary(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	auto data = readParam<std::string_view>(L, 1);
+
+	std::unique_ptr<PackedValue> pv;
+	try {
+		pv.reset(script_deserialize_packed(data));
+	} catch (SerializationError &e) {
+		lua_pushnil(L);
+		lua_pushstring(L, e.what());
+		return 2;
+	}
+
+	script_unpack(L, pv.get());
+	return 1;
+}
+
 // encode_base64(string)
 int ModApiUtil::l_encode_base64(lua_State *L)
 {
@@ -712,6 +750,8 @@ void ModApiUtil::Initialize(lua_State *L, int top)
 
 	API_FCT(compress);
 	API_FCT(decompress);
+	API_FCT(serialize_binary);
+	API_FCT(deserialize_binary);
 
 	API_FCT(mkdir);
 	API_FCT(rmdir);
@@ -758,6 +798,8 @@ void ModApiUtil::InitializeClient(lua_State *L, int top)
 
 	API_FCT(compress);
 	API_FCT(decompress);
+	API_FCT(serialize_binary);
+	API_FCT(deserialize_binary);
 
 	API_FCT(encode_base64);
 	API_FCT(decode_base64);
@@ -795,6 +837,8 @@ void ModApiUtil::InitializeAsync(lua_State *L, int top)
 
 	API_FCT(compress);
 	API_FCT(decompress);
+	API_FCT(serialize_binary);
+	API_FCT(deserialize_binary);
 
 	API_FCT(mkdir);
 	API_FCT(rmdir);
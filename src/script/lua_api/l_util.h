@@ -65,6 +65,12 @@ class ModApiUtil : public ModApiBase
 	// decompress(data, method, ...)
 	static int l_decompress(lua_State *L);
 
+	// serialize_binary(value)
+	static int l_serialize_binary(lua_State *L);
+
+	// deserialize_binary(data)
+	static int l_deserialize_binary(lua_State *L);
+
 	// mkdir(path)
 	static int l_mkdir(lua_State *L);
 
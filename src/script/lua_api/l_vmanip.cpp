@@ -312,6 +312,33 @@ int LuaVoxelManip::l_set_param2_data(lua_State *L)
 	return 0;
 }
 
+int LuaVoxelManip::l_get_data_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	checkObject<LuaVoxelManip>(L, 1);
+	LuaVoxelManipBuffer::create(L, 1, LuaVoxelManipBuffer::FIELD_CONTENT);
+	return 1;
+}
+
+int LuaVoxelManip::l_get_light_data_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	checkObject<LuaVoxelManip>(L, 1);
+	LuaVoxelManipBuffer::create(L, 1, LuaVoxelManipBuffer::FIELD_PARAM1);
+	return 1;
+}
+
+int LuaVoxelManip::l_get_param2_data_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	checkObject<LuaVoxelManip>(L, 1);
+	LuaVoxelManipBuffer::create(L, 1, LuaVoxelManipBuffer::FIELD_PARAM2);
+	return 1;
+}
+
 int LuaVoxelManip::l_update_map(lua_State *L)
 {
 	return 0;
@@ -431,6 +458,8 @@ void LuaVoxelManip::Register(lua_State *L)
 	lua_register(L, className, create_object);
 
 	script_register_packer(L, className, packIn, packOut);
+
+	LuaVoxelManipBuffer::Register(L);
 }
 
 const char LuaVoxelManip::className[] = "VoxelManip";
@@ -449,7 +478,142 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, set_light_data),
 	luamethod(LuaVoxelManip, get_param2_data),
 	luamethod(LuaVoxelManip, set_param2_data),
+	luamethod(LuaVoxelManip, get_data_buffer),
+	luamethod(LuaVoxelManip, get_light_data_buffer),
+	luamethod(LuaVoxelManip, get_param2_data_buffer),
 	luamethod(LuaVoxelManip, was_modified),
 	luamethod(LuaVoxelManip, get_emerged_area),
 	{0,0}
 };
+
+/*
+	LuaVoxelManipBuffer
+*/
+
+void LuaVoxelManipBuffer::create(lua_State *L, int vm_idx, Field field)
+{
+	LuaVoxelManip *vm_obj = checkObject<LuaVoxelManip>(L, vm_idx);
+
+	auto *o = new LuaVoxelManipBuffer(vm_obj, field);
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+
+	// Reference the VoxelManip from the environment table of the buffer
+	// so that it is not collected before the buffer
+	lua_createtable(L, 1, 0);
+	lua_pushvalue(L, vm_idx);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+}
+
+// garbage collector
+int LuaVoxelManipBuffer::gc_object(lua_State *L)
+{
+	LuaVoxelManipBuffer *o = *(LuaVoxelManipBuffer **)(lua_touserdata(L, 1));
+	delete o;
+
+	return 0;
+}
+
+s32 LuaVoxelManipBuffer::getIndex(lua_State *L, int idx) const
+{
+	if (lua_type(L, idx) != LUA_TNUMBER)
+		return -1;
+	lua_Number n = lua_tonumber(L, idx);
+	const u32 volume = vm_obj->vm->m_area.getVolume();
+	// also rejects fractional indices and NaN
+	if (!(n >= 1 && n <= volume) || n != (lua_Number)(u32)n)
+		return -1;
+	return (s32)n - 1;
+}
+
+// The metamethods are only ever called with a buffer as first argument,
+// so checking the type of it is not needed.
+
+// buffer[i]
+int LuaVoxelManipBuffer::l_index(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	const LuaVoxelManipBuffer *o = *(LuaVoxelManipBuffer **)(lua_touserdata(L, 1));
+	const s32 i = o->getIndex(L, 2);
+	if (i < 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	const MMVManip *vm = o->vm_obj->vm;
+	// Do not push unintialized data to Lua, like get_data()
+	const bool no_data = vm->m_flags[i] & VOXELFLAG_NO_DATA;
+	const MapNode &n = vm->m_data[i];
+	switch (o->field) {
+	case FIELD_CONTENT:
+		lua_pushinteger(L, no_data ? CONTENT_IGNORE : n.getContent());
+		break;
+	case FIELD_PARAM1:
+		lua_pushinteger(L, no_data ? 0 : n.getParam1());
+		break;
+	case FIELD_PARAM2:
+		lua_pushinteger(L, no_data ? 0 : n.getParam2());
+		break;
+	}
+	return 1;
+}
+
+// buffer[i] = value
+int LuaVoxelManipBuffer::l_newindex(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	const LuaVoxelManipBuffer *o = *(LuaVoxelManipBuffer **)(lua_touserdata(L, 1));
+	const s32 i = o->getIndex(L, 2);
+	if (i < 0)
+		throw LuaError("VoxelManipBuffer: index out of bounds");
+	const lua_Integer value = luaL_checkinteger(L, 3);
+
+	MapNode &n = o->vm_obj->vm->m_data[i];
+	switch (o->field) {
+	case FIELD_CONTENT:
+		n.setContent(value);
+		break;
+	case FIELD_PARAM1:
+		n.setParam1(value);
+		break;
+	case FIELD_PARAM2:
+		n.setParam2(value);
+		break;
+	}
+	return 0;
+}
+
+// #buffer
+int LuaVoxelManipBuffer::l_len(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	const LuaVoxelManipBuffer *o = *(LuaVoxelManipBuffer **)(lua_touserdata(L, 1));
+	lua_pushinteger(L, o->vm_obj->vm->m_area.getVolume());
+	return 1;
+}
+
+void LuaVoxelManipBuffer::Register(lua_State *L)
+{
+	static const luaL_Reg metamethods[] = {
+		{"__gc", gc_object},
+		{"__index", l_index},
+		{"__newindex", l_newindex},
+		{"__len", l_len},
+		{0, 0}
+	};
+	luaL_newmetatable(L, className);
+	luaL_register(L, NULL, metamethods);
+
+	// Protect the real metatable.
+	lua_pushboolean(L, false);
+	lua_setfield(L, -2, "__metatable");
+
+	lua_pop(L, 1);
+}
+
+const char LuaVoxelManipBuffer::className[] = "VoxelManipBuffer";
@@ -42,6 +42,10 @@ class LuaVoxelManip : public ModApiBase
 	static int l_get_param2_data(lua_State *L);
 	static int l_set_param2_data(lua_State *L);
 
+	static int l_get_data_buffer(lua_State *L);
+	static int l_get_light_data_buffer(lua_State *L);
+	static int l_get_param2_data_buffer(lua_State *L);
+
 	static int l_was_modified(lua_State *L);
 	static int l_get_emerged_area(lua_State *L);
 
@@ -65,3 +69,43 @@ class LuaVoxelManip : public ModApiBase
 
 	static const char className[];
 };
+
+/*
+  VoxelManipBuffer
+
+  Gives direct access to one field of the nodes of a VoxelManip, with the
+  same indices as the flat arrays returned by VoxelManip:get_data().
+  Reads and writes go to the VoxelManip itself, nothing is copied.
+ */
+class LuaVoxelManipBuffer : public ModApiBase
+{
+public:
+	enum Field : u8 {
+		FIELD_CONTENT,
+		FIELD_PARAM1,
+		FIELD_PARAM2,
+	};
+
+	// Creates a buffer for the VoxelManip at the absolute index vm_idx and
+	// leaves it on top of stack. The buffer keeps the VoxelManip alive.
+	static void create(lua_State *L, int vm_idx, Field field);
+
+	static void Register(lua_State *L);
+
+	static const char className[];
+
+private:
+	LuaVoxelManip *vm_obj;
+	Field field;
+
+	LuaVoxelManipBuffer(LuaVoxelManip *vm_obj, Field field) :
+		vm_obj(vm_obj), field(field) {}
+
+	// Returns the index into the VoxelManip data, or -1 if out of range
+	s32 getIndex(lua_State *L, int idx) const;
+
+	static int gc_object(lua_State *L);
+	static int l_index(lua_State *L);
+	static int l_newindex(lua_State *L);
+	static int l_len(lua_State *L);
+};
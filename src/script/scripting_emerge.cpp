@@ -23,9 +23,24 @@
 #include "lua_api/l_ipc.h"
 
 extern "C" {
+#include <lauxlib.h>
 #include <lualib.h>
 }
 
+// get_transferred_item(name) -> item definition or nil
+// (see mapgen_env_lazy_definitions)
+static int l_get_transferred_item(lua_State *L)
+{
+	const auto &defs = ModApiBase::getServer(L)->m_lua_item_definitions;
+	auto it = defs.find(luaL_checkstring(L, 1));
+	if (it == defs.end())
+		return 0;
+	// the definitions are shared with the other emerge threads, this is
+	// fine since unpacking only modifies values that contain userdata
+	script_unpack(L, it->second.get());
+	return 1;
+}
+
 EmergeScripting::EmergeScripting(EmergeThread *parent):
 		ScriptApiBase(ScriptingType::Emerge)
 {
@@ -42,10 +57,18 @@ EmergeScripting::EmergeScripting(EmergeThread *parent):
 
 	InitializeModApi(L, top);
 
-	auto *data = ModApiBase::getServer(L)->m_lua_globals_data.get();
-	assert(data);
-	script_unpack(L, data);
-	lua_setfield(L, top, "transferred_globals");
+	auto *server = ModApiBase::getServer(L);
+	if (server->m_lua_mapgen_globals_data) {
+		script_unpack(L, server->m_lua_mapgen_globals_data.get());
+		lua_setfield(L, top, "transferred_globals");
+		lua_pushcfunction(L, l_get_transferred_item);
+		lua_setfield(L, top, "get_transferred_item");
+	} else {
+		auto *data = server->m_lua_globals_data.get();
+		assert(data);
+		script_unpack(L, data);
+		lua_setfield(L, top, "transferred_globals");
+	}
 
 	lua_pop(L, 1);
 
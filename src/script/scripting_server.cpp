@@ -8,6 +8,8 @@
 #include "settings.h"
 #include "filesys.h"
 #include "cpp_api/s_internal.h"
+#include "common/c_converter.h"
+#include "common/c_packer.h"
 #include "lua_api/l_areastore.h"
 #include "lua_api/l_auth.h"
 #include "lua_api/l_base.h"
@@ -93,6 +95,30 @@ void ServerScripting::saveGlobals()
 	auto *data = script_pack(L, -1);
 	assert(!data->contains_userdata);
 	getServer()->m_lua_globals_data.reset(data);
+
+	if (g_settings->getBool("mapgen_env_lazy_definitions")) {
+		// Pack every item definition on its own and only transfer the
+		// item types, builtin unpacks the definitions once they're used.
+		auto &defs = getServer()->m_lua_item_definitions;
+		lua_getfield(L, -1, "registered_items");
+		lua_newtable(L);
+		lua_pushnil(L);
+		while (lua_next(L, -3) != 0) {
+			// key at -2, value at -1
+			defs[readParam<std::string>(L, -2)].reset(script_pack(L, -1));
+			lua_getfield(L, -1, "type");
+			lua_pushvalue(L, -3);
+			lua_insert(L, -2);
+			lua_rawset(L, -5);
+			lua_pop(L, 1);
+		}
+		lua_setfield(L, -3, "registered_items");
+		lua_pop(L, 1);
+
+		data = script_pack(L, -1);
+		getServer()->m_lua_mapgen_globals_data.reset(data);
+	}
+
 	// unset the function
 	lua_pushnil(L);
 	lua_setfield(L, -3, "get_globals_to_transfer");
@@ -6,12 +6,14 @@
 #include <iostream>
 #include <queue>
 #include <algorithm>
+#include <array>
 #include "irr_v2d.h"
 #include "network/connection.h"
 #include "network/networkpacket.h"
 #include "network/networkprotocol.h"
 #include "network/serveropcodes.h"
 #include "server/ban.h"
+#include "server/blocksendcache.h"
 #include "environment.h"
 #include "servermap.h"
 #include "threading/mutex_auto_lock.h"
@@ -42,6 +44,7 @@
 #include "server/rollback.h"
 #include "util/serialize.h"
 #include "util/thread.h"
+#include "threading/workerpool.h"
 #include "defaultsettings.h"
 #include "server/mods.h"
 #include "util/base64.h"
@@ -267,7 +270,8 @@ Server::Server(
 	m_simple_singleplayer_mode(simple_singleplayer_mode),
 	m_dedicated(dedicated),
 	m_async_fatal_error(""),
-	m_con(con::createMTP(CONNECTION_TIMEOUT, m_bind_addr.isIPv6(), this)),
+	m_con(con::createMTP(CONNECTION_TIMEOUT, m_bind_addr.isIPv6(), this,
+		rangelim(g_settings->getU16("network_threads"), 1, 16))),
 	m_itemdef(createItemDefManager()),
 	m_nodedef(createNodeDefManager()),
 	m_craftdef(createCraftDefManager()),
@@ -327,6 +331,16 @@ Server::Server(
 
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
 
+	if (u32 cache_size = g_settings->getU32("block_send_cache_size")) {
+		m_block_send_cache = std::make_unique<BlockSendCache>(
+			(size_t)cache_size * 1024 * 1024, m_metrics_backend.get());
+	}
+
+	if (u32 threads = g_settings->getU32("block_send_threads")) {
+		m_block_send_workers = std::make_unique<WorkerPool>("BlockSend",
+			std::min<u32>(threads, 64));
+	}
+
 	m_path_mod_data = porting::path_user + DIR_DELIM "mod_data";
 	if (!fs::CreateDir(m_path_mod_data))
 		throw ServerError("Failed to create mod data dir");
@@ -879,61 +893,74 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
-			const RemoteClientMap &clients = m_clients.getClientList();
-			// Route data to every client
-			std::string reliable_data, unreliable_data;
-			for (const auto &client_it : clients) {
-				reliable_data.clear();
-				unreliable_data.clear();
-				RemoteClient *client = client_it.second;
-				PlayerSAO *player = getPlayerSAO(client->peer_id);
-				// Go through all objects in message buffer
-				for (const auto &buffered_message : buffered_messages) {
-					// If object does not exist or is not known by client, skip it
-					u16 id = buffered_message.first;
-					ServerActiveObject *sao = m_env->getActiveObject(id);
-					if (!sao || client->m_known_objects.find(id) == client->m_known_objects.end())
-						continue;
 
-					// Get message list of object
-					std::vector<ActiveObjectMessage>* list = buffered_message.second;
-					// Go through every message
-					for (const ActiveObjectMessage &aom : *list) {
-						// Send position updates to players who do not see the attachment
-						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION) {
-							if (sao->getId() == player->getId())
-								continue;
+			// Data to send to each client, reliable and unreliable
+			std::unordered_map<session_t, std::array<std::string, 2>> client_data;
+			// Messages of one object, serialized once for all recipients.
+			// Indexed by whether position updates are included and reliability.
+			std::string object_data[2][2];
+
+			// Route data to the clients that know the object
+			for (const auto &buffered_message : buffered_messages) {
+				u16 id = buffered_message.first;
+				ServerActiveObject *sao = m_env->getActiveObject(id);
+				const std::vector<session_t> *peers = m_clients.getObjectSubscribers(id);
+				if (!sao || !peers)
+					continue;
 
+				for (auto &data : object_data) {
+					data[0].clear();
+					data[1].clear();
+				}
+				bool has_position_update = false;
+				for (const ActiveObjectMessage &aom : *buffered_message.second) {
+					const bool is_position_update =
+						aom.datastring[0] == AO_CMD_UPDATE_POSITION;
+					has_position_update |= is_position_update;
+
+					std::string &buffer = object_data[1][aom.reliable];
+					const size_t start = buffer.size();
+					char idbuf[2];
+					writeU16((u8*) idbuf, aom.id);
+					// u16 id
+					// std::string data
+					buffer.append(idbuf, sizeof(idbuf));
+					buffer.append(serializeString16(aom.datastring));
+					if (!is_position_update)
+						object_data[0][aom.reliable].append(buffer, start);
+				}
+
+				ServerActiveObject *parent = sao->getParent();
+				for (session_t peer_id : *peers) {
+					bool with_position = true;
+					if (has_position_update) {
+						// Send position updates to players who do not see the attachment
+						if (sao->getType() == ACTIVEOBJECT_TYPE_PLAYER &&
+								static_cast<PlayerSAO*>(sao)->getPeerID() == peer_id) {
+							with_position = false;
+						} else if (parent) {
 							// Do not send position updates for attached players
 							// as long the parent is known to the client
-							ServerActiveObject *parent = sao->getParent();
-							if (parent && client->m_known_objects.find(parent->getId()) !=
-									client->m_known_objects.end())
-								continue;
+							RemoteClient *client = m_clients.lockedGetClientNoEx(peer_id, CS_Invalid);
+							if (client && client->m_known_objects.count(parent->getId()) != 0)
+								with_position = false;
 						}
-
-						// Add full new data to appropriate buffer
-						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
-						char idbuf[2];
-						writeU16((u8*) idbuf, aom.id);
-						// u16 id
-						// std::string data
-						buffer.append(idbuf, sizeof(idbuf));
-						buffer.append(serializeString16(aom.datastring));
 					}
-				}
-				/*
-					reliable_data and unreliable_data are now ready.
-					Send them.
-				*/
-				if (!reliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, reliable_data);
-				}
 
-				if (!unreliable_data.empty()) {
-					SendActiveObjectMessages(client->peer_id, unreliable_data, false);
+					auto &data = client_data[peer_id];
+					data[0].append(object_data[with_position][0]);
+					data[1].append(object_data[with_position][1]);
 				}
 			}
+
+			for (const auto &it : client_data) {
+				const std::string &reliable_data = it.second[1];
+				const std::string &unreliable_data = it.second[0];
+				if (!reliable_data.empty())
+					SendActiveObjectMessages(it.first, reliable_data);
+				if (!unreliable_data.empty())
+					SendActiveObjectMessages(it.first, unreliable_data, false);
+			}
 		}
 
 		// Clear buffered_messages
@@ -989,12 +1016,6 @@ void Server::AsyncRunStep(float dtime, bool initial_step)
 				if (!event->is_private_change) {
 					node_meta_updates.emplace(event->p);
 				}
-
-				if (MapBlock *block = m_env->getMap().getBlockNoCreateNoEx(
-						getNodeBlockPos(event->p))) {
-					block->raiseModified(MOD_STATE_WRITE_NEEDED,
-						MOD_REASON_REPORT_META_CHANGE);
-				}
 				break;
 			}
 			case MEET_OTHER:
@@ -1332,6 +1353,16 @@ void Server::setTimeOfDay(u32 time)
 
 void Server::onMapEditEvent(const MapEditEvent &event)
 {
+	// Metadata is modified in place, so this is done right away to keep
+	// stale data from being sent out of the block send cache.
+	if (event.type == MEET_BLOCK_NODE_METADATA_CHANGED) {
+		if (MapBlock *block = m_env->getMap().getBlockNoCreateNoEx(
+				getNodeBlockPos(event.p))) {
+			block->raiseModified(MOD_STATE_WRITE_NEEDED,
+				MOD_REASON_REPORT_META_CHANGE);
+		}
+	}
+
 	if (m_ignore_map_edit_events_area.contains(event.getArea()))
 		return;
 
@@ -2118,7 +2149,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		pkt << id;
 
 		// Remove from known objects
-		client->m_known_objects.erase(id);
+		m_clients.removeKnownObject(client, id);
 		if (obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
 	}
@@ -2145,7 +2176,7 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		pkt.putLongString(obj->getClientInitializationData(client->net_proto_version));
 
 		// Add to known objects
-		client->m_known_objects.insert(id);
+		m_clients.addKnownObject(client, id);
 		obj->m_known_by_count++;
 	}
 
@@ -2416,16 +2447,14 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 }
 
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version)
 {
 	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
+	std::string s;
+	const std::string *sptr = nullptr;
 
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	if (m_block_send_cache)
+		sptr = m_block_send_cache->get(block, ver);
 
 	// Serialize the block in the right format
 	if (!sptr) {
@@ -2436,82 +2465,150 @@ void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
 		sptr = &s;
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+	SendBlockData(peer_id, block->getPos(), *sptr);
 
 	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+	if (m_block_send_cache && sptr == &s)
+		m_block_send_cache->put(block, ver, std::move(s));
 }
 
-void Server::SendBlocks(float dtime)
+void Server::SendBlockData(session_t peer_id, v3s16 pos, const std::string &data)
 {
-	EnvAutoLock envlock(this);
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << pos;
+	pkt.putRawString(data);
+	Send(&pkt);
+}
+
+namespace {
 
-	std::vector<PrioritySortedBlockTransfer> queue;
+// A block that is compressed and sent off the server thread
+struct BlockSendJob {
+	v3s16 pos;
+	u8 ver;
+	u64 stamp;
+	// uncompressed at first, then the data for TOCLIENT_BLOCKDATA
+	std::string data;
+	std::vector<session_t> peer_ids;
+};
+
+}
 
-	u32 total_sending = 0, unique_clients = 0;
+void Server::SendBlocks(float dtime)
+{
+	std::vector<BlockSendJob> jobs;
 
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		EnvAutoLock envlock(this);
 
-		std::vector<session_t> clients = m_clients.getClientIDs();
+		std::vector<PrioritySortedBlockTransfer> queue;
 
-		ClientInterface::AutoLock clientlock(m_clients);
-		for (const session_t client_id : clients) {
-			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+		u32 total_sending = 0;
 
-			if (!client)
-				continue;
+		{
+			ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+
+			std::vector<session_t> clients = m_clients.getClientIDs();
 
-			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			ClientInterface::AutoLock clientlock(m_clients);
+			for (const session_t client_id : clients) {
+				RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
+
+				if (!client)
+					continue;
+
+				total_sending += client->getSendingCount();
+				client->GetNextBlocks(m_env, m_emerge.get(), dtime, queue);
+			}
 		}
-	}
 
-	// Sort.
-	// Lowest priority number comes first.
-	// Lowest is most important.
-	std::sort(queue.begin(), queue.end());
+		// Sort.
+		// Lowest priority number comes first.
+		// Lowest is most important.
+		std::sort(queue.begin(), queue.end());
 
-	ClientInterface::AutoLock clientlock(m_clients);
+		ClientInterface::AutoLock clientlock(m_clients);
 
-	// Maximal total count calculation
-	// The per-client block sends is halved with the maximal online users
-	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
-		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
+		// Maximal total count calculation
+		// The per-client block sends is halved with the maximal online users
+		u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
+			g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
 
-	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
-	Map &map = m_env->getMap();
+		ScopeProfiler sp(g_profiler, m_block_send_workers ?
+			"Server::SendBlocks(): Snapshot" : "Server::SendBlocks(): Send to clients");
+		Map &map = m_env->getMap();
+		// index into jobs by position and version
+		std::map<std::pair<v3s16, u8>, size_t> job_indices;
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
+		for (const PrioritySortedBlockTransfer &block_to_send : queue) {
+			if (total_sending >= max_blocks_to_send)
+				break;
 
-	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
-		if (total_sending >= max_blocks_to_send)
-			break;
+			MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
+			if (!block)
+				continue;
 
-		MapBlock *block = map.getBlockNoCreateNoEx(block_to_send.pos);
-		if (!block)
-			continue;
+			RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
+					CS_Active);
+			if (!client)
+				continue;
 
-		RemoteClient *client = m_clients.lockedGetClientNoEx(block_to_send.peer_id,
-				CS_Active);
-		if (!client)
-			continue;
+			const u8 ver = client->serialization_version;
+			if (!m_block_send_workers || ver < 29) {
+				SendBlockNoLock(block_to_send.peer_id, block, ver,
+						client->net_proto_version);
+			} else if (const std::string *cached = m_block_send_cache ?
+					m_block_send_cache->get(block, ver) : nullptr) {
+				SendBlockData(block_to_send.peer_id, block->getPos(), *cached);
+			} else {
+				// Only the compression is left for later, which is the slow part
+				auto key = std::make_pair(block->getPos(), ver);
+				auto it = job_indices.find(key);
+				if (it == job_indices.end()) {
+					BlockSendJob job;
+					job.pos = block->getPos();
+					job.ver = ver;
+					job.stamp = block->getChangeStamp();
+					std::ostringstream os(std::ios_base::binary);
+					block->serializeUncompressed(os, ver, false);
+					job.data = os.str();
+					it = job_indices.emplace(key, jobs.size()).first;
+					jobs.push_back(std::move(job));
+				}
+				jobs[it->second].peer_ids.push_back(block_to_send.peer_id);
+			}
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+			client->SentBlock(block_to_send.pos);
+			total_sending++;
+		}
+	}
+
+	if (jobs.empty())
+		return;
+
+	// The environment is not locked anymore so that the emerge threads and
+	// others can go on in the meantime
+	{
+		ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Compress and send");
+		g_profiler->avg("Server::SendBlocks(): Compressed blocks [#]", jobs.size());
+
+		const int net_compression_level = rangelim(
+			g_settings->getS16("map_compression_level_net"), -1, 9);
+		m_block_send_workers->run(jobs.size(), [&] (size_t i) {
+			BlockSendJob &job = jobs[i];
+			std::ostringstream os(std::ios_base::binary);
+			compress(job.data, os, job.ver, net_compression_level);
+			MapBlock::serializeNetworkSpecific(os);
+			job.data = os.str();
+
+			for (session_t peer_id : job.peer_ids)
+				SendBlockData(peer_id, job.pos, job.data);
+		});
+	}
 
-		client->SentBlock(block_to_send.pos);
-		total_sending++;
+	if (m_block_send_cache) {
+		for (BlockSendJob &job : jobs)
+			m_block_send_cache->put(job.pos, job.ver, job.stamp, std::move(job.data));
 	}
 }
 
@@ -29,6 +29,7 @@
 #include <list>
 #include <map>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 #include <optional>
 #include <string_view>
@@ -62,6 +63,8 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class BlockSendCache;
+class WorkerPool;
 struct PackedValue;
 struct ParticleParameters;
 struct ParticleSpawnerParameters;
@@ -449,6 +452,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// Data transferred into other Lua envs at init time
 	std::unique_ptr<PackedValue> m_lua_globals_data;
+	// Variant of the above for the mapgen env if mapgen_env_lazy_definitions
+	// is enabled: item definitions are left out and unpacked on demand from
+	// m_lua_item_definitions, which is shared by all emerge threads.
+	std::unique_ptr<PackedValue> m_lua_mapgen_globals_data;
+	std::unordered_map<std::string, std::unique_ptr<PackedValue>> m_lua_item_definitions;
 
 	// Bind address
 	Address m_bind_addr;
@@ -502,15 +510,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
 
 	void SendMovement(session_t peer_id);
@@ -567,9 +566,10 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version);
+	// Sends an already serialized block, may be called from any thread
+	void SendBlockData(session_t peer_id, v3s16 pos, const std::string &data);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -775,6 +775,11 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Global server metrics backend
 	std::unique_ptr<MetricsBackend> m_metrics_backend;
 
+	// Blocks serialized for sending (may be null)
+	std::unique_ptr<BlockSendCache> m_block_send_cache;
+	// Threads compressing blocks for sending (may be null)
+	std::unique_ptr<WorkerPool> m_block_send_workers;
+
 	// Server metrics
 	MetricCounterPtr m_uptime_counter;
 	MetricGaugePtr m_player_gauge;
@@ -0,0 +1,83 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "abmscanner.h"
+#include "mapblock.h"
+#include "noise.h" // PcgRandom
+
+bool ABMScanner::mayHaveTriggers(MapBlock *block) const
+{
+	if (m_aabms.empty())
+		return false;
+	if (block->contents.empty())
+		return true;
+
+	assert(!block->do_not_cache_contents); // invariant
+	for (content_t c : block->contents) {
+		if (c < m_aabms.size() && m_aabms[c])
+			return true;
+	}
+	return false;
+}
+
+void ABMScanner::addToContentCache(MapBlock *block, content_t c,
+		bool &want_contents_cached)
+{
+	if (!block->addToContentCache(c))
+		want_contents_cached = false;
+}
+
+void ABMScanner::scan(MapBlock *const neighbors[27], PcgRandom &rand,
+		std::vector<ABMTrigger> &out) const
+{
+	MapBlock *block = neighbors[13];
+	const s16 y_offset = block->getPosRelative().Y;
+	bool want_contents_cached = block->contents.empty() && !block->do_not_cache_contents;
+
+	auto get_content = [block, neighbors] (v3s16 p1) -> content_t {
+		if (block->isValidPosition(p1))
+			return block->getNodeNoCheck(p1).getContent();
+
+		v3s16 bp(0, 0, 0);
+		for (u32 i = 0; i < 3; i++) {
+			if (p1[i] < 0)
+				bp[i] = -1;
+			else if (p1[i] >= MAP_BLOCKSIZE)
+				bp[i] = 1;
+		}
+		MapBlock *b = neighbors[(bp.Z + 1) * 9 + (bp.Y + 1) * 3 + (bp.X + 1)];
+		if (!b)
+			return CONTENT_IGNORE;
+		return b->getNodeNoCheck(p1 - bp * MAP_BLOCKSIZE).getContent();
+	};
+
+	v3s16 p0;
+	for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
+	for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
+	for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
+	{
+		const MapNode n = block->getNodeNoCheck(p0);
+		const content_t c = n.getContent();
+
+		// Cache content types as we go
+		if (want_contents_cached)
+			addToContentCache(block, c, want_contents_cached);
+
+		if (c >= m_aabms.size() || !m_aabms[c])
+			continue;
+
+		const s16 y = p0.Y + y_offset;
+		for (const ActiveABM &aabm : *m_aabms[c]) {
+			if (y < aabm.min_y || y > aabm.max_y)
+				continue;
+
+			if (rand.next() % aabm.chance != 0)
+				continue;
+
+			if (!checkNeighbors(aabm, p0, get_content))
+				continue;
+
+			out.push_back({p0, n, &aabm});
+		}
+	}
+}
@@ -0,0 +1,102 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "util/basic_macros.h" // CONTAINS
+
+class ActiveBlockModifier;
+class MapBlock;
+class PcgRandom;
+
+// An ABM that is due to run, with its per-run parameters
+struct ActiveABM
+{
+	ActiveBlockModifier *abm;
+	std::vector<content_t> required_neighbors;
+	std::vector<content_t> without_neighbors;
+	int chance;
+	s16 min_y, max_y;
+};
+
+// A node an ABM is to be triggered on
+struct ABMTrigger
+{
+	v3s16 p0; // relative to the block
+	MapNode n;
+	const ActiveABM *aabm;
+};
+
+/*
+	Finds the nodes of a block that ABMs are to be triggered on, i.e. does
+	the content lookup, y limit, chance and neighbor checks without running
+	anything.
+
+	Scanning only reads the map (apart from the content cache of the scanned
+	block itself), so different blocks can be scanned on several threads at
+	once as long as nothing modifies the map meanwhile.
+*/
+class ABMScanner
+{
+public:
+	// The ABMs to run, indexed by content id. Entries may be null.
+	typedef std::vector<std::vector<ActiveABM> *> ABMTable;
+
+	ABMScanner(const ABMTable &aabms) : m_aabms(aabms) {}
+
+	// Returns false if the content cache of the block says that there is
+	// nothing to run in it
+	bool mayHaveTriggers(MapBlock *block) const;
+
+	/*
+	 * Appends the triggers in the block to out and updates its content cache.
+	 * neighbors are the 3x3x3 blocks around the block (X varying fastest,
+	 * the block itself in the middle), missing ones may be null.
+	 */
+	void scan(MapBlock *const neighbors[27], PcgRandom &rand,
+			std::vector<ABMTrigger> &out) const;
+
+	static void addToContentCache(MapBlock *block, content_t c,
+			bool &want_contents_cached);
+
+	// Checks the neighbor conditions of the ABM for the node at p0.
+	// get_content(p1) returns the content at p1, relative to the same block.
+	template <typename F>
+	static bool checkNeighbors(const ActiveABM &aabm, v3s16 p0, F &&get_content)
+	{
+		const bool check_required_neighbors = !aabm.required_neighbors.empty();
+		const bool check_without_neighbors = !aabm.without_neighbors.empty();
+		if (!check_required_neighbors && !check_without_neighbors)
+			return true;
+
+		v3s16 p1;
+		bool have_required = false;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if(p1 == p0)
+				continue;
+			content_t c = get_content(p1);
+			if (check_required_neighbors && !have_required) {
+				if (CONTAINS(aabm.required_neighbors, c)) {
+					if (!check_without_neighbors)
+						return true;
+					have_required = true;
+				}
+			}
+			if (check_without_neighbors) {
+				if (CONTAINS(aabm.without_neighbors, c))
+					return false;
+			}
+		}
+		return have_required || !check_required_neighbors;
+	}
+
+private:
+	const ABMTable &m_aabms;
+};
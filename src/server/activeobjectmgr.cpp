@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2018 nerzhul, Loic BLOT <loic.blot@unix-experience.fr>
 
+#include <algorithm>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -19,12 +20,21 @@ ActiveObjectMgr::~ActiveObjectMgr()
 	}
 }
 
+void ActiveObjectMgr::clear()
+{
+	::ActiveObjectMgr<ServerActiveObject>::clear();
+	m_spatial_map.clear();
+	m_player_ids.clear();
+}
+
 void ActiveObjectMgr::clearIf(const std::function<bool(ServerActiveObject *, u16)> &cb)
 {
 	for (auto &it : m_active_objects.iter()) {
 		if (!it.second)
 			continue;
 		if (cb(it.second.get(), it.first)) {
+			m_spatial_map.remove(it.first);
+			m_player_ids.erase(it.first);
 			// Remove reference from m_active_objects
 			m_active_objects.remove(it.first);
 		}
@@ -77,6 +87,9 @@ bool ActiveObjectMgr::registerObject(std::unique_ptr<ServerActiveObject> obj)
 	}
 
 	auto obj_id = obj->getId();
+	m_spatial_map.insert(obj_id, obj->getBasePosition());
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.insert(obj_id);
 	m_active_objects.put(obj_id, std::move(obj));
 
 	auto new_size = m_active_objects.size();
@@ -95,6 +108,9 @@ void ActiveObjectMgr::removeObject(u16 id)
 	verbosestream << "Server::ActiveObjectMgr::removeObject(): "
 			<< "id=" << id << std::endl;
 
+	m_spatial_map.remove(id);
+	m_player_ids.erase(id);
+
 	// this will take the object out of the map and then destruct it
 	bool ok = m_active_objects.remove(id);
 	if (!ok) {
@@ -103,6 +119,11 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 }
 
+void ActiveObjectMgr::updateObjectPos(u16 id, v3f pos)
+{
+	m_spatial_map.updatePosition(id, pos);
+}
+
 void ActiveObjectMgr::invalidateActiveObjectObserverCaches()
 {
 	for (auto &active_object : m_active_objects.iter()) {
@@ -113,13 +134,24 @@ void ActiveObjectMgr::invalidateActiveObjectObserverCaches()
 	}
 }
 
+void ActiveObjectMgr::getCandidateIds(const aabb3f &box,
+		std::vector<u16> &result) const
+{
+	m_spatial_map.getRelevantObjectIds(box, result);
+	// Keep the id order of a full scan, callers may depend on it
+	std::sort(result.begin(), result.end());
+}
+
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects.iter()) {
-		ServerActiveObject *obj = activeObject.second.get();
+	std::vector<u16> ids;
+	getCandidateIds(aabb3f(pos - radius, pos + radius), ids);
+	for (u16 id : ids) {
+		// The callback may remove objects, so look each one up again
+		ServerActiveObject *obj = m_active_objects.get(id).get();
 		if (!obj)
 			continue;
 		const v3f &objectpos = obj->getBasePosition();
@@ -135,8 +167,10 @@ void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects.iter()) {
-		ServerActiveObject *obj = activeObject.second.get();
+	std::vector<u16> ids;
+	getCandidateIds(box, ids);
+	for (u16 id : ids) {
+		ServerActiveObject *obj = m_active_objects.get(id).get();
 		if (!obj)
 			continue;
 		const v3f &objectpos = obj->getBasePosition();
@@ -162,11 +196,22 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(
 		- discard objects that are not observed by the player.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects.iter()) {
-		u16 id = ao_it.first;
-
+	f32 query_radius = radius;
+	if (player_radius != 0)
+		query_radius = std::max(radius, player_radius);
+
+	std::vector<u16> ids;
+	m_spatial_map.getRelevantObjectIds(
+			aabb3f(player_pos - query_radius, player_pos + query_radius), ids);
+	// players are always relevant if their transfer distance is unlimited
+	if (player_radius == 0)
+		ids.insert(ids.end(), m_player_ids.begin(), m_player_ids.end());
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	for (u16 id : ids) {
 		// Get object
-		ServerActiveObject *object = ao_it.second.get();
+		ServerActiveObject *object = m_active_objects.get(id).get();
 		if (!object)
 			continue;
 
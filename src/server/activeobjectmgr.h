@@ -5,9 +5,11 @@
 #pragma once
 
 #include <functional>
+#include <set>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
+#include "spatial_map.h"
 
 namespace server
 {
@@ -16,6 +18,7 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 public:
 	~ActiveObjectMgr() override;
 
+	void clear();
 	// If cb returns true, the obj will be deleted
 	void clearIf(const std::function<bool(ServerActiveObject *, u16)> &cb);
 	void step(float dtime,
@@ -23,6 +26,9 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(std::unique_ptr<ServerActiveObject> obj) override;
 	void removeObject(u16 id) override;
 
+	// Must be called whenever the base position of an object changes
+	void updateObjectPos(u16 id, v3f pos);
+
 	void invalidateActiveObjectObserverCaches();
 
 	void getObjectsInsideRadius(const v3f &pos, float radius,
@@ -36,5 +42,14 @@ class ActiveObjectMgr final : public ::ActiveObjectMgr<ServerActiveObject>
 			f32 radius, f32 player_radius,
 			const std::set<u16> &current_objects,
 			std::vector<u16> &added_objects);
+
+private:
+	// Appends ids of objects possibly inside box, sorted
+	void getCandidateIds(const aabb3f &box, std::vector<u16> &result) const;
+
+	SpatialMap m_spatial_map;
+	// Player objects, so unlimited player_transfer_distance does not need
+	// a full scan
+	std::set<u16> m_player_ids;
 };
 } // namespace server
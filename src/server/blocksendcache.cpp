@@ -0,0 +1,88 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "blocksendcache.h"
+#include "mapblock.h"
+
+BlockSendCache::BlockSendCache(size_t max_bytes, MetricsBackend *mb) :
+	m_max_bytes(max_bytes)
+{
+	m_hit_counter = mb->addCounter(
+		"minetest_block_send_cache_hits",
+		"Number of block sends served from the serialized block cache");
+	m_miss_counter = mb->addCounter(
+		"minetest_block_send_cache_misses",
+		"Number of block sends that had to serialize the block");
+	m_size_gauge = mb->addGauge(
+		"minetest_block_send_cache_size",
+		"Memory used by the serialized block cache (in bytes)");
+}
+
+size_t BlockSendCache::Entry::getSize() const
+{
+	// rough estimate of the bookkeeping overhead
+	return data.size() + sizeof(Entry) + 4 * sizeof(void*);
+}
+
+const std::string *BlockSendCache::get(const MapBlock *block, u8 ver)
+{
+	auto it = m_entries.find({block->getPos(), ver});
+	if (it == m_entries.end()) {
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	EntryIt entry = it->second;
+	if (entry->stamp != block->getChangeStamp()) {
+		// block was modified or replaced since
+		erase(entry);
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, entry);
+	m_hit_counter->increment();
+	return &entry->data;
+}
+
+void BlockSendCache::put(const MapBlock *block, u8 ver, std::string &&data)
+{
+	put(block->getPos(), ver, block->getChangeStamp(), std::move(data));
+}
+
+void BlockSendCache::put(v3s16 pos, u8 ver, u64 stamp, std::string &&data)
+{
+	const Key key(pos, ver);
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		erase(it->second);
+
+	Entry entry{key, stamp, std::move(data)};
+	if (entry.getSize() > m_max_bytes)
+		return;
+
+	m_size += entry.getSize();
+	m_lru.push_front(std::move(entry));
+	m_entries[key] = m_lru.begin();
+
+	m_size_gauge->set(m_size);
+
+	while (m_size > m_max_bytes)
+		erase(std::prev(m_lru.end()));
+}
+
+void BlockSendCache::clear()
+{
+	m_lru.clear();
+	m_entries.clear();
+	m_size = 0;
+	m_size_gauge->set(0);
+}
+
+void BlockSendCache::erase(EntryIt it)
+{
+	m_size -= it->getSize();
+	m_entries.erase(it->key);
+	m_lru.erase(it);
+	m_size_gauge->set(m_size);
+}
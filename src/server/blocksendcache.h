@@ -0,0 +1,68 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "irrlichttypes_bloated.h"
+#include "util/metricsbackend.h"
+
+class MapBlock;
+
+/*
+	Keeps blocks serialized in network format, so that an unchanged block does
+	not have to be serialized and compressed again for every client that is
+	sent it.
+
+	Entries are validated with MapBlock::getChangeStamp() and the least
+	recently used ones are dropped when the memory budget is exceeded.
+	Not thread-safe.
+*/
+class BlockSendCache
+{
+public:
+	BlockSendCache(size_t max_bytes, MetricsBackend *mb);
+
+	// Returns the cached data if it matches the current state of the block
+	const std::string *get(const MapBlock *block, u8 ver);
+	void put(const MapBlock *block, u8 ver, std::string &&data);
+	// For data serialized from the block when it had the given change stamp
+	void put(v3s16 pos, u8 ver, u64 stamp, std::string &&data);
+
+	void clear();
+
+	size_t getSize() const { return m_size; }
+
+private:
+	typedef std::pair<v3s16, u8> Key;
+
+	struct KeyHash {
+		size_t operator()(const Key &k) const {
+			return std::hash<v3s16>()(k.first) ^ k.second;
+		}
+	};
+
+	struct Entry {
+		Key key;
+		u64 stamp;
+		std::string data;
+
+		size_t getSize() const;
+	};
+
+	typedef std::list<Entry>::iterator EntryIt;
+
+	void erase(EntryIt it);
+
+	const size_t m_max_bytes;
+	size_t m_size = 0;
+	// most recently used first
+	std::list<Entry> m_lru;
+	std::unordered_map<Key, EntryIt, KeyHash> m_entries;
+
+	MetricCounterPtr m_hit_counter;
+	MetricCounterPtr m_miss_counter;
+	MetricGaugePtr m_size_gauge;
+};
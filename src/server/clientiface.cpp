@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: LGPL-2.1-or-later
 // Copyright (C) 2010-2014 celeron55, Perttu Ahola <celeron55@gmail.com>
 
+#include <algorithm>
 #include <sstream>
 #include "clientiface.h"
 #include "debug.h"
@@ -818,6 +819,37 @@ RemoteClient* ClientInterface::lockedGetClientNoEx(session_t peer_id, ClientStat
 	return NULL;
 }
 
+void ClientInterface::addKnownObject(RemoteClient *client, u16 id)
+{
+	RecursiveMutexAutoLock clientslock(m_clients_mutex);
+	if (client->m_known_objects.insert(id).second)
+		m_object_subscribers[id].push_back(client->peer_id);
+}
+
+void ClientInterface::removeKnownObject(RemoteClient *client, u16 id)
+{
+	RecursiveMutexAutoLock clientslock(m_clients_mutex);
+	if (client->m_known_objects.erase(id) != 0)
+		removeObjectSubscriber(id, client->peer_id);
+}
+
+void ClientInterface::removeObjectSubscriber(u16 id, session_t peer_id)
+{
+	auto it = m_object_subscribers.find(id);
+	if (it == m_object_subscribers.end())
+		return;
+	auto &peers = it->second;
+	peers.erase(std::remove(peers.begin(), peers.end(), peer_id), peers.end());
+	if (peers.empty())
+		m_object_subscribers.erase(it);
+}
+
+const std::vector<session_t> *ClientInterface::getObjectSubscribers(u16 id) const
+{
+	auto it = m_object_subscribers.find(id);
+	return it == m_object_subscribers.end() ? nullptr : &it->second;
+}
+
 ClientState ClientInterface::getClientState(session_t peer_id)
 {
 	RecursiveMutexAutoLock clientslock(m_clients_mutex);
@@ -863,6 +895,8 @@ void ClientInterface::DeleteClient(session_t peer_id)
 
 		if(obj && obj->m_known_by_count > 0)
 			obj->m_known_by_count--;
+
+		removeObjectSubscriber(id, peer_id);
 	}
 
 	// Delete client
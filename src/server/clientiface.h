@@ -518,16 +518,27 @@ class ClientInterface {
 
 	RemoteClientMap& getClientList() { return m_clients; }
 
+	/* mark an active object as known / not known by a client */
+	void addKnownObject(RemoteClient *client, u16 id);
+	void removeKnownObject(RemoteClient *client, u16 id);
+
+	/* get the peers that know an active object, or nullptr (make sure you have list lock before!) */
+	const std::vector<session_t> *getObjectSubscribers(u16 id) const;
+
 private:
 	/* update internal player list */
 	void UpdatePlayerList();
 
+	void removeObjectSubscriber(u16 id, session_t peer_id);
+
 	// Connection
 	std::shared_ptr<con::IConnection> m_con;
 	std::recursive_mutex m_clients_mutex;
 	// Connected clients (behind the con mutex)
 	RemoteClientMap m_clients;
 	std::vector<std::string> m_clients_names; //for announcing masterserver
+	// Reverse of RemoteClient::m_known_objects (behind the con mutex)
+	std::unordered_map<u16, std::vector<session_t>> m_object_subscribers;
 
 	// Environment
 	ServerEnvironment *m_env;
@@ -0,0 +1,243 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "mapsavethread.h"
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include "database/database.h"
+#include "debug.h"
+#include "log.h"
+#include "mapblock.h"
+#include "porting.h"
+#include "profiler.h"
+#include "serialization.h"
+#include "servermap.h" // MapDatabaseAccessor
+#include "irrlicht_changes/printing.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/serialize.h"
+
+// Maximum number of blocks written in one database transaction
+static constexpr size_t MAX_BATCH_SIZE = 256;
+// Number of attempts to write a block before giving up on it
+static constexpr u8 MAX_TRIES = 3;
+
+MapSaveThread::MapSaveThread(MapDatabaseAccessor *db, int compression_level,
+		size_t max_queued_bytes, MetricsBackend *mb) :
+	Thread("MapSave"),
+	m_db(db),
+	m_compression_level(compression_level),
+	m_max_queued_bytes(max_queued_bytes)
+{
+	m_queue_gauge = mb->addGauge(
+		"minetest_map_save_queue_blocks",
+		"Number of blocks waiting to be written to the database");
+	m_write_time_counter = mb->addCounter(
+		"minetest_map_save_write_time",
+		"Time spent compressing and writing blocks on the map saving thread (in microseconds)");
+	m_flush_latency_gauge = mb->addGauge(
+		"minetest_map_save_flush_latency",
+		"Time from queuing until writing of the oldest block in the last batch (in milliseconds)");
+}
+
+void MapSaveThread::enqueue(MapBlock *block)
+{
+	Job job;
+	job.version = SER_FMT_VER_HIGHEST_WRITE;
+	{
+		std::ostringstream os(std::ios_base::binary);
+		block->serializeUncompressed(os, job.version, true);
+		job.data = os.str();
+	}
+	job.queued_at = porting::getTimeUs();
+	const v3s16 pos = block->getPos();
+	const size_t size = job.data.size();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_queued_bytes > m_max_queued_bytes && isRunning()) {
+		ScopeProfiler sp(g_profiler, "MapSaveThread: queue full wait", SPT_AVG);
+		m_done_cv.wait(lock, [this] {
+			return m_queued_bytes <= m_max_queued_bytes || m_exited;
+		});
+	}
+
+	auto it = m_queue.find(pos);
+	if (it != m_queue.end()) {
+		// replace the older snapshot
+		m_queued_bytes -= it->second.data.size();
+		it->second = std::move(job);
+	} else {
+		m_queue.emplace(pos, std::move(job));
+	}
+	m_queued_bytes += size;
+	m_queue_gauge->set(m_queue.size() + m_in_flight.size());
+
+	m_work_cv.notify_one();
+}
+
+void MapSaveThread::flush()
+{
+	if (!isRunning())
+		return;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this] {
+		return (m_queue.empty() && m_in_flight.empty()) || m_exited;
+	});
+}
+
+void MapSaveThread::discard(v3s16 pos)
+{
+	MutexAutoLock lock(m_mutex);
+	auto it = m_queue.find(pos);
+	if (it != m_queue.end()) {
+		m_queued_bytes -= it->second.data.size();
+		m_queue.erase(it);
+	}
+	it = m_in_flight.find(pos);
+	if (it != m_in_flight.end())
+		it->second.discarded = true;
+}
+
+bool MapSaveThread::getPending(v3s16 pos, std::string &ret)
+{
+	MutexAutoLock lock(m_mutex);
+	// if a block is in both, the queued snapshot is the newer one
+	auto it = m_queue.find(pos);
+	if (it == m_queue.end()) {
+		it = m_in_flight.find(pos);
+		if (it == m_in_flight.end() || it->second.discarded)
+			return false;
+	}
+	ret = toBlob(it->second);
+	return true;
+}
+
+void MapSaveThread::signal()
+{
+	MutexAutoLock lock(m_mutex);
+	m_work_cv.notify_all();
+}
+
+std::string MapSaveThread::toBlob(const Job &job) const
+{
+	// same format as ServerMap::saveBlock()
+	std::ostringstream os(std::ios_base::binary);
+	writeU8(os, job.version);
+	compress(job.data, os, job.version, m_compression_level);
+	return os.str();
+}
+
+void MapSaveThread::processBatch()
+{
+	const u64 start_time = porting::getTimeUs();
+	u64 oldest_job = start_time;
+
+	// m_in_flight is only modified by this thread, so it can be read
+	// without holding the lock
+	std::vector<std::pair<v3s16, std::string>> blobs;
+	blobs.reserve(m_in_flight.size());
+	for (auto &it : m_in_flight) {
+		blobs.emplace_back(it.first, toBlob(it.second));
+		oldest_job = std::min(oldest_job, it.second.queued_at);
+	}
+
+	std::vector<bool> written(blobs.size(), false);
+	{
+		MutexAutoLock dblock(m_db->mutex);
+		MapDatabase *db = m_db->dbase;
+		db->beginSave();
+		for (size_t i = 0; i < blobs.size(); i++) {
+			const v3s16 pos = blobs[i].first;
+			{
+				MutexAutoLock lock(m_mutex);
+				if (m_in_flight.find(pos)->second.discarded) {
+					written[i] = true;
+					continue;
+				}
+			}
+			try {
+				written[i] = db->saveBlock(pos, blobs[i].second);
+			} catch (std::exception &e) {
+				errorstream << "MapSaveThread: failed to save block " << pos
+						<< ": " << e.what() << std::endl;
+			}
+		}
+		try {
+			db->endSave();
+		} catch (std::exception &e) {
+			errorstream << "MapSaveThread: failed to commit blocks: "
+					<< e.what() << std::endl;
+			written.assign(written.size(), false);
+		}
+	}
+
+	const u64 end_time = porting::getTimeUs();
+	bool failed = false;
+	{
+		MutexAutoLock lock(m_mutex);
+		for (size_t i = 0; i < blobs.size(); i++) {
+			const v3s16 pos = blobs[i].first;
+			auto it = m_in_flight.find(pos);
+			Job &job = it->second;
+			m_queued_bytes -= job.data.size();
+
+			// Retry unless the block was deleted or saved again meanwhile
+			if (!written[i] && !job.discarded && m_queue.count(pos) == 0) {
+				failed = true;
+				if (++job.tries < MAX_TRIES) {
+					m_queued_bytes += job.data.size();
+					m_queue.emplace(pos, std::move(job));
+				} else {
+					errorstream << "MapSaveThread: giving up on saving block "
+							<< pos << std::endl;
+				}
+			}
+			m_in_flight.erase(it);
+		}
+		m_queue_gauge->set(m_queue.size());
+	}
+	m_done_cv.notify_all();
+
+	m_write_time_counter->increment(end_time - start_time);
+	m_flush_latency_gauge->set((end_time - oldest_job) / 1000.0);
+
+	// don't hammer a database that is failing
+	if (failed)
+		sleep_ms(1000);
+}
+
+void *MapSaveThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [this] {
+				return !m_queue.empty() || stopRequested();
+			});
+			// when stopping, everything queued is still written out
+			if (m_queue.empty())
+				break;
+
+			while (!m_queue.empty() && m_in_flight.size() < MAX_BATCH_SIZE) {
+				auto it = m_queue.begin();
+				m_in_flight.emplace(it->first, std::move(it->second));
+				m_queue.erase(it);
+			}
+		}
+
+		processBatch();
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	{
+		MutexAutoLock lock(m_mutex);
+		m_exited = true;
+	}
+	m_done_cv.notify_all();
+
+	return nullptr;
+}
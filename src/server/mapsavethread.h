@@ -0,0 +1,85 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include "irrlichttypes_bloated.h"
+#include "threading/thread.h"
+#include "util/metricsbackend.h"
+
+class MapBlock;
+struct MapDatabaseAccessor;
+
+/*
+	Writes map blocks to the database on a separate thread.
+
+	The thread owning the map only takes a snapshot of each block with
+	MapBlock::serializeUncompressed(), compression and the database
+	transaction happen here. Snapshots are coalesced by position, so only the
+	newest one of a block is written.
+*/
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapDatabaseAccessor *db, int compression_level,
+			size_t max_queued_bytes, MetricsBackend *mb);
+
+	// Takes a snapshot of the block and queues it.
+	// Waits for the thread if too much data is queued already.
+	void enqueue(MapBlock *block);
+
+	// Waits until everything queued so far has been written
+	void flush();
+
+	// Drops any pending write of the block at pos.
+	// @note call with the database mutex held
+	void discard(v3s16 pos);
+
+	// Returns the newest data of the block at pos that has not reached the
+	// database yet, in database format.
+	// @note call with the database mutex held
+	bool getPending(v3s16 pos, std::string &ret);
+
+	// Wakes up the thread, e.g. after stop()
+	void signal();
+
+protected:
+	void *run() override;
+
+private:
+	struct Job {
+		u8 version;
+		std::string data; // uncompressed
+		u64 queued_at; // microseconds
+		u8 tries = 0;
+		bool discarded = false;
+	};
+
+	std::string toBlob(const Job &job) const;
+	void processBatch();
+
+	MapDatabaseAccessor *m_db;
+	const int m_compression_level;
+	const size_t m_max_queued_bytes;
+
+	std::mutex m_mutex;
+	// signaled when there is something to write
+	std::condition_variable m_work_cv;
+	// signaled when a batch was written
+	std::condition_variable m_done_cv;
+	std::map<v3s16, Job> m_queue;
+	// jobs currently being written, only modified by the thread itself
+	std::map<v3s16, Job> m_in_flight;
+	// size of m_queue and m_in_flight
+	size_t m_queued_bytes = 0;
+	// set once run() has returned, nobody is going to drain the queue anymore
+	bool m_exited = false;
+
+	MetricGaugePtr m_queue_gauge;
+	MetricCounterPtr m_write_time_counter;
+	MetricGaugePtr m_flush_latency_gauge;
+};
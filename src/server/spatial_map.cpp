@@ -0,0 +1,126 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "spatial_map.h"
+#include <cmath>
+#include "constants.h" // BS, MAP_BLOCKSIZE
+#include "debug.h"
+
+namespace server
+{
+
+static constexpr f32 CELL_SIZE = MAP_BLOCKSIZE * BS;
+
+static inline s16 cell_coord(f32 v)
+{
+	f32 c = std::floor(v / CELL_SIZE);
+	// the comparisons are written so that NaN ends up in cell 0
+	if (c >= S16_MAX)
+		return S16_MAX;
+	if (c <= S16_MIN)
+		return S16_MIN;
+	if (c == c)
+		return static_cast<s16>(c);
+	return 0;
+}
+
+v3s16 SpatialMap::getCell(v3f pos)
+{
+	return v3s16(cell_coord(pos.X), cell_coord(pos.Y), cell_coord(pos.Z));
+}
+
+void SpatialMap::addToCell(u16 id, v3s16 cell)
+{
+	auto &ids = m_cells[cell];
+	m_entries[id] = Entry{cell, static_cast<u32>(ids.size())};
+	ids.push_back(id);
+}
+
+void SpatialMap::removeFromCell(u16 id, const Entry &entry)
+{
+	auto it = m_cells.find(entry.cell);
+	sanity_check(it != m_cells.end());
+	auto &ids = it->second;
+	assert(ids[entry.index] == id);
+
+	// swap with the last element so removal is constant-time
+	u16 last = ids.back();
+	if (last != id) {
+		ids[entry.index] = last;
+		m_entries[last].index = entry.index;
+	}
+	ids.pop_back();
+	if (ids.empty())
+		m_cells.erase(it);
+}
+
+void SpatialMap::insert(u16 id, v3f pos)
+{
+	if (m_entries.count(id) != 0)
+		remove(id);
+	addToCell(id, getCell(pos));
+}
+
+void SpatialMap::remove(u16 id)
+{
+	auto it = m_entries.find(id);
+	if (it == m_entries.end())
+		return;
+	Entry entry = it->second;
+	m_entries.erase(it);
+	removeFromCell(id, entry);
+}
+
+void SpatialMap::updatePosition(u16 id, v3f pos)
+{
+	auto it = m_entries.find(id);
+	if (it == m_entries.end())
+		return;
+	v3s16 cell = getCell(pos);
+	if (it->second.cell == cell)
+		return;
+	Entry entry = it->second;
+	removeFromCell(id, entry);
+	addToCell(id, cell);
+}
+
+void SpatialMap::clear()
+{
+	m_cells.clear();
+	m_entries.clear();
+}
+
+void SpatialMap::getRelevantObjectIds(const aabb3f &box,
+		std::vector<u16> &result) const
+{
+	const v3s16 min = getCell(box.MinEdge);
+	const v3s16 max = getCell(box.MaxEdge);
+	if (min.X > max.X || min.Y > max.Y || min.Z > max.Z)
+		return;
+
+	const u64 num_cells = (u64)(max.X - min.X + 1) * (max.Y - min.Y + 1) *
+			(max.Z - min.Z + 1);
+
+	// Huge boxes: walking the occupied cells is cheaper than probing
+	if (num_cells > m_cells.size()) {
+		for (auto &it : m_cells) {
+			const v3s16 &c = it.first;
+			if (c.X < min.X || c.Y < min.Y || c.Z < min.Z ||
+					c.X > max.X || c.Y > max.Y || c.Z > max.Z)
+				continue;
+			result.insert(result.end(), it.second.begin(), it.second.end());
+		}
+		return;
+	}
+
+	// s32 so the loops terminate when the box touches the edge of the range
+	for (s32 z = min.Z; z <= max.Z; z++)
+	for (s32 y = min.Y; y <= max.Y; y++)
+	for (s32 x = min.X; x <= max.X; x++) {
+		auto it = m_cells.find(v3s16(x, y, z));
+		if (it != m_cells.end())
+			result.insert(result.end(), it->second.begin(), it->second.end());
+	}
+}
+
+} // namespace server
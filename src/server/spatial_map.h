@@ -0,0 +1,54 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "irrlichttypes_bloated.h"
+
+namespace server
+{
+
+/*
+	Uniform grid over the positions of active objects.
+
+	Each cell is one mapblock wide. Objects are bucketed by the cell of their
+	base position, so area queries only have to look at the cells overlapping
+	the queried box instead of at every object.
+*/
+class SpatialMap
+{
+public:
+	void insert(u16 id, v3f pos);
+	void remove(u16 id);
+	// Moves the object to the cell containing pos. Unknown ids are ignored.
+	void updatePosition(u16 id, v3f pos);
+	void clear();
+
+	/*
+		Appends the ids of all objects whose cell overlaps box to result.
+		This is a superset of the objects inside the box, the caller has
+		to do the exact check.
+	*/
+	void getRelevantObjectIds(const aabb3f &box, std::vector<u16> &result) const;
+
+	size_t size() const { return m_entries.size(); }
+
+private:
+	struct Entry {
+		v3s16 cell;
+		// index into the vector of m_cells[cell]
+		u32 index;
+	};
+
+	static v3s16 getCell(v3f pos);
+
+	void removeFromCell(u16 id, const Entry &entry);
+	void addToCell(u16 id, v3s16 cell);
+
+	std::unordered_map<v3s16, std::vector<u16>> m_cells;
+	std::unordered_map<u16, Entry> m_entries;
+};
+
+} // namespace server
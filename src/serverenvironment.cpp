@@ -11,6 +11,7 @@
 #include "mapblock.h"
 #include "nodedef.h"
 #include "nodemetadata.h"
+#include "noise.h"
 #include "gamedef.h"
 #include "porting.h"
 #include "profiler.h"
@@ -23,6 +24,7 @@
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
 #include "threading/mutex_auto_lock.h"
+#include "threading/workerpool.h"
 #include "filesys.h"
 #include "gameparams.h"
 #include "database/database-dummy.h"
@@ -35,6 +37,7 @@
 #include "database/database-leveldb.h"
 #endif
 #include "irrlicht_changes/printing.h"
+#include "server/abmscanner.h"
 #include "server/luaentity_sao.h"
 #include "server/player_sao.h"
 
@@ -251,6 +254,19 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 
 	// Note: the iteration count of this outer loop is typically very low, so it's ok.
 	for (auto it = getLBMsIntroducedAfter(stamp); it != m_lbm_lookup.end(); ++it) {
+		// The content cache tells whether the block needs to be scanned at all
+		if (!block->contents.empty()) {
+			bool may_apply = false;
+			for (content_t c : block->contents) {
+				if (it->second.lookup(c)) {
+					may_apply = true;
+					break;
+				}
+			}
+			if (!may_apply)
+				continue;
+		}
+
 		v3s16 pos;
 		content_t c;
 
@@ -315,7 +331,7 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block,
 	ActiveBlockList
 */
 
-static void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
+static void fillRadiusBlock(v3s16 p0, s16 r, std::vector<v3s16> &list)
 {
 	v3s16 p;
 	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
@@ -325,7 +341,7 @@ static void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
 				// limit to a sphere
 				if (p.getDistanceFrom(p0) <= r) {
 					// Set in list
-					list.insert(p);
+					list.push_back(p);
 				}
 			}
 }
@@ -335,7 +351,7 @@ static void fillViewConeBlock(v3s16 p0,
 	const v3f camera_pos,
 	const v3f camera_dir,
 	const float camera_fov,
-	std::set<v3s16> &list)
+	std::vector<v3s16> &list)
 {
 	v3s16 p;
 	const s16 r_nodes = r * BS * MAP_BLOCKSIZE;
@@ -343,11 +359,27 @@ static void fillViewConeBlock(v3s16 p0,
 	for (p.Y = p0.Y - r; p.Y <= p0.Y+r; p.Y++)
 	for (p.Z = p0.Z - r; p.Z <= p0.Z+r; p.Z++) {
 		if (isBlockInSight(p, camera_pos, camera_dir, camera_fov, r_nodes)) {
-			list.insert(p);
+			list.push_back(p);
 		}
 	}
 }
 
+ActiveBlockList::PlayerView ActiveBlockList::getPlayerView(const PlayerSAO *playersao)
+{
+	PlayerView view;
+	view.id = playersao->getId();
+	view.blockpos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
+	view.camera_pos = playersao->getEyePosition();
+	view.camera_dir = v3f(0,0,1);
+	view.camera_dir.rotateYZBy(playersao->getLookPitch());
+	view.camera_dir.rotateXZBy(playersao->getRotation().Y);
+	if (playersao->getCameraInverted())
+		view.camera_dir = -view.camera_dir;
+	view.camera_fov = playersao->getFov();
+	view.wanted_range = playersao->getWantedRange();
+	return view;
+}
+
 void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	s16 active_block_range,
 	s16 active_object_range,
@@ -355,85 +387,169 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	std::set<v3s16> &blocks_added,
 	std::set<v3s16> &extra_blocks_added)
 {
+	std::vector<PlayerView> players;
+	players.reserve(active_players.size());
+	for (const PlayerSAO *playersao : active_players)
+		players.push_back(getPlayerView(playersao));
+
+	update(players, active_block_range, active_object_range,
+		blocks_removed, blocks_added, extra_blocks_added);
+}
+
+void ActiveBlockList::update(const std::vector<PlayerView> &players,
+	s16 active_block_range,
+	s16 active_object_range,
+	std::set<v3s16> &blocks_removed,
+	std::set<v3s16> &blocks_added,
+	std::set<v3s16> &extra_blocks_added)
+{
+	m_update_count++;
+
 	/*
-		Create the new list
+		Update the reference counts with what changed since the last time
 	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	std::set<v3s16> extralist;
-	m_abm_list = m_forceloaded_list;
-	for (const PlayerSAO *playersao : active_players) {
-		v3s16 pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
-		fillRadiusBlock(pos, active_block_range, m_abm_list);
-		fillRadiusBlock(pos, active_block_range, newlist);
-
-		s16 player_ao_range = std::min(active_object_range, playersao->getWantedRange());
-		// only do this if this would add blocks
-		if (player_ao_range > active_block_range) {
-			v3f camera_dir = v3f(0,0,1);
-			camera_dir.rotateYZBy(playersao->getLookPitch());
-			camera_dir.rotateXZBy(playersao->getRotation().Y);
-			if (playersao->getCameraInverted())
-				camera_dir = -camera_dir;
-			fillViewConeBlock(pos,
-				player_ao_range,
-				playersao->getEyePosition(),
-				camera_dir,
-				playersao->getFov(),
-				extralist);
-		}
+	for (const PlayerView &view : players) {
+		PlayerArea &area = m_players[view.id];
+		updatePlayer(area, view, active_block_range, active_object_range);
+		area.last_update = m_update_count;
 	}
 
-	/*
-		Find out which blocks on the new list are not on the old list
-	*/
-	for (v3s16 p : newlist) {
-		// also remove duplicate blocks from the extra list
-		extralist.erase(p);
-		// If not on old list, it's been added
-		if (m_list.find(p) == m_list.end())
-			blocks_added.insert(p);
+	for (auto it = m_players.begin(); it != m_players.end(); ) {
+		if (it->second.last_update == m_update_count) {
+			++it;
+			continue;
+		}
+		// player is gone
+		removeRefs(m_abm_refs, it->second.blocks);
+		removeRefs(m_extra_refs, it->second.cone_blocks);
+		it = m_players.erase(it);
 	}
+
+	updateForceloaded();
+
 	/*
-		Find out which blocks on the extra list are not on the old list
+		Apply the changes to the lists
 	*/
-	for (v3s16 p : extralist) {
-		// also make sure newlist has all blocks
-		newlist.insert(p);
-		// If not on old list, it's been added
-		if (m_list.find(p) == m_list.end())
-			extra_blocks_added.insert(p);
+	for (v3s16 p : m_touched) {
+		const bool in_abm_list = m_abm_refs.count(p) > 0;
+		const bool wanted = in_abm_list || m_extra_refs.count(p) > 0;
+
+		if (in_abm_list)
+			m_abm_list.insert(p);
+		else
+			m_abm_list.erase(p);
+
+		if (wanted && m_list.insert(p).second) {
+			if (in_abm_list)
+				blocks_added.insert(p);
+			else
+				extra_blocks_added.insert(p);
+		} else if (!wanted && m_list.erase(p) > 0) {
+			blocks_removed.insert(p);
+		}
 	}
+	m_touched.clear();
 
-	/*
-		Find out which blocks on the old list are not on the new + extra list
-	*/
-	std::set_difference(m_list.begin(), m_list.end(), newlist.begin(), newlist.end(),
-			std::inserter(blocks_removed, blocks_removed.end()));
+	assert(m_abm_list.size() == m_abm_refs.size());
+	assert(m_list.size() <= m_abm_refs.size() + m_extra_refs.size());
+}
 
-	/*
-		Do some least-effort sanity checks to hopefully catch code bugs.
-	*/
-	assert(newlist.size() >= extralist.size());
-	assert(blocks_removed.size() <= m_list.size());
-	if (!blocks_added.empty()) {
-		assert(newlist.count(*blocks_added.begin()) > 0);
-		assert(blocks_removed.count(*blocks_added.begin()) == 0);
+void ActiveBlockList::clear()
+{
+	m_list.clear();
+	m_abm_list.clear();
+	m_players.clear();
+	m_forceloaded_applied.clear();
+	m_abm_refs.clear();
+	m_extra_refs.clear();
+	m_touched.clear();
+}
+
+void ActiveBlockList::addRefs(RefMap &refs, const std::vector<v3s16> &blocks)
+{
+	for (v3s16 p : blocks) {
+		if (refs[p]++ == 0)
+			m_touched.push_back(p);
 	}
-	if (!extra_blocks_added.empty()) {
-		assert(newlist.count(*extra_blocks_added.begin()) > 0);
-		assert(extralist.count(*extra_blocks_added.begin()) > 0);
-		assert(blocks_added.count(*extra_blocks_added.begin()) == 0);
+}
+
+void ActiveBlockList::removeRefs(RefMap &refs, const std::vector<v3s16> &blocks)
+{
+	for (v3s16 p : blocks) {
+		auto it = refs.find(p);
+		assert(it != refs.end());
+		if (--it->second == 0) {
+			refs.erase(it);
+			m_touched.push_back(p);
+		}
 	}
-	if (!blocks_removed.empty()) {
-		assert(newlist.count(*blocks_removed.begin()) == 0);
-		assert(extralist.count(*blocks_removed.begin()) == 0);
-		assert(m_list.count(*blocks_removed.begin()) > 0);
+}
+
+void ActiveBlockList::replaceRefs(RefMap &refs, std::vector<v3s16> &blocks,
+	std::vector<v3s16> &&new_blocks)
+{
+	// both are sorted since the fill functions iterate in X, Y, Z order
+	std::vector<v3s16> added, removed;
+	std::set_difference(new_blocks.begin(), new_blocks.end(),
+		blocks.begin(), blocks.end(), std::back_inserter(added));
+	std::set_difference(blocks.begin(), blocks.end(),
+		new_blocks.begin(), new_blocks.end(), std::back_inserter(removed));
+	addRefs(refs, added);
+	removeRefs(refs, removed);
+	blocks = std::move(new_blocks);
+}
+
+void ActiveBlockList::updatePlayer(PlayerArea &area, const PlayerView &view,
+	s16 active_block_range, s16 active_object_range)
+{
+	const bool moved = area.blockpos != view.blockpos;
+
+	if (moved || area.radius != active_block_range) {
+		std::vector<v3s16> blocks;
+		fillRadiusBlock(view.blockpos, active_block_range, blocks);
+		replaceRefs(m_abm_refs, area.blocks, std::move(blocks));
+		area.radius = active_block_range;
 	}
 
-	/*
-		Update m_list
-	*/
-	m_list = std::move(newlist);
+	s16 cone_range = std::min(active_object_range, view.wanted_range);
+	// only do this if this would add blocks
+	if (cone_range <= active_block_range)
+		cone_range = 0;
+
+	// The exact camera position is only taken into account when the cone
+	// is recomputed, which is good enough for activating objects.
+	if (moved || cone_range != area.cone_range ||
+			view.camera_dir != area.camera_dir ||
+			view.camera_fov != area.camera_fov) {
+		std::vector<v3s16> cone_blocks;
+		if (cone_range > 0) {
+			fillViewConeBlock(view.blockpos, cone_range, view.camera_pos,
+				view.camera_dir, view.camera_fov, cone_blocks);
+		}
+		replaceRefs(m_extra_refs, area.cone_blocks, std::move(cone_blocks));
+		area.cone_range = cone_range;
+		area.camera_dir = view.camera_dir;
+		area.camera_fov = view.camera_fov;
+	}
+
+	area.blockpos = view.blockpos;
+}
+
+void ActiveBlockList::updateForceloaded()
+{
+	if (m_forceloaded_list == m_forceloaded_applied)
+		return;
+
+	std::vector<v3s16> added, removed;
+	std::set_difference(m_forceloaded_list.begin(), m_forceloaded_list.end(),
+		m_forceloaded_applied.begin(), m_forceloaded_applied.end(),
+		std::back_inserter(added));
+	std::set_difference(m_forceloaded_applied.begin(), m_forceloaded_applied.end(),
+		m_forceloaded_list.begin(), m_forceloaded_list.end(),
+		std::back_inserter(removed));
+	addRefs(m_abm_refs, added);
+	removeRefs(m_abm_refs, removed);
+	m_forceloaded_applied = m_forceloaded_list;
 }
 
 /*
@@ -467,6 +583,12 @@ ServerEnvironment::ServerEnvironment(std::unique_ptr<ServerMap> map,
 
 	m_active_object_gauge = mb->addGauge(
 		"minetest_env_active_objects", "Number of active objects");
+
+	u32 abm_threads = g_settings->getU32("abm_worker_threads");
+	if (abm_threads > 0) {
+		m_abm_workers = std::make_unique<WorkerPool>("ABMWorker",
+			std::min<u32>(abm_threads, 64));
+	}
 }
 
 void ServerEnvironment::init()
@@ -547,6 +669,11 @@ void ServerEnvironment::init()
 
 void ServerEnvironment::deactivateBlocksAndObjects()
 {
+	for (const v3s16 &p : m_active_blocks.m_list) {
+		if (MapBlock *block = m_map->getBlockNoCreateNoEx(p))
+			block->detachNodeTimers();
+	}
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -798,27 +925,18 @@ void ServerEnvironment::loadDefaultMeta()
 	m_lbm_mgr.loadIntroductionTimes("", m_server, m_game_time);
 }
 
-struct ActiveABM
-{
-	ActiveBlockModifier *abm;
-	std::vector<content_t> required_neighbors;
-	std::vector<content_t> without_neighbors;
-	int chance;
-	s16 min_y, max_y;
-};
-
-#define CONTENT_TYPE_CACHE_MAX 64
-
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
-	std::vector<std::vector<ActiveABM> *> m_aabms;
+	ABMScanner::ABMTable m_aabms;
+	ABMScanner m_scanner;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
 		bool use_timers):
-		m_env(env)
+		m_env(env),
+		m_scanner(m_aabms)
 	{
 		if (dtime_s < 0.001f)
 			return;
@@ -912,27 +1030,21 @@ class ABMHandler
 		wider += wider_unknown_count * wider / wider_known_count;
 		return active_object_count;
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	// Checks the content type cache to see whether there are any ABMs
+	// to be run at all for this block
+	bool mayApply(MapBlock *block, int &blocks_cached)
 	{
 		if (m_aabms.empty())
-			return;
-
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (!block->contents.empty()) {
-			assert(!block->do_not_cache_contents); // invariant
+			return false;
+		if (!block->contents.empty())
 			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
-		}
+		return m_scanner.mayHaveTriggers(block);
+	}
+
+	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		if (!mayApply(block, blocks_cached))
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -952,17 +1064,8 @@ class ABMHandler
 			content_t c = n.getContent();
 
 			// Cache content types as we go
-			if (want_contents_cached && !CONTAINS(block->contents, c)) {
-				if (block->contents.size() >= CONTENT_TYPE_CACHE_MAX) {
-					// Too many different nodes... don't try to cache
-					want_contents_cached = false;
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-					block->contents.shrink_to_fit();
-				} else {
-					block->contents.push_back(c);
-				}
-			}
+			if (want_contents_cached)
+				ABMScanner::addToContentCache(block, c, want_contents_cached);
 
 			if (c >= m_aabms.size() || !m_aabms[c])
 				continue;
@@ -976,48 +1079,18 @@ class ABMHandler
 					continue;
 
 				// Check neighbors
-				const bool check_required_neighbors = !aabm.required_neighbors.empty();
-				const bool check_without_neighbors = !aabm.without_neighbors.empty();
-				if (check_required_neighbors || check_without_neighbors) {
-					v3s16 p1;
-					bool have_required = false;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
+				bool neighbors_ok = ABMScanner::checkNeighbors(aabm, p0,
+					[&] (v3s16 p1) -> content_t {
 						if (block->isValidPosition(p1)) {
 							// if the neighbor is found on the same map block
 							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
+							return block->getNodeNoCheck(p1).getContent();
 						}
-						if (check_required_neighbors && !have_required) {
-							if (CONTAINS(aabm.required_neighbors, c)) {
-								if (!check_without_neighbors)
-									goto neighbor_found;
-								have_required = true;
-							}
-						}
-						if (check_without_neighbors) {
-							if (CONTAINS(aabm.without_neighbors, c))
-								goto neighbor_invalid;
-						}
-					}
-					if (have_required || !check_required_neighbors)
-						goto neighbor_found;
-					// No required neighbor found
-					neighbor_invalid:
+						// otherwise consult the map
+						return map->getNode(p1 + block->getPosRelative()).getContent();
+					});
+				if (!neighbors_ok)
 					continue;
-				}
-
-				neighbor_found:
 
 				abms_run++;
 				// Call all the trigger variations
@@ -1041,6 +1114,88 @@ class ABMHandler
 			}
 		}
 	}
+
+	// Finds the ABM triggers of all blocks using the worker threads.
+	// triggers[i] receives the ones of blocks[i].
+	void scanParallel(WorkerPool *pool, const std::vector<MapBlock*> &blocks,
+		std::vector<std::vector<ABMTrigger>> &triggers,
+		int &blocks_scanned, int &blocks_cached)
+	{
+		ScopeProfiler sp(g_profiler, "SEnv: ABM scan avg per interval", SPT_AVG);
+		triggers.clear();
+		triggers.resize(blocks.size());
+
+		// Collect what the workers need, since the map itself must not be
+		// accessed from several threads
+		struct ScanJob {
+			size_t index;
+			u64 seed;
+			MapBlock *neighbors[27];
+		};
+		std::vector<ScanJob> jobs;
+		ServerMap *map = &m_env->getServerMap();
+		for (size_t i = 0; i < blocks.size(); i++) {
+			MapBlock *block = blocks[i];
+			if (!mayApply(block, blocks_cached))
+				continue;
+			blocks_scanned++;
+
+			ScanJob &job = jobs.emplace_back();
+			job.index = i;
+			job.seed = ((u64)myrand() << 32) | myrand();
+			v3s16 d;
+			int k = 0;
+			for (d.Z = -1; d.Z <= 1; d.Z++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.X = -1; d.X <= 1; d.X++)
+				job.neighbors[k++] = d == v3s16(0, 0, 0) ? block :
+					map->getBlockNoCreateNoEx(block->getPos() + d);
+		}
+
+		pool->run(jobs.size(), [&] (size_t i) {
+			const ScanJob &job = jobs[i];
+			PcgRandom rand(job.seed);
+			m_scanner.scan(job.neighbors, rand, triggers[job.index]);
+		});
+	}
+
+	// Runs the triggers found by ABMScanner::scan()
+	void runTriggers(MapBlock *block, const std::vector<ABMTrigger> &triggers,
+		int &abms_run)
+	{
+		if (triggers.empty())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		u32 active_object_count_wider;
+		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
+		m_env->m_added_objects = 0;
+
+		for (const ABMTrigger &t : triggers) {
+			// Skip nodes changed by earlier triggers
+			MapNode n = block->getNodeNoCheck(t.p0);
+			if (n.getContent() != t.n.getContent())
+				continue;
+
+			abms_run++;
+			v3s16 p = t.p0 + block->getPosRelative();
+			ActiveBlockModifier *abm = t.aabm->abm;
+			// Call all the trigger variations
+			abm->trigger(m_env, p, n);
+			abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
+
+			if (block->isOrphan())
+				return;
+
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+	}
 };
 
 void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
@@ -1090,6 +1245,11 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	block->step((float)dtime_s, [&](v3s16 p, MapNode n, f32 d) -> bool {
 		return !block->isOrphan() && m_script->node_on_timer(p, n, d);
 	});
+	if (block->isOrphan())
+		return;
+
+	// From now on the timers are run by step()
+	block->attachNodeTimers(&m_node_timer_scheduler);
 }
 
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
@@ -1445,6 +1605,7 @@ void ServerEnvironment::step(float dtime)
 
 			// Set current time as timestamp (and let it set ChangedFlag)
 			block->setTimestamp(m_game_time);
+			block->detachNodeTimers();
 		}
 
 		/*
@@ -1496,6 +1657,10 @@ void ServerEnvironment::step(float dtime)
 			if (!block)
 				continue;
 
+			// The block may have been replaced since it was activated
+			if (!block->nodeTimersAttachedTo(&m_node_timer_scheduler))
+				block->attachNodeTimers(&m_node_timer_scheduler);
+
 			// Reset block usage timer
 			block->resetUsageTimer();
 
@@ -1506,9 +1671,17 @@ void ServerEnvironment::step(float dtime)
 			if(block->getTimestamp() > block->getDiskTimestamp() + 60)
 				block->raiseModified(MOD_STATE_WRITE_AT_UNLOAD,
 					MOD_REASON_BLOCK_EXPIRED);
+		}
 
-			// Run node timers
-			block->step(dtime, [&](v3s16 p, MapNode n, f32 d) -> bool {
+		// Run node timers, only the blocks that have some due are touched
+		const std::vector<v3s16> due_blocks = m_node_timer_scheduler.step(dtime);
+		for (const v3s16 &p : due_blocks) {
+			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+			// stale entry of a block that was unloaded or deactivated
+			if (!block || !block->nodeTimersAttachedTo(&m_node_timer_scheduler))
+				continue;
+
+			block->step(0.0f, [&](v3s16 p, MapNode n, f32 d) -> bool {
 				return m_script->node_on_timer(p, n, d);
 			});
 		}
@@ -1535,27 +1708,43 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), MyRandGenerator());
 
-		int i = 0;
+		std::vector<MapBlock*> blocks;
+		blocks.reserve(output.size());
+		for (const v3s16 &p : output) {
+			if (MapBlock *block = m_map->getBlockNoCreateNoEx(p))
+				blocks.push_back(block);
+		}
+
+		// With worker threads the blocks are scanned up front and only
+		// the triggers are run below
+		std::vector<std::vector<ABMTrigger>> triggers;
+		if (m_abm_workers) {
+			abmhandler.scanParallel(m_abm_workers.get(), blocks, triggers,
+				blocks_scanned, blocks_cached);
+		}
+
 		// determine the time budget for ABMs
 		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
-		for (const v3s16 &p : output) {
-			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
+		for (size_t i = 0; i < blocks.size(); i++) {
+			MapBlock *block = blocks[i];
+			// may have been deleted by an ABM
+			if (block->isOrphan())
 				continue;
 
-			i++;
-
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			if (m_abm_workers)
+				abmhandler.runTriggers(block, triggers[i], abms_run);
+			else
+				abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
 
 			u32 time_ms = timer.getTimerTime();
 
 			if (time_ms > max_time_ms) {
 				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
+					  << time_ms << "ms (processed " << (i + 1) << " of "
 					  << output.size() << " active blocks)" << std::endl;
 				break;
 			}
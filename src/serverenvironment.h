@@ -5,10 +5,13 @@
 #pragma once
 
 #include <set>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "activeobject.h"
 #include "environment.h"
+#include "nodetimer.h"
 #include "servermap.h"
 #include "settings.h"
 #include "server/activeobjectmgr.h"
@@ -23,6 +26,7 @@ class AuthDatabase;
 class PlayerSAO;
 class ServerEnvironment;
 class ActiveBlockModifier;
+class WorkerPool;
 struct StaticObject;
 class ServerActiveObject;
 class Server;
@@ -158,11 +162,27 @@ class LBMManager
 
 /*
 	List of active blocks, used by ServerEnvironment
+
+	The list is maintained incrementally: the blocks each player contributes
+	are cached and only recomputed when the block position or the view of
+	the player changes, the other blocks are kept alive by reference counts.
 */
 
 class ActiveBlockList
 {
 public:
+	// What is needed from a player to determine its active blocks
+	struct PlayerView {
+		u16 id;
+		v3s16 blockpos;
+		v3f camera_pos;
+		v3f camera_dir;
+		f32 camera_fov;
+		s16 wanted_range;
+	};
+
+	static PlayerView getPlayerView(const PlayerSAO *playersao);
+
 	void update(std::vector<PlayerSAO*> &active_players,
 		s16 active_block_range,
 		s16 active_object_range,
@@ -170,6 +190,13 @@ class ActiveBlockList
 		std::set<v3s16> &blocks_added,
 		std::set<v3s16> &extra_blocks_added);
 
+	void update(const std::vector<PlayerView> &players,
+		s16 active_block_range,
+		s16 active_object_range,
+		std::set<v3s16> &blocks_removed,
+		std::set<v3s16> &blocks_added,
+		std::set<v3s16> &extra_blocks_added);
+
 	bool contains(v3s16 p) const {
 		return (m_list.find(p) != m_list.end());
 	}
@@ -178,19 +205,57 @@ class ActiveBlockList
 		return m_list.size();
 	}
 
-	void clear() {
-		m_list.clear();
-	}
+	void clear();
 
+	// The block will be added again on the next update if still wanted
 	void remove(v3s16 p) {
 		m_list.erase(p);
 		m_abm_list.erase(p);
+		m_touched.push_back(p);
 	}
 
 	std::set<v3s16> m_list;
 	std::set<v3s16> m_abm_list;
 	// list of blocks that are always active, not modified by this class
 	std::set<v3s16> m_forceloaded_list;
+
+private:
+	typedef std::unordered_map<v3s16, u32> RefMap;
+
+	struct PlayerArea {
+		v3s16 blockpos;
+		s16 radius = -1;
+		// blocks within the active block range
+		std::vector<v3s16> blocks;
+
+		v3f camera_dir;
+		f32 camera_fov = 0;
+		s16 cone_range = -1;
+		// additional blocks in sight, within the active object range
+		std::vector<v3s16> cone_blocks;
+
+		u32 last_update = 0;
+	};
+
+	void addRefs(RefMap &refs, const std::vector<v3s16> &blocks);
+	void removeRefs(RefMap &refs, const std::vector<v3s16> &blocks);
+	void replaceRefs(RefMap &refs, std::vector<v3s16> &blocks,
+		std::vector<v3s16> &&new_blocks);
+
+	void updatePlayer(PlayerArea &area, const PlayerView &view,
+		s16 active_block_range, s16 active_object_range);
+	void updateForceloaded();
+
+	std::unordered_map<u16, PlayerArea> m_players;
+	// m_forceloaded_list as of the last update
+	std::set<v3s16> m_forceloaded_applied;
+	// number of players (and forceloads) that want each block active
+	RefMap m_abm_refs;
+	// the same for blocks that are only in sight
+	RefMap m_extra_refs;
+	// blocks whose membership may have changed since the last update
+	std::vector<v3s16> m_touched;
+	u32 m_update_count = 0;
 };
 
 /*
@@ -348,6 +413,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getObjectsInArea(box, objects, include_obj_cb);
 	}
 
+	// Called by ServerActiveObject when its base position changes
+	void updateActiveObjectPos(u16 id, v3f pos)
+	{
+		m_ao_manager.updateObjectPos(id, pos);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -474,6 +545,8 @@ class ServerEnvironment final : public Environment
 	IntervalLimiter m_active_blocks_mgmt_interval;
 	IntervalLimiter m_active_block_modifier_interval;
 	IntervalLimiter m_active_blocks_nodemetadata_interval;
+	// Clock of the node timers in active blocks
+	NodeTimerScheduler m_node_timer_scheduler;
 	// Whether the variables below have been read from file yet
 	bool m_meta_loaded = false;
 	// Time from the beginning of the game in seconds.
@@ -486,6 +559,8 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Threads that ABM scanning is spread over, if enabled
+	std::unique_ptr<WorkerPool> m_abm_workers;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
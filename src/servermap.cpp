@@ -26,6 +26,7 @@
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
 #include "irrlicht_changes/printing.h"
+#include "server/mapsavethread.h"
 #if USE_LEVELDB
 #include "database/database-leveldb.h"
 #endif
@@ -43,11 +44,39 @@
 void MapDatabaseAccessor::loadBlock(v3s16 blockpos, std::string &ret)
 {
 	ret.clear();
+	// the database may still have an outdated version
+	if (save_thread && save_thread->getPending(blockpos, ret))
+		return;
 	dbase->loadBlock(blockpos, &ret);
 	if (ret.empty() && dbase_ro)
 		dbase_ro->loadBlock(blockpos, &ret);
 }
 
+void MapDatabaseAccessor::loadBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> &ret)
+{
+	dbase->loadBlocks(positions, &ret);
+
+	std::vector<v3s16> missing;
+	std::vector<size_t> missing_idx;
+	for (size_t i = 0; i < positions.size(); i++) {
+		// the database may still have an outdated version
+		if (save_thread && save_thread->getPending(positions[i], ret[i]))
+			continue;
+		if (ret[i].empty() && dbase_ro) {
+			missing.push_back(positions[i]);
+			missing_idx.push_back(i);
+		}
+	}
+
+	if (missing.empty())
+		return;
+	std::vector<std::string> ret_ro;
+	dbase_ro->loadBlocks(missing, &ret_ro);
+	for (size_t i = 0; i < missing.size(); i++)
+		ret[missing_idx[i]] = std::move(ret_ro[i]);
+}
+
 /*
 	ServerMap
 */
@@ -99,6 +128,15 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
 
+	if (g_settings->getBool("server_map_save_async")) {
+		size_t queue_size = rangelim(
+			g_settings->getU32("server_map_save_queue_size"), 1U, 4096U);
+		m_save_thread = std::make_unique<MapSaveThread>(&m_db,
+			m_map_compression_level, queue_size * 1024 * 1024, mb);
+		m_db.save_thread = m_save_thread.get();
+		m_save_thread->start();
+	}
+
 	try {
 		// If directory exists, check contents and load if possible
 		if (fs::PathExists(m_savedir)) {
@@ -159,6 +197,15 @@ ServerMap::~ServerMap()
 				 << ", exception: " << e.what() << std::endl;
 	}
 
+	if (m_save_thread) {
+		// writes out everything that is still queued
+		m_save_thread->stop();
+		m_save_thread->signal();
+		m_save_thread->wait();
+		m_db.save_thread = nullptr;
+		m_save_thread.reset();
+	}
+
 	m_emerge->resetMap();
 
 	{
@@ -531,6 +578,10 @@ void ServerMap::save(ModifiedState save_level)
 	if(save_started)
 		endSave();
 
+	// Saving the whole map is expected to be done when this returns
+	if (save_level == MOD_STATE_CLEAN && m_save_thread)
+		m_save_thread->flush();
+
 	/*
 		Only print if something happened or saved whole map
 	*/
@@ -551,6 +602,10 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
+	// newly saved blocks may not be in the database yet
+	if (m_save_thread)
+		m_save_thread->flush();
+
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->listAllLoadableBlocks(dst);
 	if (m_db.dbase_ro)
@@ -602,21 +657,39 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// the save thread does its own transactions
+	if (m_save_thread)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	if (m_save_thread)
+		return;
 	MutexAutoLock dblock(m_db.mutex);
 	m_db.dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
+	// Blocks are usually done being modified by the time they are saved
+	block->compactNodes();
+
+	if (m_save_thread) {
+		m_save_thread->enqueue(block);
+		m_db.write_count++;
+		// The snapshot has been taken, so consider the block saved
+		block->resetModified();
+		return true;
+	}
+
 	// FIXME: serialization happens under mutex
 	MutexAutoLock dblock(m_db.mutex);
-	return saveBlock(block, m_db.dbase, m_map_compression_level);
+	bool ret = saveBlock(block, m_db.dbase, m_map_compression_level);
+	m_db.write_count++;
+	return ret;
 }
 
 bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
@@ -643,7 +716,8 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_leve
 	return ret;
 }
 
-void ServerMap::deSerializeBlock(MapBlock *block, std::istream &is)
+void ServerMap::deSerializeBlock(MapBlock *block, std::istream &is,
+	MapBlock::UnknownNodes *unknown)
 {
 	ScopeProfiler sp(g_profiler, "ServerMap: deSer block", SPT_AVG, PRECISION_MICRO);
 
@@ -651,7 +725,8 @@ void ServerMap::deSerializeBlock(MapBlock *block, std::istream &is)
 	if (is.fail())
 		throw SerializationError("Failed to read MapBlock version");
 
-	block->deSerialize(is, version, true);
+	block->deSerialize(is, version, true, unknown);
+	block->compactNodes();
 }
 
 MapBlock *ServerMap::loadBlock(const std::string &blob, v3s16 p3d, bool save_after_load)
@@ -699,6 +774,58 @@ MapBlock *ServerMap::loadBlock(const std::string &blob, v3s16 p3d, bool save_aft
 
 	assert(block);
 
+	finishLoadBlock(block, created_new, save_after_load);
+
+	return block;
+}
+
+ServerMap::DecodedBlock ServerMap::decodeBlock(const std::string &blob, v3s16 p3d) const
+{
+	ScopeProfiler sp(g_profiler, "ServerMap: decode block", SPT_AVG, PRECISION_MICRO);
+	DecodedBlock decoded;
+	decoded.block = std::make_unique<MapBlock>(p3d, m_gamedef);
+
+	try {
+		std::istringstream iss(blob, std::ios_base::binary);
+		deSerializeBlock(decoded.block.get(), iss, &decoded.unknown_nodes);
+	} catch (SerializationError &e) {
+		errorstream << "Invalid block data in database " << p3d
+				<< " (SerializationError): " << e.what() << std::endl;
+
+		if (g_settings->getBool("ignore_world_load_errors")) {
+			errorstream << "Ignoring block load error. Duck and cover! "
+					<< "(ignore_world_load_errors)" << std::endl;
+			return {};
+		}
+		throw SerializationError("Invalid block data in database");
+	}
+
+	return decoded;
+}
+
+MapBlock *ServerMap::insertDecodedBlock(DecodedBlock &&decoded,
+	bool save_after_load)
+{
+	ScopeProfiler sp(g_profiler, "ServerMap: load block", SPT_AVG, PRECISION_MICRO);
+	std::unique_ptr<MapBlock> block_u = std::move(decoded.block);
+	MapBlock *block = block_u.get();
+	const v3s16 p3d = block->getPos();
+
+	if (!decoded.unknown_nodes.empty()) {
+		block->resolveUnknownNodes(decoded.unknown_nodes);
+		block->compactNodes();
+	}
+
+	MapSector *sector = createSector(v2s16(p3d.X, p3d.Z));
+	sector->insertBlock(std::move(block_u));
+
+	finishLoadBlock(block, true, save_after_load);
+
+	return block;
+}
+
+void ServerMap::finishLoadBlock(MapBlock *block, bool created_new, bool save_after_load)
+{
 	if (created_new) {
 		ReflowScan scanner(this, m_emerge->ndef);
 		scanner.scan(block, &m_transforming_liquid);
@@ -719,8 +846,6 @@ MapBlock *ServerMap::loadBlock(const std::string &blob, v3s16 p3d, bool save_aft
 
 	// We just loaded it, so it's up-to-date.
 	block->resetModified();
-
-	return block;
 }
 
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
@@ -740,7 +865,12 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
 	MutexAutoLock dblock(m_db.mutex);
-	if (!m_db.dbase->deleteBlock(blockpos))
+	// a pending write would bring the block back
+	if (m_save_thread)
+		m_save_thread->discard(blockpos);
+	bool deleted = m_db.dbase->deleteBlock(blockpos);
+	m_db.write_count++;
+	if (!deleted)
 		return false;
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
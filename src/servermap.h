@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <memory>
 
@@ -19,6 +20,7 @@ class EmergeManager;
 class ServerEnvironment;
 struct BlockMakeData;
 class MetricsBackend;
+class MapSaveThread;
 
 // TODO: this could wrap all calls to MapDatabase, including locking
 struct MapDatabaseAccessor {
@@ -28,10 +30,19 @@ struct MapDatabaseAccessor {
 	MapDatabase *dbase = nullptr;
 	/// Fallback database for read operations
 	MapDatabase *dbase_ro = nullptr;
+	/// Blocks that are still waiting to be written to dbase (optional)
+	MapSaveThread *save_thread = nullptr;
+	/// Incremented after every block write or deletion, so that data read
+	/// earlier can be recognized as possibly outdated
+	std::atomic<u32> write_count{0};
 
-	/// Load a block, taking dbase_ro into account.
+	/// Load a block, taking dbase_ro and save_thread into account.
 	/// @note call locked
 	void loadBlock(v3s16 blockpos, std::string &ret);
+	/// Same as loadBlock() for several blocks, see MapDatabase::loadBlocks()
+	/// @note call locked
+	void loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> &ret);
 };
 
 /*
@@ -119,9 +130,28 @@ class ServerMap : public Map
 	/// @return non-null block (but can be blank)
 	MapBlock *loadBlock(const std::string &blob, v3s16 p, bool save_after_load=false);
 
+	struct DecodedBlock {
+		std::unique_ptr<MapBlock> block;
+		// ids for these are allocated when the block is inserted, as that
+		// changes the node definitions
+		MapBlock::UnknownNodes unknown_nodes;
+	};
+
+	/// Decode a block that was read from disk without touching the map or the
+	/// node definitions, so that it can be done without holding the
+	/// environment lock.
+	/// @return null block if the data is invalid and ignore_world_load_errors is set
+	/// @throws SerializationError
+	DecodedBlock decodeBlock(const std::string &blob, v3s16 p) const;
+	/// Insert a block returned by decodeBlock().
+	/// @note the block must not exist in memory yet
+	MapBlock *insertDecodedBlock(DecodedBlock &&decoded,
+		bool save_after_load=false);
+
 	// Helper for deserializing blocks from disk
 	// @throws SerializationError
-	static void deSerializeBlock(MapBlock *block, std::istream &is);
+	static void deSerializeBlock(MapBlock *block, std::istream &is,
+		MapBlock::UnknownNodes *unknown = nullptr);
 
 	// Blocks are removed from the map but not deleted from memory until
 	// deleteDetachedBlocks() is called, since pointers to them may still exist
@@ -165,6 +195,9 @@ class ServerMap : public Map
 private:
 	friend class ModApiMapgen; // for m_transforming_liquid
 
+	// Common part of loading a block after it has been put into the map
+	void finishLoadBlock(MapBlock *block, bool created_new, bool save_after_load);
+
 	// Emerge manager
 	EmergeManager *m_emerge;
 
@@ -192,6 +225,8 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 
 	MapDatabaseAccessor m_db;
+	// Compresses and writes blocks, if asynchronous saving is enabled
+	std::unique_ptr<MapSaveThread> m_save_thread;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
@@ -0,0 +1,112 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "workerpool.h"
+#include "threading/thread.h"
+
+class WorkerPool::Worker : public Thread
+{
+public:
+	Worker(const std::string &name, WorkerPool *pool) :
+		Thread(name), m_pool(pool)
+	{}
+
+protected:
+	void *run() override
+	{
+		m_pool->workerLoop();
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+};
+
+WorkerPool::WorkerPool(const std::string &name, unsigned int num_threads)
+{
+	for (unsigned int i = 0; i < num_threads; i++) {
+		m_workers.emplace_back(std::make_unique<Worker>(name, this));
+		m_workers.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_work_cv.notify_all();
+	for (auto &worker : m_workers)
+		worker->wait();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &func)
+{
+	if (m_workers.empty() || count <= 1) {
+		for (size_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = &func;
+		m_count = count;
+		m_next = 0;
+		m_busy = m_workers.size();
+		m_exception = nullptr;
+		m_generation++;
+	}
+	m_work_cv.notify_all();
+
+	work();
+
+	std::exception_ptr exception;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done_cv.wait(lock, [this] { return m_busy == 0; });
+		m_func = nullptr;
+		std::swap(exception, m_exception);
+	}
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void WorkerPool::work()
+{
+	size_t i;
+	while ((i = m_next.fetch_add(1)) < m_count) {
+		try {
+			(*m_func)(i);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!m_exception)
+				m_exception = std::current_exception();
+			// skip the remaining items
+			m_next = m_count;
+		}
+	}
+}
+
+void WorkerPool::workerLoop()
+{
+	unsigned long generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_cv.wait(lock, [&] {
+				return m_stopping || m_generation != generation;
+			});
+			if (m_stopping)
+				return;
+			generation = m_generation;
+		}
+
+		work();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_busy == 0)
+			m_done_cv.notify_one();
+	}
+}
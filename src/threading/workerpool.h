@@ -0,0 +1,59 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/basic_macros.h"
+
+/*
+	A fixed set of threads to spread a batch of independent work items over.
+*/
+class WorkerPool
+{
+public:
+	WorkerPool(const std::string &name, unsigned int num_threads);
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool)
+
+	unsigned int getThreadCount() const { return m_workers.size(); }
+
+	/*
+	 * Calls func(i) for every i in [0, count), spread over the worker threads
+	 * and the calling thread. Returns once all calls have finished.
+	 * The first exception thrown by func is rethrown here.
+	 * Must not be called from several threads at once.
+	 */
+	void run(size_t count, const std::function<void(size_t)> &func);
+
+private:
+	class Worker;
+
+	void work();
+	void workerLoop();
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+
+	std::mutex m_mutex;
+	// signaled when a new batch is available or the pool is stopping
+	std::condition_variable m_work_cv;
+	// signaled when the last worker is done with a batch
+	std::condition_variable m_done_cv;
+	unsigned long m_generation = 0;
+	bool m_stopping = false;
+	// number of workers that have not finished the current batch
+	unsigned int m_busy = 0;
+	std::exception_ptr m_exception;
+
+	// the current batch
+	const std::function<void(size_t)> *m_func = nullptr;
+	size_t m_count = 0;
+	std::atomic<size_t> m_next{0};
+};
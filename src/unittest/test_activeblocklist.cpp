@@ -0,0 +1,129 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include "serverenvironment.h"
+#include "util/numeric.h"
+
+class TestActiveBlockList : public TestBase {
+public:
+	TestActiveBlockList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveBlockList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testIncrementalUpdate();
+};
+
+static TestActiveBlockList g_test_instance;
+
+void TestActiveBlockList::runTests(IGameDef *gamedef)
+{
+	TEST(testIncrementalUpdate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr s16 BLOCK_RANGE = 2;
+constexpr s16 OBJECT_RANGE = 4;
+
+// Computes the lists from scratch
+static void build_lists(const std::vector<ActiveBlockList::PlayerView> &players,
+	const std::set<v3s16> &forceloaded, std::set<v3s16> &list, std::set<v3s16> &abm_list)
+{
+	abm_list = forceloaded;
+	std::set<v3s16> extra;
+	for (const auto &view : players) {
+		const v3s16 p0 = view.blockpos;
+		v3s16 p;
+		for (p.X = p0.X - BLOCK_RANGE; p.X <= p0.X + BLOCK_RANGE; p.X++)
+		for (p.Y = p0.Y - BLOCK_RANGE; p.Y <= p0.Y + BLOCK_RANGE; p.Y++)
+		for (p.Z = p0.Z - BLOCK_RANGE; p.Z <= p0.Z + BLOCK_RANGE; p.Z++) {
+			if (p.getDistanceFrom(p0) <= BLOCK_RANGE)
+				abm_list.insert(p);
+		}
+
+		const s16 range = std::min(OBJECT_RANGE, view.wanted_range);
+		if (range <= BLOCK_RANGE)
+			continue;
+		for (p.X = p0.X - range; p.X <= p0.X + range; p.X++)
+		for (p.Y = p0.Y - range; p.Y <= p0.Y + range; p.Y++)
+		for (p.Z = p0.Z - range; p.Z <= p0.Z + range; p.Z++) {
+			if (isBlockInSight(p, view.camera_pos, view.camera_dir,
+					view.camera_fov, range * BS * MAP_BLOCKSIZE))
+				extra.insert(p);
+		}
+	}
+	list = abm_list;
+	list.insert(extra.begin(), extra.end());
+}
+
+static void randomize_view(ActiveBlockList::PlayerView &view)
+{
+	view.blockpos = v3s16(myrand_range(-4, 4), myrand_range(-1, 1), myrand_range(-4, 4));
+	view.camera_pos = intToFloat(view.blockpos * MAP_BLOCKSIZE, BS) +
+		v3f(myrand_range(0, 15), 16, myrand_range(0, 15)) * BS;
+	view.camera_dir = v3f(0, 0, 1);
+	view.camera_dir.rotateXZBy(myrand_range(0, 359));
+}
+
+void TestActiveBlockList::testIncrementalUpdate()
+{
+	ActiveBlockList abl;
+	std::vector<ActiveBlockList::PlayerView> players;
+	std::set<v3s16> old_list;
+
+	for (int i = 0; i < 200; i++) {
+		// some players join, leave, move or look around
+		if (players.size() < 5 || myrand_range(0, 3) == 0) {
+			ActiveBlockList::PlayerView view;
+			view.id = i + 1;
+			view.camera_fov = 1.2f;
+			view.wanted_range = myrand_range(1, OBJECT_RANGE);
+			randomize_view(view);
+			players.push_back(view);
+		} else if (myrand_range(0, 3) == 0) {
+			players.erase(players.begin() + myrand_range(0, players.size() - 1));
+		}
+		randomize_view(players[myrand_range(0, players.size() - 1)]);
+
+		if (myrand_range(0, 4) == 0)
+			abl.m_forceloaded_list.insert(v3s16(myrand_range(-10, 10), 0, 0));
+		if (myrand_range(0, 4) == 0)
+			abl.m_forceloaded_list.erase(v3s16(myrand_range(-10, 10), 0, 0));
+
+		// a block that failed to load
+		if (!abl.m_list.empty() && myrand_range(0, 2) == 0) {
+			v3s16 p = *abl.m_list.begin();
+			abl.remove(p);
+			old_list.erase(p);
+		}
+
+		std::set<v3s16> removed, added, extra_added;
+		abl.update(players, BLOCK_RANGE, OBJECT_RANGE, removed, added, extra_added);
+
+		std::set<v3s16> list, abm_list;
+		build_lists(players, abl.m_forceloaded_list, list, abm_list);
+		UASSERT(abl.m_list == list);
+		UASSERT(abl.m_abm_list == abm_list);
+
+		for (v3s16 p : list) {
+			bool is_new = old_list.count(p) == 0;
+			UASSERTEQ(bool, added.count(p) > 0, is_new && abm_list.count(p) > 0);
+			UASSERTEQ(bool, extra_added.count(p) > 0, is_new && abm_list.count(p) == 0);
+		}
+		for (v3s16 p : old_list)
+			UASSERTEQ(bool, removed.count(p) > 0, list.count(p) == 0);
+		UASSERTEQ(size_t, removed.size() + list.size(),
+			old_list.size() + added.size() + extra_added.size());
+
+		old_list = std::move(list);
+	}
+
+	abl.clear();
+	UASSERTEQ(size_t, abl.size(), 0);
+	std::set<v3s16> removed, added, extra_added;
+	abl.update(players, BLOCK_RANGE, OBJECT_RANGE, removed, added, extra_added);
+	UASSERTEQ(size_t, abl.size(), old_list.size());
+}
@@ -4,6 +4,9 @@
 
 #include "test.h"
 
+#include <map>
+#include <memory>
+
 #include "log.h"
 #include "porting.h"
 #include "settings.h"
@@ -27,7 +30,10 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testPacketBuffers();
 	void testConnectSendReceive();
+	void testThreads();
+	void testRTTWindowControl();
 };
 
 static TestConnection g_test_instance;
@@ -36,7 +42,10 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testPacketBuffers);
 	TEST(testConnectSendReceive);
+	TEST(testThreads);
+	TEST(testRTTWindowControl);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -143,6 +152,101 @@ void TestConnection::testHelpers()
 }
 
 
+static con::BufferedPacketPtr make_reliable(u16 seqnum, u8 value)
+{
+	SharedBuffer<u8> data(1);
+	data[0] = value;
+	return con::makePacket(Address(127, 0, 0, 1, 10),
+		con::makeReliablePacket(data, seqnum), 0x12345678, 123, 0);
+}
+
+void TestConnection::testPacketBuffers()
+{
+	// Reliable packets are ordered by seqnum, also across the wrap around
+	con::ReliablePacketBuffer reliables;
+	const u16 next_expected = 65530;
+	for (u16 seqnum : {3, 65535, 65533, 0, 100, 65531}) {
+		auto p = make_reliable(seqnum, seqnum & 0xff);
+		reliables.insert(p, next_expected);
+	}
+	// duplicates are ignored
+	auto dup = make_reliable(100, 100);
+	reliables.insert(dup, next_expected);
+	UASSERTEQ(u32, reliables.size(), 6);
+
+	u16 first = 0;
+	UASSERT(reliables.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, 65531);
+
+	UASSERTEQ(u16, reliables.popSeqnum(0)->getSeqnum(), 0);
+	EXCEPTION_CHECK(con::NotFoundException, reliables.popSeqnum(0));
+	for (u16 expected : {65531, 65533, 65535, 3, 100})
+		UASSERTEQ(u16, reliables.popFirst()->getSeqnum(), expected);
+	UASSERT(reliables.empty());
+	UASSERT(!reliables.getFirstSeqnum(first));
+
+	// Filling a whole window makes the buffer grow
+	for (u32 i = 1; i <= 2048; i++) {
+		auto p = make_reliable(next_expected + i, i & 0xff);
+		reliables.insert(p, next_expected);
+	}
+	UASSERTEQ(u32, reliables.size(), 2048);
+	UASSERT(reliables.getFirstSeqnum(first));
+	UASSERTEQ(u16, first, (u16)(next_expected + 1));
+	for (u32 i = 2048; i >= 1; i--) {
+		auto p = reliables.popSeqnum(next_expected + i);
+		UASSERTEQ(u8, p->data[BASE_HEADER_SIZE + 3], i & 0xff);
+	}
+	UASSERT(reliables.empty());
+
+	// Split packets are reassembled in chunk order
+	con::IncomingSplitBuffer splits;
+	SharedBuffer<u8> data(1000);
+	for (u32 i = 0; i < data.getSize(); i++)
+		data[i] = i % 251;
+	std::list<SharedBuffer<u8>> chunks;
+	u16 split_seqnum = 65535;
+	con::makeAutoSplitPacket(data, 300, split_seqnum, &chunks);
+	UASSERTEQ(size_t, chunks.size(), 4);
+	UASSERTEQ(u16, split_seqnum, 0);
+
+	std::vector<con::BufferedPacketPtr> packets;
+	for (auto &chunk : chunks) {
+		packets.push_back(con::makePacket(Address(127, 0, 0, 1, 10), chunk,
+			0x12345678, 123, 0));
+	}
+	UASSERTEQ(u32, splits.insert(packets[2], true).getSize(), 0);
+	UASSERTEQ(u32, splits.insert(packets[0], true).getSize(), 0);
+	UASSERTEQ(u32, splits.insert(packets[0], true).getSize(), 0);
+	UASSERTEQ(u32, splits.insert(packets[3], true).getSize(), 0);
+	SharedBuffer<u8> result = splits.insert(packets[1], true);
+	UASSERTEQ(u32, result.getSize(), data.getSize());
+	UASSERT(memcmp(*result, *data, data.getSize()) == 0);
+
+	// Split seqnums chosen by the peer must not make the buffer span more
+	// than the sequence number space
+	for (u16 seqnum : {0, 20000, 40000, 10000}) {
+		chunks.clear();
+		split_seqnum = seqnum;
+		con::makeAutoSplitPacket(data, 300, split_seqnum, &chunks);
+		auto p = con::makePacket(Address(127, 0, 0, 1, 10), chunks.front(),
+			0x12345678, 123, 0);
+		UASSERTEQ(u32, splits.insert(p, false).getSize(), 0);
+	}
+	// all incomplete packets time out
+	splits.removeUnreliableTimedOuts(100.0f, 30.0f);
+
+	chunks.clear();
+	split_seqnum = 500;
+	con::makeAutoSplitPacket(data, 300, split_seqnum, &chunks);
+	for (auto &chunk : chunks) {
+		auto p = con::makePacket(Address(127, 0, 0, 1, 10), chunk,
+			0x12345678, 123, 0);
+		result = splits.insert(p, false);
+	}
+	UASSERTEQ(u32, result.getSize(), data.getSize());
+}
+
 void TestConnection::testConnectSendReceive()
 {
 
@@ -355,3 +459,131 @@ void TestConnection::testConnectSendReceive()
 	UASSERT(hand_server.count == 1);
 	UASSERT(hand_server.last_id >= 2);
 }
+
+void TestConnection::testThreads()
+{
+	/*
+		Connect several clients to a server that spreads its peers over
+		multiple threads and exchange data in both directions
+	*/
+	constexpr int num_clients = 6;
+	constexpr int datasize = 3000; // needs to be split
+
+	Handler hand_server("server");
+	Address address(127, 0, 0, 1, 30005);
+	con::Connection server(512, 5.0f, false, &hand_server, 3);
+	server.Serve(Address(0, 0, 0, 0, 30005));
+
+	sleep_ms(50);
+
+	std::vector<std::unique_ptr<Handler>> handlers;
+	std::vector<std::unique_ptr<con::Connection>> clients;
+	for (int i = 0; i < num_clients; i++) {
+		handlers.emplace_back(new Handler("client"));
+		clients.emplace_back(new con::Connection(512, 5.0f, false,
+			handlers.back().get()));
+		clients.back()->Connect(address);
+	}
+
+	// every client sends its index once connected
+	u64 start = porting::getTimeMs();
+	std::vector<bool> sent(num_clients, false);
+	std::map<session_t, int> peer_index;
+	while (peer_index.size() < num_clients &&
+			porting::getTimeMs() - start < 5000) {
+		for (int i = 0; i < num_clients; i++) {
+			NetworkPacket pkt;
+			clients[i]->TryReceive(&pkt);
+			if (!sent[i] && clients[i]->Connected()) {
+				NetworkPacket hello(0x4b, 0);
+				hello << (u16)i;
+				clients[i]->Send(PEER_ID_SERVER, 0, &hello, true);
+				sent[i] = true;
+			}
+		}
+		for (;;) {
+			NetworkPacket pkt;
+			if (!server.ReceiveTimeoutMs(&pkt, 10))
+				break;
+			// skip the initial packet sent by Connect()
+			if (pkt.getCommand() != 0x4b)
+				continue;
+			u16 index;
+			pkt >> index;
+			UASSERT(index < num_clients);
+			peer_index[pkt.getPeerId()] = index;
+		}
+	}
+	UASSERTEQ(size_t, peer_index.size(), num_clients);
+	UASSERTEQ(int, hand_server.count, num_clients);
+
+	// the server answers every client with a large packet
+	for (auto &it : peer_index) {
+		NetworkPacket pkt(0xff, datasize);
+		for (int i = 0; i < datasize; i++)
+			pkt << static_cast<u8>(it.second + i);
+		server.Send(it.first, 0, &pkt, true);
+	}
+
+	std::vector<bool> received(num_clients, false);
+	int received_count = 0;
+	start = porting::getTimeMs();
+	while (received_count < num_clients &&
+			porting::getTimeMs() - start < 5000) {
+		for (int i = 0; i < num_clients; i++) {
+			NetworkPacket pkt;
+			if (!clients[i]->ReceiveTimeoutMs(&pkt, 5))
+				continue;
+			UASSERTEQ(u32, pkt.getSize(), datasize);
+			for (int j = 0; j < datasize; j++)
+				UASSERTEQ(u8, *pkt.getU8Ptr(j), static_cast<u8>(i + j));
+			UASSERT(!received[i]);
+			received[i] = true;
+			received_count++;
+		}
+	}
+	UASSERTEQ(int, received_count, num_clients);
+}
+
+void TestConnection::testRTTWindowControl()
+{
+	/*
+		Simulate a link with a fixed capacity and a queue in front of it:
+		everything sent beyond the bandwidth-delay product waits in the
+		queue and increases the round trip time.
+	*/
+	constexpr float dtime = 0.01f;
+	constexpr float capacity = 2000; // packets per second
+	constexpr float base_rtt = 0.05f;
+	constexpr float bdp = capacity * base_rtt;
+
+	con::RTTWindowControl control;
+	u16 window = START_RELIABLE_WINDOW_SIZE;
+	float acks = 0;
+	u16 max_window = 0;
+	for (int step = 0; step < 6000; step++) {
+		const float queue = std::max(0.0f, window - bdp);
+		const float rtt = base_rtt + queue / capacity;
+		acks += std::min(window / rtt, capacity) * dtime;
+		for (; acks >= 1; acks--)
+			control.onAck(rtt);
+		window = control.update(dtime, window, window);
+		if (step > 3000)
+			max_window = std::max(max_window, window);
+	}
+
+	UASSERT(!control.inStartup());
+	UASSERT(std::fabs(control.getMinRTT() - base_rtt) < 0.005f);
+	UASSERT(std::fabs(control.getMaxRate() - capacity) < capacity * 0.1f);
+	// stays near the bandwidth-delay product instead of filling the queue
+	UASSERT(window >= bdp && max_window <= 3 * bdp);
+
+	// An application that does not use the window must not shrink it
+	con::RTTWindowControl idle;
+	window = 500;
+	for (int step = 0; step < 1000; step++) {
+		idle.onAck(base_rtt);
+		window = idle.update(dtime, window, 5);
+	}
+	UASSERTEQ(u16, window, 500);
+}
@@ -36,20 +36,25 @@ class MockGameDef : public DummyGameDef {
 		node_mgr()->resolveCrossrefs();
 	}
 
-	MeshMakeData makeSingleNodeMMD(bool smooth_lighting = true)
+	MeshMakeData makeMMD(u16 side_length, bool smooth_lighting = true)
 	{
-		MeshMakeData data{ndef(), 1, MeshGrid{1}};
+		MeshMakeData data{ndef(), side_length, MeshGrid{1}};
 		data.m_generate_minimap = false;
 		data.m_smooth_lighting = smooth_lighting;
 		data.m_enable_water_reflections = false;
 		data.m_blockpos = {0, 0, 0};
-		for (s16 x = -1; x <= 1; x++)
-		for (s16 y = -1; y <= 1; y++)
-		for (s16 z = -1; z <= 1; z++)
+		for (s16 x = -1; x <= side_length; x++)
+		for (s16 y = -1; y <= side_length; y++)
+		for (s16 z = -1; z <= side_length; z++)
 			data.m_vmanip.setNode({x, y, z}, {CONTENT_AIR, 0, 0});
 		return data;
 	}
 
+	MeshMakeData makeSingleNodeMMD(bool smooth_lighting = true)
+	{
+		return makeMMD(1, smooth_lighting);
+	}
+
 	content_t addSimpleNode(std::string name, u32 texture)
 	{
 		ItemDefinition itemdef;
@@ -144,6 +149,9 @@ class TestMapblockMeshGenerator : public TestBase {
 	void testSurroundedNode();
 	void testInterliquidSame();
 	void testInterliquidDifferent();
+	void testGreedyMerge();
+	void testGreedyMergeDifferent();
+	void testGreedyMergeNotTileable();
 };
 
 static TestMapblockMeshGenerator g_test_instance;
@@ -155,6 +163,9 @@ void TestMapblockMeshGenerator::runTests(IGameDef *gamedef)
 	TEST(testSurroundedNode);
 	TEST(testInterliquidSame);
 	TEST(testInterliquidDifferent);
+	TEST(testGreedyMerge);
+	TEST(testGreedyMergeDifferent);
+	TEST(testGreedyMergeNotTileable);
 }
 
 namespace quad {
@@ -252,4 +263,111 @@ void TestMapblockMeshGenerator::testInterliquidDifferent()
 	UASSERT(checkMeshEqual(buf.vertices, buf.indices, {quad::xn, quad::xp, quad::yn, quad::yp, quad::zn, quad::zp}));
 }
 
+// Moves the vertices on the +X side of a unit cube quad by one node
+Quad stretchX(Quad quad, float du)
+{
+	for (auto &vertex : quad) {
+		if (vertex.Pos.X > 0) {
+			vertex.Pos.X += BS;
+			vertex.TCoords.X += du;
+		}
+	}
+	return quad;
+}
+
+void TestMapblockMeshGenerator::testGreedyMerge()
+{
+	MockGameDef gamedef;
+	content_t stone = gamedef.addSimpleNode("stone", 42);
+	gamedef.finalize();
+
+	for (bool smooth_lighting : {true, false}) {
+		MeshMakeData data = gamedef.makeMMD(2, smooth_lighting);
+		data.m_greedy_meshing = true;
+		data.m_vmanip.setNode({0, 0, 0}, {stone, 0, 0});
+		data.m_vmanip.setNode({1, 0, 0}, {stone, 0, 0});
+
+		MeshCollector col{{}};
+		MapblockMeshGenerator mg{&data, &col};
+		mg.generate();
+		UASSERTEQ(std::size_t, col.prebuffers[0].size(), 1);
+		UASSERTEQ(std::size_t, col.prebuffers[1].size(), 0);
+
+		// one cuboid covering both nodes, with the texture repeated along X
+		auto &&buf = col.prebuffers[0][0];
+		UASSERTEQ(u32, buf.layer.texture_id, 42);
+		UASSERT(checkMeshEqual(buf.vertices, buf.indices, {
+			quad::xn, stretchX(quad::xp, 0),
+			stretchX(quad::yn, 1), stretchX(quad::yp, 1),
+			stretchX(quad::zn, 1), stretchX(quad::zp, -1),
+		}));
+	}
+}
+
+void TestMapblockMeshGenerator::testGreedyMergeDifferent()
+{
+	MockGameDef gamedef;
+	content_t stone = gamedef.addSimpleNode("stone", 42);
+	content_t wood = gamedef.addSimpleNode("wood", 13);
+	gamedef.finalize();
+
+	MeshMakeData data = gamedef.makeMMD(2);
+	data.m_greedy_meshing = true;
+	data.m_vmanip.setNode({0, 0, 0}, {stone, 0, 0});
+	data.m_vmanip.setNode({1, 0, 0}, {wood, 0, 0});
+
+	MeshCollector col{{}};
+	MapblockMeshGenerator mg{&data, &col};
+	mg.generate();
+	UASSERTEQ(std::size_t, col.prebuffers[0].size(), 2);
+	UASSERTEQ(std::size_t, col.prebuffers[1].size(), 0);
+
+	// faces of different nodes are not merged
+	for (auto &&buf : col.prebuffers[0]) {
+		UASSERTEQ(std::size_t, buf.vertices.size(), 5 * 4);
+		if (buf.layer.texture_id == 42)
+			UASSERT(checkMeshEqual(buf.vertices, buf.indices, {quad::xn, quad::yn, quad::yp, quad::zn, quad::zp}));
+	}
+}
+
+
+void TestMapblockMeshGenerator::testGreedyMergeNotTileable()
+{
+	MockGameDef gamedef;
+	ItemDefinition itemdef;
+	itemdef.type = ITEM_NODE;
+	itemdef.name = "test:frame";
+	ContentFeatures f;
+	f.name = itemdef.name;
+	f.drawtype = NDT_NORMAL;
+	f.solidness = 2;
+	f.alpha = ALPHAMODE_OPAQUE;
+	for (TileDef &tiledef : f.tiledef) {
+		tiledef.name = "frame.png";
+		tiledef.tileable_horizontal = false;
+	}
+	for (TileSpec &tile : f.tiles) {
+		tile.layers[0].texture_id = 42;
+		tile.layers[0].material_flags &= ~MATERIAL_FLAG_TILEABLE_HORIZONTAL;
+	}
+	content_t frame = gamedef.registerNode(itemdef, f);
+	gamedef.finalize();
+
+	MeshMakeData data = gamedef.makeMMD(2);
+	data.m_greedy_meshing = true;
+	data.m_vmanip.setNode({0, 0, 0}, {frame, 0, 0});
+	data.m_vmanip.setNode({1, 0, 0}, {frame, 0, 0});
+
+	MeshCollector col{{}};
+	MapblockMeshGenerator mg{&data, &col};
+	mg.generate();
+	UASSERTEQ(std::size_t, col.prebuffers[0].size(), 1);
+	UASSERTEQ(std::size_t, col.prebuffers[1].size(), 0);
+
+	// the texture must not repeat, so every node keeps its own faces
+	auto &&buf = col.prebuffers[0][0];
+	UASSERTEQ(std::size_t, buf.vertices.size(), 10 * 4);
+	UASSERTEQ(std::size_t, buf.indices.size(), 10 * 6);
+}
+
 }
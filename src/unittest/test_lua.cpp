@@ -5,7 +5,10 @@
 
 #include "test.h"
 #include "config.h"
+#include "exceptions.h"
+#include "script/common/c_packer.h"
 
+#include <memory>
 #include <stdexcept>
 
 extern "C" {
@@ -15,6 +18,7 @@ extern "C" {
 	#include <lua.h>
 #endif
 #include <lauxlib.h>
+#include <lualib.h>
 }
 
 /*
@@ -35,6 +39,8 @@ class TestLua : public TestBase
 
 	void testLuaDestructors();
 	void testCxxExceptions();
+	void testPackedSerialization();
+	void testPackedDeserializationInvalid();
 };
 
 static TestLua g_test_instance;
@@ -43,6 +49,8 @@ void TestLua::runTests(IGameDef *gamedef)
 {
 	TEST(testLuaDestructors);
 	TEST(testCxxExceptions);
+	TEST(testPackedSerialization);
+	TEST(testPackedDeserializationInvalid);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -138,3 +146,132 @@ void TestLua::testCxxExceptions()
 	UASSERTEQ(int, caught, 2);
 	UASSERT(errmsg.find("example") != std::string::npos);
 }
+
+namespace {
+
+	std::string serialize_top(lua_State *L)
+	{
+		std::unique_ptr<PackedValue> pv(script_pack(L, -1));
+		return script_serialize_packed(pv.get());
+	}
+
+	void deserialize_push(lua_State *L, const std::string &data)
+	{
+		std::unique_ptr<PackedValue> pv(script_deserialize_packed(data));
+		script_unpack(L, pv.get());
+	}
+
+	const char *test_value = R"(
+		local shared = {"shared"}
+		local zero = 0 -- a literal -0 would be folded into 0
+		local t = {
+			1, 2.5, -zero, 0/0, 1e300, 2^31, -2^31, "a\0b",
+			[true] = "bool key", [2.5] = "float key", ["k\0ey"] = "null in key",
+			nested = {a = {b = {c = {}}}},
+			s1 = shared, s2 = shared, [shared] = shared,
+			empty = "", f = false,
+		}
+		t.self = t
+		return t
+	)";
+
+	const char *test_check = R"(
+		local u = ...
+		assert(u[1] == 1 and u[2] == 2.5)
+		assert(u[3] == 0 and 1/u[3] == -math.huge)
+		assert(u[4] ~= u[4])
+		assert(u[5] == 1e300 and u[6] == 2^31 and u[7] == -2^31)
+		assert(u[8] == "a\0b")
+		assert(u[true] == "bool key" and u[2.5] == "float key")
+		assert(u["k\0ey"] == "null in key")
+		assert(type(u.nested.a.b.c) == "table")
+		assert(u.s1 == u.s2 and u.s1[1] == "shared" and u[u.s1] == u.s1)
+		assert(u.empty == "" and u.f == false)
+		assert(u.self == u)
+	)";
+
+}
+
+void TestLua::testPackedSerialization()
+{
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	UASSERT(luaL_dostring(L, test_value) == 0);
+	const std::string data = serialize_top(L);
+	lua_pop(L, 1);
+
+	deserialize_push(L, data);
+	UASSERT(luaL_loadstring(L, test_check) == 0);
+	lua_insert(L, -2);
+	if (lua_pcall(L, 1, 0, 0) != 0) {
+		rawstream << lua_tostring(L, -1) << std::endl;
+		UASSERT(false);
+	}
+
+	// primitives
+	lua_pushnil(L);
+	deserialize_push(L, serialize_top(L));
+	UASSERT(lua_isnil(L, -1));
+	lua_pushstring(L, "foo");
+	deserialize_push(L, serialize_top(L));
+	UASSERT(lua_tostring(L, -1) == std::string("foo"));
+	lua_pushnumber(L, 0.1);
+	deserialize_push(L, serialize_top(L));
+	UASSERTEQ(lua_Number, lua_tonumber(L, -1), 0.1);
+	lua_settop(L, 0);
+
+	// unsupported types
+	UASSERT(luaL_dostring(L, "return {f = function() end}") == 0);
+	EXCEPTION_CHECK(SerializationError, serialize_top(L));
+
+	lua_close(L);
+}
+
+void TestLua::testPackedDeserializationInvalid()
+{
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	UASSERT(luaL_dostring(L, test_value) == 0);
+	const std::string data = serialize_top(L);
+	lua_settop(L, 0);
+
+	EXCEPTION_CHECK(SerializationError, script_deserialize_packed(""));
+	EXCEPTION_CHECK(SerializationError, script_deserialize_packed(data + "x"));
+	for (size_t i = 0; i < data.size(); i++)
+		EXCEPTION_CHECK(SerializationError, script_deserialize_packed(data.substr(0, i)));
+
+	// corrupted data must be rejected or unpack to something
+	for (size_t i = 0; i < data.size(); i++) {
+		for (u8 c : {0x00, 0x01, 0x02, 0x7f, 0x80, 0xf3, 0xff}) {
+			std::string corrupt = data;
+			corrupt[i] = c;
+			try {
+				deserialize_push(L, corrupt);
+			} catch (SerializationError &e) {
+			}
+			lua_settop(L, 0);
+		}
+	}
+
+	// nil keys are checked as well
+	PackedValue pv;
+	pv.i.resize(4);
+	pv.i[0].type = LUA_TTABLE;
+	pv.i[0].uidata1 = pv.i[0].uidata2 = 0;
+	pv.i[1].type = LUA_TNIL;
+	pv.i[2].type = LUA_TBOOLEAN;
+	pv.i[2].bdata = true;
+	pv.i[3].type = INSTR_SETTABLE;
+	pv.i[3].set_into = 1;
+	pv.i[3].sidata1 = 2;
+	pv.i[3].sidata2 = 3;
+	pv.i[3].pop = true;
+	EXCEPTION_CHECK(SerializationError, script_serialize_packed(&pv));
+	pv.i[1].type = LUA_TNUMBER;
+	pv.i[1].ndata = 1;
+	script_serialize_packed(&pv);
+
+	lua_close(L);
+}
@@ -23,6 +23,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <unordered_map>
 #include "mapblock.h"
 #include "dummymap.h"
+#include "servermap.h"
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#include "filesys.h"
+#include "server/mapsavethread.h"
+#include "util/metricsbackend.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +42,11 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testSaveThread(IGameDef *gamedef);
+	void testLoadBlocks();
+
+private:
+	void checkLoadBlocks(MapDatabase *dbase);
 };
 
 static TestMap g_test_instance;
@@ -46,6 +57,8 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testSaveThread, gamedef);
+	TEST(testLoadBlocks);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +182,125 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testSaveThread(IGameDef *gamedef)
+{
+	const v3s16 pos(1, -2, 3);
+	MapBlock block(pos, gamedef);
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+		block.setNodeNoCheck(x, 0, z, MapNode(t_CONTENT_STONE));
+
+	// what the synchronous path writes
+	std::string expected;
+	{
+		Database_Dummy ref_db;
+		ServerMap::saveBlock(&block, &ref_db);
+		ref_db.loadBlock(pos, &expected);
+		UASSERT(!expected.empty());
+	}
+
+	Database_Dummy dbase;
+	MapDatabaseAccessor db;
+	db.dbase = &dbase;
+	MetricsBackend mb;
+	MapSaveThread thread(&db, -1, 1024 * 1024, &mb);
+	db.save_thread = &thread;
+	UASSERT(thread.start());
+
+	// pending or not, loading must return the new data
+	thread.enqueue(&block);
+	std::string data;
+	{
+		MutexAutoLock dblock(db.mutex);
+		db.loadBlock(pos, data);
+	}
+	UASSERT(data == expected);
+
+	thread.flush();
+	data.clear();
+	dbase.loadBlock(pos, &data);
+	UASSERT(data == expected);
+
+	// a deleted block must not be brought back by a pending write
+	thread.enqueue(&block);
+	{
+		MutexAutoLock dblock(db.mutex);
+		thread.discard(pos);
+		dbase.deleteBlock(pos);
+	}
+	thread.flush();
+	data.clear();
+	dbase.loadBlock(pos, &data);
+	UASSERT(data.empty());
+
+	thread.stop();
+	thread.signal();
+	thread.wait();
+}
+
+void TestMap::checkLoadBlocks(MapDatabase *dbase)
+{
+	auto data_for = [] (v3s16 p) {
+		return "block " + std::to_string(p.X) + "," +
+			std::to_string(p.Y) + "," + std::to_string(p.Z);
+	};
+
+	// every other block of a small area, across the origin
+	std::vector<v3s16> positions;
+	v3s16 p;
+	for (p.Z = -2; p.Z <= 1; p.Z++)
+	for (p.Y = -2; p.Y <= 1; p.Y++)
+	for (p.X = -3; p.X <= 2; p.X++) {
+		if ((p.X + p.Y + p.Z) % 2 == 0)
+			dbase->saveBlock(p, data_for(p));
+		positions.push_back(p);
+	}
+	// out of order and far away
+	positions.push_back(v3s16(-2048, 2047, 100));
+	std::swap(positions[3], positions[40]);
+
+	std::vector<std::string> blocks;
+	dbase->loadBlocks(positions, &blocks);
+	UASSERTEQ(size_t, blocks.size(), positions.size());
+	for (size_t i = 0; i < positions.size(); i++) {
+		const v3s16 p = positions[i];
+		bool saved = p.X <= 2 && (p.X + p.Y + p.Z) % 2 == 0;
+		UASSERTEQ(std::string, blocks[i], saved ? data_for(p) : "");
+	}
+
+	// empty request
+	dbase->loadBlocks({}, &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMap::testLoadBlocks()
+{
+	{
+		Database_Dummy dbase;
+		checkLoadBlocks(&dbase);
+	}
+
+	const std::string test_dir = getTestTempDirectory();
+	{
+		MapDatabaseSQLite3 dbase(test_dir);
+		checkLoadBlocks(&dbase);
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	// the read-only database fills in what the main one does not have
+	Database_Dummy dbase, dbase_ro;
+	MapDatabaseAccessor db;
+	db.dbase = &dbase;
+	db.dbase_ro = &dbase_ro;
+	dbase.saveBlock(v3s16(0, 0, 0), "main");
+	dbase_ro.saveBlock(v3s16(0, 0, 0), "ro");
+	dbase_ro.saveBlock(v3s16(1, 0, 0), "ro");
+
+	std::vector<std::string> blocks;
+	db.loadBlocks({v3s16(0, 0, 0), v3s16(1, 0, 0), v3s16(2, 0, 0)}, blocks);
+	UASSERTEQ(size_t, blocks.size(), 3);
+	UASSERTEQ(std::string, blocks[0], "main");
+	UASSERTEQ(std::string, blocks[1], "ro");
+	UASSERT(blocks[2].empty());
+}
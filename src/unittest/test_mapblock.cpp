@@ -5,11 +5,13 @@
 
 #include <sstream>
 #include "gamedef.h"
+#include "dummygamedef.h"
 #include "nodedef.h"
 #include "mapblock.h"
 #include "serialization.h"
 #include "noise.h"
 #include "inventory.h"
+#include "server/blocksendcache.h"
 
 class TestMapBlock : public TestBase
 {
@@ -33,6 +35,15 @@ class TestMapBlock : public TestBase
 
 	// Tests loading a non-standard MapBlock
 	void testLoadNonStd(IGameDef *gamedef);
+
+	// Tests loading a MapBlock without allocating ids for unknown nodes
+	void testLoadUnknownNodes();
+
+	void testSendCache(IGameDef *gamedef);
+
+	void testCompactNodes(IGameDef *gamedef);
+
+	void testContentCache(IGameDef *gamedef);
 };
 
 static TestMapBlock g_test_instance;
@@ -45,6 +56,10 @@ void TestMapBlock::runTests(IGameDef *gamedef)
 	TEST(testLoad29, gamedef);
 	TEST(testLoad20, gamedef);
 	TEST(testLoadNonStd, gamedef);
+	TEST(testLoadUnknownNodes);
+	TEST(testSendCache, gamedef);
+	TEST(testCompactNodes, gamedef);
+	TEST(testContentCache, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -70,7 +85,7 @@ void TestMapBlock::testSaveLoad(IGameDef *gamedef, const u8 version)
 		PcgRandom r(seed);
 		for (size_t i = 0; i < MapBlock::nodecount; ++i) {
 			u32 rval = r.next();
-			block.getData()[i] =
+			block.getDataForWrite()[i] =
 				MapNode(rval % max, (rval >> 16) & 0xff, (rval >> 24) & 0xff);
 		}
 
@@ -105,7 +120,7 @@ void TestMapBlock::testSave29(IGameDef *gamedef)
 		// Prepare test block
 		MapBlock block({}, gamedef);
 		for (size_t i = 0; i < MapBlock::nodecount; ++i)
-			block.getData()[i] = MapNode(CONTENT_AIR);
+			block.getDataForWrite()[i] = MapNode(CONTENT_AIR);
 		block.setNode({0, 0, 0}, MapNode(t_CONTENT_STONE));
 
 		block.serialize(ss, 29, true, -1);
@@ -356,3 +371,204 @@ void TestMapBlock::testLoadNonStd(IGameDef *gamedef)
 	for (s16 i = 0; i < 16; i++)
 		UASSERTEQ(int, block.getNodeNoEx({i, 1, 0}).param2, data_lo[i]);
 }
+
+void TestMapBlock::testLoadUnknownNodes()
+{
+	// doesn't know about test:one and test:two
+	DummyGameDef gamedef;
+	auto *ndef = gamedef.getNodeDefManager();
+
+	const std::string_view buf(reinterpret_cast<const char*>(coded_mapblock_nonstd), sizeof(coded_mapblock_nonstd));
+	std::istringstream iss;
+	iss.str(std::string(buf));
+	u8 version = readU8(iss);
+	MapBlock block({}, &gamedef);
+	MapBlock::UnknownNodes unknown;
+	block.deSerialize(iss, version, true, &unknown);
+
+	// the node definitions are left alone
+	content_t id;
+	UASSERT(!ndef->getId("test:one", id));
+	UASSERT(!ndef->getId("test:two", id));
+	UASSERTEQ(size_t, unknown.names.size(), 2);
+	UASSERTEQ(size_t, unknown.nodes.size(), 32);
+	UASSERTEQ(int, block.getNodeNoEx({0, 0, 0}).getContent(), CONTENT_UNKNOWN);
+	UASSERTEQ(int, block.getNodeNoEx({0, 1, 0}).getContent(), CONTENT_UNKNOWN);
+	UASSERTEQ(int, block.getNodeNoEx({0, 2, 0}).getContent(), CONTENT_AIR);
+
+	block.resolveUnknownNodes(unknown);
+	UASSERTEQ(int, block.getNodeNoEx({0, 0, 0}).getContent(), ndef->getId("test:one"));
+	UASSERTEQ(int, block.getNodeNoEx({15, 1, 0}).getContent(), ndef->getId("test:two"));
+	UASSERTEQ(int, block.getNodeNoEx({0, 2, 0}).getContent(), CONTENT_AIR);
+	UASSERT(block.getNodeNoEx({0, 0, 0}).getContent() != CONTENT_UNKNOWN);
+	UASSERT(block.getNodeNoEx({0, 1, 0}).getContent() != CONTENT_UNKNOWN);
+}
+
+void TestMapBlock::testSendCache(IGameDef *gamedef)
+{
+	MetricsBackend mb;
+	BlockSendCache cache(1024 * 1024, &mb);
+
+	MapBlock block({1, 2, 3}, gamedef);
+	const u8 ver = SER_FMT_VER_HIGHEST_WRITE;
+
+	UASSERT(!cache.get(&block, ver));
+	cache.put(&block, ver, "data");
+	UASSERT(cache.get(&block, ver) && *cache.get(&block, ver) == "data");
+	UASSERT(!cache.get(&block, ver - 1));
+
+	// changes that are not sent to clients keep the entry valid
+	block.setTimestamp(1234);
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_ADDED);
+	UASSERT(cache.get(&block, ver));
+
+	block.setNode({0, 0, 0}, MapNode(t_CONTENT_STONE));
+	UASSERT(!cache.get(&block, ver));
+	UASSERT(cache.getSize() == 0);
+
+	// another block at the same position
+	cache.put(&block, ver, "data");
+	{
+		MapBlock block2({1, 2, 3}, gamedef);
+		UASSERT(!cache.get(&block2, ver));
+	}
+
+	// data serialized before the block was changed is not used
+	const u64 stamp = block.getChangeStamp();
+	block.setNode({0, 0, 0}, MapNode(CONTENT_AIR));
+	cache.put(block.getPos(), ver, stamp, "old");
+	UASSERT(!cache.get(&block, ver));
+	cache.put(block.getPos(), ver, block.getChangeStamp(), "new");
+	UASSERT(cache.get(&block, ver) && *cache.get(&block, ver) == "new");
+
+	// compressing separately (as done on the block send threads) gives the
+	// same data as serialize()
+	{
+		std::ostringstream whole(std::ios_base::binary);
+		block.serialize(whole, ver, false, -1);
+		std::ostringstream raw(std::ios_base::binary);
+		block.serializeUncompressed(raw, ver, false);
+		std::ostringstream compressed(std::ios_base::binary);
+		compress(raw.str(), compressed, ver, -1);
+		UASSERT(whole.str() == compressed.str());
+	}
+
+	// the memory budget is respected
+	BlockSendCache small_cache(10000, &mb);
+	const std::string big(4000, 'x');
+	MapBlock a({0, 0, 0}, gamedef), b({0, 0, 1}, gamedef), c({0, 0, 2}, gamedef);
+	small_cache.put(&a, ver, std::string(big));
+	small_cache.put(&b, ver, std::string(big));
+	UASSERT(small_cache.get(&a, ver));
+	small_cache.put(&c, ver, std::string(big));
+	UASSERT(small_cache.getSize() <= 10000);
+	// b was the least recently used one
+	UASSERT(!small_cache.get(&b, ver));
+	UASSERT(small_cache.get(&a, ver) && small_cache.get(&c, ver));
+}
+
+void TestMapBlock::testCompactNodes(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	const size_t plain_size = MapBlock::nodecount * sizeof(MapNode);
+
+	// new blocks are uniform
+	UASSERT(block.getNodeDataSize() < 64);
+	UASSERT(block.getNodeNoCheck(5, 5, 5).getContent() == CONTENT_IGNORE);
+
+	for (size_t i = 0; i < MapBlock::nodecount; i++)
+		block.getDataForWrite()[i] = MapNode(CONTENT_AIR);
+	UASSERT(block.getNodeDataSize() >= plain_size);
+	block.compactNodes();
+	UASSERT(block.getNodeDataSize() < 64);
+	block.expireIsAirCache();
+	UASSERT(block.isAir());
+
+	// writes expand to a palette
+	block.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE, 0, 7));
+	UASSERT(block.getNodeDataSize() < plain_size / 2);
+	UASSERT(block.getNodeNoCheck(1, 2, 3) == MapNode(t_CONTENT_STONE, 0, 7));
+	UASSERT(block.getNodeNoCheck(3, 2, 1) == MapNode(CONTENT_AIR));
+	block.expireIsAirCache();
+	UASSERT(!block.isAir());
+
+	// and to plain storage once the palette is full
+	for (u32 i = 0; i < 300; i++) {
+		v3s16 p(i % 16, i / 16 % 16, i / 256);
+		block.setNode(p, MapNode(CONTENT_AIR, i / 256, i % 256));
+	}
+	UASSERT(block.getNodeDataSize() >= plain_size);
+	for (u32 i = 0; i < 300; i++) {
+		v3s16 p(i % 16, i / 16 % 16, i / 256);
+		UASSERT(block.getNodeNoCheck(p) == MapNode(CONTENT_AIR, i / 256, i % 256));
+	}
+	UASSERT(block.getNodeNoCheck(1, 2, 3) == MapNode(t_CONTENT_STONE, 0, 7));
+
+	// too many different nodes, stays plain
+	block.compactNodes();
+	UASSERT(block.getNodeDataSize() >= plain_size);
+
+	// serialization is the same no matter the representation
+	for (u32 i = 0; i < 300; i++)
+		block.setNode(v3s16(i % 16, i / 16 % 16, i / 256), MapNode(CONTENT_AIR));
+	std::ostringstream os1(std::ios_base::binary), os2(std::ios_base::binary);
+	block.serialize(os1, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+	block.compactNodes();
+	UASSERT(block.getNodeDataSize() < plain_size / 2);
+	block.serialize(os2, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+	UASSERT(os1.str() == os2.str());
+
+	std::unique_ptr<MapNode[]> nodes(new MapNode[MapBlock::nodecount]);
+	block.copyNodesTo(nodes.get());
+	UASSERT(nodes[MapBlock::zstride * 3 + MapBlock::ystride * 2 + 1] ==
+		MapNode(t_CONTENT_STONE, 0, 7));
+	UASSERT(nodes[0] == MapNode(CONTENT_AIR));
+}
+
+void TestMapBlock::testContentCache(IGameDef *gamedef)
+{
+	MapBlock block({}, gamedef);
+	UASSERT(block.contents == std::vector<content_t>{CONTENT_IGNORE});
+
+	// reading doesn't touch the cache
+	UASSERT(block.getData()[0].getContent() == CONTENT_IGNORE);
+	UASSERT(block.contents == std::vector<content_t>{CONTENT_IGNORE});
+
+	// raw writes drop the cache
+	for (size_t i = 0; i < MapBlock::nodecount; i++)
+		block.getDataForWrite()[i] = MapNode(CONTENT_AIR);
+	UASSERT(block.contents.empty());
+
+	// it is built when loading
+	std::stringstream ss(std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+	block.serialize(ss, SER_FMT_VER_HIGHEST_WRITE, true, -1);
+	MapBlock block2({}, gamedef);
+	block2.deSerialize(ss, SER_FMT_VER_HIGHEST_WRITE, true);
+	UASSERT(block2.contents == std::vector<content_t>{CONTENT_AIR});
+
+	// and extended by modifications
+	block2.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+	block2.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_UNKNOWN);
+	UASSERT(block2.contents == (std::vector<content_t>{CONTENT_AIR, t_CONTENT_STONE}));
+
+	// removed contents may stay listed
+	block2.setNode({1, 2, 3}, MapNode(CONTENT_AIR));
+	UASSERTEQ(size_t, block2.contents.size(), 2);
+
+	// too many different contents are not cached
+	for (content_t c = 0; c < 100; c++)
+		block2.setNode(v3s16(c % 16, c / 16, 0), MapNode(c));
+	UASSERT(block2.contents.empty());
+	UASSERT(block2.do_not_cache_contents);
+
+	// until the cache is rebuilt
+	for (content_t c = 0; c < 100; c++)
+		block2.setNode(v3s16(c % 16, c / 16, 0), MapNode(CONTENT_AIR));
+	block2.setNode({1, 2, 3}, MapNode(t_CONTENT_STONE));
+	block2.updateContentCache();
+	UASSERT(!block2.do_not_cache_contents);
+	UASSERT(block2.contents == (std::vector<content_t>{CONTENT_AIR, t_CONTENT_STONE}));
+	block2.compactNodes();
+	block2.updateContentCache();
+	UASSERT(block2.contents == (std::vector<content_t>{CONTENT_AIR, t_CONTENT_STONE}));
+}
@@ -0,0 +1,317 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <sstream>
+
+#include "dummygamedef.h"
+#include "filesys.h"
+#include "nodedef.h"
+#include "serialization.h"
+#include "client/content_mapblock.h"
+#include "client/mapblock_mesh.h"
+#include "client/meshgen/collector.h"
+#include "client/meshgen/diskcache.h"
+#include "client/shader.h"
+#include "client/texturesource.h"
+
+namespace {
+
+class MockTextureSource : public ITextureSource
+{
+public:
+	u32 getTextureId(const std::string &name) override { return 0; }
+	std::string getTextureName(u32 id) override
+	{
+		return "test_" + std::to_string(id) + ".png";
+	}
+	video::ITexture *getTexture(u32 id) override { return nullptr; }
+	video::ITexture *getTexture(const std::string &name, u32 *id) override
+	{
+		return nullptr;
+	}
+	video::ITexture *getTextureForMesh(const std::string &name, u32 *id) override
+	{
+		return nullptr;
+	}
+	Palette *getPalette(const std::string &name) override { return nullptr; }
+	bool isKnownSourceImage(const std::string &name) override { return false; }
+	video::SColor getTextureAverageColor(const std::string &name) override
+	{
+		return video::SColor(0);
+	}
+};
+
+class MockShaderSource : public IShaderSource
+{
+public:
+	ShaderInfo getShaderInfo(u32 id) override { return ShaderInfo(); }
+	u32 getShader(const std::string &name, MaterialType material_type,
+		NodeDrawType drawtype) override { return 0; }
+	u32 getShaderRaw(const std::string &name, bool blendAlpha) override { return 0; }
+};
+
+struct Fixture
+{
+	DummyGameDef gamedef;
+	MockTextureSource tsrc;
+	MockShaderSource shdrsrc;
+	content_t stone, wood;
+
+	Fixture()
+	{
+		stone = addNode("stone", 42);
+		wood = addNode("wood", 13);
+	}
+
+	content_t addNode(const std::string &name, u32 texture)
+	{
+		ContentFeatures f;
+		f.name = "test:" + name;
+		f.drawtype = NDT_NORMAL;
+		f.solidness = 2;
+		f.alpha = ALPHAMODE_OPAQUE;
+		for (TileSpec &tile : f.tiles)
+			tile.layers[0].texture_id = texture;
+		return gamedef.getWritableNodeDefManager()->set(f.name, f);
+	}
+
+	MeshMakeData makeMMD()
+	{
+		MeshMakeData data{gamedef.getNodeDefManager(), 2, MeshGrid{1}};
+		data.m_blockpos = {0, 0, 0};
+		data.m_generate_minimap = false;
+		for (s16 x = -1; x <= 2; x++)
+		for (s16 y = -1; y <= 2; y++)
+		for (s16 z = -1; z <= 2; z++)
+			data.m_vmanip.setNode({x, y, z}, {CONTENT_AIR, 0, 0});
+		data.m_vmanip.setNode({0, 0, 0}, {stone, 0, 0});
+		data.m_vmanip.setNode({1, 0, 0}, {wood, 0, 0});
+		data.m_vmanip.setNode({1, 1, 0}, {stone, 0, 0});
+		return data;
+	}
+
+	std::unique_ptr<MeshDiskCache> makeCache(const std::string &dir,
+		u64 max_size = 1024 * 1024)
+	{
+		return std::make_unique<MeshDiskCache>(dir, max_size, "test",
+			gamedef.getNodeDefManager(), &tsrc, &shdrsrc);
+	}
+};
+
+void generate(MeshMakeData *data, MeshCollector &collector)
+{
+	MapblockMeshGenerator(data, &collector).generate();
+}
+
+bool is_empty(const MeshCollector &collector)
+{
+	for (auto &prebuffers : collector.prebuffers) {
+		if (!prebuffers.empty())
+			return false;
+	}
+	return true;
+}
+
+size_t count_files(const std::string &dir)
+{
+	size_t count = 0;
+	for (auto &node : fs::GetDirListing(dir))
+		count += !node.dir;
+	return count;
+}
+
+}
+
+class TestMeshDiskCache : public TestBase {
+public:
+	TestMeshDiskCache() { TestManager::registerTestModule(this); }
+	const char *getName() override { return "TestMeshDiskCache"; }
+
+	void runTests(IGameDef *gamedef) override;
+
+	void testRoundTrip();
+	void testInvalidEntries();
+	void testKey();
+	void testEviction();
+
+private:
+	// Returns an empty directory for the cache
+	std::string makeDir(const char *name);
+};
+
+static TestMeshDiskCache g_test_instance;
+
+void TestMeshDiskCache::runTests(IGameDef *gamedef)
+{
+	TEST(testRoundTrip);
+	TEST(testInvalidEntries);
+	TEST(testKey);
+	TEST(testEviction);
+}
+
+std::string TestMeshDiskCache::makeDir(const char *name)
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + name;
+	fs::RecursiveDelete(dir);
+	UASSERT(fs::CreateAllDirs(dir));
+	return dir;
+}
+
+void TestMeshDiskCache::testRoundTrip()
+{
+	Fixture f;
+	auto cache = f.makeCache(makeDir("meshes_roundtrip"));
+	MeshMakeData data = f.makeMMD();
+	const std::string key = cache->getKey(&data);
+	UASSERT(!key.empty());
+
+	MeshCollector col{{}};
+	UASSERT(!cache->load(key, col));
+	generate(&data, col);
+	UASSERTEQ(std::size_t, col.prebuffers[0].size(), 2);
+	cache->store(key, col);
+
+	MeshCollector loaded{{}};
+	UASSERT(cache->load(key, loaded));
+	UASSERTEQ(f32, loaded.m_bounding_radius_sq, col.m_bounding_radius_sq);
+	for (int layer = 0; layer < MAX_TILE_LAYERS; layer++) {
+		auto &expected = col.prebuffers[layer];
+		auto &actual = loaded.prebuffers[layer];
+		UASSERTEQ(std::size_t, actual.size(), expected.size());
+		for (std::size_t i = 0; i < expected.size(); i++) {
+			UASSERTEQ(u32, actual[i].layer.texture_id, expected[i].layer.texture_id);
+			UASSERTEQ(int, actual[i].layer.material_type, expected[i].layer.material_type);
+			UASSERT(actual[i].vertices == expected[i].vertices);
+			UASSERT(actual[i].indices == expected[i].indices);
+		}
+	}
+}
+
+void TestMeshDiskCache::testInvalidEntries()
+{
+	Fixture f;
+	const std::string dir = makeDir("meshes_invalid");
+	auto cache = f.makeCache(dir);
+	MeshMakeData data = f.makeMMD();
+	const std::string key = cache->getKey(&data);
+	const std::string path = dir + DIR_DELIM + key;
+
+	MeshCollector col{{}};
+	generate(&data, col);
+	cache->store(key, col);
+	std::string compressed;
+	UASSERT(fs::ReadFile(path, compressed));
+	std::string raw;
+	{
+		std::istringstream is(compressed, std::ios::binary);
+		std::ostringstream os(std::ios::binary);
+		decompressZstd(is, os);
+		raw = os.str();
+	}
+
+	auto check_rejected = [&] (std::string_view file) {
+		UASSERT(fs::safeWriteToFile(path, file));
+		MeshCollector loaded{{}};
+		UASSERT(!cache->load(key, loaded));
+		UASSERT(is_empty(loaded));
+	};
+
+	// not compressed data
+	check_rejected("garbage");
+	// compressed data cut short
+	check_rejected(std::string_view(compressed).substr(0, compressed.size() / 2));
+	// valid compression, but the entry is cut short
+	for (size_t size : {raw.size() - 1, raw.size() / 2, (size_t)5}) {
+		std::ostringstream os(std::ios::binary);
+		compressZstd(std::string_view(raw).substr(0, size), os);
+		check_rejected(os.str());
+	}
+	// unknown version
+	{
+		std::string modified = raw;
+		modified[0]++;
+		std::ostringstream os(std::ios::binary);
+		compressZstd(modified, os);
+		check_rejected(os.str());
+	}
+
+	// the original entry is still fine
+	UASSERT(fs::safeWriteToFile(path, compressed));
+	MeshCollector loaded{{}};
+	UASSERT(cache->load(key, loaded));
+}
+
+void TestMeshDiskCache::testKey()
+{
+	Fixture f;
+	auto cache = f.makeCache(makeDir("meshes_key"));
+	MeshMakeData data = f.makeMMD();
+	const std::string key = cache->getKey(&data);
+	UASSERT(!key.empty());
+
+	MeshMakeData same = f.makeMMD();
+	UASSERTEQ(std::string, cache->getKey(&same), key);
+
+	// the border nodes of the neighbors are part of the key
+	data.m_vmanip.setNode({-1, 0, 0}, {f.stone, 0, 0});
+	UASSERT(cache->getKey(&data) != key);
+	data.m_vmanip.setNode({-1, 0, 0}, {CONTENT_AIR, 0, 0});
+	UASSERTEQ(std::string, cache->getKey(&data), key);
+	data.m_vmanip.setNode({2, 2, 2}, {CONTENT_AIR, 15, 0});
+	UASSERT(cache->getKey(&data) != key);
+	data.m_vmanip.setNode({2, 2, 2}, {CONTENT_AIR, 0, 0});
+
+	// and so are the flags
+	data.m_smooth_lighting = !data.m_smooth_lighting;
+	UASSERT(cache->getKey(&data) != key);
+	data.m_smooth_lighting = !data.m_smooth_lighting;
+
+	// and the content
+	MeshDiskCache other(makeDir("meshes_key_other"), 1024, "other",
+		f.gamedef.getNodeDefManager(), &f.tsrc, &f.shdrsrc);
+	UASSERT(other.getKey(&data) != key);
+
+	// cracks are not cached
+	data.setCrack(1, {0, 0, 0});
+	UASSERTEQ(std::string, cache->getKey(&data), "");
+}
+
+void TestMeshDiskCache::testEviction()
+{
+	Fixture f;
+	const std::string dir = makeDir("meshes_eviction");
+	MeshMakeData data = f.makeMMD();
+	MeshCollector col{{}};
+	generate(&data, col);
+
+	uint64_t entry_size;
+	{
+		auto cache = f.makeCache(dir);
+		cache->store("size", col);
+		int64_t mtime;
+		UASSERT(fs::GetFileInfo(dir + DIR_DELIM "size", entry_size, mtime));
+		UASSERT(fs::DeleteSingleFileOrEmptyDirectory(dir + DIR_DELIM "size"));
+	}
+
+	// room for three entries
+	auto cache = f.makeCache(dir, entry_size * 3);
+	for (const char *key : {"a", "b", "c"})
+		cache->store(key, col);
+	UASSERTEQ(size_t, count_files(dir), 3);
+
+	// the least recently used one is deleted
+	MeshCollector loaded{{}};
+	UASSERT(cache->load("a", loaded));
+	cache->store("d", col);
+	UASSERTEQ(size_t, count_files(dir), 3);
+	UASSERT(fs::PathExists(dir + DIR_DELIM "a"));
+	UASSERT(!fs::PathExists(dir + DIR_DELIM "b"));
+
+	// entries of previous sessions count too
+	cache = f.makeCache(dir, entry_size * 2);
+	UASSERTEQ(size_t, count_files(dir), 2);
+	cache = f.makeCache(dir, 0);
+	UASSERTEQ(size_t, count_files(dir), 0);
+}
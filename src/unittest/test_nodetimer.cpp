@@ -0,0 +1,181 @@
+// Luanti
+// SPDX-License-Identifier: LGPL-2.1-or-later
+
+#include "test.h"
+
+#include <cmath>
+#include <sstream>
+#include "nodetimer.h"
+
+class TestNodeTimer : public TestBase {
+public:
+	TestNodeTimer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodeTimer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testStep();
+	void testSchedulerDueBlocks();
+	void testSchedulerMatchesStep();
+	void testSchedulerQueueSize();
+	void testDetach();
+};
+
+static TestNodeTimer g_test_instance;
+
+void TestNodeTimer::runTests(IGameDef *gamedef)
+{
+	TEST(testStep);
+	TEST(testSchedulerDueBlocks);
+	TEST(testSchedulerMatchesStep);
+	TEST(testSchedulerQueueSize);
+	TEST(testDetach);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static std::string serialize(const NodeTimerList &list)
+{
+	std::ostringstream os(std::ios_base::binary);
+	list.serialize(os, 25);
+	return os.str();
+}
+
+void TestNodeTimer::testStep()
+{
+	NodeTimerList list;
+	list.insert(NodeTimer(1.0f, 0.0f, v3s16(1, 2, 3)));
+	list.insert(NodeTimer(2.0f, 0.5f, v3s16(4, 5, 6)));
+
+	UASSERT(list.step(0.5f).empty());
+	UASSERTEQ(f32, list.get(v3s16(1, 2, 3)).elapsed, 0.5f);
+
+	auto elapsed = list.step(1.0f);
+	UASSERTEQ(size_t, elapsed.size(), 2);
+	UASSERT(elapsed[0].position == v3s16(1, 2, 3));
+	UASSERTEQ(f32, elapsed[0].elapsed, 1.5f);
+	UASSERT(elapsed[1].position == v3s16(4, 5, 6));
+	UASSERTEQ(f32, elapsed[1].elapsed, 2.0f);
+	UASSERT(list.step(100.0f).empty());
+}
+
+void TestNodeTimer::testSchedulerDueBlocks()
+{
+	NodeTimerScheduler scheduler;
+	NodeTimerList first, second, empty;
+	first.insert(NodeTimer(1.0f, 0.0f, v3s16(0, 0, 0)));
+	second.insert(NodeTimer(5.0f, 0.0f, v3s16(0, 0, 0)));
+	first.attach(&scheduler, v3s16(1, 0, 0));
+	second.attach(&scheduler, v3s16(2, 0, 0));
+	empty.attach(&scheduler, v3s16(3, 0, 0));
+	UASSERT(first.isAttachedTo(&scheduler));
+	UASSERTEQ(size_t, scheduler.getQueueSize(), 2);
+
+	UASSERT(scheduler.step(0.5f).empty());
+	auto due = scheduler.step(0.5f);
+	UASSERTEQ(size_t, due.size(), 1);
+	UASSERT(due[0] == v3s16(1, 0, 0));
+	UASSERTEQ(size_t, first.step(0.0f).size(), 1);
+
+	// an earlier timer queues the block again
+	second.set(NodeTimer(1.0f, 0.0f, v3s16(0, 0, 0)));
+	due = scheduler.step(1.0f);
+	UASSERTEQ(size_t, due.size(), 1);
+	UASSERT(due[0] == v3s16(2, 0, 0));
+	UASSERTEQ(size_t, second.step(0.0f).size(), 1);
+
+	// a block whose timer was removed is returned once and then dropped
+	first.insert(NodeTimer(1.0f, 0.0f, v3s16(0, 0, 0)));
+	first.remove(v3s16(0, 0, 0));
+	due = scheduler.step(1.0f);
+	UASSERTEQ(size_t, due.size(), 1);
+	UASSERT(first.step(0.0f).empty());
+	// the entry superseded by the earlier timer of the second block is skipped
+	UASSERT(scheduler.step(10.0f).empty());
+	UASSERTEQ(size_t, scheduler.getQueueSize(), 0);
+}
+
+void TestNodeTimer::testSchedulerQueueSize()
+{
+	NodeTimerScheduler scheduler;
+	NodeTimerList list;
+	list.attach(&scheduler, v3s16(1, 0, 0));
+
+	// a timer getting earlier over and over must not grow the queue
+	for (int i = 0; i < 1000; i++)
+		list.set(NodeTimer(1000.0f - i, 0.0f, v3s16(0, 0, 0)));
+	UASSERT(scheduler.getQueueSize() <= 20);
+	// later timers do not need a new entry
+	list.insert(NodeTimer(2000.0f, 0.0f, v3s16(1, 0, 0)));
+	UASSERT(scheduler.getQueueSize() <= 20);
+
+	auto due = scheduler.step(1.0f);
+	UASSERTEQ(size_t, due.size(), 1);
+	UASSERTEQ(size_t, list.step(0.0f).size(), 1);
+
+	// a detached block is not returned anymore
+	list.detach();
+	UASSERT(scheduler.step(5000.0f).empty());
+	UASSERTEQ(size_t, scheduler.getQueueSize(), 0);
+}
+
+void TestNodeTimer::testSchedulerMatchesStep()
+{
+	// An attached list must fire the same timers as one stepped by hand
+	NodeTimerScheduler scheduler;
+	NodeTimerList stepped, attached;
+	for (s16 i = 0; i < 10; i++) {
+		NodeTimer t(0.3f + i * 0.7f, 0.0f, v3s16(i, 0, 0));
+		stepped.insert(t);
+		attached.insert(t);
+	}
+	attached.attach(&scheduler, v3s16(0, 0, 0));
+
+	const float dtime = 0.2f;
+	for (int i = 0; i < 100; i++) {
+		auto expected = stepped.step(dtime);
+		std::vector<NodeTimer> actual;
+		for (v3s16 p : scheduler.step(dtime)) {
+			UASSERT(p == v3s16(0, 0, 0));
+			actual = attached.step(0.0f);
+		}
+		UASSERTEQ(size_t, actual.size(), expected.size());
+		for (size_t j = 0; j < expected.size(); j++) {
+			UASSERT(actual[j].position == expected[j].position);
+			UASSERT(std::fabs(actual[j].elapsed - expected[j].elapsed) < 0.001f);
+			// restart like a timer callback returning true
+			NodeTimer t(expected[j].timeout, 0.0f, expected[j].position);
+			stepped.set(t);
+			attached.set(t);
+		}
+	}
+}
+
+void TestNodeTimer::testDetach()
+{
+	NodeTimerScheduler scheduler;
+	scheduler.step(123.0f);
+
+	NodeTimerList list, reference;
+	list.insert(NodeTimer(10.0f, 1.0f, v3s16(1, 1, 1)));
+	reference.insert(NodeTimer(10.0f, 1.0f, v3s16(1, 1, 1)));
+
+	list.attach(&scheduler, v3s16(5, 5, 5));
+	scheduler.step(2.0f);
+	reference.step(2.0f);
+	UASSERTEQ(f32, list.get(v3s16(1, 1, 1)).elapsed, 3.0f);
+	// serialization does not depend on the clock being used
+	UASSERTEQ(std::string, serialize(list), serialize(reference));
+
+	// time stands still while detached
+	list.detach();
+	UASSERT(!list.isAttachedTo(&scheduler));
+	scheduler.step(50.0f);
+	UASSERTEQ(f32, list.get(v3s16(1, 1, 1)).elapsed, 3.0f);
+
+	list.attach(&scheduler, v3s16(5, 5, 5));
+	scheduler.step(1.0f);
+	reference.step(1.0f);
+	UASSERTEQ(std::string, serialize(list), serialize(reference));
+	UASSERTEQ(f32, list.get(v3s16(1, 1, 1)).elapsed, 4.0f);
+}
@@ -5,6 +5,8 @@
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
+#include <vector>
 #include "exceptions.h"
 #include "noise.h"
 
@@ -26,6 +28,8 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoise2dBulkExact();
+	void testNoise3dBulkExact();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -46,6 +50,8 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoise2dBulkExact);
+	TEST(testNoise3dBulkExact);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -160,6 +166,211 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+/*
+ * Straightforward implementation of the bulk noise functions, one point at a
+ * time. The optimized versions must match it bit for bit.
+ */
+
+static float lerp(float v0, float v1, float t)
+{
+	return v0 + (v1 - v0) * t;
+}
+
+static void reference_gradient_2d(std::vector<float> &out, u32 sx, u32 sy,
+	float x, float y, float step_x, float step_y, s32 seed, bool eased)
+{
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	float u0 = x - (float)x0;
+	float v = y - (float)y0;
+	s32 noisey = 0;
+	for (u32 j = 0; j != sy; j++) {
+		float u = u0;
+		s32 noisex = 0;
+		for (u32 i = 0; i != sx; i++) {
+			s32 px = x0 + noisex, py = y0 + noisey;
+			float eu = eased ? easeCurve(u) : u;
+			float ev = eased ? easeCurve(v) : v;
+			float a = lerp(noise2d(px, py, seed), noise2d(px + 1, py, seed), eu);
+			float b = lerp(noise2d(px, py + 1, seed), noise2d(px + 1, py + 1, seed), eu);
+			out[j * sx + i] = lerp(a, b, ev);
+
+			u += step_x;
+			if (u >= 1.0) {
+				u -= 1.0;
+				noisex++;
+			}
+		}
+		v += step_y;
+		if (v >= 1.0) {
+			v -= 1.0;
+			noisey++;
+		}
+	}
+}
+
+static void reference_gradient_3d(std::vector<float> &out, u32 sx, u32 sy, u32 sz,
+	float x, float y, float z, float step_x, float step_y, float step_z,
+	s32 seed, bool eased)
+{
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	s32 z0 = std::floor(z);
+	float u0 = x - (float)x0;
+	float v0 = y - (float)y0;
+	float w = z - (float)z0;
+	s32 noisez = 0;
+	for (u32 k = 0; k != sz; k++) {
+		float v = v0;
+		s32 noisey = 0;
+		for (u32 j = 0; j != sy; j++) {
+			float u = u0;
+			s32 noisex = 0;
+			for (u32 i = 0; i != sx; i++) {
+				s32 px = x0 + noisex, py = y0 + noisey, pz = z0 + noisez;
+				float eu = eased ? easeCurve(u) : u;
+				float ev = eased ? easeCurve(v) : v;
+				float ew = eased ? easeCurve(w) : w;
+				float a = lerp(
+					lerp(noise3d(px, py, pz, seed), noise3d(px + 1, py, pz, seed), eu),
+					lerp(noise3d(px, py + 1, pz, seed), noise3d(px + 1, py + 1, pz, seed), eu),
+					ev);
+				float b = lerp(
+					lerp(noise3d(px, py, pz + 1, seed), noise3d(px + 1, py, pz + 1, seed), eu),
+					lerp(noise3d(px, py + 1, pz + 1, seed), noise3d(px + 1, py + 1, pz + 1, seed), eu),
+					ev);
+				out[(k * sy + j) * sx + i] = lerp(a, b, ew);
+
+				u += step_x;
+				if (u >= 1.0) {
+					u -= 1.0;
+					noisex++;
+				}
+			}
+			v += step_y;
+			if (v >= 1.0) {
+				v -= 1.0;
+				noisey++;
+			}
+		}
+		w += step_z;
+		if (w >= 1.0) {
+			w -= 1.0;
+			noisez++;
+		}
+	}
+}
+
+static void reference_accumulate(std::vector<float> &result,
+	const std::vector<float> &gradient, float g, std::vector<float> *gmap,
+	const float *persistence_map, bool absvalue)
+{
+	for (size_t i = 0; i != result.size(); i++) {
+		float n = absvalue ? std::fabs(gradient[i]) : gradient[i];
+		if (gmap) {
+			result[i] += (*gmap)[i] * n;
+			(*gmap)[i] *= persistence_map[i];
+		} else {
+			result[i] += g * n;
+		}
+	}
+}
+
+static void reference_finish(std::vector<float> &result, const NoiseParams &np)
+{
+	if (std::fabs(np.offset - 0.f) > 0.00001 || std::fabs(np.scale - 1.f) > 0.00001) {
+		for (float &v : result)
+			v = v * np.scale + np.offset;
+	}
+}
+
+static bool bitwise_equal(const float *a, const std::vector<float> &b)
+{
+	return std::memcmp(a, b.data(), b.size() * sizeof(float)) == 0;
+}
+
+void TestNoise::testNoise2dBulkExact()
+{
+	const u32 sx = 37, sy = 23;
+	std::vector<float> persistence(sx * sy);
+	for (size_t i = 0; i != persistence.size(); i++)
+		persistence[i] = 0.4f + (i % 7) * 0.05f;
+
+	const u32 flag_sets[] = {
+		0,
+		NOISE_FLAG_DEFAULTS,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE,
+	};
+	for (u32 flags : flag_sets)
+	for (bool use_persistence : {false, true}) {
+		NoiseParams np(-3, 17, v3f(31, 19, 31), 42, 4, 0.55, 2.1, flags);
+		Noise noise(&np, 1337, sx, sy);
+		const float x = -117.3f, y = 54.6f;
+		float *actual = noise.perlinMap2D(x, y,
+			use_persistence ? persistence.data() : nullptr);
+
+		bool eased = flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
+		std::vector<float> expected(sx * sy, 0), gradient(sx * sy);
+		std::vector<float> gmap(sx * sy, 1.0f);
+		float f = 1.0, g = 1.0;
+		for (u16 oct = 0; oct < np.octaves; oct++) {
+			reference_gradient_2d(gradient, sx, sy,
+				x / np.spread.X * f, y / np.spread.Y * f,
+				f / np.spread.X, f / np.spread.Y,
+				1337 + np.seed + oct, eased);
+			reference_accumulate(expected, gradient, g,
+				use_persistence ? &gmap : nullptr, persistence.data(),
+				flags & NOISE_FLAG_ABSVALUE);
+			f *= np.lacunarity;
+			g *= np.persist;
+		}
+		reference_finish(expected, np);
+
+		UASSERT(bitwise_equal(actual, expected));
+	}
+}
+
+void TestNoise::testNoise3dBulkExact()
+{
+	const u32 sx = 13, sy = 17, sz = 11;
+	std::vector<float> persistence(sx * sy * sz);
+	for (size_t i = 0; i != persistence.size(); i++)
+		persistence[i] = 0.4f + (i % 7) * 0.05f;
+
+	const u32 flag_sets[] = {
+		0,
+		NOISE_FLAG_EASED,
+		NOISE_FLAG_ABSVALUE,
+	};
+	for (u32 flags : flag_sets)
+	for (bool use_persistence : {false, true}) {
+		NoiseParams np(5, 0.8, v3f(11, 7, 9), -7, 3, 0.5, 2.3, flags);
+		Noise noise(&np, 1337, sx, sy, sz);
+		const float x = 33.3f, y = -71.1f, z = 12.8f;
+		float *actual = noise.perlinMap3D(x, y, z,
+			use_persistence ? persistence.data() : nullptr);
+
+		bool eased = flags & NOISE_FLAG_EASED;
+		std::vector<float> expected(sx * sy * sz, 0), gradient(sx * sy * sz);
+		std::vector<float> gmap(sx * sy * sz, 1.0f);
+		float f = 1.0, g = 1.0;
+		for (u16 oct = 0; oct < np.octaves; oct++) {
+			reference_gradient_3d(gradient, sx, sy, sz,
+				x / np.spread.X * f, y / np.spread.Y * f, z / np.spread.Z * f,
+				f / np.spread.X, f / np.spread.Y, f / np.spread.Z,
+				1337 + np.seed + oct, eased);
+			reference_accumulate(expected, gradient, g,
+				use_persistence ? &gmap : nullptr, persistence.data(),
+				flags & NOISE_FLAG_ABSVALUE);
+			f *= np.lacunarity;
+			g *= np.persist;
+		}
+		reference_finish(expected, np);
+
+		UASSERT(bitwise_equal(actual, expected));
+	}
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
@@ -25,6 +25,7 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
 	void testGetAddedActiveObjectsAroundPos();
+	void testUpdateObjectPos();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -36,6 +37,7 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testUpdateObjectPos);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,3 +172,47 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	saomgr.clear();
 }
+
+void TestServerActiveObjectMgr::testUpdateObjectPos()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao_u = std::make_unique<MockServerActiveObject>(nullptr, v3f(10, 40, 10));
+	auto sao = sao_u.get();
+	UASSERT(saomgr.registerObject(std::move(sao_u)));
+	saomgr.registerObject(std::make_unique<MockServerActiveObject>(nullptr, v3f(-200, 100, -304)));
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Move the object far away, into another cell of the index
+	// (no environment, so the manager has to be told explicitly)
+	const v3f far_pos(5000, -740, 3000);
+	sao->setBasePosition(far_pos);
+	saomgr.updateObjectPos(sao->getId(), far_pos);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(far_pos, 1, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == sao);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(far_pos - 20, far_pos + 20), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Removed objects must not be returned anymore
+	saomgr.removeObject(sao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(far_pos, 1, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 750000, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	saomgr.clear();
+}
@@ -22,6 +22,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -31,6 +32,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -132,3 +134,64 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	Address address(127, 0, 0, 1, port + 1);
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		Address bind_addr(0, 0, 0, 0, 0);
+		bind_addr.Resolve(bind_str.c_str());
+		if (!bind_addr.isIPv6() && !bind_addr.isAny()) {
+			address = bind_addr;
+			address.setPort(port + 1);
+		}
+	} catch (ResolveError &e) {
+	}
+
+	UDPSocket socket(false);
+	socket.Bind(address);
+
+	// datagrams of different sizes, including an empty one
+	const size_t count = 10;
+	std::vector<std::string> payloads;
+	std::vector<UDPSocket::OutgoingDatagram> outgoing;
+	for (size_t i = 0; i < count; i++)
+		payloads.emplace_back(i * 37, 'a' + i);
+	for (const auto &payload : payloads)
+		outgoing.push_back({address, payload.data(), (int)payload.size()});
+	socket.SendBatch(outgoing.data(), outgoing.size());
+
+	sleep_ms(50);
+
+	char rcvbuffer[16][512];
+	std::vector<UDPSocket::IncomingDatagram> incoming(16);
+	for (size_t i = 0; i < incoming.size(); i++) {
+		incoming[i].data = rcvbuffer[i];
+		incoming[i].capacity = sizeof(rcvbuffer[i]);
+	}
+
+	// receive in two parts to check that nothing is lost in between
+	size_t received = socket.ReceiveBatch(incoming.data(), 4);
+	UASSERTEQ(size_t, received, 4);
+	received += socket.ReceiveBatch(&incoming[4], incoming.size() - 4);
+	UASSERTEQ(size_t, received, count);
+	UASSERTEQ(size_t, socket.ReceiveBatch(incoming.data(), incoming.size()), 0);
+
+	for (size_t i = 0; i < count; i++) {
+		UASSERT(incoming[i].sender == address);
+		UASSERTEQ(int, incoming[i].size, (int)payloads[i].size());
+		UASSERT(memcmp(rcvbuffer[i], payloads[i].data(), payloads[i].size()) == 0);
+	}
+
+	// a datagram to an address of the wrong family fails, the others go out
+	IPv6AddressBytes bytes;
+	bytes.bytes[15] = 1;
+	outgoing[1].destination = Address(&bytes, port);
+	EXCEPTION_CHECK(SendFailedException,
+		socket.SendBatch(outgoing.data(), 3));
+	sleep_ms(50);
+	UASSERTEQ(size_t, socket.ReceiveBatch(incoming.data(), incoming.size()), 2);
+	UASSERTEQ(int, incoming[0].size, (int)payloads[0].size());
+	UASSERTEQ(int, incoming[1].size, (int)payloads[2].size());
+}
@@ -6,8 +6,10 @@
 
 #include <atomic>
 #include <iostream>
+#include "exceptions.h"
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/workerpool.h"
 
 
 class TestThreading : public TestBase {
@@ -19,6 +21,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
 	void testTLS();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -28,6 +31,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
 	TEST(testTLS);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -227,3 +231,43 @@ void TestThreading::testTLS()
 		}
 	}
 }
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("TestWorker", 3);
+	UASSERTEQ(unsigned int, pool.getThreadCount(), 3);
+
+	// every item is handled exactly once, in every batch
+	std::vector<std::atomic<u32>> counts(1000);
+	for (int batch = 0; batch < 20; batch++) {
+		pool.run(counts.size(), [&] (size_t i) {
+			counts[i]++;
+		});
+	}
+	for (auto &count : counts)
+		UASSERTEQ(u32, count, 20);
+
+	pool.run(0, [] (size_t) {
+		UASSERT(false);
+	});
+
+	// exceptions reach the caller
+	bool caught = false;
+	try {
+		pool.run(100, [] (size_t i) {
+			if (i == 50)
+				throw BaseException("test");
+		});
+	} catch (BaseException &) {
+		caught = true;
+	}
+	UASSERT(caught);
+
+	// and the pool is still usable afterwards
+	std::atomic<u32> sum(0);
+	pool.run(100, [&] (size_t i) {
+		sum += i;
+	});
+	UASSERTEQ(u32, sum, 4950);
+}